@@ -0,0 +1,102 @@
+/*
+ * benchutil.h: helpers shared by the benchmark programs in bench/
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static inline long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static inline int cmpll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/*--------------------------------------------------------------------------
+    percentile
+    Nearest rank percentile of n sorted values
+----------------------------------------------------------------------------*/
+static inline long long percentile(const long long *v, int n, double p)
+{
+    int k;
+
+    if (n == 0) return 0;
+    k = (int)(p / 100.0 * n + 0.999999) - 1;
+    if (k < 0) k = 0;
+    if (k >= n) k = n - 1;
+    return v[k];
+}
+
+/*--------------------------------------------------------------------------
+    jsonNumber
+    Value of the first "key": number after p, -1 if missing
+----------------------------------------------------------------------------*/
+static inline long long jsonNumber(const char *p, const char *key)
+{
+    char pattern[64];
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    if (p == NULL || (p = strstr(p, pattern)) == NULL) return -1;
+    return strtoll(p + strlen(pattern), NULL, 10);
+}
+
+/*--------------------------------------------------------------------------
+    startMeter
+    Start a simulated meter (argv[0] with its options), return its pid and
+    the slave pty it prints in pts. quiet sends its stderr to /dev/null.
+----------------------------------------------------------------------------*/
+static inline pid_t startMeter(char *const argv[], char *pts, size_t len, int quiet)
+{
+    int fd[2];
+    pid_t pid;
+    FILE *fp;
+
+    if (pipe(fd) == -1) return -1;
+    if ((pid = fork()) == 0) {
+        dup2(fd[1], STDOUT_FILENO);
+        close(fd[0]);
+        close(fd[1]);
+        if (quiet) {
+            int null = open("/dev/null", O_WRONLY);
+            if (null != -1) dup2(null, STDERR_FILENO);
+        }
+        execv(argv[0], argv);
+        fprintf(stderr, "Can't run %s: (%d) %s\n", argv[0], errno, strerror(errno));
+        _exit(127);
+    }
+    close(fd[1]);
+    if (pid == -1) {
+        close(fd[0]);
+        return -1;
+    }
+    fp = fdopen(fd[0], "r");
+    if (fp == NULL || fgets(pts, len, fp) == NULL) {
+        if (fp) fclose(fp);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    fclose(fp);
+    pts[strcspn(pts, "\n")] = '\0';
+    return pid;
+}
+
+#endif /* BENCHUTIL_H */
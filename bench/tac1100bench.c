@@ -0,0 +1,339 @@
+/*
+ * tac1100bench: end to end benchmark of tac1100 against tac1100sim
+ *
+ * For every lock mode (-k: UUCP lock file, --fd-lock) and baud rate starts
+ * a simulated meter on a pty, runs tac1100 (all values, --stats) a number
+ * of times and collects:
+ *   - samples (values) per second of wall time
+ *   - latency of a whole invocation and of the single transactions
+ *     (p50/p99, the latter from the --stats log2 histogram)
+ *   - mean time per phase: exec (fork/exec/exit outside main), startup,
+ *     lock, connect, transactions, output, teardown
+ * Results go to stdout as a table and to a JSON file (make bench).
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "benchutil.h"
+
+static const char *version = "0.1";
+
+#define MAX_BAUDS   8
+#define MAX_LOCKS   2
+#define MAX_RUNS    10000
+#define BUCKETS     24          // Same histogram as tac1100 --stats
+#define NUM_PHASES  7
+
+static const char *phase_names[NUM_PHASES] = { "exec", "startup", "lock", "connect", "transactions", "output", "teardown" };
+
+static const char *lock_names[MAX_LOCKS] = { "uucp", "fd" };
+
+typedef struct {
+    long baud;
+    int lock;                   // Index in lock_names
+    int runs;
+    int errors;
+    long values;                // Values printed by tac1100
+    long long wall_us;          // Sum of the invocation times
+    long long *run_us;          // Time of every invocation
+    long long phase_us[NUM_PHASES];
+    unsigned long transactions;
+    long long trans_sum;
+    unsigned long hist[BUCKETS];
+    char tac_version[32];
+} benchresult_t;
+
+/*--------------------------------------------------------------------------
+    histPercentile
+    Upper bound of the histogram bucket holding the percentile p
+----------------------------------------------------------------------------*/
+static long long histPercentile(const unsigned long *hist, double p)
+{
+    unsigned long total = 0, rank, acc = 0;
+    int b;
+
+    for (b = 0; b < BUCKETS; b++) total += hist[b];
+    if (total == 0) return 0;
+    rank = (unsigned long)(p / 100.0 * total + 0.999999);
+    if (rank == 0) rank = 1;
+    for (b = 0; b < BUCKETS; b++) {
+        acc += hist[b];
+        if (acc >= rank) return b < BUCKETS - 1 ? 1LL << b : -1;
+    }
+    return -1;
+}
+
+/*--------------------------------------------------------------------------
+    parseStats
+    Accumulate the tac1100 --stats file of one run into res
+----------------------------------------------------------------------------*/
+static int parseStats(const char *file, benchresult_t *res, long long wall)
+{
+    char buf[16384];
+    const char *p, *q;
+    FILE *fp;
+    size_t n;
+    long long uptime;
+    int i;
+
+    if ((fp = fopen(file, "r")) == NULL) return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    if ((p = strstr(buf, "\"version\": \"")) != NULL) {
+        sscanf(p + 12, "%31[^\"]", res->tac_version);
+    }
+    if ((uptime = jsonNumber(buf, "uptime_us")) < 0) return -1;
+    // Spawn and exit: what main() does not see. Startup counts from main()
+    // while uptime from the --stats setup, so use the phases sum.
+    p = strstr(buf, "\"phases_us\"");
+    if (p == NULL) return -1;
+    q = strchr(p, '}');
+    for (i = 1; i < NUM_PHASES; i++) {
+        long long v = jsonNumber(p, phase_names[i]);
+        if (v < 0 || (q && strstr(p, phase_names[i]) > q)) return -1;
+        res->phase_us[i] += v;
+        wall -= v;
+    }
+    res->phase_us[0] += wall > 0 ? wall : 0;
+
+    // Every meter entry: requests, sum and histogram of the transaction times
+    p = buf;
+    while ((p = strstr(p, "\"requests\": ")) != NULL) {
+        long long requests = jsonNumber(p, "requests");
+        long long sum = jsonNumber(p, "sum");
+        long long upper;
+        unsigned long count;
+
+        res->transactions += requests;
+        res->trans_sum += sum;
+        if ((p = strstr(p, "\"histogram\": [")) == NULL) break;
+        p += 14;
+        while (*p == '[' || *p == ',' || *p == ' ') {
+            if (*p != '[') {
+                p++;
+                continue;
+            }
+            if (sscanf(p, "[%lld, %lu]", &upper, &count) == 2) {
+                int b = 0;
+                while (b < BUCKETS - 1 && (1LL << b) < upper) b++;
+                res->hist[b] += count;
+            } else if (sscanf(p, "[null, %lu]", &count) == 1) {
+                res->hist[BUCKETS - 1] += count;
+            }
+            p = strchr(p, ']');
+            if (p == NULL) return 0;
+            p++;
+        }
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    runClient
+    One tac1100 invocation reading all values with the lock mode lock,
+    returns the number of values printed or -1 on failure
+----------------------------------------------------------------------------*/
+static int runClient(const char *tac, long baud, int lock, const char *pts, const char *stats)
+{
+    int fd[2], status, values = 0;
+    char sbaud[16], sstats[300], line[256];
+    pid_t pid;
+    FILE *fp;
+
+    if (pipe(fd) == -1) return -1;
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(sstats, sizeof(sstats), "--stats=%s", stats);
+    if ((pid = fork()) == 0) {
+        dup2(fd[1], STDOUT_FILENO);
+        close(fd[0]);
+        close(fd[1]);
+        if (lock == 1) {
+            execl(tac, tac, "-b", sbaud, sstats, "--fd-lock", pts, (char *)NULL);
+        } else {
+            execl(tac, tac, "-b", sbaud, sstats, pts, (char *)NULL);
+        }
+        _exit(127);
+    }
+    close(fd[1]);
+    if (pid == -1) {
+        close(fd[0]);
+        return -1;
+    }
+    fp = fdopen(fd[0], "r");
+    while (fp && fgets(line, sizeof(line), fp) != NULL) {
+        if (strcmp(line, "OK\n") != 0) values++;
+    }
+    if (fp) fclose(fp);
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return values;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100bench %s: end to end benchmark of tac1100 against a simulated meter\n\n", version);
+    fprintf(stderr, "Usage: %s [-t tac1100] [-s tac1100sim] [-n runs] [-b baud[,baud...]] [-l latency_us] [-k lock[,lock]]\n", program);
+    fprintf(stderr, "       [-o file.json]\n");
+    fprintf(stderr, "\t-t path \tClient to measure. Default: ./tac1100\n");
+    fprintf(stderr, "\t-s path \tSimulator. Default: bench/tac1100sim\n");
+    fprintf(stderr, "\t-n runs \tInvocations per baud rate. Default: 20\n");
+    fprintf(stderr, "\t-b list \tBaud rates. Default: 1200,2400,4800,9600,19200\n");
+    fprintf(stderr, "\t-l latency_us \tSimulated meter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-k list \tLocking: uucp (lock file), fd (--fd-lock). Default: uucp\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: bench.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tac = "./tac1100";
+    const char *sim = "bench/tac1100sim";
+    const char *out = "bench.json";
+    char bauds_spec[128] = "1200,2400,4800,9600,19200";
+    char locks_spec[64] = "uucp";
+    char stats[256], pts[256], sbaud[16], slatency[16];
+    char *simargv[] = { NULL, "-b", sbaud, "-l", slatency, NULL };
+    long bauds[MAX_BAUDS];
+    int locks[MAX_LOCKS];
+    benchresult_t results[MAX_LOCKS * MAX_BAUDS];
+    int nbauds = 0, nlocks = 0, nresults = 0, runs = 20, c, b, i, k;
+    long latency = 5000;
+    char *tok, *save;
+    time_t now;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "t:s:n:b:l:k:o:h")) != -1) {
+        switch (c) {
+            case 't': tac = optarg; break;
+            case 's': sim = optarg; break;
+            case 'n': runs = atoi(optarg); break;
+            case 'b': snprintf(bauds_spec, sizeof(bauds_spec), "%s", optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'k': snprintf(locks_spec, sizeof(locks_spec), "%s", optarg); break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (runs < 1 || runs > MAX_RUNS) {
+        fprintf(stderr, "Runs must be between 1 and %d.\n", MAX_RUNS);
+        exit(EXIT_FAILURE);
+    }
+    for (tok = strtok_r(bauds_spec, ",", &save); tok && nbauds < MAX_BAUDS; tok = strtok_r(NULL, ",", &save)) {
+        bauds[nbauds++] = atol(tok);
+    }
+    for (tok = strtok_r(locks_spec, ",", &save); tok && nlocks < MAX_LOCKS; tok = strtok_r(NULL, ",", &save)) {
+        for (k = 0; k < MAX_LOCKS && strcmp(tok, lock_names[k]) != 0; k++);
+        if (k == MAX_LOCKS) {
+            fprintf(stderr, "Unknown lock mode %s.\n", tok);
+            exit(EXIT_FAILURE);
+        }
+        locks[nlocks++] = k;
+    }
+
+    simargv[0] = (char *)sim;
+    snprintf(stats, sizeof(stats), "/tmp/tac1100bench.%d.json", (int)getpid());
+    memset(results, 0, sizeof(results));
+
+    printf("%5s %7s %5s %6s %9s %9s %9s %9s %9s", "lock", "baud", "runs", "errors", "samples/s", "run_p50", "run_p99", "tx_p50", "tx_p99");
+    for (i = 0; i < NUM_PHASES; i++) printf(" %9.9s", phase_names[i]);
+    printf("\n");
+
+    for (nresults = 0; nresults < nlocks * nbauds; nresults++) {
+        benchresult_t *res = &results[nresults];
+        pid_t simpid;
+        int ok = 0;
+
+        b = nresults % nbauds;
+        res->lock = locks[nresults / nbauds];
+        res->baud = bauds[b];
+        res->run_us = calloc(runs, sizeof(long long));
+        snprintf(sbaud, sizeof(sbaud), "%ld", bauds[b]);
+        snprintf(slatency, sizeof(slatency), "%ld", latency);
+        if ((simpid = startMeter(simargv, pts, sizeof(pts), 0)) == -1) {
+            fprintf(stderr, "Can't start %s\n", sim);
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < runs; i++) {
+            long long t0, t;
+            int n;
+
+            unlink(stats);
+            t0 = now_us();
+            n = runClient(tac, bauds[b], res->lock, pts, stats);
+            t = now_us() - t0;
+            res->runs++;
+            if (n < 0 || parseStats(stats, res, t) == -1) {
+                res->errors++;
+                continue;
+            }
+            res->values += n;
+            res->wall_us += t;
+            res->run_us[ok++] = t;
+        }
+        kill(simpid, SIGTERM);
+        waitpid(simpid, NULL, 0);
+        unlink(stats);
+
+        qsort(res->run_us, ok, sizeof(long long), cmpll);
+        printf("%5s %7ld %5d %6d %9.1f %9lld %9lld %9lld %9lld", lock_names[res->lock], res->baud, res->runs, res->errors,
+               res->wall_us > 0 ? res->values * 1e6 / res->wall_us : 0.0,
+               percentile(res->run_us, ok, 50), percentile(res->run_us, ok, 99),
+               histPercentile(res->hist, 50), histPercentile(res->hist, 99));
+        for (i = 0; i < NUM_PHASES; i++) printf(" %9lld", ok ? res->phase_us[i] / ok : 0);
+        printf("\n");
+        fflush(stdout);
+        res->runs = ok + res->errors;   // runs[] holds only the successful ones
+    }
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    now = time(NULL);
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"program\": \"tac1100bench\",\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", version);
+    fprintf(fp, "  \"tac1100_version\": \"%s\",\n", nresults ? results[0].tac_version : "");
+    fprintf(fp, "  \"time\": %lld,\n", (long long)now);
+    fprintf(fp, "  \"runs\": %d,\n", runs);
+    fprintf(fp, "  \"meter_latency_us\": %ld,\n", latency);
+    fprintf(fp, "  \"results\": [");
+    for (b = 0; b < nresults; b++) {
+        benchresult_t *res = &results[b];
+        int ok = res->runs - res->errors;
+
+        fprintf(fp, "%s\n    {\"lock\": \"%s\", \"baud\": %ld, \"runs\": %d, \"errors\": %d, \"values\": %ld, \"samples_per_s\": %.2f,\n",
+                b ? "," : "", lock_names[res->lock], res->baud, res->runs, res->errors, res->values,
+                res->wall_us > 0 ? res->values * 1e6 / res->wall_us : 0.0);
+        fprintf(fp, "     \"run_us\": {\"mean\": %lld, \"p50\": %lld, \"p99\": %lld},\n",
+                ok ? res->wall_us / ok : 0, percentile(res->run_us, ok, 50), percentile(res->run_us, ok, 99));
+        fprintf(fp, "     \"transaction_us\": {\"count\": %lu, \"mean\": %lld, \"p50_le\": %lld, \"p99_le\": %lld},\n",
+                res->transactions, res->transactions ? res->trans_sum / (long long)res->transactions : 0,
+                histPercentile(res->hist, 50), histPercentile(res->hist, 99));
+        fprintf(fp, "     \"phases_us\": {");
+        for (i = 0; i < NUM_PHASES; i++) {
+            fprintf(fp, "%s\"%s\": %lld", i ? ", " : "", phase_names[i], ok ? res->phase_us[i] / ok : 0);
+        }
+        fprintf(fp, "}}");
+        free(res->run_us);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return 0;
+}
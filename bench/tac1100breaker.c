@@ -0,0 +1,204 @@
+/*
+ * tac1100breaker: per meter circuit breaker of libtac1100 against dead meters
+ *
+ * Starts one meter emulator (tools/tac1100emu) with a fleet of meters on
+ * one pty, some of them dead (every request dropped), and sweeps the
+ * fleet with the libtac1100 engine: a read of the power registers of
+ * every meter, the next sweep when all of them are done. Runs first
+ * without the circuit breaker, then with it (cfg.breaker_fails), and
+ * reports the sweeps, the sweep time and the reads of the live meters
+ * per second.
+ *
+ *   make bench-breaker
+ *   bench/tac1100breaker -m 8 -x 2 -z 3 -d 10
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define MAX_SAMPLES  (1 << 16)
+#define MODES        2
+
+static const char *mode_names[MODES] = { "off", "breaker" };
+
+typedef struct {
+    long sweeps;
+    long live_reads;                // Reads of the live meters done
+    long failed;                    // After the retries
+    long skipped;                   // TAC1100_EOPEN
+    unsigned long probes;
+    double live_rate;               // Live reads per second
+    long long p50_us, p99_us, max_us;   // Sweep time
+} moderes_t;
+
+static long long sweep[MAX_SAMPLES];
+static int nsweep;
+static long live_reads, failed, skipped;
+static int sel_power[TAC1100_NUM_REGS];
+
+static void done(void *user, const tac1100_result_t *r)
+{
+    (void)user;
+    if (r->rc == TAC1100_OK) {
+        live_reads++;
+    } else if (r->rc == TAC1100_EOPEN) {
+        skipped++;
+    } else {
+        failed++;
+    }
+}
+
+static int runMode(const char *pts, const tac1100_config_t *cfg, int meters, int seconds, moderes_t *res)
+{
+    tac1100_engine_t *engine;
+    long long start, t0;
+    int rc, m;
+
+    if ((engine = tac1100_engine_new()) == NULL) return -1;
+    if ((rc = tac1100_engine_add_port(engine, pts, cfg)) < 0) {
+        fprintf(stderr, "%s: %s\n", pts, tac1100_strerror(rc));
+        tac1100_engine_free(engine);
+        return -1;
+    }
+    nsweep = 0;
+    live_reads = failed = skipped = 0;
+    start = now_us();
+    while (now_us() < start + seconds * 1000000LL) {
+        t0 = now_us();
+        for (m = 1; m <= meters; m++) tac1100_engine_read(engine, 0, m, sel_power, done, NULL);
+        while (tac1100_engine_pending(engine) > 0) tac1100_engine_run(engine, -1);
+        if (nsweep < MAX_SAMPLES) sweep[nsweep++] = now_us() - t0;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->sweeps = nsweep;
+    res->live_reads = live_reads;
+    res->failed = failed;
+    res->skipped = skipped;
+    res->live_rate = live_reads * 1e6 / (now_us() - start);
+    for (m = 1; m <= meters; m++) res->probes += tac1100_health(tac1100_engine_context(engine, 0), m)->probes;
+    qsort(sweep, nsweep, sizeof(long long), cmpll);
+    res->p50_us = percentile(sweep, nsweep, 50);
+    res->p99_us = percentile(sweep, nsweep, 99);
+    res->max_us = nsweep ? sweep[nsweep - 1] : 0;
+    tac1100_engine_free(engine);
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100breaker %s: per meter circuit breaker of libtac1100 against dead meters\n\n", version);
+    fprintf(stderr, "Usage: %s [-e tac1100emu] [-m meters] [-x dead] [-z retries] [-j timeout_ms] [-k fails]\n", program);
+    fprintf(stderr, "       [-n probe] [-t probe_ms] [-b baud] [-d seconds] [-o file.json]\n");
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-m meters \tMeters on the bus (2-247). Default: 8\n");
+    fprintf(stderr, "\t-x dead \tOf which dead, the last ones. Default: 2\n");
+    fprintf(stderr, "\t-z retries \tAttempts of every read. Default: 3\n");
+    fprintf(stderr, "\t-j ms \t\tResponse timeout. Default: 200\n");
+    fprintf(stderr, "\t-k fails \tFailures in a row that open the breaker. Default: 3\n");
+    fprintf(stderr, "\t-n probe \tOne read in probe is a probe while open. Default: 10\n");
+    fprintf(stderr, "\t-t ms \t\tResponse timeout of a probe. Default: 50\n");
+    fprintf(stderr, "\t-b baud_rate \tDefault: 9600\n");
+    fprintf(stderr, "\t-d seconds \tDuration of every mode. Default: 10\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: breaker.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *emu = "tools/tac1100emu";
+    const char *out = "breaker.json";
+    char pts[256], slive[16], sdead[32], sbaud[16];
+    char *emuargv[] = { NULL, "-u", slive, "-u", sdead, "-b", sbaud, NULL };
+    moderes_t res[MODES];
+    tac1100_config_t cfg;
+    int meters = 8, dead = 2, retries = 3, fails = 3, probe = 10, seconds = 10, nres = 0, c, mode;
+    long baud = 9600, timeout_ms = 200, probe_ms = 50;
+    pid_t emupid;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "e:m:x:z:j:k:n:t:b:d:o:h")) != -1) {
+        switch (c) {
+            case 'e': emu = optarg; break;
+            case 'm': meters = atoi(optarg); break;
+            case 'x': dead = atoi(optarg); break;
+            case 'z': retries = atoi(optarg); break;
+            case 'j': timeout_ms = atol(optarg); break;
+            case 'k': fails = atoi(optarg); break;
+            case 'n': probe = atoi(optarg); break;
+            case 't': probe_ms = atol(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (meters < 2 || meters > 247 || dead < 1 || dead >= meters || retries < 1 || timeout_ms < 1 || timeout_ms > 999 ||
+        fails < 1 || probe < 1 || probe_ms < 1 || probe_ms > 999 || seconds < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    sel_power[TAC1100_R_POWER] = sel_power[TAC1100_R_APPARENT] = sel_power[TAC1100_R_REACTIVE] = 1;
+
+    emuargv[0] = (char *)emu;
+    snprintf(slive, sizeof(slive), "1-%d", meters - dead);
+    snprintf(sdead, sizeof(sdead), "%d-%d:drop=1", meters - dead + 1, meters);
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    if ((emupid = startMeter(emuargv, pts, sizeof(pts), 1)) == -1) {
+        fprintf(stderr, "Can't start %s\n", emu);
+        exit(EXIT_FAILURE);
+    }
+    tac1100_config_init(&cfg);
+    cfg.baud_rate = baud;
+    cfg.lock_mode = TAC1100_LOCK_NONE;
+    cfg.retries = retries;
+    cfg.resp_timeout_us = timeout_ms * 1000;
+
+    printf("%d meters (%d dead) at %ld baud, %d attempts of %ldms, breaker %d failures, probe 1/%d of %ldms\n\n",
+           meters, dead, baud, retries, timeout_ms, fails, probe, probe_ms);
+    printf("%-8s %7s %10s %10s %7s %7s %7s %10s %10s %10s\n", "mode", "sweeps", "live_reads", "live/s", "failed",
+           "skipped", "probes", "sweep_p50", "sweep_p99", "sweep_max");
+    for (mode = 0; mode < MODES; mode++) {
+        moderes_t *m = &res[mode];
+
+        cfg.breaker_fails = mode == 1 ? fails : 0;
+        cfg.breaker_probe = probe;
+        cfg.probe_timeout_us = probe_ms * 1000;
+        if (runMode(pts, &cfg, meters, seconds, m) != 0) break;
+        printf("%-8s %7ld %10ld %10.1f %7ld %7ld %7lu %10lld %10lld %10lld\n", mode_names[mode], m->sweeps,
+               m->live_reads, m->live_rate, m->failed, m->skipped, m->probes, m->p50_us, m->p99_us, m->max_us);
+        nres++;
+        fflush(stdout);
+    }
+    kill(emupid, SIGTERM);
+    waitpid(emupid, NULL, 0);
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100breaker\",\n  \"version\": \"%s\",\n  \"meters\": %d,\n  \"dead\": %d,\n"
+                "  \"retries\": %d,\n  \"timeout_ms\": %ld,\n  \"breaker_fails\": %d,\n  \"breaker_probe\": %d,\n"
+                "  \"probe_timeout_ms\": %ld,\n  \"baud\": %ld,\n  \"results\": [",
+                version, meters, dead, retries, timeout_ms, fails, probe, probe_ms, baud);
+    for (mode = 0; mode < nres; mode++) {
+        moderes_t *m = &res[mode];
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"sweeps\": %ld, \"live_reads\": %ld, \"live_per_s\": %.1f, \"failed\": %ld, "
+                    "\"skipped\": %ld, \"probes\": %lu, \"sweep_p50_us\": %lld, \"sweep_p99_us\": %lld, \"sweep_max_us\": %lld}",
+                mode ? "," : "", mode_names[mode], m->sweeps, m->live_reads, m->live_rate, m->failed, m->skipped,
+                m->probes, m->p50_us, m->p99_us, m->max_us);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return nres == MODES ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,171 @@
+/*
+ * tac1100bulk: bulk decode of a fleet sweep with libtac1100
+ *
+ * Fills the register blocks of all the float values (2 block reads per
+ * meter) of a fleet of meters with random values and some failed reads,
+ * then decodes the whole sweep, with the energy counters scaled to Wh:
+ *   - value:  one value at a time as tac1100 does it, tac1100_decode_float()
+ *             and * 1000 for every register of every meter
+ *   - scalar: tac1100_decode_bulk() into columns, scalar loop
+ *   - simd:   tac1100_decode_bulk() into columns, SSE2/NEON kernel
+ * checks that the three agree bit for bit and reports the time per value.
+ *
+ *   make bench-bulk
+ *   bench/tac1100bulk -m 200
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <math.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define MODES 3
+
+static const char *mode_names[MODES] = { "value", "scalar", "simd" };
+
+static int meters = 200;
+static int nblocks;
+static tac1100_block_t blocks[TAC1100_NUM_REGS];
+static uint16_t *raw[TAC1100_NUM_REGS]; // Register blocks of the sweep, one array per block read
+static uint8_t *valid;
+static float scale[TAC1100_NUM_REGS];
+static float *columns[MODES][TAC1100_NUM_REGS];
+
+/*--------------------------------------------------------------------------
+    sweepValue
+    One value at a time into the columns
+----------------------------------------------------------------------------*/
+static void sweepValue(float *const *cols)
+{
+    int x, m, r;
+
+    for (x = 0; x < nblocks; x++) {
+        for (m = 0; m < meters; m++) {
+            const uint16_t *block = raw[x] + (size_t)m * blocks[x].nb;
+            for (r = 0; r < TAC1100_NUM_REGS; r++) {
+                if (cols[r] == NULL || tac1100_regs[r].fc != blocks[x].fc) continue;
+                if (tac1100_regs[r].address < blocks[x].address ||
+                    tac1100_regs[r].address + tac1100_regs[r].nb > blocks[x].address + blocks[x].nb) continue;
+                if (!valid[m]) {
+                    cols[r][m] = NAN;
+                    continue;
+                }
+                cols[r][m] = tac1100_decode_float(block + tac1100_regs[r].address - blocks[x].address);
+                if (tac1100_regs[r].type == TAC1100_REG_ENERGY) cols[r][m] = cols[r][m] * 1000;
+            }
+        }
+    }
+}
+
+static void sweepBulk(float *const *cols, int flags)
+{
+    int x;
+
+    for (x = 0; x < nblocks; x++) {
+        tac1100_decode_bulk(&blocks[x], raw[x], blocks[x].nb, meters, scale, valid, cols, flags);
+    }
+}
+
+static void sweep(int mode)
+{
+    if (mode == 0) sweepValue(columns[0]);
+    else sweepBulk(columns[mode], mode == 1 ? TAC1100_BULK_SCALAR : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out = "bulk.json";
+    int selected[TAC1100_NUM_REGS];
+    double ns[MODES];
+    long long start, elapsed;
+    int values = 0, sweeps, mode, c, x, m, r, i;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "m:o:h")) != -1) {
+        switch (c) {
+            case 'm': meters = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            default:
+                fprintf(stderr, "tac1100bulk %s: bulk decode of a fleet sweep with libtac1100\n\n", version);
+                fprintf(stderr, "Usage: %s [-m meters] [-o file.json]\n", argv[0]);
+                fprintf(stderr, "\t-m meters \tMeters in the sweep. Default: 200\n");
+                fprintf(stderr, "\t-o file \tJSON results. Default: bulk.json\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (meters < 1) {
+        fprintf(stderr, "%s: -m must be at least 1\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // All the float values, read like tac1100 -p -v -e does
+    for (r = 0; r < TAC1100_NUM_REGS; r++) {
+        selected[r] = tac1100_regs[r].type != TAC1100_REG_UINT;
+        scale[r] = tac1100_regs[r].type == TAC1100_REG_ENERGY ? 1000 : 1;
+    }
+    nblocks = tac1100_plan(selected, 16, blocks);
+    srand(1100);
+    valid = malloc(meters);
+    for (m = 0; m < meters; m++) valid[m] = rand() % 20 != 0;
+    for (x = 0; x < nblocks; x++) {
+        raw[x] = malloc((size_t)meters * blocks[x].nb * sizeof(uint16_t));
+        for (i = 0; i < meters * blocks[x].nb; i += 2) {
+            float f = (float)rand() / RAND_MAX * 5000;
+            uint32_t u;
+            memcpy(&u, &f, sizeof(u));
+            raw[x][i] = u >> 16;
+            if (i + 1 < meters * blocks[x].nb) raw[x][i+1] = u & 0xFFFF;
+        }
+    }
+    for (mode = 0; mode < MODES; mode++) {
+        for (r = 0; r < TAC1100_NUM_REGS; r++) columns[mode][r] = selected[r] ? malloc(meters * sizeof(float)) : NULL;
+    }
+    for (r = 0; r < TAC1100_NUM_REGS; r++) values += selected[r] * meters;
+
+    // Same bits from the three decoders
+    for (mode = 0; mode < MODES; mode++) sweep(mode);
+    for (r = 0; r < TAC1100_NUM_REGS; r++) {
+        if (!selected[r]) continue;
+        for (mode = 1; mode < MODES; mode++) {
+            if (memcmp(columns[0][r], columns[mode][r], meters * sizeof(float)) != 0) {
+                fprintf(stderr, "%s: %s differs from value decode for %s\n", argv[0], mode_names[mode], tac1100_regs[r].label);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    printf("%d meters, %d blocks, %d values per sweep, bulk kernel %s\n\n", meters, nblocks, values, tac1100_decode_bulk_isa());
+    printf("%-8s %8s %10s %10s %8s\n", "mode", "sweeps", "ns/value", "Mvalues/s", "speedup");
+    for (mode = 0; mode < MODES; mode++) {
+        sweeps = 0;
+        start = now_us();
+        do {
+            for (i = 0; i < 16; i++) sweep(mode);
+            sweeps += 16;
+            elapsed = now_us() - start;
+        } while (elapsed < 300000);
+        ns[mode] = elapsed * 1000.0 / ((double)sweeps * values);
+        printf("%-8s %8d %10.2f %10.1f %7.1fx\n", mode_names[mode], sweeps, ns[mode], 1000.0 / ns[mode], ns[0] / ns[mode]);
+    }
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100bulk\",\n  \"version\": \"%s\",\n  \"meters\": %d,\n  \"values\": %d,\n"
+                "  \"isa\": \"%s\",\n  \"results\": [", version, meters, values, tac1100_decode_bulk_isa());
+    for (mode = 0; mode < MODES; mode++) {
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"ns_per_value\": %.3f}", mode ? "," : "", mode_names[mode], ns[mode]);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return 0;
+}
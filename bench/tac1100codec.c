@@ -0,0 +1,244 @@
+/*
+ * tac1100codec: native RTU codec of libtac1100 against libmodbus
+ *
+ *   - crc:  the slicing-by-8 tac1100_crc16() against the bit at a time
+ *           CRC on frames of the sizes the meter answers with, after
+ *           checking that both agree on every length up to 256 bytes
+ *   - read: one meter emulator (tools/tac1100emu) on a pty, the same block
+ *           reads through libmodbus and through the native codec
+ *           (cfg.native_rtu), CPU time (user + system) per transaction
+ *           and transaction latency
+ *
+ *   make bench-codec
+ *   bench/tac1100codec -n 2000 -b 115200
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include <modbus-version.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+typedef struct {
+    const char *mode;
+    int reads;
+    int transactions;
+    int failed;
+    long long user_us;
+    long long sys_us;
+    long long p50_us;           // Transaction latency
+    long long p99_us;
+} result_t;
+
+static volatile uint16_t crc_sink;
+
+static long long tvUs(const struct timeval *tv)
+{
+    return (long long)tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+static uint16_t crcBitwise(const uint8_t *buf, int len)
+{
+    uint16_t crc = 0xFFFF;
+    int i, k;
+
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+/*--------------------------------------------------------------------------
+    crcCheck
+    Both CRCs agree on random frames of every length
+----------------------------------------------------------------------------*/
+static int crcCheck(void)
+{
+    uint8_t buf[256];
+    int len, i, round;
+
+    srand(1100);
+    for (round = 0; round < 16; round++) {
+        for (i = 0; i < (int)sizeof(buf); i++) buf[i] = rand();
+        for (len = 0; len <= (int)sizeof(buf); len++) {
+            if (tac1100_crc16(buf, len) != crcBitwise(buf, len)) {
+                fprintf(stderr, "CRC mismatch: length %d, %04X != %04X\n", len, tac1100_crc16(buf, len), crcBitwise(buf, len));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    crcBench
+    Nanoseconds per frame of len bytes
+----------------------------------------------------------------------------*/
+static double crcBench(uint16_t (*crc)(const uint8_t *, int), int len)
+{
+    uint8_t buf[256];
+    long long start;
+    int i, n = 2000000 / (len + 8);
+
+    for (i = 0; i < len; i++) buf[i] = i * 7;
+    start = now_us();
+    for (i = 0; i < n; i++) {
+        buf[0] = i;
+        crc_sink = crc(buf, len);
+    }
+    return (now_us() - start) * 1000.0 / n;
+}
+
+static int runReads(const char *pts, tac1100_config_t *cfg, const int *selected, int reads, result_t *res)
+{
+    float values[TAC1100_NUM_REGS];
+    struct rusage ru0, ru1;
+    long long *lat, t0;
+    int i, rc;
+    tac1100_t *t;
+
+    if ((lat = malloc(reads * sizeof(long long))) == NULL) return -1;
+    t = tac1100_new(pts, cfg);
+    if (t == NULL || (rc = tac1100_connect(t)) != TAC1100_OK) {
+        fprintf(stderr, "%s: %s\n", pts, t ? tac1100_strerror(rc) : "out of memory");
+        tac1100_free(t);
+        free(lat);
+        return -1;
+    }
+    memset(res, 0, sizeof(*res));
+    res->mode = cfg->native_rtu ? "native" : "libmodbus";
+    getrusage(RUSAGE_SELF, &ru0);
+    for (i = 0; i < reads; i++) {
+        t0 = now_us();
+        if ((rc = tac1100_read(t, 1, selected, values, NULL)) < 0) {
+            res->failed++;
+            rc = 1;
+        }
+        lat[i] = (now_us() - t0) / rc;
+        res->transactions += rc;
+    }
+    getrusage(RUSAGE_SELF, &ru1);
+    res->user_us = tvUs(&ru1.ru_utime) - tvUs(&ru0.ru_utime);
+    res->sys_us = tvUs(&ru1.ru_stime) - tvUs(&ru0.ru_stime);
+    res->reads = reads;
+    qsort(lat, reads, sizeof(long long), cmpll);
+    res->p50_us = percentile(lat, reads, 50);
+    res->p99_us = percentile(lat, reads, 99);
+    tac1100_free(t);
+    free(lat);
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100codec %s: native RTU codec of libtac1100 against libmodbus\n\n", version);
+    fprintf(stderr, "Usage: %s [-e tac1100emu] [-n reads] [-b baud] [-l latency_us] [-r all|power|vi] [-o file.json]\n", program);
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-n reads \tReads of every mode. Default: 1000\n");
+    fprintf(stderr, "\t-b baud_rate \tDefault: 115200\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround. Default: 0\n");
+    fprintf(stderr, "\t-r group \tRegisters read: all (2 requests), power or vi (1 request). Default: all\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: codec.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = { 6, 9, 105, 256 };
+    const char *emu = "tools/tac1100emu";
+    const char *out = "codec.json";
+    const char *group = "all";
+    char pts[256], sbaud[16], slatency[16];
+    char *emuargv[] = { NULL, "-u", "1", "-b", sbaud, "-l", slatency, NULL };
+    double crc_ns[2][sizeof(sizes) / sizeof(sizes[0])];
+    int selected[TAC1100_NUM_REGS];
+    tac1100_config_t cfg;
+    result_t res[2];
+    int reads = 1000, nres = 0, c, i, r;
+    long baud = 115200, latency = 0;
+    pid_t emupid;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "e:n:b:l:r:o:h")) != -1) {
+        switch (c) {
+            case 'e': emu = optarg; break;
+            case 'n': reads = atoi(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'r': group = optarg; break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (reads < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (r = 0; r < TAC1100_NUM_REGS; r++) {
+        if (strcmp(group, "all") == 0) selected[r] = r != TAC1100_R_TIME_DISP;
+        else if (strcmp(group, "power") == 0) selected[r] = tac1100_regs[r].group == TAC1100_GRP_POWER;
+        else if (strcmp(group, "vi") == 0) selected[r] = tac1100_regs[r].group == TAC1100_GRP_VI;
+    }
+
+    if (crcCheck() != 0) exit(EXIT_FAILURE);
+    printf("%-10s %8s %8s %8s %8s\n", "crc", "bytes", "bitwise", "table", "speedup");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        crc_ns[0][i] = crcBench(crcBitwise, sizes[i]);
+        crc_ns[1][i] = crcBench(tac1100_crc16, sizes[i]);
+        printf("%-10s %8d %7.1fns %7.1fns %7.1fx\n", "", sizes[i], crc_ns[0][i], crc_ns[1][i], crc_ns[0][i] / crc_ns[1][i]);
+    }
+
+    emuargv[0] = (char *)emu;
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(slatency, sizeof(slatency), "%ld", latency);
+    if ((emupid = startMeter(emuargv, pts, sizeof(pts), 1)) == -1) {
+        fprintf(stderr, "Can't start %s\n", emu);
+        exit(EXIT_FAILURE);
+    }
+    tac1100_config_init(&cfg);
+    cfg.baud_rate = baud;
+    cfg.lock_mode = TAC1100_LOCK_NONE;
+    printf("\n%-10s %8s %8s %6s %9s %9s %9s\n", "read", "reads", "requests", "failed", "cpu_us/tx", "tx_p50", "tx_p99");
+    for (i = 0; i < 2; i++) {
+        cfg.native_rtu = i;
+        if (runReads(pts, &cfg, selected, reads, &res[nres]) != 0) continue;
+        // The user/system split of getrusage() is sampled at every tick: only the sum is exact
+        printf("%-10s %8d %8d %6d %9.1f %9lld %9lld\n", res[nres].mode, res[nres].reads, res[nres].transactions,
+               res[nres].failed, (double)(res[nres].user_us + res[nres].sys_us) / res[nres].transactions,
+               res[nres].p50_us, res[nres].p99_us);
+        nres++;
+    }
+    kill(emupid, SIGTERM);
+    waitpid(emupid, NULL, 0);
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100codec\",\n  \"version\": \"%s\",\n  \"libmodbus\": \"%s\",\n  \"baud\": %ld,\n"
+                "  \"registers\": \"%s\",\n  \"crc\": [", version, LIBMODBUS_VERSION_STRING, baud, group);
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        fprintf(fp, "%s\n    {\"bytes\": %d, \"bitwise_ns\": %.2f, \"table_ns\": %.2f}", i ? "," : "", sizes[i], crc_ns[0][i], crc_ns[1][i]);
+    }
+    fprintf(fp, "\n  ],\n  \"reads\": [");
+    for (i = 0; i < nres; i++) {
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"reads\": %d, \"transactions\": %d, \"failed\": %d, \"user_us\": %lld, \"sys_us\": %lld, "
+                    "\"tx_p50_us\": %lld, \"tx_p99_us\": %lld}",
+                i ? "," : "", res[i].mode, res[i].reads, res[i].transactions, res[i].failed, res[i].user_us, res[i].sys_us,
+                res[i].p50_us, res[i].p99_us);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return nres == 2 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,380 @@
+/*
+ * tac1100contend: multi-process contention benchmark of the bus locking
+ *
+ * For every client count N starts the meter emulator with a few unit IDs
+ * on a pty, forks N tac1100 instances (addresses 1..units round robin, so
+ * both different and identical addresses), releases them at the same
+ * instant and collects from the exit status and the --stats dumps:
+ *   - completion latency of every client (release to exit), p50/p99/max
+ *   - lock wait (lock phase: tac1100_lock_port() plus the exclusive flock) min/max
+ *     and their ratio as fairness figure
+ *   - error rate (clients failing, in tac1100_lock_port() or on the bus, and
+ *     transactions failing)
+ *   - bus utilisation: sum of the transaction times over the makespan
+ *   - tac1100_lock_port() work: lock file checks, EWOULDBLOCK retries, stale lock
+ *     suspicions and stale locks cleared (none expected: all alive)
+ * With -A the clients take turns from the bus arbiter (tac1100 --arbiter)
+ * started for every level instead (make bench-arbiter).
+ * Results go to stdout as a table and to a JSON file (make bench-contention).
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "benchutil.h"
+
+static const char *version = "0.1";
+
+#define MAX_LEVELS   8
+#define MAX_CLIENTS  1000
+#define MAX_ARGS     32
+
+typedef struct {
+    pid_t pid;
+    int address;
+    int failed;
+    int status;                 // Exit code, -1 killed
+    long long done_us;          // Release to exit
+    long long lock_us;          // Lock phase from --stats
+} client_t;
+
+typedef struct {
+    int clients;
+    int failed;
+    int lock_failed;            // Exit code 2: tac1100_lock_port() gave up
+    long long makespan_us;
+    long long latency_p50, latency_p99, latency_max;
+    long long wait_min, wait_max, wait_p50;
+    unsigned long requests, successes;
+    long long bus_us;           // Sum of the transaction times
+    unsigned long checks, shared_retries, stale_suspects, stale_cleared, missing_pid, amended;
+} level_t;
+
+static client_t clients[MAX_CLIENTS];
+
+/*--------------------------------------------------------------------------
+    startArbiter
+    Bus arbiter of the pty on sock, once it listens
+----------------------------------------------------------------------------*/
+static pid_t startArbiter(const char *arb, const char *sock, const char *pts)
+{
+    struct stat st;
+    pid_t pid;
+    int i;
+
+    if ((pid = fork()) == 0) {
+        execl(arb, arb, "-s", sock, pts, (char *)NULL);
+        _exit(127);
+    }
+    for (i = 0; pid > 0 && i < 200; i++) {
+        if (stat(sock, &st) == 0 && S_ISSOCK(st.st_mode)) return pid;
+        usleep(10000);
+    }
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    return -1;
+}
+
+/*--------------------------------------------------------------------------
+    parseStats
+    Add the --stats dump of one client to the level totals
+----------------------------------------------------------------------------*/
+static int parseStats(const char *file, client_t *cl, level_t *lv)
+{
+    char buf[16384];
+    const char *p;
+    FILE *fp;
+    size_t n;
+
+    if ((fp = fopen(file, "r")) == NULL) return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    if ((p = strstr(buf, "\"phases_us\"")) == NULL) return -1;
+    cl->lock_us = jsonNumber(p, "lock");
+    if ((p = strstr(buf, "\"lock\": {")) != NULL) {
+        lv->checks += jsonNumber(p, "checks");
+        lv->shared_retries += jsonNumber(p, "shared_retries");
+        lv->stale_suspects += jsonNumber(p, "stale_suspects");
+        lv->stale_cleared += jsonNumber(p, "stale_cleared");
+        lv->missing_pid += jsonNumber(p, "missing_pid");
+        lv->amended += jsonNumber(p, "amended");
+    }
+    p = buf;
+    while ((p = strstr(p, "\"requests\": ")) != NULL) {
+        lv->requests += jsonNumber(p, "requests");
+        lv->successes += jsonNumber(p, "successes");
+        lv->bus_us += jsonNumber(p, "sum");
+        p++;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    runLevel
+    N clients released together against the pty, results in lv
+----------------------------------------------------------------------------*/
+static void runLevel(int n, int units, const char *tac, long baud, int lock_wait, char **extra, int nextra,
+                     const char *pts, level_t *lv)
+{
+    char sbaud[16], swait[16], saddr[16], sstats[300];
+    char *argv[MAX_ARGS + 12];
+    long long t0, *lat, *wait;
+    int start[2], i, k, status, ok = 0, running = n;
+    pid_t pid;
+
+    memset(lv, 0, sizeof(*lv));
+    lv->clients = n;
+    lat = calloc(n, sizeof(long long));
+    wait = calloc(n, sizeof(long long));
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(swait, sizeof(swait), "%d", lock_wait);
+
+    if (pipe(start) == -1) {
+        fprintf(stderr, "pipe: (%d) %s\n", errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++) {
+        clients[i].address = 1 + i % units;
+        clients[i].failed = 0;
+        clients[i].lock_us = -1;
+        if ((pid = fork()) == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            char c;
+
+            close(start[1]);
+            // Wait for the release: EOF when the parent closes its end
+            while (read(start[0], &c, 1) == -1 && errno == EINTR);
+            close(start[0]);
+            if (null != -1) {
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+            }
+            snprintf(saddr, sizeof(saddr), "%d", clients[i].address);
+            snprintf(sstats, sizeof(sstats), "--stats=/tmp/tac1100contend.%d.%d.json", (int)getppid(), i);
+            k = 0;
+            argv[k++] = (char *)tac;
+            argv[k++] = "-a"; argv[k++] = saddr;
+            argv[k++] = "-b"; argv[k++] = sbaud;
+            argv[k++] = "-w"; argv[k++] = swait;
+            argv[k++] = sstats;
+            memcpy(&argv[k], extra, nextra * sizeof(char *));
+            k += nextra;
+            argv[k++] = (char *)pts;
+            argv[k] = NULL;
+            execv(tac, argv);
+            _exit(127);
+        }
+        if (pid == -1) {
+            fprintf(stderr, "fork: (%d) %s\n", errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        clients[i].pid = pid;
+    }
+    close(start[0]);
+
+    t0 = now_us();
+    close(start[1]);
+    while (running > 0) {
+        if ((pid = waitpid(-1, &status, 0)) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (clients[i].pid != pid) continue;
+            clients[i].done_us = now_us() - t0;
+            clients[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            clients[i].failed = clients[i].status != 0;
+            running--;
+            break;
+        }
+    }
+    lv->makespan_us = now_us() - t0;
+
+    for (i = 0; i < n; i++) {
+        char file[256];
+
+        snprintf(file, sizeof(file), "/tmp/tac1100contend.%d.%d.json", (int)getpid(), i);
+        if (parseStats(file, &clients[i], lv) == -1) clients[i].failed = 1;
+        unlink(file);
+        lat[i] = clients[i].done_us;
+        if (clients[i].failed) {
+            lv->failed++;
+            if (clients[i].status == 2) lv->lock_failed++;
+        } else {
+            wait[ok++] = clients[i].lock_us;
+        }
+    }
+
+    qsort(lat, n, sizeof(long long), cmpll);
+    qsort(wait, ok, sizeof(long long), cmpll);
+    lv->latency_p50 = percentile(lat, n, 50);
+    lv->latency_p99 = percentile(lat, n, 99);
+    lv->latency_max = lat[n - 1];
+    lv->wait_min = ok ? wait[0] : 0;
+    lv->wait_max = ok ? wait[ok - 1] : 0;
+    lv->wait_p50 = percentile(wait, ok, 50);
+    free(lat);
+    free(wait);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100contend %s: multi-process contention benchmark of the bus locking\n\n", version);
+    fprintf(stderr, "Usage: %s [-t tac1100] [-e tac1100emu] [-n N[,N...]] [-u units] [-b baud] [-l latency_us]\n", program);
+    fprintf(stderr, "       [-w seconds] [-r \"tac1100 options\"] [-A tac1100arb] [-o file.json]\n");
+    fprintf(stderr, "\t-t path \tClient to measure. Default: ./tac1100\n");
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-n list \tConcurrent clients. Default: 10,50,100\n");
+    fprintf(stderr, "\t-u units \tEmulated meters (addresses 1..units). Default: 4\n");
+    fprintf(stderr, "\t-b baud_rate \tDefault: 9600\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-w seconds \ttac1100 lock wait (-w). Default: 30\n");
+    fprintf(stderr, "\t-r options \tWhat the clients read. Default: \"-p\"\n");
+    fprintf(stderr, "\t-A path \tBus arbiter: clients take turns (--arbiter) instead of the lock file\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: contention.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tac = "./tac1100";
+    const char *emu = "tools/tac1100emu";
+    const char *out = "contention.json";
+    const char *arb = NULL;
+    char arb_sock[64], arb_opt[80];
+    char levels_spec[128] = "10,50,100";
+    char read_spec[256] = "-p";
+    char pts[256], sbaud[16], slatency[16], sunits[16];
+    char *emuargv[] = { NULL, "-u", sunits, "-b", sbaud, "-l", slatency, NULL };
+    char *extra[MAX_ARGS];
+    int levels[MAX_LEVELS];
+    level_t results[MAX_LEVELS];
+    int nlevels = 0, nextra = 0, units = 4, lock_wait = 30, c, l;
+    long baud = 9600, latency = 5000;
+    char *tok, *save;
+    pid_t emupid, arbpid = -1;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "t:e:n:u:b:l:w:r:A:o:h")) != -1) {
+        switch (c) {
+            case 't': tac = optarg; break;
+            case 'e': emu = optarg; break;
+            case 'n': snprintf(levels_spec, sizeof(levels_spec), "%s", optarg); break;
+            case 'u': units = atoi(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'w': lock_wait = atoi(optarg); break;
+            case 'r': snprintf(read_spec, sizeof(read_spec), "%s", optarg); break;
+            case 'A': arb = optarg; break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (units < 1 || units > 247) {
+        fprintf(stderr, "Units must be between 1 and 247.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (tok = strtok_r(levels_spec, ",", &save); tok && nlevels < MAX_LEVELS; tok = strtok_r(NULL, ",", &save)) {
+        levels[nlevels] = atoi(tok);
+        if (levels[nlevels] < 1 || levels[nlevels] > MAX_CLIENTS) {
+            fprintf(stderr, "Clients must be between 1 and %d.\n", MAX_CLIENTS);
+            exit(EXIT_FAILURE);
+        }
+        nlevels++;
+    }
+    for (tok = strtok_r(read_spec, " ", &save); tok && nextra < MAX_ARGS; tok = strtok_r(NULL, " ", &save)) {
+        extra[nextra++] = tok;
+    }
+    if (arb != NULL && nextra < MAX_ARGS) {
+        snprintf(arb_sock, sizeof(arb_sock), "/tmp/tac1100contend.%d.arb", (int)getpid());
+        snprintf(arb_opt, sizeof(arb_opt), "--arbiter=%s", arb_sock);
+        extra[nextra++] = arb_opt;
+    }
+
+    emuargv[0] = (char *)emu;
+    snprintf(sunits, sizeof(sunits), "1-%d", units);
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(slatency, sizeof(slatency), "%ld", latency);
+
+    printf("%7s %6s %6s %9s %9s %9s %9s %9s %9s %9s %6s %7s %7s %7s %7s\n", "clients", "failed", "lock", "makespan", "lat_p50", "lat_p99",
+           "lat_max", "wait_min", "wait_max", "fairness", "tx_err", "bus_%", "checks", "stale", "cleared");
+    for (l = 0; l < nlevels; l++) {
+        level_t *lv = &results[l];
+
+        // A fresh emulator (and lock file) for every level
+        if ((emupid = startMeter(emuargv, pts, sizeof(pts), 1)) == -1) {
+            fprintf(stderr, "Can't start %s\n", emu);
+            exit(EXIT_FAILURE);
+        }
+        if (arb != NULL && (arbpid = startArbiter(arb, arb_sock, pts)) == -1) {
+            fprintf(stderr, "Can't start %s\n", arb);
+            exit(EXIT_FAILURE);
+        }
+        runLevel(levels[l], units, tac, baud, lock_wait, extra, nextra, pts, lv);
+        if (arbpid != -1) {
+            kill(arbpid, SIGTERM);
+            waitpid(arbpid, NULL, 0);
+        }
+        kill(emupid, SIGTERM);
+        waitpid(emupid, NULL, 0);
+
+        printf("%7d %6d %6d %9lld %9lld %9lld %9lld %9lld %9lld %9.1f %6lu %7.1f %7lu %7lu %7lu\n", lv->clients, lv->failed, lv->lock_failed,
+               lv->makespan_us, lv->latency_p50, lv->latency_p99, lv->latency_max, lv->wait_min, lv->wait_max,
+               lv->wait_min > 0 ? (double)lv->wait_max / lv->wait_min : 0.0, lv->requests - lv->successes,
+               lv->makespan_us > 0 ? 100.0 * lv->bus_us / lv->makespan_us : 0.0,
+               lv->checks, lv->stale_suspects, lv->stale_cleared);
+        fflush(stdout);
+    }
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"program\": \"tac1100contend\",\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", version);
+    fprintf(fp, "  \"time\": %lld,\n", (long long)time(NULL));
+    fprintf(fp, "  \"units\": %d,\n", units);
+    fprintf(fp, "  \"baud\": %ld,\n", baud);
+    fprintf(fp, "  \"meter_latency_us\": %ld,\n", latency);
+    fprintf(fp, "  \"lock_wait_s\": %d,\n", lock_wait);
+    fprintf(fp, "  \"locking\": \"%s\",\n", arb != NULL ? "arbiter" : "lockfile");
+    fprintf(fp, "  \"results\": [");
+    for (l = 0; l < nlevels; l++) {
+        level_t *lv = &results[l];
+
+        fprintf(fp, "%s\n    {\"clients\": %d, \"failed\": %d, \"lock_failed\": %d, \"error_rate\": %.4f, \"makespan_us\": %lld,\n",
+                l ? "," : "", lv->clients, lv->failed, lv->lock_failed, (double)lv->failed / lv->clients, lv->makespan_us);
+        fprintf(fp, "     \"latency_us\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld},\n",
+                lv->latency_p50, lv->latency_p99, lv->latency_max);
+        fprintf(fp, "     \"lock_wait_us\": {\"min\": %lld, \"p50\": %lld, \"max\": %lld, \"max_min_ratio\": %.2f},\n",
+                lv->wait_min, lv->wait_p50, lv->wait_max, lv->wait_min > 0 ? (double)lv->wait_max / lv->wait_min : 0.0);
+        fprintf(fp, "     \"transactions\": {\"requests\": %lu, \"successes\": %lu, \"bus_us\": %lld, \"bus_utilisation\": %.4f},\n",
+                lv->requests, lv->successes, lv->bus_us, lv->makespan_us > 0 ? (double)lv->bus_us / lv->makespan_us : 0.0);
+        fprintf(fp, "     \"lock\": {\"checks\": %lu, \"shared_retries\": %lu, \"stale_suspects\": %lu, \"stale_cleared\": %lu, "
+                    "\"missing_pid\": %lu, \"amended\": %lu}}",
+                lv->checks, lv->shared_retries, lv->stale_suspects, lv->stale_cleared, lv->missing_pid, lv->amended);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * tac1100flight: single-flight coalescing of the libtac1100 engine
+ *
+ * Starts one meter emulator (tools/tac1100emu) hosting a fleet of meters
+ * on one pty and has several consumers (think of a Prometheus scrape, a
+ * dashboard and a cron job) read all the values of every meter once per
+ * period, each a few milliseconds apart from the others. Runs first with
+ * every read making its own transactions, then with the identical reads
+ * coalesced (tac1100_engine_set_coalesce()), and reports the transactions
+ * on the bus, those saved and the latency of the reads (queued to done).
+ *
+ *   make bench-flight
+ *   bench/tac1100flight -m 4 -c 3 -p 1000 -d 10
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <poll.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define MAX_SAMPLES  (1 << 16)
+#define MAX_CONSUMERS 32
+#define MODES        2
+
+static const char *mode_names[MODES] = { "each", "coalesce" };
+
+typedef struct {
+    long reads;
+    long failed;
+    long coalesced;
+    long long transactions;
+    long long saved;
+    double bus_pct;                 // Bus busy over the run
+    long long p50_us, p99_us, max_us;
+} moderes_t;
+
+static long long lat[MAX_SAMPLES];
+static int nlat;
+static long failed;
+static int sel_all[TAC1100_NUM_REGS];
+
+static void done(void *user, const tac1100_result_t *r)
+{
+    long long *queued = user;
+
+    if (r->rc != TAC1100_OK) failed++;
+    if (nlat < MAX_SAMPLES) lat[nlat++] = now_us() - *queued;
+    free(queued);
+}
+
+static int runMode(const char *pts, const tac1100_config_t *cfg, int coalesce, int meters, int consumers,
+                   long period_ms, long jitter_ms, int seconds, moderes_t *res)
+{
+    tac1100_prio_stats_t stats[TAC1100_PRIO_CLASSES];
+    long long next[MAX_CONSUMERS], start, now, first, wait;
+    tac1100_engine_t *engine;
+    struct pollfd pfd;
+    int rc, c, k, m;
+
+    if ((engine = tac1100_engine_new()) == NULL) return -1;
+    if ((rc = tac1100_engine_add_port(engine, pts, cfg)) < 0) {
+        fprintf(stderr, "%s: %s\n", pts, tac1100_strerror(rc));
+        tac1100_engine_free(engine);
+        return -1;
+    }
+    tac1100_engine_set_coalesce(engine, coalesce);
+    nlat = 0;
+    failed = 0;
+    srand(1100);
+    start = now_us();
+    for (k = 0; k < consumers; k++) next[k] = start + (rand() % (jitter_ms + 1)) * 1000;
+
+    pfd.fd = tac1100_engine_fd(engine);
+    pfd.events = POLLIN;
+    while ((now = now_us()) < start + seconds * 1000000LL) {
+        first = next[0];
+        for (k = 0; k < consumers; k++) {
+            if (now >= next[k]) {
+                // Every consumer wants every meter, at the same rate
+                for (m = 1; m <= meters; m++) {
+                    long long *queued = malloc(sizeof(*queued));
+                    *queued = now;
+                    tac1100_engine_read(engine, 0, m, sel_all, done, queued);
+                }
+                next[k] += period_ms * 1000 + (rand() % (2 * jitter_ms + 1) - jitter_ms) * 1000;
+            }
+            if (next[k] < first) first = next[k];
+        }
+        wait = first - now_us();
+        if (poll(&pfd, 1, wait > 0 ? (int)((wait + 999) / 1000) : 0) > 0) tac1100_engine_run(engine, 0);
+    }
+    // Drain what was asked before the end: a backlog shows in the latency
+    while (tac1100_engine_pending(engine) > 0) tac1100_engine_run(engine, -1);
+
+    tac1100_engine_prio_stats(engine, 0, stats);
+    memset(res, 0, sizeof(*res));
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        res->transactions += stats[c].transactions;
+        res->coalesced += stats[c].coalesced;
+        res->saved += stats[c].saved;
+        res->bus_pct += stats[c].bus_us;
+    }
+    res->bus_pct = 100.0 * res->bus_pct / (now_us() - start);
+    res->reads = nlat;
+    res->failed = failed;
+    qsort(lat, nlat, sizeof(long long), cmpll);
+    res->p50_us = percentile(lat, nlat, 50);
+    res->p99_us = percentile(lat, nlat, 99);
+    res->max_us = nlat ? lat[nlat - 1] : 0;
+    tac1100_engine_free(engine);
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100flight %s: single-flight coalescing of the libtac1100 engine\n\n", version);
+    fprintf(stderr, "Usage: %s [-e tac1100emu] [-m meters] [-c consumers] [-p period_ms] [-j jitter_ms]\n", program);
+    fprintf(stderr, "       [-b baud] [-l latency_us] [-d seconds] [-o file.json]\n");
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-m meters \tMeters on the bus (1-247). Default: 4\n");
+    fprintf(stderr, "\t-c consumers \tReading all the meters every period. Default: 3\n");
+    fprintf(stderr, "\t-p ms \t\tPeriod of every consumer. Default: 1000\n");
+    fprintf(stderr, "\t-j ms \t\tJitter of the consumers around the period. Default: 20\n");
+    fprintf(stderr, "\t-b baud_rate \tDefault: 9600\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-d seconds \tDuration of every mode. Default: 10\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: flight.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *emu = "tools/tac1100emu";
+    const char *out = "flight.json";
+    char pts[256], sunits[16], sbaud[16], slatency[16];
+    char *emuargv[] = { NULL, "-u", sunits, "-b", sbaud, "-l", slatency, NULL };
+    moderes_t res[MODES];
+    tac1100_config_t cfg;
+    int meters = 4, consumers = 3, seconds = 10, nres = 0, c, mode, r;
+    long baud = 9600, latency = 5000, period_ms = 1000, jitter_ms = 20;
+    pid_t emupid;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "e:m:c:p:j:b:l:d:o:h")) != -1) {
+        switch (c) {
+            case 'e': emu = optarg; break;
+            case 'm': meters = atoi(optarg); break;
+            case 'c': consumers = atoi(optarg); break;
+            case 'p': period_ms = atol(optarg); break;
+            case 'j': jitter_ms = atol(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (meters < 1 || meters > 247 || consumers < 1 || consumers > MAX_CONSUMERS || period_ms < 1 ||
+        jitter_ms < 0 || jitter_ms >= period_ms || seconds < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (r = 0; r < TAC1100_NUM_REGS; r++) sel_all[r] = r != TAC1100_R_TIME_DISP;
+
+    emuargv[0] = (char *)emu;
+    snprintf(sunits, sizeof(sunits), "1-%d", meters);
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(slatency, sizeof(slatency), "%ld", latency);
+    if ((emupid = startMeter(emuargv, pts, sizeof(pts), 1)) == -1) {
+        fprintf(stderr, "Can't start %s\n", emu);
+        exit(EXIT_FAILURE);
+    }
+    tac1100_config_init(&cfg);
+    cfg.baud_rate = baud;
+    cfg.lock_mode = TAC1100_LOCK_NONE;
+
+    printf("%d meters at %ld baud, %d consumers every %ldms +-%ldms\n\n", meters, baud, consumers, period_ms, jitter_ms);
+    printf("%-9s %7s %6s %9s %12s %7s %6s %9s %9s %9s\n", "mode", "reads", "failed", "coalesced", "transactions",
+           "saved", "bus_%", "lat_p50", "lat_p99", "lat_max");
+    for (mode = 0; mode < MODES; mode++) {
+        moderes_t *m = &res[mode];
+
+        if (runMode(pts, &cfg, mode == 1, meters, consumers, period_ms, jitter_ms, seconds, m) != 0) break;
+        printf("%-9s %7ld %6ld %9ld %12lld %7lld %6.1f %9lld %9lld %9lld\n", mode_names[mode], m->reads, m->failed,
+               m->coalesced, m->transactions, m->saved, m->bus_pct, m->p50_us, m->p99_us, m->max_us);
+        nres++;
+        fflush(stdout);
+    }
+    kill(emupid, SIGTERM);
+    waitpid(emupid, NULL, 0);
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100flight\",\n  \"version\": \"%s\",\n  \"meters\": %d,\n  \"consumers\": %d,\n"
+                "  \"period_ms\": %ld,\n  \"jitter_ms\": %ld,\n  \"baud\": %ld,\n  \"latency_us\": %ld,\n  \"results\": [",
+                version, meters, consumers, period_ms, jitter_ms, baud, latency);
+    for (mode = 0; mode < nres; mode++) {
+        moderes_t *m = &res[mode];
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"reads\": %ld, \"failed\": %ld, \"coalesced\": %ld, \"transactions\": %lld, "
+                    "\"saved\": %lld, \"bus_pct\": %.1f, \"latency_p50_us\": %lld, \"latency_p99_us\": %lld, "
+                    "\"latency_max_us\": %lld}",
+                mode ? "," : "", mode_names[mode], m->reads, m->failed, m->coalesced, m->transactions, m->saved,
+                m->bus_pct, m->p50_us, m->p99_us, m->max_us);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    return nres == MODES ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,283 @@
+/*
+ * tac1100multi: many buses from one thread with the libtac1100 engine
+ *
+ * Starts one meter emulator (tools/tac1100emu) per bus, each on its own
+ * pty at the given baud rate, and reads the selected registers of every
+ * bus back to back for a while:
+ *   - engine:     one thread, tac1100_engine_*: all the buses in parallel
+ *   - sequential: one thread, blocking tac1100_read() on the buses in turn
+ * and reports the reads per second (total and per bus), the failed reads,
+ * the read latency and the CPU time used per read and in total.
+ *
+ *   make bench-engine
+ *   bench/tac1100multi -n 16 -b 9600 -d 5
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/resource.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define MAX_BUSES   64
+#define MAX_SAMPLES (1 << 20)
+
+typedef struct {
+    const char *mode;
+    int buses;
+    long reads;
+    long failed;
+    long long elapsed_us;
+    long long cpu_us;               // User + system time of the reading thread
+    double bus_min;                 // Reads per second of the slowest bus
+    double bus_max;
+    long long p50_us;               // Read latency: request queued to callback
+    long long p99_us;
+} result_t;
+
+static long bus_reads[MAX_BUSES];
+static long bus_failed[MAX_BUSES];
+static long long bus_start[MAX_BUSES];
+static long long *lat;
+static int nlat;
+static int selected[TAC1100_NUM_REGS];
+static int unit = 1;
+static long long deadline;
+static tac1100_engine_t *engine;
+
+static long long cpu_us(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void summary(result_t *res, const char *mode, int buses, long long elapsed, long long cpu)
+{
+    int i;
+
+    res->mode = mode;
+    res->buses = buses;
+    res->reads = res->failed = 0;
+    res->elapsed_us = elapsed;
+    res->cpu_us = cpu;
+    for (i = 0; i < buses; i++) {
+        double rate = bus_reads[i] * 1e6 / elapsed;
+        res->reads += bus_reads[i];
+        res->failed += bus_failed[i];
+        if (i == 0 || rate < res->bus_min) res->bus_min = rate;
+        if (i == 0 || rate > res->bus_max) res->bus_max = rate;
+    }
+    qsort(lat, nlat, sizeof(long long), cmpll);
+    res->p50_us = percentile(lat, nlat, 50);
+    res->p99_us = percentile(lat, nlat, 99);
+}
+
+static void resetCounters(void)
+{
+    memset(bus_reads, 0, sizeof(bus_reads));
+    memset(bus_failed, 0, sizeof(bus_failed));
+    nlat = 0;
+}
+
+/*--------------------------------------------------------------------------
+    readDone
+    Count the read and queue the next one on the same bus until the end
+----------------------------------------------------------------------------*/
+static void readDone(void *user, const tac1100_result_t *r)
+{
+    long long now = now_us();
+
+    (void)user;
+    if (r->rc == TAC1100_OK) bus_reads[r->port]++; else bus_failed[r->port]++;
+    if (nlat < MAX_SAMPLES) lat[nlat++] = now - bus_start[r->port];
+    if (now < deadline) {
+        bus_start[r->port] = now;
+        tac1100_engine_read(engine, r->port, unit, selected, readDone, NULL);
+    }
+}
+
+static int runEngine(char pts[][256], int buses, const tac1100_config_t *cfg, int seconds, result_t *res)
+{
+    long long start, cpu;
+    int i, rc;
+
+    if ((engine = tac1100_engine_new()) == NULL) return -1;
+    for (i = 0; i < buses; i++) {
+        if ((rc = tac1100_engine_add_port(engine, pts[i], cfg)) < 0) {
+            fprintf(stderr, "%s: %s\n", pts[i], tac1100_strerror(rc));
+            tac1100_engine_free(engine);
+            return -1;
+        }
+    }
+    resetCounters();
+    start = now_us();
+    cpu = cpu_us();
+    deadline = start + seconds * 1000000LL;
+    for (i = 0; i < buses; i++) {
+        bus_start[i] = start;
+        tac1100_engine_read(engine, i, unit, selected, readDone, NULL);
+    }
+    while (tac1100_engine_pending(engine) > 0) tac1100_engine_run(engine, -1);
+    summary(res, "engine", buses, now_us() - start, cpu_us() - cpu);
+    tac1100_engine_free(engine);
+    return 0;
+}
+
+static int runSequential(char pts[][256], int buses, const tac1100_config_t *cfg, int seconds, result_t *res)
+{
+    tac1100_t *t[MAX_BUSES];
+    float values[TAC1100_NUM_REGS];
+    long long start, cpu, t0;
+    int i, rc;
+
+    for (i = 0; i < buses; i++) {
+        t[i] = tac1100_new(pts[i], cfg);
+        if (t[i] == NULL || (rc = tac1100_connect(t[i])) != TAC1100_OK) {
+            fprintf(stderr, "%s: %s\n", pts[i], t[i] ? tac1100_strerror(rc) : "out of memory");
+            while (i >= 0) tac1100_free(t[i--]);
+            return -1;
+        }
+    }
+    resetCounters();
+    start = now_us();
+    cpu = cpu_us();
+    deadline = start + seconds * 1000000LL;
+    while (now_us() < deadline) {
+        for (i = 0; i < buses; i++) {
+            t0 = now_us();
+            if (tac1100_read(t[i], unit, selected, values, NULL) >= 0) bus_reads[i]++; else bus_failed[i]++;
+            if (nlat < MAX_SAMPLES) lat[nlat++] = now_us() - t0;
+        }
+    }
+    summary(res, "sequential", buses, now_us() - start, cpu_us() - cpu);
+    for (i = 0; i < buses; i++) tac1100_free(t[i]);
+    return 0;
+}
+
+static void printResult(const result_t *r)
+{
+    printf("%-10s %5d %8ld %6ld %9.1f %9.2f %9.2f %8lld %8lld %9.1f %7.1f\n", r->mode, r->buses, r->reads, r->failed,
+           r->reads * 1e6 / r->elapsed_us, r->bus_min, r->bus_max, r->p50_us, r->p99_us,
+           r->reads + r->failed ? (double)r->cpu_us / (r->reads + r->failed) : 0.0,
+           100.0 * r->cpu_us / r->elapsed_us);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100multi %s: many buses from one thread with the libtac1100 engine\n\n", version);
+    fprintf(stderr, "Usage: %s [-e tac1100emu] [-n buses] [-b baud] [-l latency_us] [-d seconds] [-k uucp|fd|none]\n", program);
+    fprintf(stderr, "       [-r all|power|vi] [-s] [-o file.json]\n");
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-n buses \tEmulated buses, one meter each (1-%d). Default: 16\n", MAX_BUSES);
+    fprintf(stderr, "\t-b baud_rate \tDefault: 9600\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-d seconds \tDuration of every mode. Default: 5\n");
+    fprintf(stderr, "\t-k mode \tPort locking. Default: fd\n");
+    fprintf(stderr, "\t-r group \tRegisters read: all (2 requests), power or vi (1 request). Default: all\n");
+    fprintf(stderr, "\t-s \t\tAlso run the blocking reads on the buses in turn\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: engine.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *emu = "tools/tac1100emu";
+    const char *out = "engine.json";
+    const char *group = "all";
+    static char pts[MAX_BUSES][256];
+    char sbaud[16], slatency[16];
+    char *emuargv[] = { NULL, "-u", "1", "-b", sbaud, "-l", slatency, NULL };
+    pid_t emupid[MAX_BUSES];
+    tac1100_config_t cfg;
+    result_t res[2];
+    int buses = 16, seconds = 5, sequential = 0, nres = 0, c, i, r;
+    long baud = 9600, latency = 5000;
+    FILE *fp;
+
+    tac1100_config_init(&cfg);
+    cfg.lock_mode = TAC1100_LOCK_FD;
+    while ((c = getopt(argc, argv, "e:n:b:l:d:k:r:so:h")) != -1) {
+        switch (c) {
+            case 'e': emu = optarg; break;
+            case 'n': buses = atoi(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'k':
+                if (strcmp(optarg, "uucp") == 0) cfg.lock_mode = TAC1100_LOCK_UUCP;
+                else if (strcmp(optarg, "fd") == 0) cfg.lock_mode = TAC1100_LOCK_FD;
+                else if (strcmp(optarg, "none") == 0) cfg.lock_mode = TAC1100_LOCK_NONE;
+                else {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r': group = optarg; break;
+            case 's': sequential = 1; break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (buses < 1 || buses > MAX_BUSES || seconds < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (r = 0; r < TAC1100_NUM_REGS; r++) {
+        if (strcmp(group, "all") == 0) selected[r] = r != TAC1100_R_TIME_DISP;
+        else if (strcmp(group, "power") == 0) selected[r] = tac1100_regs[r].group == TAC1100_GRP_POWER;
+        else if (strcmp(group, "vi") == 0) selected[r] = tac1100_regs[r].group == TAC1100_GRP_VI;
+    }
+    cfg.baud_rate = baud;
+
+    emuargv[0] = (char *)emu;
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(slatency, sizeof(slatency), "%ld", latency);
+    for (i = 0; i < buses; i++) {
+        if ((emupid[i] = startMeter(emuargv, pts[i], sizeof(pts[i]), 1)) == -1) {
+            fprintf(stderr, "Can't start %s\n", emu);
+            while (--i >= 0) kill(emupid[i], SIGTERM);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((lat = malloc(MAX_SAMPLES * sizeof(long long))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%-10s %5s %8s %6s %9s %9s %9s %8s %8s %9s %7s\n", "mode", "buses", "reads", "failed", "reads/s", "bus_min/s",
+           "bus_max/s", "p50_us", "p99_us", "cpu_us/rd", "cpu_%");
+    if (runEngine(pts, buses, &cfg, seconds, &res[nres]) == 0) printResult(&res[nres++]);
+    fflush(stdout);
+    if (sequential && runSequential(pts, buses, &cfg, seconds, &res[nres]) == 0) printResult(&res[nres++]);
+
+    for (i = 0; i < buses; i++) {
+        kill(emupid[i], SIGTERM);
+        waitpid(emupid[i], NULL, 0);
+    }
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100multi\",\n  \"version\": \"%s\",\n  \"baud\": %ld,\n  \"latency_us\": %ld,\n"
+                "  \"registers\": \"%s\",\n  \"results\": [", version, baud, latency, group);
+    for (i = 0; i < nres; i++) {
+        fprintf(fp, "%s\n    {\"mode\": \"%s\", \"buses\": %d, \"reads\": %ld, \"failed\": %ld, \"elapsed_us\": %lld, "
+                    "\"cpu_us\": %lld, \"bus_min_hz\": %.2f, \"bus_max_hz\": %.2f, \"p50_us\": %lld, \"p99_us\": %lld}",
+                i ? "," : "", res[i].mode, res[i].buses, res[i].reads, res[i].failed, res[i].elapsed_us, res[i].cpu_us,
+                res[i].bus_min, res[i].bus_max, res[i].p50_us, res[i].p99_us);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    free(lat);
+    return nres > 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,277 @@
+/*
+ * tac1100sched: priority classes of the libtac1100 engine on a busy bus
+ *
+ * Starts one meter emulator (tools/tac1100emu) hosting a fleet of meters
+ * on one pty and loads the bus from one engine with:
+ *   - poll:        back to back sweeps reading all the values of every meter
+ *   - bulk:        two reads of all the values always queued (history)
+ *   - alarm:       a power read at a fixed interval
+ *   - interactive: a voltage/current read at a fixed interval, every third
+ *                  one a write of the backlight time instead
+ * first with every request in the same class (first come, first served),
+ * then each in its own class, and reports per class the requests served
+ * and their queueing delay.
+ *
+ *   make bench-sched
+ *   bench/tac1100sched -m 8 -b 9600 -d 10
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <poll.h>
+
+#include "benchutil.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define MAX_SAMPLES (1 << 16)
+#define MODES       2
+
+static const char *class_names[TAC1100_PRIO_CLASSES] = { "interactive", "alarm", "poll", "bulk" };
+static const char *mode_names[MODES] = { "fifo", "prio" };
+
+typedef struct {
+    long requests;
+    long failed;
+    double rate;                    // Requests per second
+    long long p50_us;               // Queueing delay
+    long long p99_us;
+    long long max_us;
+    double bus_pct;                 // Share of the bus time (prio mode)
+} classres_t;
+
+static long long *waits[TAC1100_PRIO_CLASSES];
+static int nwaits[TAC1100_PRIO_CLASSES];
+static long failed[TAC1100_PRIO_CLASSES];
+static int sel_all[TAC1100_NUM_REGS], sel_power[TAC1100_NUM_REGS], sel_vi[TAC1100_NUM_REGS];
+static int meters = 8;
+static int sweep_left;              // Reads of the current poll sweep still to complete
+static int bulk_unit = 1;
+static int fifo;
+static long long deadline;
+static tac1100_engine_t *engine;
+
+static int classOf(int cls)
+{
+    return fifo ? TAC1100_PRIO_POLL : cls;
+}
+
+static void done(void *user, const tac1100_result_t *r);
+
+static void submitRead(int cls, int unit, const int *selected)
+{
+    tac1100_engine_read_prio(engine, 0, unit, selected, classOf(cls), done, (void *)(intptr_t)cls);
+}
+
+static void submitSweep(void)
+{
+    int m;
+
+    sweep_left = meters;
+    for (m = 1; m <= meters; m++) submitRead(TAC1100_PRIO_POLL, m, sel_all);
+}
+
+static void submitBulk(void)
+{
+    submitRead(TAC1100_PRIO_BULK, bulk_unit, sel_all);
+    bulk_unit = bulk_unit % meters + 1;
+}
+
+/*--------------------------------------------------------------------------
+    done
+    Record the queueing delay, keep the poll sweeps and the bulk reads
+    going until the end
+----------------------------------------------------------------------------*/
+static void done(void *user, const tac1100_result_t *r)
+{
+    int cls = (int)(intptr_t)user;
+
+    if (r->rc != TAC1100_OK) failed[cls]++;
+    if (nwaits[cls] < MAX_SAMPLES) waits[cls][nwaits[cls]++] = r->wait_us;
+    if (now_us() >= deadline) return;
+    if (cls == TAC1100_PRIO_POLL && --sweep_left == 0) submitSweep();
+    if (cls == TAC1100_PRIO_BULK) submitBulk();
+}
+
+static int runMode(const char *pts, const tac1100_config_t *cfg, int seconds, long interactive_ms, long alarm_ms,
+                   classres_t *res)
+{
+    tac1100_prio_stats_t stats[TAC1100_PRIO_CLASSES];
+    long long start, now, next_inter, next_alarm, elapsed, bus = 0;
+    struct pollfd pfd;
+    long inter = 0;
+    int rc, c;
+
+    if ((engine = tac1100_engine_new()) == NULL) return -1;
+    if ((rc = tac1100_engine_add_port(engine, pts, cfg)) < 0) {
+        fprintf(stderr, "%s: %s\n", pts, tac1100_strerror(rc));
+        tac1100_engine_free(engine);
+        return -1;
+    }
+    memset(nwaits, 0, sizeof(nwaits));
+    memset(failed, 0, sizeof(failed));
+    start = now_us();
+    deadline = start + seconds * 1000000LL;
+    next_inter = start + interactive_ms * 1000;
+    next_alarm = start + alarm_ms * 1000;
+    submitSweep();
+    submitBulk();
+    submitBulk();
+
+    // The engine embedded in a loop of our own: its fd tells when to run it
+    pfd.fd = tac1100_engine_fd(engine);
+    pfd.events = POLLIN;
+    while ((now = now_us()) < deadline) {
+        if (now >= next_inter) {
+            if (++inter % 3 == 0) {
+                tac1100_engine_write(engine, 0, 1 + inter % meters, TAC1100_BACKLIT_TIME, 60, classOf(TAC1100_PRIO_INTERACTIVE),
+                                     done, (void *)(intptr_t)TAC1100_PRIO_INTERACTIVE);
+            } else {
+                submitRead(TAC1100_PRIO_INTERACTIVE, 1 + inter % meters, sel_vi);
+            }
+            next_inter += interactive_ms * 1000;
+        }
+        if (now >= next_alarm) {
+            submitRead(TAC1100_PRIO_ALARM, 1, sel_power);
+            next_alarm += alarm_ms * 1000;
+        }
+        elapsed = (next_inter < next_alarm ? next_inter : next_alarm) - now_us();
+        if (poll(&pfd, 1, elapsed > 0 ? (int)((elapsed + 999) / 1000) : 0) > 0) tac1100_engine_run(engine, 0);
+    }
+    elapsed = now_us() - start;
+    // What is still queued is dropped with the engine: only the load up to the deadline counts
+    tac1100_engine_prio_stats(engine, 0, stats);
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) bus += stats[c].bus_us;
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        qsort(waits[c], nwaits[c], sizeof(long long), cmpll);
+        res[c].requests = nwaits[c];
+        res[c].failed = failed[c];
+        res[c].rate = nwaits[c] * 1e6 / elapsed;
+        res[c].p50_us = percentile(waits[c], nwaits[c], 50);
+        res[c].p99_us = percentile(waits[c], nwaits[c], 99);
+        res[c].max_us = nwaits[c] ? waits[c][nwaits[c] - 1] : 0;
+        res[c].bus_pct = bus ? 100.0 * stats[c].bus_us / bus : 0;
+    }
+    tac1100_engine_free(engine);
+    // Let the meter answer the request dropped in flight before the next mode opens the port
+    usleep(500000);
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100sched %s: priority classes of the libtac1100 engine on a busy bus\n\n", version);
+    fprintf(stderr, "Usage: %s [-e tac1100emu] [-m meters] [-b baud] [-l latency_us] [-d seconds]\n", program);
+    fprintf(stderr, "       [-i interactive_ms] [-a alarm_ms] [-o file.json]\n");
+    fprintf(stderr, "\t-e path \tMeter emulator. Default: tools/tac1100emu\n");
+    fprintf(stderr, "\t-m meters \tMeters on the bus (1-247). Default: 8\n");
+    fprintf(stderr, "\t-b baud_rate \tDefault: 9600\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-d seconds \tDuration of every mode. Default: 10\n");
+    fprintf(stderr, "\t-i ms \t\tInteractive request interval. Default: 250\n");
+    fprintf(stderr, "\t-a ms \t\tAlarm read interval. Default: 1000\n");
+    fprintf(stderr, "\t-o file \tJSON results. Default: sched.json\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *emu = "tools/tac1100emu";
+    const char *out = "sched.json";
+    char pts[256], sunits[16], sbaud[16], slatency[16], share[16];
+    char *emuargv[] = { NULL, "-u", sunits, "-b", sbaud, "-l", slatency, NULL };
+    classres_t res[MODES][TAC1100_PRIO_CLASSES];
+    tac1100_config_t cfg;
+    int seconds = 10, nres = 0, c, mode, r;
+    long baud = 9600, latency = 5000, interactive_ms = 250, alarm_ms = 1000;
+    pid_t emupid;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "e:m:b:l:d:i:a:o:h")) != -1) {
+        switch (c) {
+            case 'e': emu = optarg; break;
+            case 'm': meters = atoi(optarg); break;
+            case 'b': baud = atol(optarg); break;
+            case 'l': latency = atol(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'i': interactive_ms = atol(optarg); break;
+            case 'a': alarm_ms = atol(optarg); break;
+            case 'o': out = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (meters < 1 || meters > 247 || seconds < 1 || interactive_ms < 1 || alarm_ms < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (r = 0; r < TAC1100_NUM_REGS; r++) {
+        sel_all[r] = r != TAC1100_R_TIME_DISP;
+        sel_power[r] = tac1100_regs[r].group == TAC1100_GRP_POWER;
+        sel_vi[r] = tac1100_regs[r].group == TAC1100_GRP_VI;
+    }
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        if ((waits[c] = malloc(MAX_SAMPLES * sizeof(long long))) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    emuargv[0] = (char *)emu;
+    snprintf(sunits, sizeof(sunits), "1-%d", meters);
+    snprintf(sbaud, sizeof(sbaud), "%ld", baud);
+    snprintf(slatency, sizeof(slatency), "%ld", latency);
+    if ((emupid = startMeter(emuargv, pts, sizeof(pts), 1)) == -1) {
+        fprintf(stderr, "Can't start %s\n", emu);
+        exit(EXIT_FAILURE);
+    }
+    tac1100_config_init(&cfg);
+    cfg.baud_rate = baud;
+    cfg.lock_mode = TAC1100_LOCK_NONE;
+
+    printf("%d meters at %ld baud, interactive every %ldms, alarm every %ldms\n\n", meters, baud, interactive_ms, alarm_ms);
+    printf("%-5s %-12s %8s %6s %8s %9s %9s %9s %6s\n", "mode", "class", "requests", "failed", "req/s", "wait_p50",
+           "wait_p99", "wait_max", "bus_%");
+    for (mode = 0; mode < MODES; mode++) {
+        fifo = mode == 0;
+        if (runMode(pts, &cfg, seconds, interactive_ms, alarm_ms, res[mode]) != 0) break;
+        for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+            // In fifo mode the engine accounts every request as poll
+            if (fifo) snprintf(share, sizeof(share), "-");
+            else snprintf(share, sizeof(share), "%.1f", res[mode][c].bus_pct);
+            printf("%-5s %-12s %8ld %6ld %8.2f %9lld %9lld %9lld %6s\n", mode_names[mode], class_names[c],
+                   res[mode][c].requests, res[mode][c].failed, res[mode][c].rate, res[mode][c].p50_us,
+                   res[mode][c].p99_us, res[mode][c].max_us, share);
+        }
+        nres++;
+        fflush(stdout);
+    }
+    kill(emupid, SIGTERM);
+    waitpid(emupid, NULL, 0);
+
+    if ((fp = fopen(out, "w")) == NULL) {
+        fprintf(stderr, "Can't write %s: (%d) %s\n", out, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "{\n  \"program\": \"tac1100sched\",\n  \"version\": \"%s\",\n  \"meters\": %d,\n  \"baud\": %ld,\n"
+                "  \"latency_us\": %ld,\n  \"interactive_ms\": %ld,\n  \"alarm_ms\": %ld,\n  \"results\": [",
+                version, meters, baud, latency, interactive_ms, alarm_ms);
+    for (mode = 0; mode < nres; mode++) {
+        for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+            fprintf(fp, "%s\n    {\"mode\": \"%s\", \"class\": \"%s\", \"requests\": %ld, \"failed\": %ld, \"rate_hz\": %.2f, "
+                        "\"wait_p50_us\": %lld, \"wait_p99_us\": %lld, \"wait_max_us\": %lld, \"bus_pct\": %.1f}",
+                    mode || c ? "," : "", mode_names[mode], class_names[c], res[mode][c].requests, res[mode][c].failed,
+                    res[mode][c].rate, res[mode][c].p50_us, res[mode][c].p99_us, res[mode][c].max_us,
+                    res[mode][c].bus_pct);
+        }
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    printf("Results written to %s\n", out);
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) free(waits[c]);
+    return nres == MODES ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,277 @@
+/*
+ * tac1100sim: simulated TAC1100 meter on a pseudo-terminal
+ *
+ * Creates a pty pair, prints the slave device name on stdout and answers
+ * ModBus RTU requests on the master side with a libmodbus RTU server
+ * holding the full register map read and written by tac1100.
+ * The pty delivers frames instantly: the time a real line needs to
+ * transmit the request and the response at the given baud rate, plus the
+ * meter turnaround, is added before every reply.
+ *
+ * Used by tac1100bench (make bench), can also be run by hand:
+ *   bench/tac1100sim -b 9600 &
+ *   ./tac1100 -b 9600 /dev/pts/N
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <modbus.h>
+
+static const char *version = "0.1";
+
+// Register map (see tac1100.c)
+#define VOLTAGE        0x0000
+#define CURRENT        0x0006
+#define POWER          0x000C
+#define APOWER         0x0012
+#define RAPOWER        0x0018
+#define PFACTOR        0x001E
+#define PANGLE         0x0024
+#define FREQUENCY      0x0030
+#define IAENERGY       0x0500
+#define EAENERGY       0x0502
+#define TAENERGY       0x0504
+#define IRAENERGY      0x0508
+#define ERAENERGY      0x050A
+#define TRENERGY       0x050C
+
+#define INPUT_START    0x0000
+#define INPUT_NB       0x050E   // 0x0000-0x050D
+#define HOLDING_START  0x5000
+#define HOLDING_NB     0x0608   // 0x5000-0x5607
+
+#define KPPA           0x5000
+#define DEMAND_PERIOD  0x5002
+#define SLIDE_TIME     0x5003
+#define DEVICE_ID      0x5005
+#define BAUD_RATE      0x5006
+#define NPARSTOP       0x5007
+#define PASSWORD       0x5008
+#define TIME_DISP      0x5018
+#define BACKLIT_TIME   0x5019
+#define METER_CODE     0x5601
+#define SERIAL_NUM     0x5602
+#define SW_VERSION     0x5604
+#define HW_VERSION     0x5605
+#define DISP_VERSION   0x5606
+#define FAULT_CODE     0x5607
+
+static volatile sig_atomic_t sim_stop = 0;
+
+static void simSignal(int sig)
+{
+    (void)sig;
+    sim_stop = 1;
+}
+
+/*--------------------------------------------------------------------------
+    setFloat
+    Store f in the meter word order (high word first)
+----------------------------------------------------------------------------*/
+static void setFloat(modbus_mapping_t *mb, int address, float f)
+{
+    uint16_t tmp[2];
+
+    modbus_set_float(f, tmp);
+    mb->tab_input_registers[address - INPUT_START] = tmp[1];
+    mb->tab_input_registers[address - INPUT_START + 1] = tmp[0];
+}
+
+/*--------------------------------------------------------------------------
+    updateValues
+    Slowly varying measures, energy counters integrated from the power
+----------------------------------------------------------------------------*/
+static void updateValues(modbus_mapping_t *mb, double t, double dt, double *kwh)
+{
+    double v = 230.0 + 2.0 * sin(t / 60.0);
+    double p = 1200.0 + 800.0 * sin(t / 17.0);
+    double q = 100.0 + 20.0 * sin(t / 23.0);
+    double s = sqrt(p * p + q * q);
+
+    kwh[0] += p * dt / 3600000.0;
+    kwh[1] += q * dt / 3600000.0;
+
+    setFloat(mb, VOLTAGE, v);
+    setFloat(mb, CURRENT, s / v);
+    setFloat(mb, POWER, p);
+    setFloat(mb, APOWER, q);
+    setFloat(mb, RAPOWER, s);
+    setFloat(mb, PFACTOR, p / s);
+    setFloat(mb, PANGLE, atan2(q, p) * 180.0 / M_PI);
+    setFloat(mb, FREQUENCY, 50.0 + 0.02 * sin(t / 7.0));
+    setFloat(mb, IAENERGY, kwh[0]);
+    setFloat(mb, EAENERGY, 0.0);
+    setFloat(mb, TAENERGY, kwh[0]);
+    setFloat(mb, IRAENERGY, kwh[1]);
+    setFloat(mb, ERAENERGY, 0.0);
+    setFloat(mb, TRENERGY, kwh[1]);
+}
+
+/*--------------------------------------------------------------------------
+    replyLength
+    Length of the RTU response to req (address to CRC)
+----------------------------------------------------------------------------*/
+static int replyLength(const uint8_t *req)
+{
+    switch (req[1]) {
+        case 0x03:
+        case 0x04:
+            return 5 + 2 * ((req[4] << 8) | req[5]);
+        case 0x06:
+        case 0x10:
+            return 8;
+        default:
+            return 5;
+    }
+}
+
+static long long mono_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100sim %s: simulated TAC1100 meter on a pseudo-terminal\n\n", version);
+    fprintf(stderr, "Usage: %s [-a address] [-b baud_rate] [-l latency_us] [-d]\n", program);
+    fprintf(stderr, "\t-a address \tMeter number (1-247). Default: 1\n");
+    fprintf(stderr, "\t-b baud_rate \tEmulated line speed, 0 = no line time. Default: 9600\n");
+    fprintf(stderr, "\t-l latency_us \tMeter turnaround before the response. Default: 5000\n");
+    fprintf(stderr, "\t-d \t\tlibmodbus debug\n");
+    fprintf(stderr, "The slave device name is printed on stdout.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int address = 1;
+    long baud = 9600;
+    long latency = 5000;
+    int debug = 0;
+    int master, slave, c, rc;
+    char *pts;
+    modbus_t *ctx;
+    modbus_mapping_t *mb;
+    uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
+    double kwh[2] = { 1234.5, 321.0 };
+    long long start, last, now;
+    unsigned long served = 0;
+    struct sigaction sa;
+
+    while ((c = getopt(argc, argv, "a:b:l:dh")) != -1) {
+        switch (c) {
+            case 'a':
+                address = atoi(optarg);
+                if (address < 1 || address > 247) {
+                    fprintf(stderr, "Address must be between 1 and 247.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                baud = atol(optarg);
+                break;
+            case 'l':
+                latency = atol(optarg);
+                break;
+            case 'd':
+                debug = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(master) == -1 ||
+        unlockpt(master) == -1 || (pts = ptsname(master)) == NULL) {
+        fprintf(stderr, "Can't create pseudo-terminal: (%d) %s\n", errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    // Keep the slave side open: without it the master reads EIO every
+    // time a client closes the port
+    if ((slave = open(pts, O_RDWR | O_NOCTTY)) == -1) {
+        fprintf(stderr, "Can't open %s: (%d) %s\n", pts, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    ctx = modbus_new_rtu(pts, baud > 0 ? baud : 9600, 'N', 8, 1);
+    mb = modbus_mapping_new_start_address(0, 0, 0, 0, HOLDING_START, HOLDING_NB, INPUT_START, INPUT_NB);
+    if (ctx == NULL || mb == NULL) {
+        fprintf(stderr, "Can't create the ModBus server: (%d) %s\n", errno, modbus_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    modbus_set_debug(ctx, debug);
+    modbus_set_slave(ctx, address);
+    modbus_set_socket(ctx, master);
+
+    mb->tab_registers[DEMAND_PERIOD - HOLDING_START] = 60;
+    mb->tab_registers[SLIDE_TIME - HOLDING_START]    = 1;
+    mb->tab_registers[DEVICE_ID - HOLDING_START]     = address;
+    mb->tab_registers[BAUD_RATE - HOLDING_START]     = 3;
+    mb->tab_registers[NPARSTOP - HOLDING_START]      = 0;
+    mb->tab_registers[TIME_DISP - HOLDING_START]     = 0;
+    mb->tab_registers[BACKLIT_TIME - HOLDING_START]  = 60;
+    mb->tab_registers[METER_CODE - HOLDING_START]    = 0x1100;
+    mb->tab_registers[SERIAL_NUM - HOLDING_START]    = 0x0012;
+    mb->tab_registers[SERIAL_NUM - HOLDING_START + 1] = 0x3456;
+    mb->tab_registers[SW_VERSION - HOLDING_START]    = 0x0100;
+    mb->tab_registers[HW_VERSION - HOLDING_START]    = 0x0100;
+    mb->tab_registers[DISP_VERSION - HOLDING_START]  = 0x0100;
+    mb->tab_registers[FAULT_CODE - HOLDING_START]    = 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = simSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("%s\n", pts);
+    fflush(stdout);
+
+    start = last = mono_us();
+    updateValues(mb, 0.0, 0.0, kwh);
+    while (!sim_stop) {
+        rc = modbus_receive(ctx, query);
+        if (rc == -1) {
+            if (errno == EINTR || errno == EMBBADCRC) continue;
+            if (sim_stop) break;
+            fprintf(stderr, "modbus_receive: (%d) %s\n", errno, modbus_strerror(errno));
+            break;
+        }
+        if (rc == 0) continue;      // Request for another meter
+
+        now = mono_us();
+        updateValues(mb, (now - start) / 1e6, (now - last) / 1e6, kwh);
+        last = now;
+
+        if (baud > 0) {
+            // 10 bits per character (8N1), request and response on the line
+            long long line_us = (long long)(rc + replyLength(query)) * 10 * 1000000LL / baud;
+            usleep(line_us + latency);
+        } else if (latency > 0) {
+            usleep(latency);
+        }
+        modbus_reply(ctx, query, rc, mb);
+        served++;
+    }
+
+    fprintf(stderr, "tac1100sim: %lu requests served\n", served);
+    modbus_mapping_free(mb);
+    modbus_free(ctx);
+    close(slave);
+    close(master);
+    return 0;
+}
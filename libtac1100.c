@@ -0,0 +1,2879 @@
+/*
+ * libtac1100: TAC1100 ModBus RTU access library (see libtac1100.h)
+ *
+ * Copyright (C) 2026 Flavio Anesi <www.flanesi.it>
+ *
+ * Locking code partially from aurora by Curtronis.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include <modbus-version.h>
+#include <modbus.h>
+
+#include "libtac1100.h"
+#include "tac1100regs.h"
+
+#define RTU_ADU_MAX  256        // ModBus RTU frame: unit, function, 252 bytes of data, CRC
+#define RTU_REQ_LEN  8          // Read request: unit, function, address, count, CRC
+#define RTU_WRITE_LEN 11        // Write of one register: read request, byte count, value
+#define FC_WRITE     0x10       // Write Multiple Registers
+#define MAX_UNITS    248        // ModBus unit addresses, 0 (broadcast) to 247
+
+const regdef_t tac1100_regs[NUM_REGS] = {
+    { VOLTAGE,   FC_INPUT,   2, REG_FLOAT,  GRP_VI,     "Voltage",                       "V",       "V",   "V"    },
+    { CURRENT,   FC_INPUT,   2, REG_FLOAT,  GRP_VI,     "Current",                       "A",       "C",   "A"    },
+    { POWER,     FC_INPUT,   2, REG_FLOAT,  GRP_POWER,  "Power",                         "W",       "P",   "W"    },
+    { RAPOWER,   FC_INPUT,   2, REG_FLOAT,  GRP_POWER,  "Apparent Power",                "VA",      "VA",  "VA"   },
+    { APOWER,    FC_INPUT,   2, REG_FLOAT,  GRP_POWER,  "Reactive Power",                "VAR",     "VAR", "VAR"  },
+    { PFACTOR,   FC_INPUT,   2, REG_FLOAT,  GRP_VI,     "Power Factor",                  "",        "PF",  "F"    },
+    { PANGLE,    FC_INPUT,   2, REG_FLOAT,  GRP_VI,     "Phase Angle",                   "Degree",  "PA",  "Dg"   },
+    { FREQUENCY, FC_INPUT,   2, REG_FLOAT,  GRP_VI,     "Frequency",                     "Hz",      "F",   "Hz"   },
+    { IAENERGY,  FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Import Active Energy",          "Wh",      "IE",  "Wh"   },
+    { EAENERGY,  FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Export Active Energy",          "Wh",      "EE",  "Wh"   },
+    { TAENERGY,  FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Total Active Energy",           "Wh",      "TE",  "Wh"   },
+    { IRAENERGY, FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Import Reactive Energy",        "VARh",    "IRE", "VARh" },
+    { ERAENERGY, FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Export Reactive Energy",        "VARh",    "ERE", "VARh" },
+    { TRENERGY,  FC_INPUT,   2, REG_ENERGY, GRP_ENERGY, "Total Reactive Energy",         "VARh",    "TRE", "VARh" },
+    { TIME_DISP, FC_HOLDING, 1, REG_UINT,   GRP_CONFIG, "Automatic scroll display time", "seconds", NULL,  NULL   },
+};
+
+struct tac1100 {
+    char *device;
+    tac1100_config_t cfg;
+    modbus_t *mb;
+    unsigned long pid;
+    char *lck_file;             // TAC1100_LOCK_PREFIX + port name
+    char *lck_file_new;         // Lock file being created: lck_file.PID
+    FILE *excl;                 // Lock file open with LOCK_EX while using the bus
+    int fd;                     // Serial port (TAC1100_LOCK_FD)
+    int fd_locked;
+    unsigned int seed;          // rand_r() state
+    int err;                    // errno of the last failure
+    long long read_time_us;     // Midpoint of the last successful request/response
+    tac1100_lockstats_t lock_stats;
+    tac1100_log_fn log;
+    void *log_user;
+    tac1100_xfer_fn xfer;
+    void *xfer_user;
+    uint8_t tx[RTU_REQ_LEN];    // Native RTU codec (native_rtu): request built in place
+    uint8_t rx[RTU_ADU_MAX];    // and the response, decoded from here
+    int rx_len;
+    int rx_stale;               // Last response given up: late bytes may follow
+    char *arb_path;             // TAC1100_LOCK_ARB: arbiter socket
+    int arb_fd;                 // Connection to the arbiter, -1 if none
+    char arb_in[128];           // Lines from the arbiter not handled yet
+    int arb_len;
+    int arb_granted;            // Our turn on the bus
+    long arb_lease_ms;          // Lease of the turn
+    long long arb_lease_end;    // as granted or renewed (us)
+    tac1100_recovery_t recovery;
+    int recover_tier;           // Last tac1100_recover() waiting for a good transaction, -1 if none
+    tac1100_health_t health[MAX_UNITS];
+    int probing;                // Request in progress is a probe: one attempt, probe_timeout_us
+};
+
+static void clrSerLock(tac1100_t *t, unsigned long PID);
+static void exclusiveDone(tac1100_t *t, long long tStart);
+
+/*--------------------------------------------------------------------------
+    tac1100_now_us
+    CLOCK_MONOTONIC in microseconds
+----------------------------------------------------------------------------*/
+long long tac1100_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void logMsg(tac1100_t *t, int level, const char *format, ...)
+{
+    va_list ap;
+
+    if (t->log == NULL) return;
+    va_start(ap, format);
+    t->log(t->log_user, level, format, ap);
+    va_end(ap);
+}
+
+/*--------------------------------------------------------------------------
+    rndSleep
+    Sleep 1 to 10 times usecs
+----------------------------------------------------------------------------*/
+static void rndSleep(tac1100_t *t, useconds_t usecs)
+{
+    unsigned long rnd10 = 10.0*rand_r(&t->seed)/(RAND_MAX+1.0) + 1;
+    usleep(usecs*rnd10);
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_pid_command
+    First string of /proc/PID/cmdline (allocated), NULL if not running
+----------------------------------------------------------------------------*/
+char *tac1100_pid_command(unsigned long PID)
+{
+    int fdcmd;
+    ssize_t length;
+    char buffer[1024];
+    char cmdFilename[40];
+
+    snprintf(cmdFilename, sizeof(cmdFilename), "/proc/%lu/cmdline", PID);
+    if ((fdcmd = open(cmdFilename, O_RDONLY)) < 0) return NULL;
+    length = read(fdcmd, buffer, sizeof(buffer) - 1);
+    close(fdcmd);
+    if (length <= 0) return NULL;
+
+    // read does not NUL-terminate the buffer, so do it here
+    buffer[length] = '\0';
+    return strdup(buffer);
+}
+
+/*--------------------------------------------------------------------------
+    Configuration and context
+----------------------------------------------------------------------------*/
+void tac1100_config_init(tac1100_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->baud_rate = 9600;
+    cfg->parity = 'N';
+    cfg->stop_bits = 0;
+    cfg->resp_timeout_us = 200000;
+    cfg->byte_timeout_us = -1;
+    cfg->retries = 1;
+    cfg->max_gap = 16;
+    cfg->lock_mode = TAC1100_LOCK_UUCP;
+    cfg->breaker_probe = 10;
+}
+
+tac1100_t *tac1100_new(const char *device, const tac1100_config_t *cfg)
+{
+    tac1100_t *t;
+
+    if (device == NULL || cfg == NULL) return NULL;
+    if ((t = calloc(1, sizeof(*t))) == NULL) return NULL;
+    if ((t->device = strdup(device)) == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->cfg = *cfg;
+    if (t->cfg.retries < 1) t->cfg.retries = 1;
+    if (cfg->arb_socket != NULL && (t->arb_path = strdup(cfg->arb_socket)) == NULL) {
+        free(t->device);
+        free(t);
+        return NULL;
+    }
+    t->cfg.arb_socket = t->arb_path;
+    t->pid = getpid();
+    t->fd = -1;
+    t->arb_fd = -1;
+    t->recover_tier = -1;
+    t->seed = t->pid ^ time(NULL) ^ (unsigned long)t;
+    return t;
+}
+
+void tac1100_free(tac1100_t *t)
+{
+    if (t == NULL) return;
+    tac1100_close(t);
+    free(t->lck_file);
+    free(t->lck_file_new);
+    free(t->arb_path);
+    free(t->device);
+    free(t);
+}
+
+void tac1100_set_log(tac1100_t *t, tac1100_log_fn fn, void *user)
+{
+    t->log = fn;
+    t->log_user = user;
+}
+
+void tac1100_set_xfer_hook(tac1100_t *t, tac1100_xfer_fn fn, void *user)
+{
+    t->xfer = fn;
+    t->xfer_user = user;
+}
+
+void tac1100_set_retries(tac1100_t *t, int retries)
+{
+    t->cfg.retries = retries < 1 ? 1 : retries;
+}
+
+int tac1100_errno(const tac1100_t *t)
+{
+    return t->err;
+}
+
+long long tac1100_read_time(const tac1100_t *t)
+{
+    return t->read_time_us;
+}
+
+const tac1100_lockstats_t *tac1100_lock_stats(const tac1100_t *t)
+{
+    return &t->lock_stats;
+}
+
+const char *tac1100_strerror(int code)
+{
+    switch (code) {
+        case TAC1100_OK:        return "Success";
+        case TAC1100_EINVAL:    return "Invalid argument";
+        case TAC1100_ENOMEM:    return "Out of memory";
+        case TAC1100_ELOCK:     return "Serial port locked by another process";
+        case TAC1100_ELOCKFILE: return "Serial port lock error";
+        case TAC1100_ECONNECT:  return "Can't open the serial port";
+        case TAC1100_EBUS:      return "ModBus request failed";
+        case TAC1100_EOPEN:     return "Meter skipped, circuit breaker open";
+    }
+    return "Unknown error";
+}
+
+/*--------------------------------------------------------------------------
+    Bus arbiter client
+    TAC1100_LOCK_ARB: reference client of the protocol of tools/tac1100arb
+    (README "Bus Arbiter"). A turn is asked for with the time it is
+    expected to last and granted as a lease: renewed by a heartbeat at half
+    of it, ended early when less than a transaction is left (the client
+    queues again), revoked by the arbiter when overstayed.
+----------------------------------------------------------------------------*/
+static int arbSend(tac1100_t *t, const char *line)
+{
+    size_t len = strlen(line);
+
+    if (send(t->arb_fd, line, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter %s: (%d) %s", t->arb_path, t->err, strerror(t->err));
+        return -1;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    arbLine
+    Next line from the arbiter, waiting until deadline (-1: forever, 0:
+    only what is there): 1, 0 when none came, -1 when the arbiter is gone
+----------------------------------------------------------------------------*/
+static int arbLine(tac1100_t *t, char *line, size_t size, long long deadline)
+{
+    struct pollfd pfd;
+    char *nl;
+    long long now;
+    ssize_t n;
+    int rc;
+
+    for (;;) {
+        if ((nl = memchr(t->arb_in, '\n', t->arb_len)) != NULL) {
+            n = nl - t->arb_in;
+            snprintf(line, size, "%.*s", (int)n, t->arb_in);
+            t->arb_len -= n + 1;
+            memmove(t->arb_in, nl + 1, t->arb_len);
+            return 1;
+        }
+        if (t->arb_len == (int)sizeof(t->arb_in)) {
+            t->err = EPROTO;
+            return -1;
+        }
+        now = tac1100_now_us();
+        pfd.fd = t->arb_fd;
+        pfd.events = POLLIN;
+        rc = poll(&pfd, 1, deadline < 0 ? -1 : deadline <= now ? 0 : (int)((deadline - now + 999) / 1000));
+        if (rc == -1 && errno == EINTR) continue;
+        if (rc == 0) return 0;
+        n = rc == -1 ? -1 : read(t->arb_fd, t->arb_in + t->arb_len, sizeof(t->arb_in) - t->arb_len);
+        if (n <= 0) {
+            t->err = n == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        t->arb_len += n;
+    }
+}
+
+static void arbClose(tac1100_t *t)
+{
+    if (t->arb_fd < 0) return;
+    close(t->arb_fd);
+    t->arb_fd = -1;
+    t->arb_len = 0;
+    t->arb_granted = 0;
+}
+
+/*--------------------------------------------------------------------------
+    arbEvent
+    Turn state from a line of the arbiter: 1 for a GRANT, LEASE or QUEUED
+    (the answers awaited), -1 for an ERR, else 0
+----------------------------------------------------------------------------*/
+static int arbEvent(tac1100_t *t, const char *line)
+{
+    long ms;
+    int pos;
+
+    if (sscanf(line, "GRANT %ld", &ms) == 1) {
+        t->arb_granted = 1;
+        t->arb_lease_ms = ms;
+        t->arb_lease_end = tac1100_now_us() + ms * 1000LL;
+        return 1;
+    }
+    if (sscanf(line, "LEASE %ld", &ms) == 1) {
+        t->arb_lease_end = tac1100_now_us() + ms * 1000LL;
+        return 1;
+    }
+    if (sscanf(line, "QUEUED %d %ld", &pos, &ms) == 2) {
+        logMsg(t, TAC1100_LOG_DEBUG, "Bus arbiter: waiting, position %d, expected %ldms", pos, ms);
+        return 1;
+    }
+    if (strcmp(line, "REVOKE") == 0) {
+        logMsg(t, TAC1100_LOG_NOTICE, "Bus arbiter revoked the turn of %lu", t->pid);
+        t->arb_granted = 0;
+        return 0;
+    }
+    if (strncmp(line, "ERR", 3) == 0) {
+        logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter: %s", line);
+        return -1;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    arbConnect
+    Connect to the arbiter of the port and introduce ourselves
+----------------------------------------------------------------------------*/
+static int arbConnect(tac1100_t *t)
+{
+    struct sockaddr_un sa;
+    char line[128];
+    char *COMMAND;
+    const char *pos;
+    int version = 0;
+
+    if (t->arb_fd >= 0) return TAC1100_OK;
+    if (t->arb_path == NULL) {
+        pos = strrchr(t->device, '/');
+        pos = pos == NULL ? t->device : pos + 1;
+        if ((t->arb_path = malloc(strlen(TAC1100_ARB_PREFIX) + strlen(pos) + 1)) == NULL) return TAC1100_ENOMEM;
+        sprintf(t->arb_path, "%s%s", TAC1100_ARB_PREFIX, pos);
+        t->cfg.arb_socket = t->arb_path;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(t->arb_path) >= sizeof(sa.sun_path)) {
+        logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter socket path too long: %s", t->arb_path);
+        return TAC1100_EINVAL;
+    }
+    strcpy(sa.sun_path, t->arb_path);
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Connecting to bus arbiter %s...", t->arb_path);
+    if ((t->arb_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+        connect(t->arb_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_ERROR, "No bus arbiter on %s: (%d) %s", t->arb_path, t->err, strerror(t->err));
+        if (t->arb_fd >= 0) close(t->arb_fd);
+        t->arb_fd = -1;
+        return TAC1100_ELOCKFILE;
+    }
+    COMMAND = tac1100_pid_command(t->pid);
+    pos = COMMAND != NULL && strrchr(COMMAND, '/') != NULL ? strrchr(COMMAND, '/') + 1 : COMMAND;
+    snprintf(line, sizeof(line), "HELLO %lu %.31s\n", t->pid, pos != NULL && *pos ? pos : "-");
+    free(COMMAND);
+    if (arbSend(t, line) == -1 || arbLine(t, line, sizeof(line), tac1100_now_us() + 2000000LL) != 1 ||
+        sscanf(line, "OK %d", &version) != 1) {
+        if (t->err == 0) t->err = EPROTO;
+        logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter %s didn't answer", t->arb_path);
+        arbClose(t);
+        return TAC1100_ELOCKFILE;
+    }
+    logMsg(t, TAC1100_LOG_DEBUG, "Bus arbiter protocol %d", version);
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    arbAcquire
+    Queue for a turn and wait for it, at most lock_wait seconds (forever
+    with 0). Giving up closes the connection: the arbiter drops our request.
+----------------------------------------------------------------------------*/
+static int arbAcquire(tac1100_t *t)
+{
+    const tac1100_config_t *c = &t->cfg;
+    long long tStart, deadline;
+    char line[128];
+    long hold;
+    int rc;
+
+    if ((rc = arbConnect(t)) != TAC1100_OK) return rc;
+    if (t->arb_granted) return TAC1100_OK;
+
+    hold = c->arb_hold_ms > 0 ? c->arb_hold_ms : 4 * c->retries * (c->resp_timeout_us + c->command_delay_us) / 1000;
+    if (hold < 1) hold = 1;
+    logMsg(t, TAC1100_LOG_DEBUG, "Asking the bus arbiter for a %ldms turn...", hold);
+    tStart = tac1100_now_us();
+    deadline = c->lock_wait > 0 ? tStart + c->lock_wait * 1000000LL : -1;
+    snprintf(line, sizeof(line), "REQ %ld\n", hold);
+    if (arbSend(t, line) == -1) {
+        arbClose(t);
+        return TAC1100_ELOCKFILE;
+    }
+    while (!t->arb_granted) {
+        if ((rc = arbLine(t, line, sizeof(line), deadline)) == 1) rc = arbEvent(t, line) == -1 ? -1 : 1;
+        if (rc == 0) {
+            logMsg(t, TAC1100_LOG_ERROR, "Unable to get a bus turn for %lu in %ds.", t->pid, c->lock_wait);
+            arbClose(t);
+            return TAC1100_ELOCK;
+        }
+        if (rc == -1) {
+            if (t->err == 0) t->err = EPROTO;
+            logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter %s lost: (%d) %s", t->arb_path, t->err, strerror(t->err));
+            arbClose(t);
+            return TAC1100_ELOCKFILE;
+        }
+    }
+    exclusiveDone(t, tStart);
+    logMsg(t, TAC1100_LOG_DEBUG, "Bus turn of %ldms granted in %lldus. Ready for ModBus communication.",
+           t->arb_lease_ms, t->lock_stats.exclusive_us);
+    return TAC1100_OK;
+}
+
+static void arbRelease(tac1100_t *t)
+{
+    if (t->arb_fd < 0 || !t->arb_granted) return;
+    logMsg(t, TAC1100_LOG_DEBUG, "Ending bus turn...");
+    t->arb_granted = 0;
+    if (arbSend(t, "REL\n") == -1) arbClose(t);
+}
+
+/*--------------------------------------------------------------------------
+    arbTurn
+    Before every transaction: still our turn, with time left for the
+    transaction? Renew the lease at half of it; when it can't be renewed
+    (others are waiting) and a transaction would overrun it, end the turn
+    and queue for the next one.
+----------------------------------------------------------------------------*/
+static int arbTurn(tac1100_t *t)
+{
+    long long xfer_us = t->cfg.resp_timeout_us + t->cfg.command_delay_us;
+    char line[128];
+    int rc = 0;
+
+    if (t->cfg.lock_mode != TAC1100_LOCK_ARB) return TAC1100_OK;
+    while (t->arb_fd >= 0 && (rc = arbLine(t, line, sizeof(line), 0)) == 1) arbEvent(t, line);
+    if (t->arb_fd >= 0 && rc == -1) {
+        logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter %s lost: (%d) %s", t->arb_path, t->err, strerror(t->err));
+        arbClose(t);
+        return TAC1100_ELOCKFILE;
+    }
+    if (!t->arb_granted) return arbAcquire(t);
+
+    if (t->arb_lease_end - tac1100_now_us() < t->arb_lease_ms * 500LL) {
+        if (arbSend(t, "HB\n") == -1) {
+            arbClose(t);
+            return TAC1100_ELOCKFILE;
+        }
+        while ((rc = arbLine(t, line, sizeof(line), tac1100_now_us() + 1000000LL)) == 1) {
+            if (arbEvent(t, line) != 0 || !t->arb_granted) break;
+        }
+        if (rc != 1) {
+            logMsg(t, TAC1100_LOG_ERROR, "Bus arbiter %s didn't answer the heartbeat", t->arb_path);
+            arbClose(t);
+            return TAC1100_ELOCKFILE;
+        }
+        if (!t->arb_granted) return arbAcquire(t);
+    }
+    if (t->arb_lease_end - tac1100_now_us() < xfer_us) {
+        logMsg(t, TAC1100_LOG_DEBUG, "Bus turn over, queueing for the next one");
+        arbRelease(t);
+        return arbAcquire(t);
+    }
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    Exclusive bus lock
+    Lock file mode: LOCK_EX on the lock file, upgraded from the shared
+    access of the lock file protocol. Fd mode: LOCK_EX on a descriptor of
+    the serial port of our own.
+----------------------------------------------------------------------------*/
+static void unlockBusFd(tac1100_t *t)
+{
+    if (!t->fd_locked) return;
+    logMsg(t, TAC1100_LOG_DEBUG, "Unlocking serial port...");
+    flock(t->fd, LOCK_UN);
+    t->fd_locked = 0;
+}
+
+void tac1100_release(tac1100_t *t)
+{
+    arbRelease(t);
+    unlockBusFd(t);
+    if (t->excl != NULL) {
+        logMsg(t, TAC1100_LOG_DEBUG, "Releasing exclusive ModBus lock...");
+        fclose(t->excl);
+        t->excl = NULL;
+    }
+}
+
+static void exclusiveDone(tac1100_t *t, long long tStart)
+{
+    tac1100_lockstats_t *ls = &t->lock_stats;
+
+    ls->exclusive_us = tac1100_now_us() - tStart;
+    ls->exclusive_count++;
+    ls->exclusive_sum_us += ls->exclusive_us;
+    if (ls->exclusive_us > ls->exclusive_max_us) ls->exclusive_max_us = ls->exclusive_us;
+}
+
+/*--------------------------------------------------------------------------
+    lockBusFd
+    TAC1100_LOCK_FD: exclusive flock() on the serial port itself, waiting at
+    most lock_wait seconds (forever with 0, as for the lock file). The
+    bounded wait polls: an alarm() would not be thread safe. No TIOCEXCL:
+    a second opener would fail with EBUSY instead of waiting its turn.
+----------------------------------------------------------------------------*/
+static int lockBusFd(tac1100_t *t)
+{
+    long long tStart, deadline;
+    int rc;
+
+    if (t->fd_locked || t->fd < 0) return TAC1100_OK;
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Locking serial port for ModBus communication...");
+    tStart = tac1100_now_us();
+    if (t->cfg.lock_wait > 0) {
+        deadline = tStart + t->cfg.lock_wait * 1000000LL;
+        while ((rc = flock(t->fd, LOCK_EX | LOCK_NB)) != 0 && errno == EWOULDBLOCK && tac1100_now_us() < deadline) {
+            usleep(1000);
+        }
+    } else {
+        rc = flock(t->fd, LOCK_EX);
+    }
+    if (rc != 0) {
+        t->err = errno;
+        if (t->err == EWOULDBLOCK) {
+            logMsg(t, TAC1100_LOG_ERROR, "Unable to lock serial port for %lu in %ds.", t->pid, t->cfg.lock_wait);
+            return TAC1100_ELOCK;
+        }
+        logMsg(t, TAC1100_LOG_ERROR, "Failed to lock serial port: (%d) %s", t->err, strerror(t->err));
+        return TAC1100_ELOCKFILE;
+    }
+    t->fd_locked = 1;
+    exclusiveDone(t, tStart);
+    logMsg(t, TAC1100_LOG_DEBUG, "Serial port locked in %lldus. Ready for ModBus communication.", t->lock_stats.exclusive_us);
+    return TAC1100_OK;
+}
+
+int tac1100_acquire(tac1100_t *t)
+{
+    long long tStart;
+
+    if (t->cfg.lock_mode == TAC1100_LOCK_FD) return lockBusFd(t);
+    if (t->cfg.lock_mode == TAC1100_LOCK_ARB) return arbAcquire(t);
+    if (t->cfg.lock_mode != TAC1100_LOCK_UUCP || t->lck_file == NULL || t->excl != NULL) return TAC1100_OK;
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Upgrading to exclusive lock for ModBus communication...");
+    tStart = tac1100_now_us();
+    t->excl = fopen(t->lck_file, "r");
+    if (t->excl == NULL) {
+        // As before the library: go on with the shared access only
+        logMsg(t, TAC1100_LOG_ERROR, "Failed to open lock file for exclusive access");
+        return TAC1100_OK;
+    }
+    if (flock(fileno(t->excl), LOCK_EX) != 0) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_ERROR, "Failed to acquire exclusive lock: (%d) %s", t->err, strerror(t->err));
+        fclose(t->excl);
+        t->excl = NULL;
+        return TAC1100_ELOCKFILE;
+    }
+    exclusiveDone(t, tStart);
+    logMsg(t, TAC1100_LOG_DEBUG, "Exclusive lock acquired in %lldus. Ready for ModBus communication.", t->lock_stats.exclusive_us);
+    // Keep this file open during all ModBus operations
+    // It will be closed by tac1100_release() or tac1100_close()
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    clrSerLock
+    Remove the lock file if PID holds it
+----------------------------------------------------------------------------*/
+static void clrSerLock(tac1100_t *t, unsigned long PID)
+{
+    FILE *fdserlck;
+    unsigned long LckPID;
+    char *COMMAND = NULL;
+    int fLen = 0;
+    int curChar = 0;
+
+    // Always release exclusive ModBus lock before clearing serial lock
+    tac1100_release(t);
+
+    if (t->lck_file == NULL) return;
+
+    if ((fdserlck = fopen(t->lck_file, "r")) == NULL) {
+        logMsg(t, TAC1100_LOG_NOTICE, "ClrSerLock(): can't open lock file: %s for read.", t->lck_file);
+        return;
+    }
+
+    // Acquire exclusive lock before clearing - wait for all shared locks to release
+    // Note: During normal operation, we use LOCK_SH (shared lock) which allows
+    // multiple processes to access the serial port. This works well when processes
+    // communicate with different ModBus addresses. However, if multiple instances
+    // try to communicate simultaneously (even with the same address), there's a small
+    // chance of bus collisions. Use -z option for retries to handle this gracefully.
+    logMsg(t, TAC1100_LOG_DEBUG, "Acquiring exclusive lock on %s to clear...", t->lck_file);
+    flock(fileno(fdserlck), LOCK_EX);   // Will wait to acquire lock then continue
+    logMsg(t, TAC1100_LOG_DEBUG, "Exclusive lock on %s acquired.", t->lck_file);
+
+    while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n' && curChar != ' ') fLen++;
+    fLen = 0;
+    if (curChar == ' ') while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n') fLen++;
+
+    rewind(fdserlck);
+
+    if ((COMMAND = calloc(fLen+1, 1)) == NULL) {
+        fclose(fdserlck);
+        return;
+    }
+    LckPID = 0;
+
+    int bRead = fscanf(fdserlck, "%lu%*[ ]%[^\n]\n", &LckPID, COMMAND);
+
+    if (bRead != EOF && LckPID > 0) {
+        if (LckPID != PID) {
+            logMsg(t, TAC1100_LOG_NOTICE, "Lock held by process (%lu)%s, can't clear for process (%lu)", LckPID, COMMAND, PID);
+            fclose(fdserlck);  // Release exclusive lock
+            free(COMMAND);
+            return;
+        }
+    }
+
+    // Keep file open with exclusive lock while deleting to prevent race conditions
+    if (unlink(t->lck_file_new) != 0 && errno != ENOENT) {
+        logMsg(t, TAC1100_LOG_SYSLOG, "ClrSerLock(): unlink(%s): (%d) %s", t->lck_file_new, errno, strerror(errno));
+    }
+
+    if (PID == LckPID && unlink(t->lck_file) == -1) {
+        logMsg(t, TAC1100_LOG_SYSLOG, "ClrSerLock(): unlink(%s): (%d) %s", t->lck_file, errno, strerror(errno));
+    }
+
+    logMsg(t, TAC1100_LOG_DEBUG, "ClrSerLock(%lu) removed lock file: %s", PID, t->lck_file);
+
+    fclose(fdserlck);  // This also releases the exclusive lock
+    free(COMMAND);
+}
+
+/*--------------------------------------------------------------------------
+    addSerLock
+    Create lck_file.PID with "PID COMMAND" and link it to lck_file
+----------------------------------------------------------------------------*/
+static int addSerLock(tac1100_t *t, const char *COMMAND)
+{
+    int fddevlock = -1;
+    int retry = 0;
+    char PIDstr[24];
+
+    snprintf(PIDstr, sizeof(PIDstr), "%lu", t->pid);
+
+    while (retry < 3) {
+        if ((fddevlock = open(t->lck_file_new, O_WRONLY | O_CREAT | O_EXCL, 0644)) > 0) break;
+
+        if (errno == EEXIST) {
+            logMsg(t, TAC1100_LOG_DEBUG, "AddSerLock(): lock file exists: %s, retry %d", t->lck_file_new, retry);
+            rndSleep(t, 25000);
+            retry++;
+        } else {
+            t->err = errno;
+            logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): open(%s): (%d) %s", t->lck_file_new, t->err, strerror(t->err));
+            return TAC1100_ELOCKFILE;
+        }
+    }
+
+    if (retry >= 3) {
+        t->err = EEXIST;
+        logMsg(t, TAC1100_LOG_ERROR, "AddSerLock(): Unable to create lock file %s after %d retries", t->lck_file_new, retry);
+        return TAC1100_ELOCKFILE;
+    }
+
+    if (write(fddevlock, PIDstr, strlen(PIDstr)) != (ssize_t)strlen(PIDstr)) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): write(): (%d) %s", t->err, strerror(t->err));
+        close(fddevlock);
+        return TAC1100_ELOCKFILE;
+    }
+
+    if (COMMAND != NULL && strlen(COMMAND) > 0) {
+        if (write(fddevlock, " ", 1) != 1 ||
+            write(fddevlock, COMMAND, strlen(COMMAND)) != (ssize_t)strlen(COMMAND)) {
+            logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): write(command): (%d) %s", errno, strerror(errno));
+        }
+    }
+
+    if (write(fddevlock, "\n", 1) != 1) {
+        logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): write(newline): (%d) %s", errno, strerror(errno));
+    }
+
+    close(fddevlock);
+
+    if (link(t->lck_file_new, t->lck_file) == -1) {
+        if (errno != EEXIST) {
+            t->err = errno;
+            logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): link(%s, %s): (%d) %s", t->lck_file_new, t->lck_file, t->err, strerror(t->err));
+            return TAC1100_ELOCKFILE;
+        }
+    }
+
+    if (unlink(t->lck_file_new) == -1) {
+        logMsg(t, TAC1100_LOG_SYSLOG, "AddSerLock(): unlink(%s): (%d) %s", t->lck_file_new, errno, strerror(errno));
+    }
+
+    logMsg(t, TAC1100_LOG_DEBUG, "AddSerLock(%lu) to %s", t->pid, t->lck_file);
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_lock_port
+    Lock file protocol shared with sdm120c, aurora...: add our lock file,
+    then wait (at most lock_wait seconds) until it is ours or held by a
+    compatible ModBus client, clearing stale ones, and finally upgrade to
+    the exclusive bus lock
+----------------------------------------------------------------------------*/
+int tac1100_lock_port(tac1100_t *t)
+{
+    tac1100_lockstats_t *ls = &t->lock_stats;
+    const char *pos;
+    FILE *fdserlck = NULL;
+    char *COMMAND = NULL;
+    unsigned long LckPID;
+    unsigned long PID = t->pid;
+    long long tLockStart, tLockNow, tShared;
+    int bRead;
+    int errno_save = 0;
+    int fLen = 0;
+    int curChar = 0;
+    int rc = TAC1100_OK;
+    char *LckCOMMAND = NULL;
+    char *LckPIDcommand = NULL;
+
+    if (t->cfg.lock_mode == TAC1100_LOCK_ARB) return tac1100_acquire(t);
+    if (t->cfg.lock_mode != TAC1100_LOCK_UUCP || t->lck_file != NULL) return TAC1100_OK;
+
+    pos = strrchr(t->device, '/');
+    if (pos == NULL) {
+        logMsg(t, TAC1100_LOG_ERROR, "Can't lock %s: not a device path", t->device);
+        return TAC1100_EINVAL;
+    }
+    pos++;
+    t->lck_file = malloc(strlen(TAC1100_LOCK_PREFIX) + strlen(pos) + 1);
+    t->lck_file_new = malloc(strlen(TAC1100_LOCK_PREFIX) + strlen(pos) + 24);  /* dot, PID & terminator */
+    if (t->lck_file == NULL || t->lck_file_new == NULL) {
+        free(t->lck_file);
+        free(t->lck_file_new);
+        t->lck_file = t->lck_file_new = NULL;
+        return TAC1100_ENOMEM;
+    }
+    sprintf(t->lck_file, "%s%s", TAC1100_LOCK_PREFIX, pos);
+    sprintf(t->lck_file_new, "%s.%lu", t->lck_file, PID);
+
+    logMsg(t, TAC1100_LOG_DEBUG, "szttyDevice: %s", t->device);
+    logMsg(t, TAC1100_LOG_DEBUG, "devLCKfile: <%s>", t->lck_file);
+    logMsg(t, TAC1100_LOG_DEBUG, "devLCKfileNew: <%s>", t->lck_file_new);
+    logMsg(t, TAC1100_LOG_DEBUG, "PID: %lu", PID);
+
+    tLockStart = tac1100_now_us();
+    COMMAND = tac1100_pid_command(PID);
+    if ((rc = addSerLock(t, COMMAND)) != TAC1100_OK) {
+        free(COMMAND);
+        goto fail;
+    }
+    ls->add_us = tac1100_now_us() - tLockStart;
+
+    LckPID = 0;
+    unsigned long oldLckPID = 0;
+    int staleLockRetries = 0;
+    int const staleLockRetriesMax = 2;
+    unsigned long clrStaleTargetPID = 0;
+    int missingPidRetries = 0;
+    int const missingPidRetriesMax = 2;
+    int totalLockAttempts = 0;
+    int const maxLockAttempts = 100; // Prevent infinite loop
+
+    tLockStart = tac1100_now_us();
+    tLockNow = tLockStart;
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Checking for lock");
+    while(LckPID != PID && tLockNow - tLockStart <= t->cfg.lock_wait*1000000LL) {
+
+        totalLockAttempts++;
+        ls->checks++;
+        if (totalLockAttempts > maxLockAttempts) {
+            logMsg(t, TAC1100_LOG_ERROR, "Exceeded maximum lock attempts (%d). Lock file may be corrupted: %s", maxLockAttempts, t->lck_file);
+            logMsg(t, TAC1100_LOG_ERROR, "Try removing the lock file manually: sudo rm -f %s", t->lck_file);
+            rc = TAC1100_ELOCKFILE;
+            break;
+        }
+
+        tShared = tac1100_now_us();
+        do {
+            fdserlck = fopen(t->lck_file, "r");
+            if (fdserlck == NULL) {
+                t->err = errno;
+                logMsg(t, TAC1100_LOG_NOTICE, "Problem locking serial device, can't open lock file: %s for read.", t->lck_file);
+                rc = TAC1100_ELOCKFILE;
+                break;
+            }
+            errno = 0;
+            if (flock(fileno(fdserlck), LOCK_SH | LOCK_NB) == 0) break;      // Lock Acquired
+            errno_save=errno;
+
+            if (errno_save == EWOULDBLOCK) {
+                ls->shared_retries++;
+                logMsg(t, TAC1100_LOG_DEBUG, "Would block %s, retry (%d) %s...", t->lck_file, errno_save, strerror(errno_save));
+                rndSleep(t, 25000);
+                fclose(fdserlck);
+            } else {
+                t->err = errno_save;
+                logMsg(t, TAC1100_LOG_ERROR, "Problem locking serial device, can't open lock file: %s for read. (%d) %s", t->lck_file, errno_save, strerror(errno_save));
+                fclose(fdserlck);
+                rc = TAC1100_ELOCKFILE;
+                break;
+            }
+        } while (errno_save == EWOULDBLOCK);
+        if (rc != TAC1100_OK) break;
+        ls->shared_wait_us += tac1100_now_us() - tShared;
+
+        fLen = 0;
+        while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n' && curChar != ' ') fLen++;
+        fLen = 0;
+        if (curChar == ' ') while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n') fLen++;
+
+        rewind(fdserlck);
+
+        if ((LckCOMMAND = calloc(fLen+1, 1)) == NULL) {
+            fclose(fdserlck);
+            rc = TAC1100_ENOMEM;
+            break;
+        }
+        LckPID=0;
+
+        errno = 0;
+        bRead = fscanf(fdserlck, "%lu%*[ ]%[^\n]\n", &LckPID, LckCOMMAND);
+        errno_save = errno;
+        fclose(fdserlck);
+        if (LckPID != oldLckPID) {
+            logMsg(t, bRead==EOF || errno_save != 0 ? TAC1100_LOG_NOTICE : TAC1100_LOG_DEBUG, "errno=%i, bRead=%i PID=%lu LckPID=%lu", errno_save, bRead, PID, LckPID);
+            logMsg(t, TAC1100_LOG_DEBUG, "Checking process %lu (%s) for lock", LckPID, LckCOMMAND);
+        }
+        if (bRead == EOF || LckPID == 0 || errno_save != 0) {
+            logMsg(t, TAC1100_LOG_NOTICE, "Problem locking serial device, can't read PID from lock file: %s.", t->lck_file);
+            logMsg(t, TAC1100_LOG_NOTICE, "errno=%i, bRead=%i PID=%lu LckPID=%lu", errno_save, bRead, PID, LckPID);
+            if (errno_save != 0) {
+                t->err = errno_save;
+                logMsg(t, TAC1100_LOG_NOTICE, "(%u) %s", errno_save, strerror(errno_save));
+                rc = TAC1100_ELOCKFILE;
+                break;
+            } else {
+                if (missingPidRetries < missingPidRetriesMax) {
+                    missingPidRetries++;
+                    ls->missing_pid++;
+                    logMsg(t, TAC1100_LOG_DEBUG, "%s miss process self PID from lock file?", t->lck_file);
+                    rndSleep(t, 250000); // Wait 250ms before retry
+                } else if (missingPidRetries >= missingPidRetriesMax) {
+                    logMsg(t, TAC1100_LOG_NOTICE, "%s miss process self PID from lock file, amending.", t->lck_file);
+                    if ((rc = addSerLock(t, COMMAND)) != TAC1100_OK) break;
+                    ls->amended++;
+                    missingPidRetries = 0;
+                }
+            }
+            oldLckPID = LckPID;
+        } else { //fread OK
+
+          missingPidRetries = 0;
+
+          LckPIDcommand = tac1100_pid_command(LckPID);
+
+          if (LckPID != PID) {
+              ls->holder_pid = LckPID;
+              snprintf(ls->holder_cmd, sizeof(ls->holder_cmd), "%s", LckPIDcommand ? LckPIDcommand : "");
+          }
+
+          if (LckPID != oldLckPID) {
+              logMsg(t, TAC1100_LOG_DEBUG, "PID: %lu COMMAND: \"%s\" LckPID: %lu LckCOMMAND: \"%s\" LckPIDcommand \"%s\"%s", PID, COMMAND
+                                          , LckPID, LckCOMMAND, LckPIDcommand
+                                          , LckPID == PID ? " = me" : "");
+              oldLckPID = LckPID;
+          }
+
+          if ((PID != LckPID && LckPIDcommand == NULL) || (LckCOMMAND[0]!='\0' && strcmp(LckPIDcommand,LckCOMMAND) != 0) || strcmp(LckPIDcommand,"") == 0) {
+                // Stale lock: process doesn't exist or command mismatch
+                if (staleLockRetries < staleLockRetriesMax) {
+                    staleLockRetries++;
+                    ls->stale_suspects++;
+                    clrStaleTargetPID = LckPID;
+                    logMsg(t, staleLockRetries > 1 ? TAC1100_LOG_NOTICE : TAC1100_LOG_DEBUG, "Stale pid lock(%d)? PID=%lu, LckPID=%lu, LckCOMMAND='%s', LckPIDCommand='%s'", staleLockRetries, PID, LckPID, LckCOMMAND, LckPIDcommand);
+                } else if (LckPID == clrStaleTargetPID && staleLockRetries >= staleLockRetriesMax) {
+                    logMsg(t, TAC1100_LOG_NOTICE, "Clearing stale serial port lock. (%lu)", LckPID);
+                    clrSerLock(t, LckPID);
+                    ls->stale_cleared++;
+                    staleLockRetries = 0;
+                    clrStaleTargetPID = 0;
+                }
+          } else {
+                // Valid lock: process exists and command matches
+                staleLockRetries = 0;
+                clrStaleTargetPID = 0;
+
+                // Check if it's a compatible ModBus client (sdm120c, aurora, tac1100, etc.)
+                if (PID != LckPID && LckPIDcommand != NULL) {
+                    // Lock held by another process - check if it's ModBus compatible
+                    if (strstr(LckPIDcommand, "sdm120") != NULL ||
+                        strstr(LckPIDcommand, "tac1100") != NULL ||
+                        strstr(LckPIDcommand, "aurora") != NULL ||
+                        strstr(LckPIDcommand, "modbus") != NULL) {
+                        // Compatible ModBus client - we can share the bus
+                        logMsg(t, TAC1100_LOG_DEBUG, "Compatible ModBus client detected: %s (PID %lu). Sharing bus.", LckPIDcommand, LckPID);
+                        // Accept this as valid - we have shared lock, exit loop
+                        LckPID = PID;  // Set to our PID to exit the loop
+                    }
+                }
+          }
+        }
+
+        if (t->cfg.lock_wait > 0 && LckPID != PID) {
+             rndSleep(t, 25000);
+        }
+
+        // Cleanup and loop
+        free(LckCOMMAND);
+        free(LckPIDcommand);
+        LckCOMMAND = NULL;
+        LckPIDcommand = NULL;
+
+        tLockNow = tac1100_now_us();
+    }
+
+    free(LckCOMMAND);
+    free(LckPIDcommand);
+    free(COMMAND);
+
+    if (rc == TAC1100_OK && LckPID != PID) {
+        logMsg(t, TAC1100_LOG_ERROR, "Unable to get lock on serial %s for %lu in %ds: still locked by %lu.", t->device, PID, (t->cfg.lock_wait)%30, LckPID);
+        rc = TAC1100_ELOCK;
+    }
+    if (rc != TAC1100_OK) goto fail;
+
+    ls->shared_us = tac1100_now_us() - tLockStart;
+
+    // We have shared lock now. Before opening ModBus connection, upgrade to exclusive lock
+    // to prevent bus collisions when multiple processes communicate simultaneously.
+    if ((rc = tac1100_acquire(t)) != TAC1100_OK) goto fail;
+
+    logMsg(t, TAC1100_LOG_NOTICE, "lockstats add_us=%lld shared_us=%lld shared_wait_us=%lld shared_retries=%lu checks=%lu "
+            "stale_suspects=%lu stale_cleared=%lu missing_pid=%lu amended=%lu holder_pid=%lu holder_cmd=\"%s\" exclusive_us=%lld",
+            ls->add_us, ls->shared_us, ls->shared_wait_us, ls->shared_retries, ls->checks,
+            ls->stale_suspects, ls->stale_cleared, ls->missing_pid, ls->amended,
+            ls->holder_pid, ls->holder_cmd, ls->exclusive_us);
+    return TAC1100_OK;
+
+fail:
+    clrSerLock(t, PID);
+    free(t->lck_file);
+    free(t->lck_file_new);
+    t->lck_file = t->lck_file_new = NULL;
+    return rc;
+}
+
+/*--------------------------------------------------------------------------
+    mbOpen
+    libmodbus context of the port from the configuration, connected (and
+    locked with TAC1100_LOCK_FD)
+----------------------------------------------------------------------------*/
+static int mbOpen(tac1100_t *t)
+{
+    tac1100_config_t *c = &t->cfg;
+    int stop_bits = c->stop_bits;
+    int rc;
+
+    if (stop_bits == 0) {
+        if (c->parity != 'N')
+            stop_bits=1;     // Default if parity != N
+        else
+            stop_bits=2;     // Default if parity == N
+    }
+
+    t->mb = modbus_new_rtu(t->device, c->baud_rate, c->parity, 8, stop_bits);
+    if (t->mb == NULL) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_NOTICE, "Unable to create the libmodbus context");
+        return TAC1100_EINVAL;
+    }
+    logMsg(t, TAC1100_LOG_DEBUG, "Libmodbus context open (%d%c%d)", c->baud_rate, c->parity, stop_bits);
+
+#if LIBMODBUS_VERSION_MAJOR >= 3 && LIBMODBUS_VERSION_MINOR >= 1 && LIBMODBUS_VERSION_MICRO >= 2
+
+    if (c->byte_timeout_us == -1) {
+        modbus_set_byte_timeout(t->mb, -1, 0);
+        logMsg(t, TAC1100_LOG_DEBUG, "Byte timeout disabled.");
+    } else {
+        modbus_set_byte_timeout(t->mb, 0, c->byte_timeout_us);
+        logMsg(t, TAC1100_LOG_DEBUG, "New byte timeout: %ds, %ldus", 0, c->byte_timeout_us);
+    }
+    modbus_set_response_timeout(t->mb, 0, c->resp_timeout_us);
+    logMsg(t, TAC1100_LOG_DEBUG, "New response timeout: %ds, %ldus", 0, c->resp_timeout_us);
+
+#else
+
+    struct timeval timeout;
+
+    if (c->byte_timeout_us == -1) {
+        timeout.tv_sec = -1;
+        timeout.tv_usec = 0;
+        modbus_set_byte_timeout(t->mb, &timeout);
+        logMsg(t, TAC1100_LOG_DEBUG, "Byte timeout disabled.");
+    } else {
+        timeout.tv_sec = 0;
+        timeout.tv_usec = c->byte_timeout_us;
+        modbus_set_byte_timeout(t->mb, &timeout);
+        logMsg(t, TAC1100_LOG_DEBUG, "New byte timeout: %lds, %ldus", (long)timeout.tv_sec, (long)timeout.tv_usec);
+    }
+
+    timeout.tv_sec = 0;
+    timeout.tv_usec = c->resp_timeout_us;
+    modbus_set_response_timeout(t->mb, &timeout);
+    logMsg(t, TAC1100_LOG_DEBUG, "New response timeout: %lds, %ldus", (long)timeout.tv_sec, (long)timeout.tv_usec);
+
+#endif
+
+    modbus_set_error_recovery(t->mb, MODBUS_ERROR_RECOVERY_NONE);
+
+    if (c->settle_us) {
+      // Wait for line settle
+      logMsg(t, TAC1100_LOG_DEBUG, "Sleeping %ldus for line settle...", c->settle_us);
+      usleep(c->settle_us);
+    }
+
+    if (c->trace) {
+        modbus_set_debug(t->mb, 1);
+    }
+
+    // TAC1100_LOCK_FD: the port is ours before modbus_connect() sets it up,
+    // the descriptor doesn't wait for the carrier and outlives reconnects
+    if (c->lock_mode == TAC1100_LOCK_FD) {
+        if ((t->fd = open(t->device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+            t->err = errno;
+            logMsg(t, TAC1100_LOG_ERROR, "Connection failed: (%d) %s", t->err, strerror(t->err));
+            modbus_free(t->mb);
+            t->mb = NULL;
+            return TAC1100_ECONNECT;
+        }
+        if ((rc = tac1100_acquire(t)) != TAC1100_OK) {
+            close(t->fd);
+            t->fd = -1;
+            modbus_free(t->mb);
+            t->mb = NULL;
+            return rc;
+        }
+    }
+
+    if (modbus_connect(t->mb) == -1) {
+        t->err = errno;
+        logMsg(t, TAC1100_LOG_ERROR, "Connection failed: (%d) %s", t->err, modbus_strerror(t->err));
+        modbus_free(t->mb);
+        t->mb = NULL;
+        if (t->fd != -1) {
+            unlockBusFd(t);
+            close(t->fd);
+            t->fd = -1;
+        }
+        return TAC1100_ECONNECT;
+    }
+    t->rx_stale = 1;
+    return TAC1100_OK;
+}
+
+static void mbClose(tac1100_t *t)
+{
+    unlockBusFd(t);
+    modbus_close(t->mb);
+    modbus_free(t->mb);
+    t->mb = NULL;
+    if (t->fd != -1) close(t->fd);
+    t->fd = -1;
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_connect
+----------------------------------------------------------------------------*/
+int tac1100_connect(tac1100_t *t)
+{
+    int rc;
+
+    if (t->mb != NULL) return TAC1100_OK;
+    if ((rc = tac1100_lock_port(t)) != TAC1100_OK) return rc;
+    return mbOpen(t);
+}
+
+void tac1100_close(tac1100_t *t)
+{
+    if (t->mb != NULL) {
+        tac1100_release(t);
+        mbClose(t);
+    }
+    arbClose(t);
+    clrSerLock(t, t->pid);
+}
+
+/*--------------------------------------------------------------------------
+    Recovery
+    In place of closing the context after a failed transaction; the lock
+    file (or arbiter turn) stays ours throughout, the TAC1100_LOCK_FD lock
+    is held while the port is set up again.
+----------------------------------------------------------------------------*/
+static const char *recover_names[TAC1100_RECOVER_TIERS] = { "flush", "reconnect", "reopen" };
+
+/*--------------------------------------------------------------------------
+    lineQuiet
+    Discard what comes in until the line is silent for 3.5 characters
+    (11 bits each, 2ms at least), at most resp_timeout, then flush both
+    directions: late or garbled frames are gone, the next request starts
+    on a frame boundary
+----------------------------------------------------------------------------*/
+static void lineQuiet(tac1100_t *t)
+{
+    long long deadline = tac1100_now_us() + t->cfg.resp_timeout_us;
+    int gap_ms = (38500 / t->cfg.baud_rate) > 2 ? 38500 / t->cfg.baud_rate + 1 : 2;
+    struct pollfd pfd;
+    uint8_t junk[256];
+    long discarded = 0;
+    ssize_t n;
+
+    pfd.fd = modbus_get_socket(t->mb);
+    pfd.events = POLLIN;
+    while (tac1100_now_us() < deadline && poll(&pfd, 1, gap_ms) > 0) {
+        if ((n = read(pfd.fd, junk, sizeof(junk))) <= 0) break;
+        discarded += n;
+    }
+    modbus_flush(t->mb);
+    tcflush(pfd.fd, TCIOFLUSH);
+    t->rx_stale = 0;
+    logMsg(t, TAC1100_LOG_DEBUG, "Line quiet, %ld bytes discarded", discarded);
+}
+
+int tac1100_recover(tac1100_t *t, int tier)
+{
+    tac1100_config_t *c = &t->cfg;
+    int locked = t->fd_locked;
+    int rc = TAC1100_OK;
+
+    if (tier < 0 || tier >= TAC1100_RECOVER_TIERS) return TAC1100_EINVAL;
+    // Nothing left to flush or reconnect after a failed reopen
+    if (t->mb == NULL) {
+        tier = TAC1100_RECOVER_REOPEN;
+        locked = c->lock_mode == TAC1100_LOCK_FD;
+    }
+    t->recovery.count[tier]++;
+    logMsg(t, TAC1100_LOG_NOTICE, "Bus recovery: %s %s", recover_names[tier], t->device);
+
+    if (tier == TAC1100_RECOVER_FLUSH) {
+        lineQuiet(t);
+    } else if (tier == TAC1100_RECOVER_RECONNECT) {
+        // The port is set up again under the TAC1100_LOCK_FD lock only
+        if ((rc = lockBusFd(t)) == TAC1100_OK) {
+            modbus_close(t->mb);
+            if (modbus_connect(t->mb) == -1) {
+                t->err = errno;
+                logMsg(t, TAC1100_LOG_ERROR, "Reconnection failed: (%d) %s", t->err, modbus_strerror(t->err));
+                rc = TAC1100_ECONNECT;
+            } else {
+                if (c->settle_us) usleep(c->settle_us);
+                t->rx_stale = 1;
+            }
+            if (!locked) unlockBusFd(t);
+        }
+    } else {
+        if (t->mb != NULL) mbClose(t);
+        // Takes the TAC1100_LOCK_FD lock: give it back if it wasn't held
+        if ((rc = mbOpen(t)) == TAC1100_OK && !locked) unlockBusFd(t);
+    }
+
+    if (rc != TAC1100_OK) {
+        t->recovery.failed++;
+        t->recover_tier = -1;
+        return rc;
+    }
+    t->recover_tier = tier;
+    return TAC1100_OK;
+}
+
+const tac1100_recovery_t *tac1100_recovery_stats(const tac1100_t *t)
+{
+    return &t->recovery;
+}
+
+/*--------------------------------------------------------------------------
+    Circuit breaker
+    Per meter of the port: cfg.breaker_fails failed requests in a row open
+    it, then the requests to the meter fail at once with TAC1100_EOPEN
+    except one in cfg.breaker_probe, sent once with the probe timeout. A
+    probe answered (an exception too, the meter is alive) closes it: a
+    dead meter costs the bus a short probe now and then instead of the
+    retries of every request.
+----------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------
+    respTimeout
+    Response timeout of the request in progress
+----------------------------------------------------------------------------*/
+static long respTimeout(const tac1100_t *t)
+{
+    return t->probing && t->cfg.probe_timeout_us > 0 ? t->cfg.probe_timeout_us : t->cfg.resp_timeout_us;
+}
+
+/*--------------------------------------------------------------------------
+    probeTimeout
+    Start or end a probe on the libmodbus context
+----------------------------------------------------------------------------*/
+static void probeTimeout(tac1100_t *t, int on)
+{
+    t->probing = on;
+    if (t->mb == NULL || t->cfg.probe_timeout_us <= 0) return;
+#if LIBMODBUS_VERSION_MAJOR >= 3 && LIBMODBUS_VERSION_MINOR >= 1 && LIBMODBUS_VERSION_MICRO >= 2
+    modbus_set_response_timeout(t->mb, 0, respTimeout(t));
+#else
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = respTimeout(t);
+    modbus_set_response_timeout(t->mb, &timeout);
+#endif
+}
+
+/*--------------------------------------------------------------------------
+    breakerAdmit
+    TAC1100_OK to send a request to unit, 1 to send it as a probe,
+    TAC1100_EOPEN to fail it
+----------------------------------------------------------------------------*/
+static int breakerAdmit(tac1100_t *t, int unit)
+{
+    tac1100_health_t *h = &t->health[unit];
+
+    if (t->cfg.breaker_fails <= 0 || h->state == TAC1100_METER_CLOSED) return TAC1100_OK;
+    if (h->next_probe > 0) {
+        h->next_probe--;
+        h->skipped++;
+        return TAC1100_EOPEN;
+    }
+    h->probes++;
+    logMsg(t, TAC1100_LOG_DEBUG, "%s: Unit %d probe %lu", t->device, unit, h->probes);
+    return 1;
+}
+
+/*--------------------------------------------------------------------------
+    breakerResult
+    Outcome of a request to unit after its retries: 0, or the errno of
+    the failure
+----------------------------------------------------------------------------*/
+static void breakerResult(tac1100_t *t, int unit, int err)
+{
+    tac1100_health_t *h = &t->health[unit];
+
+    if (t->cfg.breaker_fails <= 0) return;
+    if (err == 0 || (err >= EMBXILFUN && err <= EMBXGTAR)) {
+        h->fails = 0;
+        if (h->state == TAC1100_METER_OPEN) {
+            h->state = TAC1100_METER_CLOSED;
+            h->closed++;
+            logMsg(t, TAC1100_LOG_NOTICE, "%s: Unit %d back, circuit breaker closed after %lu skipped requests",
+                   t->device, unit, h->skipped);
+            h->since_us = tac1100_now_us();
+        }
+        return;
+    }
+    h->fails++;
+    if (h->state == TAC1100_METER_OPEN) {
+        h->next_probe = t->cfg.breaker_probe - 1;
+    } else if (h->fails >= t->cfg.breaker_fails) {
+        h->state = TAC1100_METER_OPEN;
+        h->opened++;
+        h->next_probe = t->cfg.breaker_probe - 1;
+        logMsg(t, TAC1100_LOG_NOTICE, "%s: Unit %d not answering (%d failures in a row), circuit breaker open",
+               t->device, unit, h->fails);
+        h->since_us = tac1100_now_us();
+    }
+}
+
+const tac1100_health_t *tac1100_health(const tac1100_t *t, int unit)
+{
+    return unit < 0 || unit >= MAX_UNITS ? NULL : &t->health[unit];
+}
+
+void tac1100_probe_next(tac1100_t *t, int unit)
+{
+    if (unit < 0 || unit >= MAX_UNITS || t->health[unit].state != TAC1100_METER_OPEN) return;
+    t->health[unit].next_probe = 0;
+}
+
+/*--------------------------------------------------------------------------
+    recovered
+    A transaction succeeded: credit the recovery before it
+----------------------------------------------------------------------------*/
+static void recovered(tac1100_t *t)
+{
+    if (t->recover_tier < 0) return;
+    t->recovery.recovered[t->recover_tier]++;
+    logMsg(t, TAC1100_LOG_NOTICE, "Bus recovered by %s", recover_names[t->recover_tier]);
+    t->recover_tier = -1;
+}
+
+/*--------------------------------------------------------------------------
+    Native RTU codec
+    Read requests built into a buffer of the context and responses checked
+    and decoded where they were received, with no copy to registers. Used
+    by the engine and, with cfg.native_rtu, by the blocking reads; writes
+    always go through libmodbus.
+----------------------------------------------------------------------------*/
+static uint16_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*--------------------------------------------------------------------------
+    crcInit
+    Tables of the slicing-by-8 CRC: crc_table[0] is the byte at a time
+    table, crc_table[k] the same byte followed by k zero bytes
+----------------------------------------------------------------------------*/
+static void crcInit(void)
+{
+    uint16_t crc;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) crc_table[k][i] = (crc_table[k-1][i] >> 8) ^ crc_table[0][crc_table[k-1][i] & 0xFF];
+    }
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_crc16
+    ModBus CRC-16 (polynomial 0xA001 reflected, init 0xFFFF), 8 bytes per
+    step: the 16 bit CRC only overlaps the first two of them
+----------------------------------------------------------------------------*/
+uint16_t tac1100_crc16(const uint8_t *buf, int len)
+{
+    uint16_t crc = 0xFFFF;
+
+    pthread_once(&crc_once, crcInit);
+    for (; len >= 8; buf += 8, len -= 8) {
+        crc ^= buf[0] | (buf[1] << 8);
+        crc = crc_table[7][crc & 0xFF] ^ crc_table[6][crc >> 8] ^ crc_table[5][buf[2]] ^ crc_table[4][buf[3]] ^
+              crc_table[3][buf[4]] ^ crc_table[2][buf[5]] ^ crc_table[1][buf[6]] ^ crc_table[0][buf[7]];
+    }
+    while (len-- > 0) crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xFF];
+    return crc;
+}
+
+/*--------------------------------------------------------------------------
+    rtuRequest
+    Read request (FC 0x03/0x04) into adu, RTU_REQ_LEN bytes
+----------------------------------------------------------------------------*/
+static void rtuRequest(uint8_t *adu, int unit, int fc, int address, int nb)
+{
+    uint16_t crc;
+
+    adu[0] = unit;
+    adu[1] = fc;
+    adu[2] = address >> 8;
+    adu[3] = address & 0xFF;
+    adu[4] = nb >> 8;
+    adu[5] = nb & 0xFF;
+    crc = tac1100_crc16(adu, 6);
+    adu[6] = crc & 0xFF;
+    adu[7] = crc >> 8;
+}
+
+/*--------------------------------------------------------------------------
+    rtuWriteRequest
+    Write of one register (FC 0x10) into adu, RTU_WRITE_LEN bytes
+----------------------------------------------------------------------------*/
+static void rtuWriteRequest(uint8_t *adu, int unit, int address, int value)
+{
+    uint16_t crc;
+
+    adu[0] = unit;
+    adu[1] = FC_WRITE;
+    adu[2] = address >> 8;
+    adu[3] = address & 0xFF;
+    adu[4] = 0;
+    adu[5] = 1;
+    adu[6] = 2;
+    adu[7] = (value >> 8) & 0xFF;
+    adu[8] = value & 0xFF;
+    crc = tac1100_crc16(adu, 9);
+    adu[9] = crc & 0xFF;
+    adu[10] = crc >> 8;
+}
+
+/*--------------------------------------------------------------------------
+    rtuLength
+    Length of the response to a read of nb registers (8 for a write),
+    known from its first two bytes: 5 for an exception
+----------------------------------------------------------------------------*/
+static int rtuLength(const uint8_t *adu, int len, int fc, int nb)
+{
+    if (len >= 2 && (adu[1] & 0x80)) return 5;
+    return fc == FC_WRITE ? 8 : 5 + 2 * nb;
+}
+
+/*--------------------------------------------------------------------------
+    rtuCheck
+    0 if the complete response answers the request, else the libmodbus
+    error code
+----------------------------------------------------------------------------*/
+static int rtuCheck(const uint8_t *adu, int len, int unit, int fc, int address, int nb)
+{
+    if (tac1100_crc16(adu, len - 2) != (adu[len-2] | (adu[len-1] << 8))) return EMBBADCRC;
+    if (adu[0] != unit || (adu[1] & 0x7F) != fc) return EMBBADDATA;
+    if (adu[1] & 0x80) return MODBUS_ENOBASE + adu[2];
+    // A write echoes its address and count
+    if (fc == FC_WRITE) return ((adu[2] << 8 | adu[3]) == address && (adu[4] << 8 | adu[5]) == nb) ? 0 : EMBBADDATA;
+    if (adu[2] != 2 * nb) return EMBBADDATA;
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    rtuRegisters
+    Registers of a response (data after the byte count) in host order
+----------------------------------------------------------------------------*/
+static void rtuRegisters(const uint8_t *data, int nb, uint16_t *dest)
+{
+    int i;
+
+    for (i = 0; i < nb; i++) dest[i] = (data[2*i] << 8) | data[2*i + 1];
+}
+
+/*--------------------------------------------------------------------------
+    rtuFloat
+    Float of two registers, high word first, straight from the frame: the
+    four bytes are a big-endian IEEE 754 value
+----------------------------------------------------------------------------*/
+static float rtuFloat(const uint8_t *src)
+{
+    uint32_t i = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+    float f;
+
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+/*--------------------------------------------------------------------------
+    rtuTrace
+    Frame on stdout in the libmodbus debug format (cfg.trace)
+----------------------------------------------------------------------------*/
+static void rtuTrace(const uint8_t *adu, int len, int sent)
+{
+    int i;
+
+    for (i = 0; i < len; i++) printf(sent ? "[%.2X]" : "<%.2X>", adu[i]);
+    printf("\n");
+    if (sent) printf("Waiting for a confirmation...\n");
+}
+
+/*--------------------------------------------------------------------------
+    rtuTransact
+    One read request and its response on the port of the libmodbus
+    context: nb, or -1 with errno set as libmodbus does. The response is
+    left in t->rx.
+----------------------------------------------------------------------------*/
+static int rtuTransact(tac1100_t *t, int unit, int fc, int address, int nb)
+{
+    int fd = modbus_get_socket(t->mb);
+    long timeout = respTimeout(t);
+    int expect = 5 + 2 * nb;
+    struct timeval tv;
+    fd_set rset;
+    ssize_t n;
+    int rc;
+
+    rtuRequest(t->tx, unit, fc, address, nb);
+    if (t->cfg.trace) rtuTrace(t->tx, RTU_REQ_LEN, 1);
+    // Late bytes of a response given up are not part of this one. Only
+    // then: tcflush() costs as much as the rest of the transaction.
+    if (t->rx_stale) tcflush(fd, TCIFLUSH);
+    t->rx_stale = 1;
+    if (write(fd, t->tx, RTU_REQ_LEN) != RTU_REQ_LEN) return -1;
+
+    t->rx_len = 0;
+    while (t->rx_len < expect) {
+        FD_ZERO(&rset);
+        FD_SET(fd, &rset);
+        tv.tv_sec = timeout / 1000000;
+        tv.tv_usec = timeout % 1000000;
+        if ((rc = select(fd + 1, &rset, NULL, NULL, &tv)) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (rc == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if ((n = read(fd, t->rx + t->rx_len, expect - t->rx_len)) == -1) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        if (n == 0) continue;
+        if (t->cfg.trace) rtuTrace(t->rx + t->rx_len, n, 0);
+        t->rx_len += n;
+        expect = rtuLength(t->rx, t->rx_len, fc, nb);
+        // Between the bytes of a response the byte timeout applies
+        if (t->cfg.byte_timeout_us > 0) timeout = t->cfg.byte_timeout_us;
+    }
+    if ((rc = rtuCheck(t->rx, expect, unit, fc, address, nb)) != 0) {
+        errno = rc;
+        return -1;
+    }
+    t->rx_stale = 0;
+    return nb;
+}
+
+/*--------------------------------------------------------------------------
+    readRegisters
+    Read a block of registers (Input or Holding) with retries. With the
+    native codec dest may be NULL: the registers stay in t->rx.
+----------------------------------------------------------------------------*/
+static int readRegisters(tac1100_t *t, int unit, int fc, int address, int nb, uint16_t *dest)
+{
+    uint16_t tab_reg[MODBUS_MAX_READ_REGISTERS];
+    tac1100_xfer_t x;
+    int rc = -1;
+    int i;
+    int j = 0;
+    int retries = t->cfg.retries;
+    int errno_save = 0;
+    int base = (fc == FC_INPUT) ? 30000 : 40000;
+    int probe;
+
+    if ((fc != FC_INPUT && fc != FC_HOLDING) || nb < 1 || nb > MODBUS_MAX_READ_REGISTERS) return TAC1100_EINVAL;
+    if (unit < 0 || unit >= MAX_UNITS) return TAC1100_EINVAL;
+    if (t->mb == NULL) return TAC1100_ECONNECT;
+    if ((probe = breakerAdmit(t, unit)) < 0) return probe;
+    if (probe) {
+      retries = 1;
+      probeTimeout(t, 1);
+    }
+    modbus_set_slave(t->mb, unit);
+
+    while (j < retries && rc == -1) {
+      j++;
+
+      if ((i = arbTurn(t)) != TAC1100_OK) {
+        if (probe) probeTimeout(t, 0);
+        return i;
+      }
+      if (t->cfg.command_delay_us) {
+        logMsg(t, TAC1100_LOG_DEBUG, "Sleeping command delay: %ldus", t->cfg.command_delay_us);
+        usleep(t->cfg.command_delay_us);
+      }
+
+      logMsg(t, TAC1100_LOG_DEBUG, "%d/%d. Register Address %d [%04X]", j, retries, base+address+1, address);
+      x.t_start = tac1100_now_us();
+      if (t->cfg.native_rtu)
+        rc = rtuTransact(t, unit, fc, address, nb);
+      else if (fc == FC_INPUT)
+        rc = modbus_read_input_registers(t->mb, address, nb, dest);
+      else
+        rc = modbus_read_registers(t->mb, address, nb, dest);
+      errno_save = errno;
+      x.t_stop = tac1100_now_us();
+      if (t->cfg.native_rtu && rc != -1 && (dest != NULL || t->xfer)) {
+        if (dest == NULL) dest = tab_reg;
+        rtuRegisters(t->rx + 3, nb, dest);
+      }
+      if (t->xfer) {
+        x.unit = unit;
+        x.fc = fc;
+        x.address = address;
+        x.nb = nb;
+        x.wdata = NULL;
+        x.rdata = rc != -1 ? dest : NULL;
+        x.rc = rc;
+        x.err = errno_save;
+        x.attempt = j;
+        x.attempts = retries;
+        t->xfer(t->xfer_user, &x);
+      }
+
+      if (rc == -1) {
+        logMsg(t, j==retries ? TAC1100_LOG_NOTICE : TAC1100_LOG_DEBUG, "ERROR (%d) %s, %d/%d, Address %d [%04X]", errno_save, modbus_strerror(errno_save), j, retries, base+address+1, address);
+        logMsg(t, j==retries ? TAC1100_LOG_NOTICE : TAC1100_LOG_DEBUG, "Response timeout gave up after %lldus", x.t_stop - x.t_start);
+        if (t->cfg.command_delay_us) {
+          logMsg(t, TAC1100_LOG_DEBUG, "Sleeping command delay: %ldus", t->cfg.command_delay_us);
+          usleep(t->cfg.command_delay_us);
+        }
+      } else {
+        logMsg(t, TAC1100_LOG_DEBUG, "Read time: %lldus", x.t_stop - x.t_start);
+        // The value was sampled between request and response: use the midpoint
+        t->read_time_us = x.t_start + (x.t_stop - x.t_start) / 2;
+        recovered(t);
+      }
+    }
+
+    if (probe) probeTimeout(t, 0);
+    breakerResult(t, unit, rc == -1 ? errno_save : 0);
+    if (rc == -1) {
+      t->err = errno_save;
+      return TAC1100_EBUS;
+    }
+
+    return rc;
+}
+
+int tac1100_read_registers(tac1100_t *t, int unit, int fc, int address, int nb, uint16_t *dest)
+{
+    return readRegisters(t, unit, fc, address, nb, dest);
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_decode_float
+    Big-endian float (high word first) from two registers
+----------------------------------------------------------------------------*/
+float tac1100_decode_float(const uint16_t *src)
+{
+    uint16_t tab_reg[2];
+
+    // swap LSB and MSB
+    tab_reg[0] = src[1];
+    tab_reg[1] = src[0];
+
+    return modbus_get_float(&tab_reg[0]);
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_plan
+    Merge the selected registers into as few block reads as possible.
+    Registers are merged when they share the function code, the unused gap
+    between them is at most max_gap and the block fits a single ModBus
+    request.
+----------------------------------------------------------------------------*/
+int tac1100_plan(const int *selected, int max_gap, tac1100_block_t *blocks)
+{
+    const regdef_t *regs = tac1100_regs;
+    int order[NUM_REGS];
+    int n = 0, nx = 0;
+    int i, k;
+
+    // Sort selected registers by function code and address (insertion sort, tiny table)
+    for (i = 0; i < NUM_REGS; i++) {
+        if (!selected[i]) continue;
+        for (k = n; k > 0; k--) {
+            const regdef_t *p = &regs[order[k-1]];
+            if (p->fc < regs[i].fc || (p->fc == regs[i].fc && p->address < regs[i].address)) break;
+            order[k] = order[k-1];
+        }
+        order[k] = i;
+        n++;
+    }
+
+    for (i = 0; i < n; i++) {
+        const regdef_t *r = &regs[order[i]];
+        if (nx > 0) {
+            tac1100_block_t *x = &blocks[nx-1];
+            int end = x->address + x->nb;
+            if (x->fc == r->fc && r->address - end <= max_gap &&
+                r->address + r->nb - x->address <= MODBUS_MAX_READ_REGISTERS) {
+                if (r->address + r->nb > end) x->nb = r->address + r->nb - x->address;
+                continue;
+            }
+        }
+        blocks[nx].fc = r->fc;
+        blocks[nx].address = r->address;
+        blocks[nx].nb = r->nb;
+        nx++;
+    }
+
+    return nx;
+}
+
+/*--------------------------------------------------------------------------
+    decodeBlock
+    Values of the selected registers in the block read into tab_reg
+----------------------------------------------------------------------------*/
+static void decodeBlock(const int *selected, const tac1100_block_t *b, const uint16_t *tab_reg,
+                        long long t, float *values, long long *times)
+{
+    const regdef_t *regs = tac1100_regs;
+    int r;
+
+    for (r = 0; r < NUM_REGS; r++) {
+        const uint16_t *src;
+        if (!selected[r] || regs[r].fc != b->fc) continue;
+        if (regs[r].address < b->address || regs[r].address + regs[r].nb > b->address + b->nb) continue;
+        src = &tab_reg[regs[r].address - b->address];
+        if (times != NULL) times[r] = t;
+        values[r] = regs[r].type == REG_UINT ? src[0] : tac1100_decode_float(src);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    decodeFrame
+    Values of the selected registers in the block, from the data bytes of
+    its response
+----------------------------------------------------------------------------*/
+static void decodeFrame(const int *selected, const tac1100_block_t *b, const uint8_t *data,
+                        long long t, float *values, long long *times)
+{
+    const regdef_t *regs = tac1100_regs;
+    int r;
+
+    for (r = 0; r < NUM_REGS; r++) {
+        const uint8_t *src;
+        if (!selected[r] || regs[r].fc != b->fc) continue;
+        if (regs[r].address < b->address || regs[r].address + regs[r].nb > b->address + b->nb) continue;
+        src = &data[2 * (regs[r].address - b->address)];
+        if (times != NULL) times[r] = t;
+        values[r] = regs[r].type == REG_UINT ? ((src[0] << 8) | src[1]) : rtuFloat(src);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_read
+----------------------------------------------------------------------------*/
+int tac1100_read(tac1100_t *t, int unit, const int *selected, float *values, long long *times)
+{
+    uint16_t tab_reg[MODBUS_MAX_READ_REGISTERS];
+    tac1100_block_t blocks[NUM_REGS];
+    int x, nx, rc;
+
+    nx = tac1100_plan(selected, t->cfg.max_gap, blocks);
+    for (x = 0; x < nx; x++) {
+        if (t->cfg.native_rtu) {
+            if ((rc = readRegisters(t, unit, blocks[x].fc, blocks[x].address, blocks[x].nb, NULL)) < 0) return rc;
+            decodeFrame(selected, &blocks[x], t->rx + 3, t->read_time_us, values, times);
+        } else {
+            if ((rc = readRegisters(t, unit, blocks[x].fc, blocks[x].address, blocks[x].nb, tab_reg)) < 0) return rc;
+            decodeBlock(selected, &blocks[x], tab_reg, t->read_time_us, values, times);
+        }
+    }
+    return nx;
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_read_partial
+    As tac1100_read, a failed block doesn't stop the others: its values
+    are NaN with the errno of the failure in status
+----------------------------------------------------------------------------*/
+int tac1100_read_partial(tac1100_t *t, int unit, const int *selected, float *values, long long *times, int *status)
+{
+    uint16_t tab_reg[MODBUS_MAX_READ_REGISTERS];
+    tac1100_block_t blocks[NUM_REGS];
+    int x, nx, rc, r, good = 0;
+
+    nx = tac1100_plan(selected, t->cfg.max_gap, blocks);
+    for (r = 0; r < NUM_REGS; r++) status[r] = 0;
+    for (x = 0; x < nx; x++) {
+        if (t->cfg.native_rtu) {
+            rc = readRegisters(t, unit, blocks[x].fc, blocks[x].address, blocks[x].nb, NULL);
+            if (rc >= 0) decodeFrame(selected, &blocks[x], t->rx + 3, t->read_time_us, values, times);
+        } else {
+            rc = readRegisters(t, unit, blocks[x].fc, blocks[x].address, blocks[x].nb, tab_reg);
+            if (rc >= 0) decodeBlock(selected, &blocks[x], tab_reg, t->read_time_us, values, times);
+        }
+        if (rc >= 0) {
+            good++;
+            continue;
+        }
+        // No bus, no point in trying the next blocks
+        if (rc != TAC1100_EBUS) return rc;
+        for (r = 0; r < NUM_REGS; r++) {
+            if (!selected[r] || tac1100_regs[r].fc != blocks[x].fc) continue;
+            if (tac1100_regs[r].address < blocks[x].address ||
+                tac1100_regs[r].address + tac1100_regs[r].nb > blocks[x].address + blocks[x].nb) continue;
+            values[r] = NAN;
+            if (times != NULL) times[r] = 0;
+            status[r] = t->err;
+        }
+    }
+    return good > 0 || nx == 0 ? nx : TAC1100_EBUS;
+}
+
+/*--------------------------------------------------------------------------
+    Bulk decode
+    Many reads of the same block (a sweep of a fleet of meters) into one
+    column per register. The SIMD kernel fills the columns 4 reads at a
+    time: where at least 3 of 4 consecutive floats are wanted it loads them
+    from every read, swaps the words of every float with a 16 bit shuffle
+    and transposes the 4x4 tile so that every vector holds one register of
+    the 4 reads; other floats are gathered from the 4 reads one register at
+    a time. The vectors are then scaled, masked and stored. The last reads,
+    UINT and odd offset registers go through the scalar loop.
+----------------------------------------------------------------------------*/
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BULK_ISA "sse2"
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define BULK_ISA "neon"
+#else
+#define BULK_ISA "scalar"
+#endif
+
+/*--------------------------------------------------------------------------
+    bulkScalar
+    Column of register r (off registers into the block) for reads from..to
+----------------------------------------------------------------------------*/
+static void bulkScalar(int r, int off, const uint16_t *raw, int stride, int from, int to,
+                       const float *scale, const uint8_t *valid, float *column)
+{
+    float s = scale != NULL ? scale[r] : 1.0f;
+    const uint16_t *src;
+    uint32_t i;
+    float f;
+    int m;
+
+    for (m = from; m < to; m++) {
+        if (valid != NULL && !valid[m]) {
+            column[m] = NAN;
+            continue;
+        }
+        src = raw + (size_t)m * stride + off;
+        if (tac1100_regs[r].type == REG_UINT) {
+            column[m] = src[0] * s;
+            continue;
+        }
+        i = ((uint32_t)src[0] << 16) | src[1];
+        memcpy(&f, &i, sizeof(f));
+        column[m] = f * s;
+    }
+}
+
+#if defined(__SSE2__)
+
+// High word first: swap the two registers of every 32 bit lane
+#define BULK_SWAP(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16((v), _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1))
+
+/*--------------------------------------------------------------------------
+    bulkStore
+    4 values of register r into its column: scaled, NaN for failed reads
+----------------------------------------------------------------------------*/
+static inline void bulkStore(__m128 v, int r, int m, const float *scale, const uint8_t *valid, float *const *columns)
+{
+    uint32_t flags;
+
+    if (scale != NULL) v = _mm_mul_ps(v, _mm_set1_ps(scale[r]));
+    if (valid != NULL) {
+        memcpy(&flags, valid + m, sizeof(flags));
+        // Any zero byte: put NaN in its lane
+        if ((flags - 0x01010101) & ~flags & 0x80808080) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i f = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(flags), zero), zero);
+            __m128 bad = _mm_castsi128_ps(_mm_cmpeq_epi32(f, zero));
+            v = _mm_or_ps(_mm_andnot_ps(bad, v), _mm_and_ps(bad, _mm_set1_ps(NAN)));
+        }
+    }
+    _mm_storeu_ps(columns[r] + m, v);
+}
+
+static int bulkTiles(const int *slot_reg, int nslots, const uint16_t *raw, int stride, int n,
+                     const float *scale, const uint8_t *valid, float *const *columns)
+{
+    __m128 v[4];
+    __m128i w;
+    int32_t x[4];
+    int m, t, k, used;
+
+    for (t = 0; t < nslots; t++) {
+        used = 0;
+        if (t % 4 == 0 && t + 4 <= nslots) {
+            used = (slot_reg[t] >= 0) + (slot_reg[t+1] >= 0) + (slot_reg[t+2] >= 0) + (slot_reg[t+3] >= 0);
+        }
+        // A tile pays for its 4 loads and the transpose from 3 columns up
+        if (used >= 3) {
+            for (m = 0; m + 4 <= n; m += 4) {
+                const uint16_t *p = raw + (size_t)m * stride + 2 * t;
+                for (k = 0; k < 4; k++) v[k] = _mm_castsi128_ps(BULK_SWAP(_mm_loadu_si128((const __m128i *)(p + (size_t)k * stride))));
+                _MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]);
+                for (k = 0; k < 4; k++) {
+                    if (slot_reg[t + k] >= 0) bulkStore(v[k], slot_reg[t + k], m, scale, valid, columns);
+                }
+            }
+            t += 3;
+            continue;
+        }
+        // Sparser floats are gathered from the 4 reads
+        if (slot_reg[t] < 0) continue;
+        for (m = 0; m + 4 <= n; m += 4) {
+            const uint16_t *p = raw + (size_t)m * stride + 2 * t;
+            for (k = 0; k < 4; k++) memcpy(&x[k], p + (size_t)k * stride, sizeof(x[k]));
+            w = _mm_unpacklo_epi64(_mm_unpacklo_epi32(_mm_cvtsi32_si128(x[0]), _mm_cvtsi32_si128(x[1])),
+                                   _mm_unpacklo_epi32(_mm_cvtsi32_si128(x[2]), _mm_cvtsi32_si128(x[3])));
+            bulkStore(_mm_castsi128_ps(BULK_SWAP(w)), slot_reg[t], m, scale, valid, columns);
+        }
+    }
+    return n & ~3;
+}
+
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// High word first: swap the two registers of every 32 bit lane
+#define BULK_SWAP(v) vreinterpretq_f32_u16(vrev32q_u16(v))
+
+/*--------------------------------------------------------------------------
+    bulkStore
+    4 values of register r into its column: scaled, NaN for failed reads
+----------------------------------------------------------------------------*/
+static inline void bulkStore(float32x4_t v, int r, int m, const float *scale, const uint8_t *valid, float *const *columns)
+{
+    uint32_t flags;
+
+    if (scale != NULL) v = vmulq_n_f32(v, scale[r]);
+    if (valid != NULL) {
+        memcpy(&flags, valid + m, sizeof(flags));
+        // Any zero byte: put NaN in its lane
+        if ((flags - 0x01010101) & ~flags & 0x80808080) {
+            uint32x4_t f = vmovl_u16(vget_low_u16(vmovl_u8(vcreate_u8(flags))));
+            v = vbslq_f32(vceqq_u32(f, vdupq_n_u32(0)), vdupq_n_f32(NAN), v);
+        }
+    }
+    vst1q_f32(columns[r] + m, v);
+}
+
+static int bulkTiles(const int *slot_reg, int nslots, const uint16_t *raw, int stride, int n,
+                     const float *scale, const uint8_t *valid, float *const *columns)
+{
+    float32x4_t v[4];
+    float32x4x2_t t01, t23;
+    uint32_t x[4];
+    int m, t, k, used;
+
+    for (t = 0; t < nslots; t++) {
+        used = 0;
+        if (t % 4 == 0 && t + 4 <= nslots) {
+            used = (slot_reg[t] >= 0) + (slot_reg[t+1] >= 0) + (slot_reg[t+2] >= 0) + (slot_reg[t+3] >= 0);
+        }
+        // A tile pays for its 4 loads and the transpose from 3 columns up
+        if (used >= 3) {
+            for (m = 0; m + 4 <= n; m += 4) {
+                const uint16_t *p = raw + (size_t)m * stride + 2 * t;
+                for (k = 0; k < 4; k++) v[k] = BULK_SWAP(vld1q_u16(p + (size_t)k * stride));
+                t01 = vtrnq_f32(v[0], v[1]);
+                t23 = vtrnq_f32(v[2], v[3]);
+                v[0] = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+                v[1] = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+                v[2] = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+                v[3] = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+                for (k = 0; k < 4; k++) {
+                    if (slot_reg[t + k] >= 0) bulkStore(v[k], slot_reg[t + k], m, scale, valid, columns);
+                }
+            }
+            t += 3;
+            continue;
+        }
+        // Sparser floats are gathered from the 4 reads
+        if (slot_reg[t] < 0) continue;
+        for (m = 0; m + 4 <= n; m += 4) {
+            const uint16_t *p = raw + (size_t)m * stride + 2 * t;
+            for (k = 0; k < 4; k++) memcpy(&x[k], p + (size_t)k * stride, sizeof(x[k]));
+            bulkStore(BULK_SWAP(vreinterpretq_u16_u32(vld1q_u32(x))), slot_reg[t], m, scale, valid, columns);
+        }
+    }
+    return n & ~3;
+}
+
+#endif
+
+/*--------------------------------------------------------------------------
+    tac1100_decode_bulk
+----------------------------------------------------------------------------*/
+int tac1100_decode_bulk(const tac1100_block_t *b, const uint16_t *raw, int stride, int n,
+                        const float *scale, const uint8_t *valid, float *const *columns, int flags)
+{
+    const regdef_t *regs = tac1100_regs;
+    int slot_reg[MODBUS_MAX_READ_REGISTERS / 2];
+    int nslots = b->nb / 2;
+    int tiled = 0, ncols = 0;
+    int r, k, off;
+
+    if (n < 0 || stride < b->nb || b->nb < 1 || b->nb > MODBUS_MAX_READ_REGISTERS) return TAC1100_EINVAL;
+    for (k = 0; k < nslots; k++) slot_reg[k] = -1;
+    for (r = 0; r < NUM_REGS; r++) {
+        if (columns[r] == NULL || regs[r].fc != b->fc) continue;
+        if (regs[r].address < b->address || regs[r].address + regs[r].nb > b->address + b->nb) continue;
+        off = regs[r].address - b->address;
+        if (regs[r].type != REG_UINT && off % 2 == 0) slot_reg[off / 2] = r;
+        ncols++;
+    }
+
+#if defined(__SSE2__) || (defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    if (!(flags & TAC1100_BULK_SCALAR)) tiled = bulkTiles(slot_reg, nslots, raw, stride, n, scale, valid, columns);
+#else
+    (void)slot_reg;
+    (void)flags;
+#endif
+
+    for (r = 0; r < NUM_REGS; r++) {
+        if (columns[r] == NULL || regs[r].fc != b->fc) continue;
+        if (regs[r].address < b->address || regs[r].address + regs[r].nb > b->address + b->nb) continue;
+        off = regs[r].address - b->address;
+        // Reads the kernel covered
+        k = (regs[r].type != REG_UINT && off % 2 == 0) ? tiled : 0;
+        bulkScalar(r, off, raw, stride, k, n, scale, valid, columns[r]);
+    }
+    return ncols;
+}
+
+const char *tac1100_decode_bulk_isa(void)
+{
+    return BULK_ISA;
+}
+
+/*--------------------------------------------------------------------------
+    writeRegister
+    Single register with Function Code 0x10 (Write Multiple Registers): the
+    TAC1100 requires it even for one register
+----------------------------------------------------------------------------*/
+static int writeRegister(tac1100_t *t, int unit, int address, int value)
+{
+    tac1100_xfer_t x;
+    uint16_t tab_reg[1];
+    int n, probe;
+
+    if (unit < 0 || unit >= MAX_UNITS) return TAC1100_EINVAL;
+    if (t->mb == NULL) return TAC1100_ECONNECT;
+    if ((probe = breakerAdmit(t, unit)) < 0) return probe;
+    tab_reg[0] = (uint16_t)value;
+    modbus_set_slave(t->mb, unit);
+    if ((n = arbTurn(t)) != TAC1100_OK) return n;
+    if (probe) probeTimeout(t, 1);
+
+    if (t->cfg.command_delay_us) {
+      logMsg(t, TAC1100_LOG_DEBUG, "Sleeping command delay: %ldus", t->cfg.command_delay_us);
+      usleep(t->cfg.command_delay_us);
+    }
+
+    x.t_start = tac1100_now_us();
+    n = modbus_write_registers(t->mb, address, 1, tab_reg);
+    x.err = errno;
+    x.t_stop = tac1100_now_us();
+    if (probe) probeTimeout(t, 0);
+    breakerResult(t, unit, n == -1 ? x.err : 0);
+    if (t->xfer) {
+        x.unit = unit;
+        x.fc = FC_WRITE;
+        x.address = address;
+        x.nb = 1;
+        x.wdata = tab_reg;
+        x.rdata = NULL;
+        x.rc = n;
+        x.attempt = 1;
+        x.attempts = 1;
+        t->xfer(t->xfer_user, &x);
+    }
+    if (n == -1) {
+        t->err = x.err;
+        return TAC1100_EBUS;
+    }
+    recovered(t);
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_kppa
+    Key Parameter Programming Authorization: write the current password to
+    enable writing the protected parameters
+----------------------------------------------------------------------------*/
+int tac1100_kppa(tac1100_t *t, int unit, int password)
+{
+    int rc;
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Enabling KPPA with password %d (0x%04X)", password, password);
+
+    if ((rc = writeRegister(t, unit, KPPA, password)) == TAC1100_OK) {
+        logMsg(t, TAC1100_LOG_DEBUG, "KPPA enabled successfully");
+    } else if (rc == TAC1100_EBUS) {
+        logMsg(t, TAC1100_LOG_ERROR, "KPPA enable failed: (%d) %s", t->err, modbus_strerror(t->err));
+    }
+    return rc;
+}
+
+/*--------------------------------------------------------------------------
+    tac1100_write
+----------------------------------------------------------------------------*/
+int tac1100_write(tac1100_t *t, int unit, int address, int value)
+{
+    int rc;
+
+    logMsg(t, TAC1100_LOG_DEBUG, "Writing value %d (0x%04X) to register 0x%04X", value, value, address);
+
+    if ((rc = writeRegister(t, unit, address, value)) == TAC1100_EBUS) {
+        logMsg(t, TAC1100_LOG_ERROR, "Write error: (%d) %s", t->err, modbus_strerror(t->err));
+        if (t->err == EMBXILFUN) { // Illegal function
+            logMsg(t, TAC1100_LOG_ERROR, "Tip: Parameter may be read-only or password authorization (KPPA) required");
+        }
+    }
+    return rc;
+}
+
+/*--------------------------------------------------------------------------
+    Event driven engine
+    One epoll set for all the ports. Per port a queue of requests for every
+    priority class (reads made of the planned block requests, writes of
+    one) and one timerfd armed for the command delay before a request or
+    for the response deadline after it. A response is complete when it has
+    the length its function code implies (5 bytes for an exception), then
+    its CRC, unit and function are checked.
+
+    Between two transactions the port takes the next one from the highest
+    class with requests queued, so a read of several blocks can be
+    overtaken after any of them. A class with a minimum share (percent of
+    the bus time) that got less than its share since its queue last ran
+    empty goes first instead: lower classes slow down under load from the
+    higher ones but never stop.
+----------------------------------------------------------------------------*/
+#define ENGINE_EVENTS    32
+
+#define PORT_IDLE  0
+#define PORT_DELAY 1            // Command delay before the request
+#define PORT_SEND  2            // Request partially written, waiting for EPOLLOUT
+#define PORT_WAIT  3            // Waiting for the response
+
+typedef struct enginereq {
+    struct enginereq *next;
+    int prio;
+    int selected[NUM_REGS];
+    tac1100_block_t blocks[NUM_REGS];
+    int nblocks;
+    int block;                  // Block being read
+    int attempts;               // cfg.retries for reads, 1 for a write
+    int value;                  // Register written (blocks[0].fc == FC_WRITE)
+    long long t_queued;
+    tac1100_result_t result;
+    tac1100_done_fn done;
+    void *user;
+    struct enginereq *followers;    // Identical reads attached to this one (coalesce)
+} enginereq_t;
+
+typedef struct {
+    tac1100_t *t;               // Configuration, locks and hooks
+    int fd;
+    int tfd;
+    int state;
+    int attempt;
+    enginereq_t *head[TAC1100_PRIO_CLASSES];
+    enginereq_t *tail[TAC1100_PRIO_CLASSES];
+    enginereq_t *cur;           // Request of the transaction in progress
+    long long window_us[TAC1100_PRIO_CLASSES];  // Bus time since the class queue last ran empty
+    long long served_us[TAC1100_PRIO_CLASSES];  // Of which the class had
+    tac1100_prio_stats_t stats[TAC1100_PRIO_CLASSES];
+    uint8_t tx[RTU_WRITE_LEN];
+    int tx_len, tx_off;
+    uint8_t rx[RTU_ADU_MAX];
+    int rx_len;
+    int rx_stale;               // Last response given up: late bytes may follow
+    int skipping;               // portNext() failing requests of meters with the breaker open
+    long long t_start;
+} engineport_t;
+
+struct tac1100_engine {
+    int epfd;
+    engineport_t *ports;
+    int nports;
+    int pending;
+    int completed;              // During tac1100_engine_run()
+    int share[TAC1100_PRIO_CLASSES];    // Minimum bus time of the class (%)
+    int coalesce;                       // Identical reads share the transactions
+};
+
+static void portNext(tac1100_engine_t *e, int port);
+
+static speed_t baudSpeed(int baud)
+{
+    switch (baud) {
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    portTimer
+    Arm the timerfd us from now, 0 disarms it
+----------------------------------------------------------------------------*/
+static void portTimer(engineport_t *p, long long us)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = us / 1000000;
+    its.it_value.tv_nsec = (us % 1000000) * 1000;
+    timerfd_settime(p->tfd, 0, &its, NULL);
+}
+
+static void portWatchOut(tac1100_engine_t *e, int port, int on)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+    ev.data.u32 = port * 2;
+    epoll_ctl(e->epfd, EPOLL_CTL_MOD, e->ports[port].fd, &ev);
+}
+
+/*--------------------------------------------------------------------------
+    portSend
+    Write the request of the current block, arm the response deadline
+----------------------------------------------------------------------------*/
+static void portSend(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    enginereq_t *f;
+    ssize_t n;
+
+    if (p->state != PORT_SEND) {
+        // Late bytes of a response given up are not part of the next one
+        if (p->rx_stale) tcflush(p->fd, TCIFLUSH);
+        p->rx_stale = 1;
+        p->rx_len = 0;
+        p->tx_off = 0;
+        p->t_start = tac1100_now_us();
+        if (p->cur->result.requests++ == 0) {
+            // Queueing delay: until the first request of the read or write
+            tac1100_prio_stats_t *st = &p->stats[p->cur->prio];
+            p->cur->result.wait_us = p->t_start - p->cur->t_queued;
+            st->requests++;
+            st->wait_us += p->cur->result.wait_us;
+            if (p->cur->result.wait_us > st->wait_max_us) st->wait_max_us = p->cur->result.wait_us;
+            for (f = p->cur->followers; f != NULL; f = f->next) f->result.wait_us = p->t_start - f->t_queued;
+        }
+    }
+    while (p->tx_off < p->tx_len) {
+        n = write(p->fd, p->tx + p->tx_off, p->tx_len - p->tx_off);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            logMsg(p->t, TAC1100_LOG_NOTICE, "%s: write(): (%d) %s", p->t->device, errno, strerror(errno));
+            break;
+        }
+        p->tx_off += n;
+    }
+    if (p->tx_off < p->tx_len && (errno == EAGAIN || errno == EINTR)) {
+        if (p->state != PORT_SEND) portWatchOut(e, port, 1);
+        p->state = PORT_SEND;
+        return;
+    }
+    if (p->state == PORT_SEND) portWatchOut(e, port, 0);
+    // A failed write times out like a lost request
+    p->state = PORT_WAIT;
+    portTimer(p, respTimeout(p->t));
+}
+
+/*--------------------------------------------------------------------------
+    portRequest
+    Build the request of the current block (or the write) and send it,
+    after the command delay if any
+----------------------------------------------------------------------------*/
+static void portRequest(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    enginereq_t *q = p->cur;
+    const tac1100_block_t *b = &q->blocks[q->block];
+
+    if (b->fc == FC_WRITE) {
+        rtuWriteRequest(p->tx, q->result.unit, b->address, q->value);
+        p->tx_len = RTU_WRITE_LEN;
+        logMsg(p->t, TAC1100_LOG_DEBUG, "%s: Unit %d Writing value %d (0x%04X) to register 0x%04X", p->t->device,
+               q->result.unit, q->value, q->value, b->address);
+    } else {
+        rtuRequest(p->tx, q->result.unit, b->fc, b->address, b->nb);
+        p->tx_len = RTU_REQ_LEN;
+        logMsg(p->t, TAC1100_LOG_DEBUG, "%s: %d/%d. Unit %d Register Address %d [%04X]", p->t->device, p->attempt,
+               q->attempts, q->result.unit, (b->fc == FC_INPUT ? 30000 : 40000) + b->address + 1, b->address);
+    }
+    if (p->t->cfg.command_delay_us) {
+        p->state = PORT_DELAY;
+        portTimer(p, p->t->cfg.command_delay_us);
+        return;
+    }
+    p->state = PORT_IDLE;
+    portSend(e, port);
+}
+
+/*--------------------------------------------------------------------------
+    portComplete
+    Hand the result of the current request to its callback, then to the
+    callbacks of the reads attached to it, and go on
+----------------------------------------------------------------------------*/
+static void portComplete(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    enginereq_t *q = p->cur;
+    enginereq_t *f;
+
+    // Always the head of its class: the classes are served in order
+    p->head[q->prio] = q->next;
+    if (p->head[q->prio] == NULL) {
+        p->tail[q->prio] = NULL;
+        p->window_us[q->prio] = 0;
+        p->served_us[q->prio] = 0;
+    }
+    p->cur = NULL;
+    p->state = PORT_IDLE;
+    e->pending--;
+    e->completed++;
+    q->result.selected = q->blocks[0].fc == FC_WRITE ? NULL : q->selected;
+    if (q->done) q->done(q->user, &q->result);
+    while ((f = q->followers) != NULL) {
+        q->followers = f->next;
+        e->ports[port].stats[f->prio].saved += q->result.requests;
+        e->pending--;
+        e->completed++;
+        f->result.rc = q->result.rc;
+        f->result.err = q->result.err;
+        f->result.selected = f->selected;
+        if (f->done) f->done(f->user, &f->result);
+        free(f);
+    }
+    free(q);
+    // The callback may have queued (and started) the next read already
+    if (e->ports[port].state == PORT_IDLE && !e->ports[port].skipping) portNext(e, port);
+}
+
+/*--------------------------------------------------------------------------
+    portResult
+    Outcome of one request: decode it, retry it or fail the read
+----------------------------------------------------------------------------*/
+static void portResult(tac1100_engine_t *e, int port, int err)
+{
+    engineport_t *p = &e->ports[port];
+    enginereq_t *q = p->cur;
+    enginereq_t *f;
+    tac1100_block_t *b = &q->blocks[q->block];
+    uint16_t tab_reg[MODBUS_MAX_READ_REGISTERS];
+    uint16_t wdata = q->value;
+    long long t_stop = tac1100_now_us();
+    int c;
+
+    portTimer(p, 0);
+    // Bus time of the transaction, against the share of every waiting class
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        if (p->head[c] != NULL) p->window_us[c] += t_stop - p->t_start;
+    }
+    p->served_us[q->prio] += t_stop - p->t_start;
+    p->stats[q->prio].transactions++;
+    p->stats[q->prio].bus_us += t_stop - p->t_start;
+
+    if (p->t->xfer) {
+        if (err == 0 && b->fc != FC_WRITE) rtuRegisters(p->rx + 3, b->nb, tab_reg);
+        tac1100_xfer_t x;
+        x.unit = q->result.unit;
+        x.fc = b->fc;
+        x.address = b->address;
+        x.nb = b->nb;
+        x.wdata = b->fc == FC_WRITE ? &wdata : NULL;
+        x.rdata = err == 0 && b->fc != FC_WRITE ? tab_reg : NULL;
+        x.rc = err == 0 ? b->nb : -1;
+        x.err = err;
+        x.attempt = p->attempt;
+        x.attempts = q->attempts;
+        x.t_start = p->t_start;
+        x.t_stop = t_stop;
+        p->t->xfer(p->t->xfer_user, &x);
+    }
+
+    if (err != 0) {
+        logMsg(p->t, p->attempt == q->attempts ? TAC1100_LOG_NOTICE : TAC1100_LOG_DEBUG, "%s: ERROR (%d) %s, %d/%d, Unit %d Address [%04X]",
+               p->t->device, err, modbus_strerror(err), p->attempt, q->attempts, q->result.unit, b->address);
+        if (p->attempt < q->attempts) {
+            p->attempt++;
+            portRequest(e, port);
+            return;
+        }
+        breakerResult(p->t, q->result.unit, err);
+        p->t->probing = 0;
+        q->result.rc = TAC1100_EBUS;
+        q->result.err = err;
+        portComplete(e, port);
+        return;
+    }
+
+    p->rx_stale = 0;
+    breakerResult(p->t, q->result.unit, 0);
+    if (p->t->probing) {
+        // The meter is back: the next blocks with their retries
+        p->t->probing = 0;
+        q->attempts = p->t->cfg.retries;
+    }
+    // The value was sampled between request and response: use the midpoint
+    if (b->fc != FC_WRITE) {
+        decodeFrame(q->selected, b, p->rx + 3, p->t_start + (t_stop - p->t_start) / 2, q->result.values, q->result.times);
+        for (f = q->followers; f != NULL; f = f->next) {
+            decodeFrame(f->selected, b, p->rx + 3, p->t_start + (t_stop - p->t_start) / 2, f->result.values, f->result.times);
+        }
+    }
+    if (++q->block < q->nblocks) {
+        // The next block waits for the requests of higher classes
+        p->state = PORT_IDLE;
+        portNext(e, port);
+        return;
+    }
+    q->result.rc = TAC1100_OK;
+    portComplete(e, port);
+}
+
+/*--------------------------------------------------------------------------
+    portReceive
+    Collect the response bytes, check the frame once it is complete
+----------------------------------------------------------------------------*/
+static void portReceive(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    const tac1100_block_t *b;
+    int expect;
+    ssize_t n;
+
+    for (;;) {
+        n = read(p->fd, p->rx + p->rx_len, sizeof(p->rx) - p->rx_len);
+        if (n > 0) {
+            if (p->state == PORT_WAIT) p->rx_len += n;
+            if (p->rx_len == (int)sizeof(p->rx)) break;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        break;
+    }
+    if (p->state != PORT_WAIT || p->rx_len == 0) return;
+
+    b = &p->cur->blocks[p->cur->block];
+    expect = rtuLength(p->rx, p->rx_len, b->fc, b->nb);
+    if (p->rx_len < expect) {
+        // Between the bytes of a response the byte timeout applies
+        if (p->t->cfg.byte_timeout_us > 0) portTimer(p, p->t->cfg.byte_timeout_us);
+        return;
+    }
+    portResult(e, port, rtuCheck(p->rx, expect, p->cur->result.unit, b->fc, b->address, b->nb));
+}
+
+static void portTimeout(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    uint64_t expirations;
+
+    if (read(p->tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    if (p->state == PORT_DELAY) {
+        p->state = PORT_IDLE;
+        portSend(e, port);
+    } else if (p->state == PORT_WAIT || p->state == PORT_SEND) {
+        if (p->state == PORT_SEND) portWatchOut(e, port, 0);
+        portResult(e, port, ETIMEDOUT);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    portPick
+    Request of the next transaction: the first class behind its share, else
+    the highest class with requests
+----------------------------------------------------------------------------*/
+static enginereq_t *portPick(const tac1100_engine_t *e, const engineport_t *p)
+{
+    int c, pick = -1;
+
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        if (p->head[c] == NULL) continue;
+        if (e->share[c] > 0 && p->served_us[c] * 100 < e->share[c] * p->window_us[c]) return p->head[c];
+        if (pick < 0) pick = c;
+    }
+    return pick < 0 ? NULL : p->head[pick];
+}
+
+static void portNext(tac1100_engine_t *e, int port)
+{
+    engineport_t *p = &e->ports[port];
+    int probe;
+
+    while ((p->cur = portPick(e, p)) != NULL) {
+        if (p->cur->block == 0 && (probe = breakerAdmit(p->t, p->cur->result.unit)) != TAC1100_OK) {
+            if (probe == TAC1100_EOPEN) {
+                // Fails without bus time; the callbacks queue without starting
+                p->cur->result.rc = TAC1100_EOPEN;
+                p->skipping = 1;
+                portComplete(e, port);
+                p->skipping = 0;
+                continue;
+            }
+            p->t->probing = 1;
+            p->cur->attempts = 1;
+        }
+        p->attempt = 1;
+        portRequest(e, port);
+        return;
+    }
+}
+
+/*--------------------------------------------------------------------------
+    portOpen
+    Lock the port as tac1100_connect() does and open it non-blocking, raw,
+    8 data bits
+----------------------------------------------------------------------------*/
+static int portOpen(engineport_t *p)
+{
+    tac1100_config_t *c = &p->t->cfg;
+    struct termios tio;
+    speed_t speed;
+    int rc;
+
+    if ((speed = baudSpeed(c->baud_rate)) == 0) {
+        logMsg(p->t, TAC1100_LOG_ERROR, "%s: unsupported baud rate %d", p->t->device, c->baud_rate);
+        return TAC1100_EINVAL;
+    }
+    if (c->resp_timeout_us <= 0) {
+        // A zero timerfd would disarm the response deadline
+        logMsg(p->t, TAC1100_LOG_ERROR, "%s: the engine needs a response timeout", p->t->device);
+        return TAC1100_EINVAL;
+    }
+    if (c->lock_mode == TAC1100_LOCK_ARB) {
+        logMsg(p->t, TAC1100_LOG_ERROR, "%s: the engine can't take turns from a bus arbiter", p->t->device);
+        return TAC1100_EINVAL;
+    }
+    if ((rc = tac1100_lock_port(p->t)) != TAC1100_OK) return rc;
+
+    if ((p->fd = open(p->t->device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+        p->t->err = errno;
+        logMsg(p->t, TAC1100_LOG_ERROR, "Connection failed: (%d) %s", errno, strerror(errno));
+        return TAC1100_ECONNECT;
+    }
+    // Ours before the port is set up
+    if (c->lock_mode == TAC1100_LOCK_FD) {
+        p->t->fd = p->fd;
+        if ((rc = tac1100_acquire(p->t)) != TAC1100_OK) return rc;
+    }
+    memset(&tio, 0, sizeof(tio));
+    tio.c_cflag = CREAD | CLOCAL | CS8;
+    if (c->stop_bits == 2 || (c->stop_bits == 0 && c->parity == 'N')) tio.c_cflag |= CSTOPB;
+    if (c->parity == 'E') tio.c_cflag |= PARENB;
+    if (c->parity == 'O') tio.c_cflag |= PARENB | PARODD;
+    tio.c_iflag = c->parity == 'N' ? IGNPAR : INPCK;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(p->fd, TCSANOW, &tio) == -1) {
+        p->t->err = errno;
+        logMsg(p->t, TAC1100_LOG_ERROR, "%s: tcsetattr(): (%d) %s", p->t->device, errno, strerror(errno));
+        return TAC1100_ECONNECT;
+    }
+    if (c->settle_us) {
+        logMsg(p->t, TAC1100_LOG_DEBUG, "Sleeping %ldus for line settle...", c->settle_us);
+        usleep(c->settle_us);
+    }
+    p->rx_stale = 1;
+    if ((p->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        p->t->err = errno;
+        return TAC1100_ENOMEM;
+    }
+    logMsg(p->t, TAC1100_LOG_DEBUG, "%s: engine port open (%d%c%d)", p->t->device, c->baud_rate, c->parity,
+           (tio.c_cflag & CSTOPB) ? 2 : 1);
+    return TAC1100_OK;
+}
+
+static void portClose(engineport_t *p)
+{
+    enginereq_t *q, *next, *f;
+    int c;
+
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        for (q = p->head[c]; q != NULL; q = next) {
+            next = q->next;
+            while ((f = q->followers) != NULL) {
+                q->followers = f->next;
+                free(f);
+            }
+            free(q);
+        }
+    }
+    // The context has no libmodbus port: tac1100_close() wouldn't unlock it
+    tac1100_release(p->t);
+    tac1100_free(p->t);
+    if (p->tfd != -1) close(p->tfd);
+    if (p->fd != -1) close(p->fd);
+}
+
+/*--------------------------------------------------------------------------
+    Engine API
+----------------------------------------------------------------------------*/
+tac1100_engine_t *tac1100_engine_new(void)
+{
+    tac1100_engine_t *e;
+
+    if ((e = calloc(1, sizeof(*e))) == NULL) return NULL;
+    if ((e->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        free(e);
+        return NULL;
+    }
+    e->share[TAC1100_PRIO_POLL] = 20;
+    e->share[TAC1100_PRIO_BULK] = 10;
+    return e;
+}
+
+void tac1100_engine_free(tac1100_engine_t *e)
+{
+    int i;
+
+    if (e == NULL) return;
+    for (i = 0; i < e->nports; i++) portClose(&e->ports[i]);
+    free(e->ports);
+    close(e->epfd);
+    free(e);
+}
+
+int tac1100_engine_add_port(tac1100_engine_t *e, const char *device, const tac1100_config_t *cfg)
+{
+    engineport_t *ports, *p;
+    struct epoll_event ev;
+    int port = e->nports, rc;
+
+    if ((ports = realloc(e->ports, (port + 1) * sizeof(*ports))) == NULL) return TAC1100_ENOMEM;
+    e->ports = ports;
+    p = &ports[port];
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->tfd = -1;
+    if ((p->t = tac1100_new(device, cfg)) == NULL) return TAC1100_ENOMEM;
+
+    if ((rc = portOpen(p)) == TAC1100_OK) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = port * 2;
+        if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, p->fd, &ev) == -1) rc = TAC1100_EINVAL;
+        ev.data.u32 = port * 2 + 1;
+        if (rc == TAC1100_OK && epoll_ctl(e->epfd, EPOLL_CTL_ADD, p->tfd, &ev) == -1) rc = TAC1100_EINVAL;
+    }
+    if (rc != TAC1100_OK) {
+        portClose(p);
+        return rc;
+    }
+    e->nports++;
+    return port;
+}
+
+tac1100_t *tac1100_engine_context(tac1100_engine_t *e, int port)
+{
+    return port >= 0 && port < e->nports ? e->ports[port].t : NULL;
+}
+
+/*--------------------------------------------------------------------------
+    sameRead
+    Reads l and q ask the same unit for the same blocks
+----------------------------------------------------------------------------*/
+static int sameRead(const enginereq_t *l, const enginereq_t *q)
+{
+    int x;
+
+    if (l->blocks[0].fc == FC_WRITE || l->result.unit != q->result.unit || l->nblocks != q->nblocks) return 0;
+    for (x = 0; x < q->nblocks; x++) {
+        if (l->blocks[x].fc != q->blocks[x].fc || l->blocks[x].address != q->blocks[x].address ||
+            l->blocks[x].nb != q->blocks[x].nb) return 0;
+    }
+    return 1;
+}
+
+/*--------------------------------------------------------------------------
+    engineLeader
+    Read q can attach to: same unit and blocks, no block read yet (or on
+    the bus now), and not in a lower class, which would delay q
+----------------------------------------------------------------------------*/
+static enginereq_t *engineLeader(const engineport_t *p, const enginereq_t *q)
+{
+    enginereq_t *l;
+    int c;
+
+    // On the bus already, whatever its class
+    if (p->cur != NULL && p->cur->block == 0 && sameRead(p->cur, q)) return p->cur;
+    for (c = 0; c <= q->prio; c++) {
+        for (l = p->head[c]; l != NULL; l = l->next) {
+            if (l != p->cur && l->block == 0 && sameRead(l, q)) return l;
+        }
+    }
+    return NULL;
+}
+
+/*--------------------------------------------------------------------------
+    engineQueue
+    Queue a request at the end of its class, start it if the port is idle.
+    With coalescing a read follows its leader instead, if it has one
+----------------------------------------------------------------------------*/
+static int engineQueue(tac1100_engine_t *e, int port, enginereq_t *q)
+{
+    engineport_t *p = &e->ports[port];
+    enginereq_t *l, **f;
+
+    q->result.port = port;
+    q->result.prio = q->prio;
+    q->t_queued = tac1100_now_us();
+    if (e->coalesce && q->blocks[0].fc != FC_WRITE && (l = engineLeader(p, q)) != NULL) {
+        // Served in the order they came
+        for (f = &l->followers; *f != NULL; f = &(*f)->next);
+        *f = q;
+        q->result.coalesced = 1;
+        if (l->result.requests > 0) q->result.wait_us = 0;
+        p->stats[q->prio].coalesced++;
+        e->pending++;
+        return TAC1100_OK;
+    }
+    if (p->tail[q->prio] != NULL) p->tail[q->prio]->next = q; else p->head[q->prio] = q;
+    p->tail[q->prio] = q;
+    e->pending++;
+    if (p->state == PORT_IDLE && p->cur == NULL && !p->skipping) portNext(e, port);
+    return TAC1100_OK;
+}
+
+int tac1100_engine_read_prio(tac1100_engine_t *e, int port, int unit, const int *selected, int prio,
+                             tac1100_done_fn done, void *user)
+{
+    enginereq_t *q;
+
+    if (port < 0 || port >= e->nports || unit < 1 || unit > 247) return TAC1100_EINVAL;
+    if (prio < 0 || prio >= TAC1100_PRIO_CLASSES) return TAC1100_EINVAL;
+    if ((q = calloc(1, sizeof(*q))) == NULL) return TAC1100_ENOMEM;
+    memcpy(q->selected, selected, sizeof(q->selected));
+    if ((q->nblocks = tac1100_plan(q->selected, e->ports[port].t->cfg.max_gap, q->blocks)) == 0) {
+        free(q);
+        return TAC1100_EINVAL;
+    }
+    q->prio = prio;
+    q->attempts = e->ports[port].t->cfg.retries;
+    q->result.unit = unit;
+    q->done = done;
+    q->user = user;
+    return engineQueue(e, port, q);
+}
+
+int tac1100_engine_read(tac1100_engine_t *e, int port, int unit, const int *selected, tac1100_done_fn done, void *user)
+{
+    return tac1100_engine_read_prio(e, port, unit, selected, TAC1100_PRIO_POLL, done, user);
+}
+
+int tac1100_engine_write(tac1100_engine_t *e, int port, int unit, int address, int value, int prio,
+                         tac1100_done_fn done, void *user)
+{
+    enginereq_t *q;
+
+    if (port < 0 || port >= e->nports || unit < 1 || unit > 247) return TAC1100_EINVAL;
+    if (prio < 0 || prio >= TAC1100_PRIO_CLASSES || address < 0 || address > 0xFFFF) return TAC1100_EINVAL;
+    if ((q = calloc(1, sizeof(*q))) == NULL) return TAC1100_ENOMEM;
+    q->blocks[0].fc = FC_WRITE;
+    q->blocks[0].address = address;
+    q->blocks[0].nb = 1;
+    q->nblocks = 1;
+    q->value = value & 0xFFFF;
+    q->prio = prio;
+    // Not retried, like tac1100_write()
+    q->attempts = 1;
+    q->result.unit = unit;
+    q->done = done;
+    q->user = user;
+    return engineQueue(e, port, q);
+}
+
+int tac1100_engine_set_share(tac1100_engine_t *e, int prio, int percent)
+{
+    int c, total = percent;
+
+    if (prio < 0 || prio >= TAC1100_PRIO_CLASSES || percent < 0) return TAC1100_EINVAL;
+    for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+        if (c != prio) total += e->share[c];
+    }
+    if (total > 100) return TAC1100_EINVAL;
+    e->share[prio] = percent;
+    return TAC1100_OK;
+}
+
+void tac1100_engine_set_coalesce(tac1100_engine_t *e, int on)
+{
+    e->coalesce = on != 0;
+}
+
+int tac1100_engine_prio_stats(const tac1100_engine_t *e, int port, tac1100_prio_stats_t *stats)
+{
+    const tac1100_prio_stats_t *st;
+    int i, c;
+
+    if (port < -1 || port >= e->nports) return TAC1100_EINVAL;
+    memset(stats, 0, TAC1100_PRIO_CLASSES * sizeof(*stats));
+    for (i = 0; i < e->nports; i++) {
+        if (port != -1 && i != port) continue;
+        for (c = 0; c < TAC1100_PRIO_CLASSES; c++) {
+            st = &e->ports[i].stats[c];
+            stats[c].requests += st->requests;
+            stats[c].transactions += st->transactions;
+            stats[c].wait_us += st->wait_us;
+            if (st->wait_max_us > stats[c].wait_max_us) stats[c].wait_max_us = st->wait_max_us;
+            stats[c].bus_us += st->bus_us;
+            stats[c].coalesced += st->coalesced;
+            stats[c].saved += st->saved;
+        }
+    }
+    return TAC1100_OK;
+}
+
+int tac1100_engine_pending(const tac1100_engine_t *e)
+{
+    return e->pending;
+}
+
+int tac1100_engine_fd(const tac1100_engine_t *e)
+{
+    return e->epfd;
+}
+
+int tac1100_engine_run(tac1100_engine_t *e, int timeout_ms)
+{
+    struct epoll_event ev[ENGINE_EVENTS];
+    int n, i;
+
+    e->completed = 0;
+    while (e->pending > 0) {
+        n = epoll_wait(e->epfd, ev, ENGINE_EVENTS, timeout_ms);
+        if (n <= 0) break;      // Timeout or signal
+        for (i = 0; i < n; i++) {
+            int port = ev[i].data.u32 / 2;
+            if (ev[i].data.u32 & 1) {
+                portTimeout(e, port);
+            } else {
+                if (ev[i].events & EPOLLOUT && e->ports[port].state == PORT_SEND) portSend(e, port);
+                if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) portReceive(e, port);
+            }
+        }
+        if (timeout_ms == 0) break;
+    }
+    return e->completed;
+}
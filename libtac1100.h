@@ -0,0 +1,468 @@
+/*
+ * libtac1100.h: TAC1100 ModBus RTU access library
+ *
+ * Copyright (C) 2026 Flavio Anesi <www.flanesi.it>
+ *
+ * The serial port locking (UUCP lock file shared with sdm120c, aurora...,
+ * --fd-lock or the turns of tools/tac1100arb), the connection, the block read planner, the register
+ * decoding and the configuration writes of tac1100, behind a context
+ * handle. There is no global state: functions return TAC1100_OK or a
+ * negative TAC1100_E* code and never exit, messages go to the log
+ * callback of the context. Contexts on different ports can be used from
+ * different threads at the same time; a context must not be shared
+ * between threads without external locking. The event driven engine
+ * (tac1100_engine_*) drives many ports from a single thread.
+ *
+ *   tac1100_config_t cfg;
+ *   float values[TAC1100_NUM_REGS];
+ *   int selected[TAC1100_NUM_REGS] = { [TAC1100_R_VOLTAGE] = 1, [TAC1100_R_POWER] = 1 };
+ *
+ *   tac1100_config_init(&cfg);
+ *   tac1100_t *t = tac1100_new("/dev/ttyUSB0", &cfg);
+ *   if (tac1100_connect(t) == TAC1100_OK && tac1100_read(t, 1, selected, values, NULL) >= 0)
+ *       printf("%.2f V %.2f W\n", values[TAC1100_R_VOLTAGE], values[TAC1100_R_POWER]);
+ *   tac1100_free(t);
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef LIBTAC1100_H
+#define LIBTAC1100_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================
+// TAC1100 MODBUS REGISTER ADDRESSES
+// ====================================
+
+#define TAC1100_VOLTAGE   0x0000    // Voltage (Float, V)
+#define TAC1100_CURRENT   0x0006    // Current (Float, A)
+#define TAC1100_POWER     0x000C    // Active power (Float, W)
+#define TAC1100_APOWER    0x0012    // Reactive power (Float, var)
+#define TAC1100_RAPOWER   0x0018    // Apparent power (Float, VA)
+#define TAC1100_PFACTOR   0x001E    // Power factor (Float)
+#define TAC1100_PANGLE    0x0024    // Phase angle (Float, Degrees)
+#define TAC1100_FREQUENCY 0x0030    // Frequency (Float, Hz)
+#define TAC1100_IAENERGY  0x0500    // Total import active energy (Float, kWh)
+#define TAC1100_EAENERGY  0x0502    // Total export active energy (Float, kWh)
+#define TAC1100_TAENERGY  0x0504    // Total active energy (Float, kWh)
+#define TAC1100_IRAENERGY 0x0508    // Total import reactive energy (Float, kvarh)
+#define TAC1100_ERAENERGY 0x050A    // Total export reactive energy (Float, kvarh)
+#define TAC1100_TRENERGY  0x050C    // Total reactive energy (Float, kvarh)
+
+// ====================================
+// TAC1100 MODBUS REGISTER ADDRESSES - WRITE
+// ====================================
+
+#define TAC1100_KPPA           0x5000   // Key Parameter Programming Authorization (Password per abilitare programmazione)
+#define TAC1100_DEMAND_PERIOD  0x5002   // Demand period (0-60 minuti, default 60)
+#define TAC1100_SLIDE_TIME     0x5003   // Slide time (1 to Demand Period-1, default 1)
+#define TAC1100_DEVICE_ID      0x5005   // Modbus address (1-247, default 1) - R nel protocollo ma scrivibile via pulsanti/modbus
+#define TAC1100_BAUD_RATE      0x5006   // Network Baud Rate (0=1200, 1=2400, 2=4800, 3=9600, 4=19200) - R nel protocollo ma scrivibile
+#define TAC1100_NPARSTOP       0x5007   // Parity and stop bit (0=N1, 1=E1, 2=O1, 3=N2) - R nel protocollo ma scrivibile
+#define TAC1100_PASSWORD       0x5008   // Password (default 0000, richiede KPPA)
+#define TAC1100_TIME_DISP      0x5018   // Automatic Scroll Display Time (0-60 secondi, 0=stop scroll, default 0)
+#define TAC1100_BACKLIT_TIME   0x5019   // Backlit time (0-120 o 255 minuti, 0=always on, 255=always off, default 60)
+#define TAC1100_SYSTEM_TIME    0x501A   // System time (BCD format: Year-Month-Date-Week-Hour-Minute-Second)
+#define TAC1100_TARIFF         0x501E   // Tariff configuration (BCD format: Tariff number-Min-Hour)
+#define TAC1100_RESET_HIST     0x5600   // Reset historical data (0=reset max demand, 8=reset monthly, 9=reset daily) - SOLO SCRITTURA
+#define TAC1100_METER_CODE     0x5601   // Meter code - SOLA LETTURA
+#define TAC1100_SERIAL_NUM     0x5602   // Serial number - SOLA LETTURA (4 bytes)
+#define TAC1100_SW_VERSION     0x5604   // Software version - SOLA LETTURA
+#define TAC1100_HW_VERSION     0x5605   // Hardware version - SOLA LETTURA
+#define TAC1100_DISP_VERSION   0x5606   // Display version - SOLA LETTURA
+#define TAC1100_FAULT_CODE     0x5607   // Fault code (0=No fault, 1=Battery low voltage) - SOLA LETTURA
+
+#define TAC1100_BR1200  0
+#define TAC1100_BR2400  1
+#define TAC1100_BR4800  2
+#define TAC1100_BR9600  3
+#define TAC1100_BR19200 4
+
+// ====================================
+// TAC1100 READ REGISTER TABLE
+// ====================================
+
+#define TAC1100_FC_HOLDING 0x03     // Read Holding Registers (UINT configuration)
+#define TAC1100_FC_INPUT   0x04     // Read Input Registers (Float measurements)
+
+#define TAC1100_REG_FLOAT  0        // Float value printed with 2 decimals
+#define TAC1100_REG_ENERGY 1        // Float kWh/kvarh value printed as integer Wh/VARh
+#define TAC1100_REG_UINT   2        // UINT configuration value
+
+// Polling groups: every group has its own polling period in poll mode
+#define TAC1100_GRP_POWER  0        // Active, reactive and apparent power
+#define TAC1100_GRP_VI     1        // Voltage, current, power factor, phase angle, frequency
+#define TAC1100_GRP_ENERGY 2        // Energy counters 0x0500-0x050D
+#define TAC1100_GRP_CONFIG 3        // Configuration holding registers
+#define TAC1100_NUM_GROUPS 4
+
+typedef struct {
+    int address;
+    int fc;                 // TAC1100_FC_INPUT or TAC1100_FC_HOLDING
+    int nb;                 // Number of registers
+    int type;               // TAC1100_REG_FLOAT, TAC1100_REG_ENERGY or TAC1100_REG_UINT
+    int group;              // GRP_*
+    const char *label;      // Normal output label
+    const char *unit;       // Normal output unit ("" if none)
+    const char *iec_id;     // IEC 62056 ID (NULL prints normal output)
+    const char *iec_unit;   // IEC 62056 unit
+} tac1100_regdef_t;
+
+// Output order is the historical one of the single flags
+#define TAC1100_R_VOLTAGE   0
+#define TAC1100_R_CURRENT   1
+#define TAC1100_R_POWER     2
+#define TAC1100_R_APPARENT  3
+#define TAC1100_R_REACTIVE  4
+#define TAC1100_R_PFACTOR   5
+#define TAC1100_R_PANGLE    6
+#define TAC1100_R_FREQUENCY 7
+#define TAC1100_R_IAENERGY  8
+#define TAC1100_R_EAENERGY  9
+#define TAC1100_R_TAENERGY  10
+#define TAC1100_R_IRAENERGY 11
+#define TAC1100_R_ERAENERGY 12
+#define TAC1100_R_TRENERGY  13
+#define TAC1100_R_TIME_DISP 14
+#define TAC1100_NUM_REGS    15
+
+extern const tac1100_regdef_t tac1100_regs[TAC1100_NUM_REGS];
+
+// ====================================
+// LIBRARY
+// ====================================
+
+#define TAC1100_LOCK_PREFIX "/var/lock/LCK.."     // UUCP lock file of a port: prefix + ttyUSB0
+#define TAC1100_ARB_PREFIX  "/var/lock/ARB.."     // Bus arbiter socket of a port: prefix + ttyUSB0
+
+// Return codes
+#define TAC1100_OK        0
+#define TAC1100_EINVAL   -1     // Invalid argument
+#define TAC1100_ENOMEM   -2     // Out of memory
+#define TAC1100_ELOCK    -3     // Port still locked by another process after lock_wait
+#define TAC1100_ELOCKFILE -4    // Lock file or port lock error (tac1100_errno() has the cause)
+#define TAC1100_ECONNECT -5     // Can't open the serial port
+#define TAC1100_EBUS     -6     // ModBus request failed after all retries (tac1100_errno():
+                                // ETIMEDOUT, EMBBADCRC, EMBX* exceptions...)
+#define TAC1100_EOPEN    -7     // Not sent: the circuit breaker of the meter is open (tac1100_health())
+
+// Serial port locking
+#define TAC1100_LOCK_UUCP 0     // Lock file shared with the other ModBus clients + flock() per transfer
+#define TAC1100_LOCK_FD   1     // flock() on the port itself: only tac1100 clients on the bus
+#define TAC1100_LOCK_NONE 2     // Caller serialises the bus
+#define TAC1100_LOCK_ARB  3     // Turns granted by the bus arbiter of the port (tools/tac1100arb)
+
+// Recovery tiers (tac1100_recover()), mildest first
+#define TAC1100_RECOVER_FLUSH     0     // Wait for a quiet line, flush the buffers
+#define TAC1100_RECOVER_RECONNECT 1     // Close and open the port again
+#define TAC1100_RECOVER_REOPEN    2     // New libmodbus context, as tac1100_connect()
+#define TAC1100_RECOVER_TIERS     3
+
+// Meter health (circuit breaker, cfg.breaker_fails)
+#define TAC1100_METER_CLOSED 0  // Served normally
+#define TAC1100_METER_OPEN   1  // Dead: its requests fail at once, one in cfg.breaker_probe is a probe
+
+// Log levels
+#define TAC1100_LOG_DEBUG  0    // Trace of every step (tac1100 -d)
+#define TAC1100_LOG_NOTICE 1    // Worth keeping in the system log
+#define TAC1100_LOG_SYSLOG 2    // System log only
+#define TAC1100_LOG_ERROR  3    // For the user as well
+
+typedef struct {
+    int baud_rate;              // Default 9600
+    char parity;                // 'N', 'E' or 'O'. Default 'N'
+    int stop_bits;              // 1, 2, or 0: 2 with no parity, else 1. Default 0
+    long resp_timeout_us;       // Default 200000
+    long byte_timeout_us;       // -1 disables it. Default -1
+    long command_delay_us;      // Delay before every request. Default 0
+    long settle_us;             // Wait for the line to settle after opening it. Default 0
+    int retries;                // Attempts of every read. Default 1
+    int max_gap;                // Unused registers merged into a block read. Default 16
+    int lock_mode;              // TAC1100_LOCK_*. Default TAC1100_LOCK_UUCP
+    int lock_wait;              // Seconds to wait for the port lock. Default 0
+    const char *arb_socket;     // TAC1100_LOCK_ARB: arbiter socket. Default NULL: TAC1100_ARB_PREFIX + port name
+    long arb_hold_ms;           // TAC1100_LOCK_ARB: expected hold of a turn.
+                                // Default 0: 4 * retries * (resp_timeout + command_delay)
+    int trace;                  // libmodbus debug output on stdout/stderr
+    int native_rtu;             // Reads framed, checked and decoded by the library
+                                // instead of libmodbus (writes always use libmodbus). Default 0
+    int breaker_fails;          // Failed requests in a row (after the retries) that open the circuit
+                                // breaker of a meter. Default 0: never
+    int breaker_probe;          // While open, one request in breaker_probe is sent as a probe (one
+                                // attempt), the others fail with TAC1100_EOPEN. Default 10
+    long probe_timeout_us;      // Response timeout of a probe. Default 0: resp_timeout_us
+} tac1100_config_t;
+
+// One ModBus request and its response, for statistics and captures
+typedef struct {
+    int unit;
+    int fc;                     // 0x03, 0x04 or 0x10
+    int address;
+    int nb;
+    const uint16_t *wdata;      // Registers written (FC 0x10), else NULL
+    const uint16_t *rdata;      // Registers read when rc != -1, else NULL
+    int rc;                     // libmodbus result, -1 on failure
+    int err;                    // errno of the failure
+    int attempt;                // 1 for the first request, up to retries
+    int attempts;
+    long long t_start;          // CLOCK_MONOTONIC request sent (us)
+    long long t_stop;           // Response received or given up (us)
+} tac1100_xfer_t;
+
+// Lock contention: time and count of every phase of the lock file
+// protocol and of the exclusive lock upgrades
+typedef struct {
+    long long add_us;               // Create and link the lock file
+    long long shared_us;            // Lock file checks until the port is ours (shared)
+    long long shared_wait_us;       // Time blocked on LOCK_SH (EWOULDBLOCK loop)
+    unsigned long shared_retries;   // EWOULDBLOCK retries
+    unsigned long checks;           // Lock file checks (loop iterations)
+    unsigned long stale_suspects;   // Stale lock suspicions
+    unsigned long stale_cleared;    // Stale locks cleared
+    unsigned long missing_pid;      // Lock file without PID
+    unsigned long amended;          // Lock file amended with our PID
+    unsigned long holder_pid;       // Other process found holding the lock file
+    char holder_cmd[64];            // and its command
+    unsigned long exclusive_count;  // Exclusive lock upgrades
+    long long exclusive_us;         // Time to get the exclusive lock (last)
+    long long exclusive_sum_us;
+    long long exclusive_max_us;
+} tac1100_lockstats_t;
+
+// Recoveries by tier, and how many the next transaction proved right
+typedef struct {
+    unsigned long count[TAC1100_RECOVER_TIERS];
+    unsigned long recovered[TAC1100_RECOVER_TIERS];
+    unsigned long failed;           // Port couldn't be opened again
+} tac1100_recovery_t;
+
+// Health of one meter (unit address) of a port
+typedef struct {
+    int state;                  // TAC1100_METER_*
+    int fails;                  // Failed requests in a row
+    int next_probe;             // Open: requests to skip before the next probe
+    unsigned long opened;       // Times the breaker opened
+    unsigned long closed;       // Times a probe closed it
+    unsigned long probes;
+    unsigned long skipped;      // Requests failed with TAC1100_EOPEN
+    long long since_us;         // Last state change (CLOCK_MONOTONIC us), 0 if none
+} tac1100_health_t;
+
+typedef struct tac1100 tac1100_t;
+
+typedef void (*tac1100_log_fn)(void *user, int level, const char *format, va_list ap);
+typedef void (*tac1100_xfer_fn)(void *user, const tac1100_xfer_t *x);
+
+void tac1100_config_init(tac1100_config_t *cfg);
+
+// NULL if out of memory. Nothing is opened until tac1100_lock_port()/tac1100_connect()
+tac1100_t *tac1100_new(const char *device, const tac1100_config_t *cfg);
+// Close the port, release the locks and free the context
+void tac1100_free(tac1100_t *t);
+
+void tac1100_set_log(tac1100_t *t, tac1100_log_fn fn, void *user);
+void tac1100_set_xfer_hook(tac1100_t *t, tac1100_xfer_fn fn, void *user);
+void tac1100_set_retries(tac1100_t *t, int retries);
+
+// Take the lock file of the port (TAC1100_LOCK_UUCP) or connect to its
+// arbiter (TAC1100_LOCK_ARB) and the exclusive bus lock; tac1100_connect()
+// does it when not done yet
+int tac1100_lock_port(tac1100_t *t);
+// Open the port; with TAC1100_LOCK_FD also lock it
+int tac1100_connect(tac1100_t *t);
+// Close the port and remove the lock file
+void tac1100_close(tac1100_t *t);
+
+// Exclusive use of the bus for a sequence of requests (e.g. a poll cycle).
+// Held after tac1100_connect(): release it while idle so that the other
+// clients of the port get their turn. With TAC1100_LOCK_ARB a request
+// past the lease of the turn queues again for the next one.
+int tac1100_acquire(tac1100_t *t);
+void tac1100_release(tac1100_t *t);
+
+// Bring the bus back after a failed transaction instead of closing the
+// context: tier TAC1100_RECOVER_*, usually escalated with the failures in
+// a row. Keeps the port lock. After a failed reconnection or reopen the
+// next call reopens whatever the tier; TAC1100_ECONNECT while the port is
+// gone.
+int tac1100_recover(tac1100_t *t, int tier);
+
+// Read nb registers with function fc: nb, or TAC1100_EBUS after all retries
+int tac1100_read_registers(tac1100_t *t, int unit, int fc, int address, int nb, uint16_t *dest);
+// Read the selected registers (R_* indexes) with as few block reads as
+// possible: values in meter units (kWh for the energy counters), times
+// (may be NULL) the midpoint of the request/response of each value.
+// Number of requests, or TAC1100_EBUS.
+int tac1100_read(tac1100_t *t, int unit, const int *selected, float *values, long long *times);
+// As tac1100_read(), the blocks after a failed one are still read: the
+// values of a failed block are NaN and their status the errno of the
+// failure (tac1100_errno()), 0 for the values read. Number of requests,
+// TAC1100_EBUS only when every one of them failed.
+int tac1100_read_partial(tac1100_t *t, int unit, const int *selected, float *values, long long *times, int *status);
+// Midpoint of the request/response of the last successful read (CLOCK_MONOTONIC us)
+long long tac1100_read_time(const tac1100_t *t);
+
+// Write a single holding register (FC 0x10)
+int tac1100_write(tac1100_t *t, int unit, int address, int value);
+// Key Parameter Programming Authorization with the current password,
+// needed before writing TAC1100_PASSWORD and TAC1100_RESET_HIST
+int tac1100_kppa(tac1100_t *t, int unit, int password);
+
+// Block reads planned for the selected registers, blocks must hold TAC1100_NUM_REGS
+typedef struct {
+    int fc;
+    int address;
+    int nb;
+} tac1100_block_t;
+int tac1100_plan(const int *selected, int max_gap, tac1100_block_t *blocks);
+// Big-endian float (high word first) from two registers
+float tac1100_decode_float(const uint16_t *src);
+// ModBus RTU CRC-16 of len bytes (sent low byte first)
+uint16_t tac1100_crc16(const uint8_t *buf, int len);
+// CLOCK_MONOTONIC in microseconds, the clock of the library times
+long long tac1100_now_us(void);
+// First string of /proc/pid/cmdline (allocated), NULL if not running
+char *tac1100_pid_command(unsigned long pid);
+
+// Bulk decode of n reads of the same block b, e.g. one sweep of a fleet of
+// meters: raw holds the n register blocks as tac1100_read_registers()
+// returns them, stride (>= b->nb) registers apart. columns[r] (NULL for
+// the registers not wanted) receives the n values of register r times
+// scale[r] (scale NULL: 1, e.g. 1000 for the energy counters in Wh).
+// Reads with valid[i] == 0 give NaN (valid NULL: all valid). SIMD (SSE2 or
+// NEON) unless flags has TAC1100_BULK_SCALAR. Columns filled, or
+// TAC1100_EINVAL.
+#define TAC1100_BULK_SCALAR 1
+int tac1100_decode_bulk(const tac1100_block_t *b, const uint16_t *raw, int stride, int n,
+                        const float *scale, const uint8_t *valid, float *const *columns, int flags);
+// Instruction set of the bulk decode kernel: "sse2", "neon" or "scalar"
+const char *tac1100_decode_bulk_isa(void);
+
+int tac1100_errno(const tac1100_t *t);
+const char *tac1100_strerror(int code);
+const tac1100_lockstats_t *tac1100_lock_stats(const tac1100_t *t);
+const tac1100_recovery_t *tac1100_recovery_stats(const tac1100_t *t);
+// Circuit breaker of unit (0-247) on the port, NULL for other units
+const tac1100_health_t *tac1100_health(const tac1100_t *t, int unit);
+// Open circuit breaker of unit: send its next request as the probe
+void tac1100_probe_next(tac1100_t *t, int unit);
+
+// ====================================
+// EVENT DRIVEN ENGINE
+// ====================================
+//
+// Many ports from one thread: requests are written without waiting and
+// the responses collected with epoll on the serial ports, each with a
+// timerfd for the command delay and the response deadline. RTU framing
+// and CRC are done here, not by libmodbus. Every port keeps its lock
+// (lock file or TAC1100_LOCK_FD) and its exclusive bus lock until the
+// engine is freed; ports can't use TAC1100_LOCK_ARB, whose leases need
+// heartbeats. An engine must be used from one thread.
+//
+// Requests have a priority class. Between two transactions a port serves
+// the highest class with requests queued, so an operator's read or write
+// waits at most for the transaction on the bus, not for a whole sweep.
+// A class given a minimum share of the bus time (tac1100_engine_set_share(),
+// default 20% for POLL and 10% for BULK) is served first whenever it got
+// less than that since its queue was last empty: it can't starve.
+//
+// With tac1100_engine_set_coalesce() a read of the same unit and blocks
+// as one queued or in flight on the port (a scrape, a dashboard and a cron
+// job after the same meter) waits for that one and gets its values: one
+// transaction per block for all of them (single flight).
+//
+//   tac1100_engine_t *e = tac1100_engine_new();
+//   int bus1 = tac1100_engine_add_port(e, "/dev/ttyUSB0", &cfg);
+//   int bus2 = tac1100_engine_add_port(e, "/dev/ttyUSB1", &cfg);
+//   tac1100_engine_read(e, bus1, 1, selected, done, NULL);
+//   tac1100_engine_read(e, bus2, 1, selected, done, NULL);
+//   while (tac1100_engine_pending(e) > 0) tac1100_engine_run(e, -1);
+
+typedef struct tac1100_engine tac1100_engine_t;
+
+// Priority classes, highest first
+#define TAC1100_PRIO_INTERACTIVE 0  // Operator reads and writes
+#define TAC1100_PRIO_ALARM       1
+#define TAC1100_PRIO_POLL        2  // Periodic polling, tac1100_engine_read()
+#define TAC1100_PRIO_BULK        3  // History and other bulk transfers
+#define TAC1100_PRIO_CLASSES     4
+
+typedef struct {
+    long long requests;         // Reads and writes started
+    long long transactions;     // Requests on the bus, retries included
+    long long wait_us;          // Total queueing delay: queued until the first request went out
+    long long wait_max_us;
+    long long bus_us;           // Bus time of the transactions
+    long long coalesced;        // Reads served by an identical read in flight (not in requests)
+    long long saved;            // Transactions they didn't make
+} tac1100_prio_stats_t;
+
+typedef struct {
+    int port;                   // tac1100_engine_add_port() number
+    int unit;
+    int rc;                     // TAC1100_OK, TAC1100_EBUS or TAC1100_EOPEN (not sent, cfg.breaker_fails)
+    int err;                    // errno of the failure (ETIMEDOUT, EMBBADCRC, EMBX*...)
+    int requests;               // Requests sent, retries included
+    int prio;                   // TAC1100_PRIO_*
+    long long wait_us;          // Queueing delay before the first request
+    int coalesced;              // Served by an identical read of another caller (requests 0)
+    const int *selected;        // As submitted, NULL for a write
+    float values[TAC1100_NUM_REGS];         // Reads: meter units, kWh for the energy counters
+    long long times[TAC1100_NUM_REGS];      // Midpoint of the request/response (CLOCK_MONOTONIC us)
+} tac1100_result_t;
+
+typedef void (*tac1100_done_fn)(void *user, const tac1100_result_t *r);
+
+tac1100_engine_t *tac1100_engine_new(void);
+// Fail nothing: requests still queued are dropped without callback
+void tac1100_engine_free(tac1100_engine_t *e);
+// Lock and open a port with cfg (resp_timeout_us > 0): port number, or a TAC1100_E* code
+int tac1100_engine_add_port(tac1100_engine_t *e, const char *device, const tac1100_config_t *cfg);
+// Context of a port, for tac1100_set_log()/tac1100_set_xfer_hook() and the lock statistics
+tac1100_t *tac1100_engine_context(tac1100_engine_t *e, int port);
+// Queue a read of the selected registers (copied) of unit on port: done
+// is called from tac1100_engine_run() with the values or the failure.
+// Requests of a port go on the bus one after the other, ports in parallel.
+// Class TAC1100_PRIO_POLL.
+int tac1100_engine_read(tac1100_engine_t *e, int port, int unit, const int *selected, tac1100_done_fn done, void *user);
+// Same in class prio
+int tac1100_engine_read_prio(tac1100_engine_t *e, int port, int unit, const int *selected, int prio,
+                             tac1100_done_fn done, void *user);
+// Queue a write of one holding register (FC 0x10, not retried), as
+// tac1100_write() does
+int tac1100_engine_write(tac1100_engine_t *e, int port, int unit, int address, int value, int prio,
+                         tac1100_done_fn done, void *user);
+// Minimum share of the bus time of class prio (percent, all classes 100
+// at most, 0 for none)
+int tac1100_engine_set_share(tac1100_engine_t *e, int prio, int percent);
+// Attach a read to an identical one (same unit and block reads) of the
+// same or a higher class that has not read any block yet, or is on the
+// bus. Default off: every read makes its own transactions.
+void tac1100_engine_set_coalesce(tac1100_engine_t *e, int on);
+// Statistics of every class (stats[TAC1100_PRIO_CLASSES]) of a port, or
+// of all of them with port -1
+int tac1100_engine_prio_stats(const tac1100_engine_t *e, int port, tac1100_prio_stats_t *stats);
+// Requests queued or in flight
+int tac1100_engine_pending(const tac1100_engine_t *e);
+// epoll descriptor, readable when tac1100_engine_run() has work: to embed
+// the engine in another event loop
+int tac1100_engine_fd(const tac1100_engine_t *e);
+// Handle the events until nothing is pending, no event comes within
+// timeout_ms (-1: no limit) or a signal arrives; 0 makes a single
+// non-blocking pass. Number of requests completed.
+int tac1100_engine_run(tac1100_engine_t *e, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBTAC1100_H */
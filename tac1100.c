@@ -29,6 +29,7 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
 
 #include <time.h>
 #include <stdlib.h>
@@ -41,60 +42,20 @@ extern "C" {
 #include <ctype.h>
 #include <getopt.h>
 #include <syslog.h>
+#include <signal.h>
+#include <limits.h>
 
 
 #include <modbus-version.h>
 #include <modbus.h>
 
+#include "libtac1100.h"
+#include "tac1100regs.h"
+#include "tac1100cap.h"
+
 #define DEFAULT_RATE 9600
 
-// ====================================
-// TAC1100 MODBUS REGISTER ADDRESSES
-// ====================================
-
-#define VOLTAGE   0x0000    // Voltage (Float, V)
-#define CURRENT   0x0006    // Current (Float, A)
-#define POWER     0x000C    // Active power (Float, W)
-#define APOWER    0x0012    // Reactive power (Float, var)
-#define RAPOWER   0x0018    // Apparent power (Float, VA)
-#define PFACTOR   0x001E    // Power factor (Float)
-#define PANGLE    0x0024    // Phase angle (Float, Degrees)
-#define FREQUENCY 0x0030    // Frequency (Float, Hz)
-#define IAENERGY  0x0500    // Total import active energy (Float, kWh)
-#define EAENERGY  0x0502    // Total export active energy (Float, kWh)
-#define TAENERGY  0x0504    // Total active energy (Float, kWh)
-#define IRAENERGY 0x0508    // Total import reactive energy (Float, kvarh)
-#define ERAENERGY 0x050A    // Total export reactive energy (Float, kvarh)
-#define TRENERGY  0x050C    // Total reactive energy (Float, kvarh)
-
-// ====================================
-// TAC1100 MODBUS REGISTER ADDRESSES - WRITE
-// ====================================
-
-#define KPPA           0x5000   // Key Parameter Programming Authorization (Password per abilitare programmazione)
-#define DEMAND_PERIOD  0x5002   // Demand period (0-60 minuti, default 60)
-#define SLIDE_TIME     0x5003   // Slide time (1 to Demand Period-1, default 1)
-#define DEVICE_ID      0x5005   // Modbus address (1-247, default 1) - R nel protocollo ma scrivibile via pulsanti/modbus
-#define BAUD_RATE      0x5006   // Network Baud Rate (0=1200, 1=2400, 2=4800, 3=9600, 4=19200) - R nel protocollo ma scrivibile
-#define NPARSTOP       0x5007   // Parity and stop bit (0=N1, 1=E1, 2=O1, 3=N2) - R nel protocollo ma scrivibile
-#define PASSWORD       0x5008   // Password (default 0000, richiede KPPA)
-#define TIME_DISP      0x5018   // Automatic Scroll Display Time (0-60 secondi, 0=stop scroll, default 0)
-#define BACKLIT_TIME   0x5019   // Backlit time (0-120 o 255 minuti, 0=always on, 255=always off, default 60)
-#define SYSTEM_TIME    0x501A   // System time (BCD format: Year-Month-Date-Week-Hour-Minute-Second)
-#define TARIFF         0x501E   // Tariff configuration (BCD format: Tariff number-Min-Hour)
-#define RESET_HIST     0x5600   // Reset historical data (0=reset max demand, 8=reset monthly, 9=reset daily) - SOLO SCRITTURA
-#define METER_CODE     0x5601   // Meter code - SOLA LETTURA
-#define SERIAL_NUM     0x5602   // Serial number - SOLA LETTURA (4 bytes)
-#define SW_VERSION     0x5604   // Software version - SOLA LETTURA
-#define HW_VERSION     0x5605   // Hardware version - SOLA LETTURA
-#define DISP_VERSION   0x5606   // Display version - SOLA LETTURA
-#define FAULT_CODE     0x5607   // Fault code (0=No fault, 1=Battery low voltage) - SOLA LETTURA
-
-#define BR1200  0
-#define BR2400  1
-#define BR4800  2
-#define BR9600  3
-#define BR19200 4
+static const regdef_t *regs = tac1100_regs;
 
 #define MAX_RETRIES 100
 
@@ -107,6 +68,31 @@ extern "C" {
 
 #define DEBUG_STDERR 1
 #define DEBUG_SYSLOG 2
+#define LOG_RING_DEFAULT 1024   // --log-ring entries
+
+// Long-only command line options
+#define OPT_POLL    256
+#define OPT_RATE    257
+#define OPT_CYCLES  258
+#define OPT_MAX_GAP 259
+#define OPT_INTERPOLATE 260
+#define OPT_NO_ALIGN    261
+#define OPT_TIMESTAMPS  262
+#define OPT_STATS       263
+#define OPT_CAPTURE     264
+#define OPT_LOG_RING    265
+#define OPT_FD_LOCK     266
+#define OPT_BATCH       267
+#define OPT_ON_ERROR    268
+#define OPT_NATIVE_RTU  269
+#define OPT_ARBITER     270
+#define OPT_RECOVER     271
+#define OPT_PARTIAL     272
+#define OPT_BREAKER     273
+#define OPT_SECONDARY   274
+#define OPT_FAILOVER    275
+
+#define EXIT_PARTIAL    3           /* --partial: some values read, the others marked invalid */
 
 int debug_mask     = 0; //DEBUG_STDERR | DEBUG_SYSLOG; // Default, let pass all
 int debug_flag     = 0;
@@ -116,7 +102,6 @@ int metern_flag    = 0;
 
 const char *version     = "1.0";
 char *programName;
-const char *ttyLCKloc   = "/var/lock/LCK.."; /* location and prefix of serial port lock file */
 
 #define CMDLINESIZE 128            /* should be enough for debug */
 char cmdline[CMDLINESIZE]="";    
@@ -128,16 +113,84 @@ char *PARENTCOMMAND = NULL;
 static int yLockWait = 0;          /* Seconds to wait to lock serial port */
 static time_t command_delay = -1;  // = 30;  /* MilliSeconds to wait before sending a command */
 static time_t settle_time = -1;    // us to wait line to settle before starting chat
-
-char *devLCKfile = NULL;
-char *devLCKfileNew = NULL;
-FILE *fdModbusExclusiveLock = NULL;  // Exclusive lock file descriptor for ModBus communication
+static int max_gap = 16;           /* Max unused registers merged into a block read (poll mode) */
+static int interpolate_flag = 0;   /* Derive high resolution energy from power samples (poll mode) */
+static int align_flag = 1;         /* Align poll deadlines to wall clock multiples of the period */
+
+#define STAMP_NONE 0
+#define STAMP_WALL 1               /* Wall clock mapped from the monotonic capture time */
+#define STAMP_MONO 2               /* CLOCK_MONOTONIC capture time */
+static int stamp_flag = STAMP_NONE;
+static long long stamp_offset = 0; /* Monotonic to wall clock offset used for the output (us) */
+static long long read_time_us = 0; /* Midpoint of the last successful request/response (monotonic us) */
+
+static volatile sig_atomic_t poll_stop = 0;   /* Set by SIGINT/SIGTERM to end poll mode */
+
+#define BATCH_STOP     0           /* --on-error=stop: no command runs after a failed one */
+#define BATCH_CONTINUE 1
+static int batch_flag = 0;         /* --batch: bus errors fail the command, not the program */
+static int batch_on_error = BATCH_STOP;
+
+typedef struct {
+    const char *name;
+    long long period_us;        // Requested polling period
+    long long next_due;         // Next due time (us)
+    long long first;            // Time of first completed read (us)
+    long long last;             // Time of last completed read (us)
+    long samples;               // Completed reads
+    long long late_sum;         // Sum of cycle start lateness vs deadline (us)
+    long long late_max;         // Max lateness (us)
+    long skipped;               // Deadlines skipped because the bus was busy
+} pollgroup_t;
+
+static pollgroup_t groups[NUM_GROUPS] = {
+    { "power",  1000000LL    },
+    { "vi",     5000000LL    },
+    { "energy", 60000000LL   },
+    { "config", 3600000000LL },
+};
+
+int fd_lock_flag = 0;               // --fd-lock: flock() on the serial port, no lock file
+int native_rtu_flag = 0;            // --native-rtu: reads framed and decoded by libtac1100, not libmodbus
+int arbiter_flag = 0;               // --arbiter: turns granted by tools/tac1100arb, no lock file
+char *arbiter_socket = NULL;        // its socket, NULL: TAC1100_ARB_PREFIX + port name
+int recover_max = -1;               // --recover: highest TAC1100_RECOVER_* tier, -1 exit on a bus fault
+int recover_fails = 0;              // Failed cycles or commands in a row, the tier to use next
+int partial_flag = 0;               // --partial: a failed value is printed invalid, the others still read
+int breaker_fails = 0;              // --breaker=K,N,ms: circuit breaker of every meter, 0 off
+int breaker_probe = 10;
+long probe_timeout_ms = 0;          // 0: the response timeout (-j)
+char *secondary_device = NULL;      // --secondary: second adapter to the same meters (poll mode)
+int failover_percent = 50;          // --failover=percent,window,probe
+int failover_window = 10;           // Transactions of the active path the rate is taken over
+int failover_probe = 10;            // Cycles on the secondary between probes of the primary
+int path_retries = 1;               // -z, given back to the primary after a probe
+
+// Redundant serial paths (--secondary): the same meters behind two adapters
+#define PATH_PRIMARY    0
+#define PATH_SECONDARY  1
+#define NUM_PATHS       2
+#define PATH_WINDOW_MAX 64
+
+typedef struct {
+    const char *device;
+    tac1100_t *ctx;
+    unsigned char window[PATH_WINDOW_MAX];  // Outcome of the last transactions, 1 failed
+    int wlen, wpos, wfails;
+    unsigned long requests;         // Transactions made over the path
+    unsigned long failures;         // Of which errors and timeouts (exceptions are answers)
+    unsigned long failovers;        // Times the polling left the path
+    unsigned long probes;           // Health probes of the primary while on the secondary
+    unsigned long probe_failures;
+} buspath_t;
+
+static buspath_t paths[NUM_PATHS];
+static int path_active = PATH_PRIMARY;
+static int path_cycles = 0;         // Cycles on the secondary since the last probe
 
 // Forward declarations
-void releaseModbusExclusiveLock(void);
-void ClrSerLock(long unsigned int PID);
-void AddSerLock(const char *szttyDevice, const char *devLCKfile, const long unsigned int PID, const char *COMMAND, int debug_flag);
-void exit_error(modbus_t *ctx);
+void exit_error(tac1100_t *ctx);
+void *getMemPtr(size_t sSize);
 
 void usage(char* program) {
     printf("TAC1100c %s: ModBus RTU client to read TAC1100 series smart mini power meter registers\n",version);
@@ -152,7 +205,8 @@ void usage(char* program) {
     printf("       %s [-a address] [-d n] [-x] [-b baud_rate] [-P parity] [-S bit] [-z num_retries] [-j seconds] [-w seconds] -U slide_time device\n", program);
     printf("       %s [-a address] [-d n] [-x] [-b baud_rate] [-P parity] [-S bit] [-z num_retries] [-j seconds] [-w seconds] -R scroll_time device\n", program);
     printf("       %s [-a address] [-d n] [-x] [-b baud_rate] [-P parity] [-S bit] [-z num_retries] [-j seconds] [-w seconds] -G backlit_time device\n", program);
-    printf("       %s [-a address] [-d n] [-x] [-b baud_rate] [-P parity] [-S bit] [-z num_retries] [-j seconds] [-w seconds] -Q current_password -H reset_type device\n\n", program);
+    printf("       %s [-a address] [-d n] [-x] [-b baud_rate] [-P parity] [-S bit] [-z num_retries] [-j seconds] [-w seconds] -Q current_password -H reset_type device\n", program);
+    printf("       %s [-a address] [-d n] [-x] [-p] [-v] [-c] [-e] [-i] [-t] [-f] [-g] [-T] [[-m]|[-q]] --poll [--rate group=seconds,...] [--cycles n] [--max-gap n] [--no-align] [--interpolate] [--secondary=device] device\n\n", program);
     printf("Required:\n");
     printf("\tdevice\t\tSerial device (i.e. /dev/ttyUSB0)\n");
     printf("Connection parameters:\n");
@@ -179,6 +233,9 @@ void usage(char* program) {
     printf("\t-T \t\tGet Time for automatic scroll display (0=no rotation)\n");
     printf("\t-m \t\tOutput values in IEC 62056 format ID(VALUE*UNIT)\n");
     printf("\t-q \t\tOutput values in compact mode\n");
+    printf("\t--timestamps[=wall|mono]\n");
+    printf("\t\t\tAppend to every value its capture time (midpoint of the\n");
+    printf("\t\t\trequest/response) as seconds.microseconds. Default: wall\n");
     printf("Writing new settings parameters:\n");
     printf("\t-s new_address \tSet new meter number (1-247)\n");
     printf("\t-r baud_rate \tSet baud_rate meter speed (1200, 2400, 4800, 9600, 19200)\n");
@@ -203,6 +260,29 @@ void usage(char* program) {
     printf("  Reset max demand:       %s -Q 1234 -H 0 /dev/ttyUSB0\n", program);
     printf("  Change meter address:   %s -s 5 /dev/ttyUSB0\n", program);
     printf("\n");
+    printf("Polling mode:\n");
+    printf("\t--poll\t\tRead the selected values continuously, each group at its own rate\n");
+    printf("\t--rate group=seconds[,group=seconds...]\n");
+    printf("\t\t\tPolling period per group (0.1-86400s). Defaults:\n");
+    printf("\t\t\tpower=1 (-p -l -n), vi=5 (-v -c -g -o -f),\n");
+    printf("\t\t\tenergy=60 (-i -e -t -A -B -C), config=3600 (-T)\n");
+    printf("\t--cycles n\tStop after n polling cycles. Default: 0 (until SIGINT/SIGTERM)\n");
+    printf("\t--max-gap n\tMerge registers up to n unused registers apart into one\n");
+    printf("\t\t\tblock read (0-125, 0=only contiguous). Default: 16\n");
+    printf("\t--no-align\tDo not align the polling instants to wall clock multiples\n");
+    printf("\t\t\tof the period (e.g. :00, :05 for 5s)\n");
+    printf("\t--interpolate\tAlso output import/export active and reactive energy\n");
+    printf("\t\t\tintegrated from the power samples between counter reads\n");
+    printf("\n");
+    printf("Batch mode:\n");
+    printf("\t--batch[=file]\tRun the commands of file (default: stdin), one per line,\n");
+    printf("\t\t\twith the read/write options above plus -a and -z, e.g.\n");
+    printf("\t\t\t\"-a 3 -v -c\" or \"-a 7 -G 5\". Prints one line per command:\n");
+    printf("\t\t\t\"<line> OK [values]\" or \"<line> NOK <reason>\"\n");
+    printf("\t--on-error=stop|continue\n");
+    printf("\t\t\tAfter a failed command stop or run the next ones.\n");
+    printf("\t\t\tDefault: stop. Exit status 1 if any command failed\n");
+    printf("\n");
     printf("Fine tuning & debug parameters:\n");
     printf("\t-z num_retries\tTry to read max num_retries times on bus before exiting\n");
     printf("\t\t\twith error. Default: 1 (no retry)\n");
@@ -214,43 +294,76 @@ void usage(char* program) {
     printf("\t-d debug_level\tDebug (0=disable, 1=debug, 2=errors to syslog, 3=both)\n");
     printf("\t\t\tDefault: 0\n");
     printf("\t-x \t\tTrace (libmodbus debug on)\n");
+    printf("\t--stats[=file]\tDump bus statistics (JSON) at exit to file or stderr.\n");
+    printf("\t\t\tIn poll mode the file is also updated every second\n");
+    printf("\t--capture=file\tAppend every request/response frame with its time to a\n");
+    printf("\t\t\tbinary capture file (tools/tac1100cap decodes it)\n");
+    printf("\t--log-ring[=n]\tKeep up to n (default %d) debug messages in memory, write\n", LOG_RING_DEFAULT);
+    printf("\t\t\tthem out when the bus is free: -d without timing changes\n");
+    printf("\t--fd-lock\tLock the serial port itself (flock) instead of\n");
+    printf("\t\t\tthe %s lock file: only when every client is tac1100\n", TAC1100_LOCK_PREFIX);
+    printf("\t--native-rtu\tFrame, check and decode the reads in tac1100 instead of\n");
+    printf("\t\t\tlibmodbus: less CPU per request (writes still use libmodbus)\n");
+    printf("\t--arbiter[=socket]\n");
+    printf("\t\t\tTake turns on the bus from the bus arbiter (tools/tac1100arb)\n");
+    printf("\t\t\tinstead of the lock file. Default: %s + port name\n", TAC1100_ARB_PREFIX);
+    printf("\t--recover[=flush|reconnect|reopen]\n");
+    printf("\t\t\tPoll and batch modes: after a bus fault bring the bus back\n");
+    printf("\t\t\tand go on, escalating up to the tier given with the\n");
+    printf("\t\t\tfailures in a row. Default: reopen. Without it poll exits\n");
+    printf("\t\t\tat the first lost cycle (but with --breaker or --secondary)\n");
+    printf("\t--partial\tKeep the values read when others fail: NaN (IEC: empty)\n");
+    printf("\t\t\tfor a failed value, PARTIAL instead of OK, exit status %d\n", EXIT_PARTIAL);
+    printf("\t--breaker=fails[,probe[,ms]]\n");
+    printf("\t\t\tPoll and batch modes: after fails failed requests in a\n");
+    printf("\t\t\trow skip a meter, send one request in probe (default 10)\n");
+    printf("\t\t\tonce with an ms response timeout (default -j) until it answers\n");
+    printf("\t--secondary=device\n");
+    printf("\t\t\tPoll mode: second adapter to the same meters, taken over\n");
+    printf("\t\t\twhen a cycle is lost on device or its failure rate is high\n");
+    printf("\t--failover=percent[,window[,probe]]\n");
+    printf("\t\t\tFail over at percent failed of the last window transactions,\n");
+    printf("\t\t\tprobe device every probe cycles to fail back. Default: 50,10,10\n");
 }
 
 /*--------------------------------------------------------------------------
-    tv_diff
+    wall_offset_us
+    Offset to add to tac1100_now_us() to get the wall clock (CLOCK_REALTIME)
 ----------------------------------------------------------------------------*/
-static long inline tv_diff(struct timeval const * const t1, struct timeval const * const t2)
+static long long wall_offset_us(void)
 {
-    struct timeval res;
-    timersub(t1, t2, &res);
-    return res.tv_sec*1000000 + res.tv_usec;
+    struct timespec ts;
+    long long mono;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    mono = tac1100_now_us();
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - mono;
 }
 
 /*--------------------------------------------------------------------------
-        rnd_usleep
+    formatStamp
+    Capture time of a value as seconds.microseconds, empty if disabled
 ----------------------------------------------------------------------------*/
-static long inline rnd_usleep(const useconds_t usecs)
+static void formatStamp(char *buf, size_t len, long long t)
 {
-    long unsigned rnd10 = 10.0*rand()/(RAND_MAX+1.0) + 1;
-    if (usleep(usecs*rnd10) == 0)
-        return usecs*rnd10;
-    else
-        return -1;
+    if (stamp_flag == STAMP_NONE) {
+        *buf = '\0';
+        return;
+    }
+    if (stamp_flag == STAMP_WALL) t += stamp_offset;
+    snprintf(buf, len, "%lld.%06lld", t / 1000000LL, t % 1000000LL);
 }
 
 /*--------------------------------------------------------------------------
-    getCurTime
+    formatTime
+    Local time of tv as "YYYY-MM-DD hh:mm:ss.uuuuuu"
 ----------------------------------------------------------------------------*/
-char* getCurTime()
+static char* formatTime(const struct timeval *tv)
 {
     time_t curTimeValue;
     struct tm *ltime;
-    static struct timeval _t;
-    static struct timezone tz;
     static char retTimeValue[85];  // Aumentato da 24 a 85 per evitare overflow
 
-    gettimeofday(&_t, &tz);
-    curTimeValue = _t.tv_sec;
+    curTimeValue = tv->tv_sec;
     ltime = localtime(&curTimeValue);
     sprintf(retTimeValue, "%04d-%02d-%02d %02d:%02d:%02d.%06ld",
             ltime->tm_year + 1900,
@@ -259,32 +372,311 @@ char* getCurTime()
             ltime->tm_hour,
             ltime->tm_min,
             ltime->tm_sec,
-            _t.tv_usec);
+            (long)tv->tv_usec);
 
     return retTimeValue;
 }
 
 /*--------------------------------------------------------------------------
-    log_message
+    getCurTime
 ----------------------------------------------------------------------------*/
-void log_message(int type, char *format, ...)
+char* getCurTime()
+{
+    static struct timeval _t;
+    static struct timezone tz;
+
+    gettimeofday(&_t, &tz);
+    return formatTime(&_t);
+}
+
+/*--------------------------------------------------------------------------
+    Log ring (--log-ring)
+    log_message() formatting a time stamp, the message and writing it out
+    (stderr flushed, syslog) costs tens of us, often between two frames:
+    debugging changes the timing being debugged. With the ring the call
+    only stores the time, the format pointer (always a literal) and the
+    raw arguments (strings copied, they may be transient buffers) in a
+    preallocated slot. The messages are formatted and written out when
+    the bus is released, when the ring is full and at exit, all in this
+    single thread: no locks needed.
+----------------------------------------------------------------------------*/
+#define LOG_MAX_ARGS     10
+#define LOG_STR_SIZE     128
+
+typedef union {
+    long long i;
+    unsigned long long u;
+    double d;
+    void *p;
+    int s;                      // Offset of a string in str
+} logarg_t;
+
+typedef struct {
+    struct timeval tv;
+    const char *format;
+    int type;
+    int nargs;
+    logarg_t args[LOG_MAX_ARGS];
+    char str[LOG_STR_SIZE];
+} logentry_t;
+
+static logentry_t *log_ring = NULL;
+static int log_ring_size = 0;
+static int log_ring_head = 0;   // Next slot to fill
+static int log_ring_count = 0;
+static unsigned long log_ring_records = 0, log_ring_full = 0;
+
+static void logRingDrain(void);
+
+/*--------------------------------------------------------------------------
+    logSpec
+    Parse the conversion at f ('%' excluded): fills spec with flags, width
+    and precision, sets the length modifier and the conversion character,
+    returns the length parsed
+----------------------------------------------------------------------------*/
+static int logSpec(const char *f, char *spec, size_t len, char *lenmod, char *conv)
+{
+    const char *p = f;
+    size_t n;
+
+    while (*p && strchr("-+ #0123456789.", *p)) p++;
+    n = p - f < (int)len - 1 ? (size_t)(p - f) : len - 1;
+    memcpy(spec, f, n);
+    spec[n] = '\0';
+    *lenmod = '\0';
+    if (*p == 'h') {
+        *lenmod = 'h';
+        p++;
+        if (*p == 'h') p++;
+    } else if (*p == 'l') {
+        *lenmod = 'l';
+        p++;
+        if (*p == 'l') {
+            *lenmod = 'L';      // long long
+            p++;
+        }
+    } else if (*p && strchr("zjt", *p)) {
+        *lenmod = *p++;
+    }
+    *conv = *p;
+    return p - f + (*p ? 1 : 0);
+}
+
+/*--------------------------------------------------------------------------
+    logRingRecord
+    Store a message in the ring, 0 if it can't be stored (the caller
+    writes it out directly)
+----------------------------------------------------------------------------*/
+static int logRingRecord(int type, const char *format, va_list ap)
+{
+    logentry_t *e;
+    const char *f;
+    char spec[32], lenmod, conv;
+    int str_len = 0;
+
+    if (log_ring_count == log_ring_size) {
+        log_ring_full++;
+        logRingDrain();
+    }
+    e = &log_ring[log_ring_head];
+    gettimeofday(&e->tv, NULL);
+    e->format = format;
+    e->type = type;
+    e->nargs = 0;
+
+    for (f = format; *f; f++) {
+        logarg_t *a;
+        if (*f != '%') continue;
+        if (*++f == '%') continue;
+        f += logSpec(f, spec, sizeof(spec), &lenmod, &conv) - 1;
+        if (e->nargs == LOG_MAX_ARGS) return 0;
+        a = &e->args[e->nargs++];
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (lenmod == 'l') a->i = va_arg(ap, long);
+                else if (lenmod == 'L') a->i = va_arg(ap, long long);
+                else if (lenmod == 'z' || lenmod == 't') a->i = va_arg(ap, ssize_t);
+                else if (lenmod == 'j') a->i = va_arg(ap, intmax_t);
+                else a->i = va_arg(ap, int);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                if (lenmod == 'l') a->u = va_arg(ap, unsigned long);
+                else if (lenmod == 'L') a->u = va_arg(ap, unsigned long long);
+                else if (lenmod == 'z' || lenmod == 't') a->u = va_arg(ap, size_t);
+                else if (lenmod == 'j') a->u = va_arg(ap, uintmax_t);
+                else a->u = va_arg(ap, unsigned int);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                a->d = va_arg(ap, double);
+                break;
+            case 'p':
+                a->p = va_arg(ap, void *);
+                break;
+            case 's': {
+                const char *str = va_arg(ap, const char *);
+                int n;
+                if (str == NULL) str = "(null)";
+                n = strlen(str) + 1;
+                if (n > LOG_STR_SIZE - str_len) return 0;
+                a->s = str_len;
+                memcpy(e->str + str_len, str, n);
+                str_len += n;
+                break;
+            }
+            default:
+                return 0;       // Nothing the ring knows how to keep
+        }
+    }
+    log_ring_head = (log_ring_head + 1) % log_ring_size;
+    log_ring_count++;
+    log_ring_records++;
+    return 1;
+}
+
+/*--------------------------------------------------------------------------
+    logRingFormat
+    The message of an entry, as vsnprintf() would have written it
+----------------------------------------------------------------------------*/
+static void logRingFormat(const logentry_t *e, char *out, size_t len)
+{
+    const char *f;
+    char spec[40], lenmod, conv;
+    size_t n = 0;
+    int k = 0;
+
+    for (f = e->format; *f && n < len - 1; f++) {
+        const logarg_t *a;
+        if (*f != '%' || f[1] == '%') {
+            out[n++] = *f;
+            if (*f == '%') f++;
+            continue;
+        }
+        f++;
+        f += logSpec(f, spec + 1, sizeof(spec) - 4, &lenmod, &conv) - 1;
+        a = &e->args[k++];
+        spec[0] = '%';
+        switch (conv) {
+            case 'd':
+            case 'i':
+                strcat(spec, "ll");
+                strncat(spec, &conv, 1);
+                n += snprintf(out + n, len - n, spec, a->i);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                strcat(spec, "ll");
+                strncat(spec, &conv, 1);
+                n += snprintf(out + n, len - n, spec, a->u);
+                break;
+            case 'c':
+                strcat(spec, "c");
+                n += snprintf(out + n, len - n, spec, (int)a->u);
+                break;
+            case 'p':
+                strcat(spec, "p");
+                n += snprintf(out + n, len - n, spec, a->p);
+                break;
+            case 's':
+                strcat(spec, "s");
+                n += snprintf(out + n, len - n, spec, e->str + a->s);
+                break;
+            default:
+                strncat(spec, &conv, 1);
+                n += snprintf(out + n, len - n, spec, a->d);
+                break;
+        }
+    }
+    if (n > len - 1) n = len - 1;
+    out[n] = '\0';
+}
+
+/*--------------------------------------------------------------------------
+    logRingDrain
+    Format and write out the messages in the ring, oldest first
+----------------------------------------------------------------------------*/
+static void logRingDrain(void)
+{
+    char msg[512];
+    int i;
+
+    if (log_ring_count == 0) return;
+    i = (log_ring_head - log_ring_count + log_ring_size) % log_ring_size;
+    for (; log_ring_count > 0; log_ring_count--, i = (i + 1) % log_ring_size) {
+        logentry_t *e = &log_ring[i];
+        logRingFormat(e, msg, sizeof(msg));
+        if (e->type & DEBUG_STDERR) {
+            fprintf(stderr, "%s %s[%lu]: %s\n", formatTime(&e->tv), programName, PID, msg);
+        }
+        if (e->type & DEBUG_SYSLOG) {
+            syslog(LOG_INFO, "%s %s[%lu]: %s\n", formatTime(&e->tv), programName, PID, msg);
+        }
+    }
+    fflush(stderr);
+}
+
+static void logRingAtExit(void)
+{
+    logRingDrain();
+    if (log_ring_full > 0 && (debug_mask & DEBUG_STDERR)) {
+        fprintf(stderr, "%s %s[%lu]: Log ring: %lu messages, drained %lu times on full ring\n", getCurTime(),
+                programName, PID, log_ring_records, log_ring_full);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    logRingOpen
+    Allocate a ring of entries messages, written out at exit
+----------------------------------------------------------------------------*/
+static void logRingOpen(int entries)
+{
+    if (log_ring != NULL) return;
+    log_ring = getMemPtr(entries * sizeof(logentry_t));
+    log_ring_size = entries;
+    atexit(logRingAtExit);
+}
+
+/*--------------------------------------------------------------------------
+    vlog_message
+----------------------------------------------------------------------------*/
+void vlog_message(int type, const char *format, va_list args)
 {
     char fmt[256];
     va_list ap;
 
     if (type & debug_mask) {
 
+        if (log_ring != NULL) {
+            int stored;
+            va_copy(ap, args);
+            stored = logRingRecord(type, format, ap);
+            va_end(ap);
+            if (stored) return;
+            logRingDrain();     // Keep the order
+        }
+
         snprintf(fmt, sizeof(fmt), "%s %s[%lu]: %s\n", getCurTime(), programName, PID, format);
         //snprintf(fmt, sizeof(fmt), "%s %s[%lu(%lu)]<%s>: %s\n", getCurTime(), programName, PID, PPID, (PARENTCOMMAND == NULL ? "" : PARENTCOMMAND), format);
 
-        va_start(ap, format);
+        va_copy(ap, args);
         if (type & DEBUG_STDERR) {
             vfprintf(stderr, fmt, ap);
             fflush(stderr);
         }
         va_end(ap);
 
-        va_start(ap, format);
+        va_copy(ap, args);
         if (type & DEBUG_SYSLOG) {
             vsyslog(LOG_INFO, fmt, ap);
         }
@@ -292,6 +684,18 @@ void log_message(int type, char *format, ...)
     }
 }
 
+/*--------------------------------------------------------------------------
+    log_message
+----------------------------------------------------------------------------*/
+void log_message(int type, char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vlog_message(type, format, ap);
+    va_end(ap);
+}
+
 /*--------------------------------------------------------------------------
     getCmdLine
 ----------------------------------------------------------------------------*/
@@ -339,153 +743,767 @@ void *getMemPtr(size_t sSize)
     return pMem;
 }
 
+inline int bcd2int(int val)
+{
+    return((((val & 0xf0) >> 4) * 10) + (val & 0xf));
+}
+
+int int2bcd(int val)
+{
+    return(((val / 10) << 4) + (val % 10));
+}
+
+int bcd2num(const uint16_t *src, int len)
+{
+    int n = 0;
+    int m = 1;
+    int i = 0;
+    int shift = 0;
+    int digit = 0;
+    int j = 0;
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < 4; j++) {
+            digit = ((src[len-1-i]>>shift) & 0x0F) * m;
+            n += digit;
+            m *= 10;
+            shift += 4;
+        }
+    }
+    return n;
+}
+
+/*--------------------------------------------------------------------------
+    Bus statistics
+    Counters per (port, address, function code) and a log2 bucketed
+    histogram of the transaction time. Fixed size, no allocation: when the
+    table is full the last entry collects everything else.
+----------------------------------------------------------------------------*/
+#define STATS_MAX_ENTRIES 16
+#define STATS_BUCKETS     24        // Bucket i counts times < 2^i us, the last one is unbounded
+
+typedef struct {
+    int used;
+    int address;                    // Slave address, -1 in the overflow entry
+    int fc;                         // Function code, -1 in the overflow entry
+    unsigned long requests;         // Requests sent (including retries)
+    unsigned long successes;
+    unsigned long timeouts;
+    unsigned long crc_errors;
+    unsigned long exceptions;       // ModBus exception responses
+    unsigned long other_errors;
+    unsigned long retries;          // Requests repeated after a failure
+    long long time_sum;             // Sum of transaction times (us)
+    long long time_min;
+    long long time_max;
+    unsigned long hist[STATS_BUCKETS];
+} busstats_t;
+
+static busstats_t bus_stats[STATS_MAX_ENTRIES];
+static const char *stats_port = NULL;   // Serial device the counters refer to
+static char *stats_file = NULL;         // NULL: dump to stderr at exit
+static int stats_flag = 0;
+static long long stats_start = 0;
+static long long stats_written = 0;     // Last live file update (us)
+
+// Lock contention, copied from the library context when it is closed
+static tac1100_lockstats_t lock_stats;
+static tac1100_recovery_t recovery_stats;
+#define STATS_UNITS 248                 // ModBus unit addresses 0-247
+static tac1100_health_t health_stats[STATS_UNITS];
+static tac1100_t *stats_bus = NULL;     // Open context, source of lock_stats and recovery_stats
+
+// Wall time spent in each phase of the run, accumulated by phaseMark()
+#define PH_STARTUP      0   // main() up to the lock request
+#define PH_LOCK         1   // tac1100_lock_port() and exclusive bus lock
+#define PH_CONNECT      2   // modbus context setup and modbus_connect()
+#define PH_TRANSACTIONS 3   // ModBus requests (reads and writes)
+#define PH_OUTPUT       4   // Formatting and printing the values
+#define PH_TEARDOWN     5   // Close, lock release, exit
+#define NUM_PHASES      6
+
+static const char *phase_names[NUM_PHASES] = { "startup", "lock", "connect", "transactions", "output", "teardown" };
+static long long phase_us[NUM_PHASES];
+static long long phase_mark = 0;        // End of the last accounted phase (us)
+
 /*--------------------------------------------------------------------------
-    ClrSerLock
+    phaseMark
+    Charge the time since the previous mark to phase ph
 ----------------------------------------------------------------------------*/
-void ClrSerLock(long unsigned int PID)
+void phaseMark(int ph)
 {
-    FILE *fdserlck;
-    long unsigned int LckPID;
-    char *COMMAND = NULL;
-    int fLen = 0;
-    int curChar = 0;
+    long long t = tac1100_now_us();
 
-    // Always release exclusive ModBus lock before clearing serial lock
-    releaseModbusExclusiveLock();
+    phase_us[ph] += t - phase_mark;
+    phase_mark = t;
+}
 
-    if ((fdserlck = fopen(devLCKfile, "r")) == NULL) {
-        log_message(debug_flag | DEBUG_SYSLOG, "ClrSerLock(): can't open lock file: %s for read.", devLCKfile);
-        return;
+static busstats_t *statsEntry(int address, int fc)
+{
+    int i;
+
+    for (i = 0; i < STATS_MAX_ENTRIES - 1; i++) {
+        if (!bus_stats[i].used) {
+            bus_stats[i].used = 1;
+            bus_stats[i].address = address;
+            bus_stats[i].fc = fc;
+            return &bus_stats[i];
+        }
+        if (bus_stats[i].address == address && bus_stats[i].fc == fc) return &bus_stats[i];
     }
+    bus_stats[i].used = 1;
+    bus_stats[i].address = -1;
+    bus_stats[i].fc = -1;
+    return &bus_stats[i];
+}
 
-    // Acquire exclusive lock before clearing - wait for all shared locks to release
-    // Note: During normal operation, we use LOCK_SH (shared lock) which allows
-    // multiple processes to access the serial port. This works well when processes
-    // communicate with different ModBus addresses. However, if multiple instances
-    // try to communicate simultaneously (even with the same address), there's a small
-    // chance of bus collisions. Use -z option for retries to handle this gracefully.
-    log_message(debug_flag, "Acquiring exclusive lock on %s to clear...", devLCKfile);
-    flock(fileno(fdserlck), LOCK_EX);   // Will wait to acquire lock then continue
-    log_message(debug_flag, "Exclusive lock on %s acquired.", devLCKfile);
+/*--------------------------------------------------------------------------
+    statsRecord
+    Account one request: rc == -1 classifies errno_save, retry != 0 if the
+    request repeats a failed one
+----------------------------------------------------------------------------*/
+void statsRecord(int address, int fc, int rc, int errno_save, long long elapsed, int retry)
+{
+    busstats_t *st = statsEntry(address, fc);
+    int b = 0;
+
+    st->requests++;
+    if (retry) st->retries++;
+    if (rc != -1) {
+        st->successes++;
+    } else if (errno_save == ETIMEDOUT) {
+        st->timeouts++;
+    } else if (errno_save == EMBBADCRC) {
+        st->crc_errors++;
+    } else if (errno_save >= EMBXILFUN && errno_save <= EMBXGTAR) {
+        st->exceptions++;
+    } else {
+        st->other_errors++;
+    }
 
-    while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n' && curChar != ' ') fLen++;
-    fLen = 0;
-    if (curChar == ' ') while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n') fLen++;
+    if (elapsed < 0) elapsed = 0;
+    st->time_sum += elapsed;
+    if (st->requests == 1 || elapsed < st->time_min) st->time_min = elapsed;
+    if (elapsed > st->time_max) st->time_max = elapsed;
+    while (b < STATS_BUCKETS - 1 && elapsed >= (1LL << b)) b++;
+    st->hist[b]++;
+}
 
-    rewind(fdserlck);
-    
-    COMMAND = getMemPtr(fLen+1);
-    COMMAND[0] = '\0';
-    LckPID = 0;
-    
-    int bRead = fscanf(fdserlck, "%lu%*[ ]%[^\n]\n", &LckPID, COMMAND);
-    
-    if (bRead != EOF && LckPID > 0) {
-        if (LckPID != PID) {
-            log_message(debug_flag | DEBUG_SYSLOG, "Lock held by process (%lu)%s, can't clear for process (%lu)", LckPID, COMMAND, PID);
-            fclose(fdserlck);  // Release exclusive lock
-            free(COMMAND);
-            return;
+/*--------------------------------------------------------------------------
+    statsSnapshot
+    Counters kept by the context, also for after it is closed
+----------------------------------------------------------------------------*/
+void statsSnapshot(tac1100_t *ctx)
+{
+    int u;
+
+    lock_stats = *tac1100_lock_stats(ctx);
+    recovery_stats = *tac1100_recovery_stats(ctx);
+    for (u = 0; u < STATS_UNITS; u++) health_stats[u] = *tac1100_health(ctx, u);
+}
+
+/*--------------------------------------------------------------------------
+    jsonEscape
+    s as the contents of a JSON string: quote, backslash and control
+    characters escaped. Truncated to fit out, never inside an escape
+----------------------------------------------------------------------------*/
+static const char *jsonEscape(char *out, size_t len, const char *s)
+{
+    size_t n = 0;
+    char esc[8];
+
+    for (; s != NULL && *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        size_t k;
+        if (c == '"' || c == '\\') {
+            snprintf(esc, sizeof(esc), "\\%c", c);
+        } else if (c < 0x20 || c == 0x7F) {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+        } else {
+            esc[0] = c;
+            esc[1] = '\0';
         }
+        k = strlen(esc);
+        if (n + k >= len) break;
+        memcpy(out + n, esc, k);
+        n += k;
     }
+    out[n] = '\0';
+    return out;
+}
 
-    // Keep file open with exclusive lock while deleting to prevent race conditions
-    if (unlink(devLCKfileNew) != 0 && errno != ENOENT) {
-        log_message(DEBUG_SYSLOG, "ClrSerLock(): unlink(%s): (%d) %s", devLCKfileNew, errno, strerror(errno));
+/*--------------------------------------------------------------------------
+    statsDump
+----------------------------------------------------------------------------*/
+void statsDump(FILE *fp)
+{
+    char esc[1024];
+    int i, b, first = 1;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"program\": \"tac1100\",\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", version);
+    fprintf(fp, "  \"pid\": %lu,\n", PID);
+    fprintf(fp, "  \"port\": \"%s\",\n", jsonEscape(esc, sizeof(esc), stats_port));
+    fprintf(fp, "  \"uptime_us\": %lld,\n", tac1100_now_us() - stats_start);
+    if (stats_bus != NULL) statsSnapshot(stats_bus);
+    fprintf(fp, "  \"phases_us\": {");
+    for (i = 0; i < NUM_PHASES; i++) {
+        fprintf(fp, "%s\"%s\": %lld", i ? ", " : "", phase_names[i], phase_us[i]);
+    }
+    fprintf(fp, "},\n");
+    fprintf(fp, "  \"lock\": {\"mode\": \"%s\", \"add_us\": %lld, \"shared_us\": %lld, \"shared_wait_us\": %lld, \"shared_retries\": %lu, "
+                "\"checks\": %lu, \"stale_suspects\": %lu, \"stale_cleared\": %lu, \"missing_pid\": %lu, \"amended\": %lu,\n",
+            fd_lock_flag ? "fd" : arbiter_flag ? "arbiter" : "uucp", lock_stats.add_us, lock_stats.shared_us, lock_stats.shared_wait_us,
+            lock_stats.shared_retries, lock_stats.checks, lock_stats.stale_suspects, lock_stats.stale_cleared,
+            lock_stats.missing_pid, lock_stats.amended);
+    fprintf(fp, "           \"holder_pid\": %lu, \"holder_cmd\": \"%s\", \"exclusive_count\": %lu, \"exclusive_us\": %lld, "
+                "\"exclusive_sum_us\": %lld, \"exclusive_max_us\": %lld},\n",
+            lock_stats.holder_pid, jsonEscape(esc, sizeof(esc), lock_stats.holder_cmd), lock_stats.exclusive_count, lock_stats.exclusive_us,
+            lock_stats.exclusive_sum_us, lock_stats.exclusive_max_us);
+    fprintf(fp, "  \"recovery\": {\"flush\": %lu, \"flush_recovered\": %lu, \"reconnect\": %lu, \"reconnect_recovered\": %lu, "
+                "\"reopen\": %lu, \"reopen_recovered\": %lu, \"failed\": %lu},\n",
+            recovery_stats.count[TAC1100_RECOVER_FLUSH], recovery_stats.recovered[TAC1100_RECOVER_FLUSH],
+            recovery_stats.count[TAC1100_RECOVER_RECONNECT], recovery_stats.recovered[TAC1100_RECOVER_RECONNECT],
+            recovery_stats.count[TAC1100_RECOVER_REOPEN], recovery_stats.recovered[TAC1100_RECOVER_REOPEN],
+            recovery_stats.failed);
+    fprintf(fp, "  \"meters\": [");
+    for (i = 0; i < STATS_MAX_ENTRIES; i++) {
+        busstats_t *st = &bus_stats[i];
+        int bfirst = 1;
+        if (!st->used) continue;
+        fprintf(fp, "%s\n    {\"address\": %d, \"function\": %d, \"requests\": %lu, \"successes\": %lu, "
+                    "\"timeouts\": %lu, \"crc_errors\": %lu, \"exceptions\": %lu, \"other_errors\": %lu, \"retries\": %lu,\n",
+                first ? "" : ",", st->address, st->fc, st->requests, st->successes,
+                st->timeouts, st->crc_errors, st->exceptions, st->other_errors, st->retries);
+        fprintf(fp, "     \"time_us\": {\"min\": %lld, \"max\": %lld, \"sum\": %lld, \"histogram\": [",
+                st->time_min, st->time_max, st->time_sum);
+        for (b = 0; b < STATS_BUCKETS; b++) {
+            if (st->hist[b] == 0) continue;
+            if (b < STATS_BUCKETS - 1) {
+                fprintf(fp, "%s[%lld, %lu]", bfirst ? "" : ", ", 1LL << b, st->hist[b]);
+            } else {
+                fprintf(fp, "%s[null, %lu]", bfirst ? "" : ", ", st->hist[b]);
+            }
+            bfirst = 0;
+        }
+        fprintf(fp, "]}}");
+        first = 0;
+    }
+    fprintf(fp, "\n  ],\n");
+    // Circuit breaker of the meters that failed at least once in a row
+    fprintf(fp, "  \"health\": [");
+    first = 1;
+    for (i = 0; i < STATS_UNITS; i++) {
+        tac1100_health_t *h = &health_stats[i];
+        if (h->fails == 0 && h->opened == 0) continue;
+        fprintf(fp, "%s\n    {\"address\": %d, \"state\": \"%s\", \"fails\": %d, \"opened\": %lu, \"closed\": %lu, "
+                    "\"probes\": %lu, \"skipped\": %lu, \"state_us\": %lld}",
+                first ? "" : ",", i, h->state == TAC1100_METER_OPEN ? "open" : "closed", h->fails, h->opened,
+                h->closed, h->probes, h->skipped, h->since_us ? tac1100_now_us() - h->since_us : 0);
+        first = 0;
+    }
+    fprintf(fp, "\n  ]");
+    if (secondary_device != NULL) {
+        fprintf(fp, ",\n  \"paths\": [");
+        for (i = 0; i < NUM_PATHS; i++) {
+            buspath_t *p = &paths[i];
+            fprintf(fp, "%s\n    {\"device\": \"%s\", \"role\": \"%s\", \"active\": %s, \"requests\": %lu, \"failures\": %lu, "
+                        "\"window_failures\": %d, \"failovers\": %lu, \"probes\": %lu, \"probe_failures\": %lu}",
+                    i ? "," : "", jsonEscape(esc, sizeof(esc), p->device), i == PATH_PRIMARY ? "primary" : "secondary", i == path_active ? "true" : "false",
+                    p->requests, p->failures, p->wfails, p->failovers, p->probes, p->probe_failures);
+        }
+        fprintf(fp, "\n  ]");
     }
+    fprintf(fp, "\n}\n");
+}
 
-    if (PID == LckPID && unlink(devLCKfile) == -1) {
-        log_message(DEBUG_SYSLOG, "ClrSerLock(): unlink(%s): (%d) %s", devLCKfile, errno, strerror(errno));
+/*--------------------------------------------------------------------------
+    userPrivileges / restorePrivileges
+    Files named on the command line are created with the real user id:
+    the program may be installed setuid to reach the lock directory
+----------------------------------------------------------------------------*/
+static uid_t saved_euid = (uid_t)-1;
+
+void userPrivileges(void)
+{
+    saved_euid = geteuid();
+    if (saved_euid == getuid() || seteuid(getuid()) == -1) saved_euid = (uid_t)-1;
+}
+
+void restorePrivileges(void)
+{
+    if (saved_euid != (uid_t)-1 && seteuid(saved_euid) == -1) {
+        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "restorePrivileges(): seteuid(%d): (%d) %s", (int)saved_euid, errno, strerror(errno));
     }
+    saved_euid = (uid_t)-1;
+}
 
-    log_message(debug_flag, "ClrSerLock(%lu) removed lock file: %s", PID, devLCKfile);
-    
-    fclose(fdserlck);  // This also releases the exclusive lock
-    free(COMMAND);
+/*--------------------------------------------------------------------------
+    statsWrite
+    Write the statistics file atomically (tmp file + rename)
+----------------------------------------------------------------------------*/
+void statsWrite(void)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+
+    if (stats_file == NULL) {
+        statsDump(stderr);
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", stats_file, PID);
+    userPrivileges();
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        log_message(debug_flag | DEBUG_SYSLOG, "statsWrite(): fopen(%s): (%d) %s", tmp, errno, strerror(errno));
+        restorePrivileges();
+        return;
+    }
+    statsDump(fp);
+    if (fclose(fp) != 0 || rename(tmp, stats_file) != 0) {
+        log_message(debug_flag | DEBUG_SYSLOG, "statsWrite(): %s: (%d) %s", stats_file, errno, strerror(errno));
+        unlink(tmp);
+    }
+    restorePrivileges();
+    stats_written = tac1100_now_us();
 }
 
 /*--------------------------------------------------------------------------
-    AddSerLock
+    statsLive
+    Refresh the live statistics file in poll mode, at most once a second
 ----------------------------------------------------------------------------*/
-void AddSerLock(const char *szttyDevice, const char *devLCKfile, const long unsigned int PID, const char *COMMAND, int debug_flag)
+void statsLive(void)
+{
+    if (stats_flag && stats_file != NULL && tac1100_now_us() - stats_written >= 1000000LL) statsWrite();
+}
+
+static void statsAtExit(void)
 {
-    int fddevlock;
-    int retry = 0;
-    char PIDstr[24];
+    phaseMark(PH_TEARDOWN);
+    statsWrite();
+}
 
-    snprintf(PIDstr, sizeof(PIDstr), "%lu", PID);
+/*--------------------------------------------------------------------------
+    Wire capture
+    Every request and response ADU with its monotonic time, unit id and
+    outcome (format in tac1100cap.h). libmodbus does not hand out the raw
+    frames: they are rebuilt from the request and the decoded response,
+    which in RTU is byte exact. A response failing the CRC check is
+    recorded with its outcome only.
+    Records go to a memory buffer, written out when the bus is released
+    (end of poll cycle), when the buffer is full and at exit.
+----------------------------------------------------------------------------*/
+#define CAPTURE_BUF_SIZE 65536
 
-    while (retry < 3) {
-        if ((fddevlock = open(devLCKfileNew, O_WRONLY | O_CREAT | O_EXCL, 0644)) > 0) break;
-        
-        if (errno == EEXIST) {
-            log_message(debug_flag, "AddSerLock(): lock file exists: %s, retry %d", devLCKfileNew, retry);
-            rnd_usleep(25000);
-            retry++;
-        } else {
-            log_message(DEBUG_SYSLOG, "AddSerLock(): open(%s): (%d) %s", devLCKfileNew, errno, strerror(errno));
-            exit(2);
+static const char *capture_file = NULL;
+static int capture_fd = -1;
+static uint8_t capture_buf[CAPTURE_BUF_SIZE];
+static size_t capture_len = 0;
+static unsigned long capture_records = 0;
+static unsigned long capture_full = 0;      // Flushes forced by a full buffer
+
+/*--------------------------------------------------------------------------
+    captureFlush
+----------------------------------------------------------------------------*/
+void captureFlush(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    if (capture_fd == -1 || capture_len == 0) return;
+    while (done < capture_len) {
+        n = write(capture_fd, capture_buf + done, capture_len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            log_message(debug_flag | DEBUG_SYSLOG, "captureFlush(): write(%s): (%d) %s", capture_file, errno, strerror(errno));
+            break;
         }
+        done += n;
     }
+    capture_len = 0;
+}
 
-    if (retry >= 3) {
-        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "AddSerLock(): Unable to create lock file %s after %d retries", devLCKfileNew, retry);
-        exit(2);
+static void captureAtExit(void)
+{
+    captureFlush();
+    if (capture_fd != -1) {
+        log_message(debug_flag, "Capture: %lu records, %lu flushes on full buffer", capture_records, capture_full);
+        close(capture_fd);
+        capture_fd = -1;
     }
+}
 
-    if (write(fddevlock, PIDstr, strlen(PIDstr)) != (ssize_t)strlen(PIDstr)) {
-        log_message(DEBUG_SYSLOG, "AddSerLock(): write(): (%d) %s", errno, strerror(errno));
-        close(fddevlock);
-        exit(2);
+/*--------------------------------------------------------------------------
+    captureOpen
+    Append a new segment to file, opened with the real user id (the
+    program may be setuid)
+----------------------------------------------------------------------------*/
+void captureOpen(const char *file)
+{
+    capheader_t h;
+    int errno_save;
+
+    userPrivileges();
+    capture_fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    errno_save = errno;
+    restorePrivileges();
+    if (capture_fd == -1) {
+        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Can't open capture file %s: (%d) %s", file, errno_save, strerror(errno_save));
+        exit(EXIT_FAILURE);
     }
+    capture_file = file;
+
+    h.version = CAP_VERSION;
+    h.pid = PID;
+    h.start = tac1100_now_us();
+    h.wall_offset = wall_offset_us();
+    capEncodeHeader(capture_buf, &h);
+    capture_len = CAP_HEADER_SIZE;
+    atexit(captureAtExit);
+}
 
-    if (COMMAND != NULL && strlen(COMMAND) > 0) {
-        if (write(fddevlock, " ", 1) != 1 ||
-            write(fddevlock, COMMAND, strlen(COMMAND)) != (ssize_t)strlen(COMMAND)) {
-            log_message(DEBUG_SYSLOG, "AddSerLock(): write(command): (%d) %s", errno, strerror(errno));
+/*--------------------------------------------------------------------------
+    captureAdu
+----------------------------------------------------------------------------*/
+void captureAdu(long long t, int dir, int unit, int outcome, int code, const uint8_t *adu, int len)
+{
+    caprecord_t r;
+
+    if (capture_len + CAP_RECORD_SIZE + len > CAPTURE_BUF_SIZE) {
+        capture_full++;
+        captureFlush();
+    }
+    r.t = t;
+    r.dir = dir;
+    r.unit = unit;
+    r.outcome = outcome;
+    r.code = code;
+    r.len = len;
+    capEncodeRecord(capture_buf + capture_len, &r);
+    memcpy(capture_buf + capture_len + CAP_RECORD_SIZE, adu, len);
+    capture_len += CAP_RECORD_SIZE + len;
+    capture_records++;
+}
+
+/*--------------------------------------------------------------------------
+    captureTransaction
+    Record one request (wdata != NULL: FC 10 with its values) and its
+    response (rdata: the registers read)
+----------------------------------------------------------------------------*/
+void captureTransaction(int unit, int fc, int address, int nb, const uint16_t *wdata, const uint16_t *rdata,
+                        int rc, int errno_save, long long tStart, long long tStop)
+{
+    uint8_t adu[CAP_MAX_ADU];
+    uint16_t crc;
+    int n = 0, i, outcome = CAP_OK, code = 0;
+
+    if (capture_fd == -1) return;
+
+    adu[n++] = unit;
+    adu[n++] = fc;
+    adu[n++] = address >> 8;
+    adu[n++] = address & 0xFF;
+    adu[n++] = nb >> 8;
+    adu[n++] = nb & 0xFF;
+    if (wdata != NULL) {
+        adu[n++] = 2 * nb;
+        for (i = 0; i < nb; i++) {
+            adu[n++] = wdata[i] >> 8;
+            adu[n++] = wdata[i] & 0xFF;
         }
     }
+    crc = tac1100_crc16(adu, n);
+    adu[n++] = crc & 0xFF;
+    adu[n++] = crc >> 8;
+    captureAdu(tStart, CAP_TX, unit, CAP_OK, 0, adu, n);
+
+    n = 0;
+    if (rc != -1) {
+        adu[n++] = unit;
+        adu[n++] = fc;
+        if (wdata != NULL) {
+            adu[n++] = address >> 8;
+            adu[n++] = address & 0xFF;
+            adu[n++] = nb >> 8;
+            adu[n++] = nb & 0xFF;
+        } else {
+            adu[n++] = 2 * nb;
+            for (i = 0; i < nb; i++) {
+                adu[n++] = rdata[i] >> 8;
+                adu[n++] = rdata[i] & 0xFF;
+            }
+        }
+    } else if (errno_save >= EMBXILFUN && errno_save <= EMBXGTAR) {
+        outcome = CAP_EXCEPTION;
+        code = errno_save - MODBUS_ENOBASE;
+        adu[n++] = unit;
+        adu[n++] = fc | 0x80;
+        adu[n++] = code;
+    } else if (errno_save == ETIMEDOUT) {
+        outcome = CAP_TIMEOUT;
+    } else if (errno_save == EMBBADCRC) {
+        outcome = CAP_BADCRC;
+    } else {
+        outcome = CAP_ERROR;
+    }
+    if (n > 0) {
+        crc = tac1100_crc16(adu, n);
+        adu[n++] = crc & 0xFF;
+        adu[n++] = crc >> 8;
+    }
+    captureAdu(tStop, CAP_RX, unit, outcome, code, adu, n);
+}
 
-    if (write(fddevlock, "\n", 1) != 1) {
-        log_message(DEBUG_SYSLOG, "AddSerLock(): write(newline): (%d) %s", errno, strerror(errno));
+/*--------------------------------------------------------------------------
+    Bus glue
+    Port locking and the ModBus requests are done by libtac1100: its
+    messages go through log_message() and every request it makes feeds
+    the statistics, the capture and the trace
+----------------------------------------------------------------------------*/
+static void busLog(void *user, int level, const char *format, va_list ap)
+{
+    int type;
+
+    (void)user;
+    switch (level) {
+        case TAC1100_LOG_NOTICE: type = debug_flag | DEBUG_SYSLOG; break;
+        case TAC1100_LOG_SYSLOG: type = DEBUG_SYSLOG; break;
+        case TAC1100_LOG_ERROR:  type = DEBUG_STDERR | DEBUG_SYSLOG; break;
+        default:                 type = debug_flag; break;
     }
+    vlog_message(type, format, ap);
+}
 
-    close(fddevlock);
+/*--------------------------------------------------------------------------
+    pathRecord
+    Outcome of one transaction over a path into its sliding window. An
+    exception is an answer: the path works
+----------------------------------------------------------------------------*/
+static void pathRecord(buspath_t *p, const tac1100_xfer_t *x)
+{
+    int failed = x->rc == -1 && !(x->err >= EMBXILFUN && x->err <= EMBXGTAR);
 
-    if (link(devLCKfileNew, devLCKfile) == -1) {
-        if (errno != EEXIST) {
-            log_message(DEBUG_SYSLOG, "AddSerLock(): link(%s, %s): (%d) %s", devLCKfileNew, devLCKfile, errno, strerror(errno));
-            exit(2);
-        }
+    p->requests++;
+    if (failed) p->failures++;
+    if (p->wlen == failover_window) {
+        p->wfails -= p->window[p->wpos];
+    } else {
+        p->wlen++;
     }
+    p->window[p->wpos] = failed;
+    p->wfails += failed;
+    p->wpos = (p->wpos + 1) % failover_window;
+}
 
-    if (unlink(devLCKfileNew) == -1) {
-        log_message(DEBUG_SYSLOG, "AddSerLock(): unlink(%s): (%d) %s", devLCKfileNew, errno, strerror(errno));
+static void busXfer(void *user, const tac1100_xfer_t *x)
+{
+    if (user != NULL) pathRecord(user, x);
+    if (stats_flag) statsRecord(x->unit, x->fc, x->rc, x->err, x->t_stop - x->t_start, x->attempt > 1);
+    if (capture_file) captureTransaction(x->unit, x->fc, x->address, x->nb, x->wdata, x->rdata, x->rc, x->err, x->t_start, x->t_stop);
+    if (x->rc == -1 && x->wdata == NULL && trace_flag) {
+        fprintf(stderr, "%s: ERROR (%d) %s, %d/%d\n", programName, x->err, modbus_strerror(x->err), x->attempt, x->attempts);
     }
+}
 
-    log_message(debug_flag, "AddSerLock(%lu) to %s", PID, devLCKfile);
+/*--------------------------------------------------------------------------
+    busStrerror
+    Reason of a failed library call
+----------------------------------------------------------------------------*/
+const char *busStrerror(tac1100_t *ctx, int rc)
+{
+    return rc == TAC1100_EBUS ? modbus_strerror(tac1100_errno(ctx)) : tac1100_strerror(rc);
+}
+
+/*--------------------------------------------------------------------------
+    busClose
+    Close the port and clear its lock, keeping the lock statistics
+----------------------------------------------------------------------------*/
+void busClose(tac1100_t *ctx)
+{
+    int k;
+
+    // The active path, when ctx is the other one
+    statsSnapshot(stats_bus != NULL ? stats_bus : ctx);
+    stats_bus = NULL;
+    tac1100_free(ctx);
+    // And the other path, with its lock
+    for (k = 0; k < NUM_PATHS; k++) {
+        if (paths[k].ctx != NULL && paths[k].ctx != ctx) tac1100_free(paths[k].ctx);
+        paths[k].ctx = NULL;
+    }
+    captureFlush();
+    if (log_ring != NULL) logRingDrain();
 }
 
-void releaseModbusExclusiveLock(void)
+/*--------------------------------------------------------------------------
+    busAcquire / busRelease
+    Exclusive bus lock around a poll cycle or a batch command
+----------------------------------------------------------------------------*/
+void busAcquire(tac1100_t *ctx)
 {
-    if (fdModbusExclusiveLock != NULL) {
-        log_message(debug_flag, "Releasing exclusive ModBus lock...");
-        fclose(fdModbusExclusiveLock);
-        fdModbusExclusiveLock = NULL;
+    if (tac1100_acquire(ctx) != TAC1100_OK) {
+        busClose(ctx);
+        free(PARENTCOMMAND);
+        exit(2);
     }
 }
 
-void exit_error(modbus_t *ctx)
+void busRelease(tac1100_t *ctx)
 {
-/*
-      log_message(debug_flag, "Flushing modbus buffer");
-      log_message(debug_flag, "Flushed %d bytes", modbus_flush(ctx));
-*/
-      modbus_close(ctx);
-      modbus_free(ctx);
-      ClrSerLock(PID);
-      free(devLCKfile);
-      free(devLCKfileNew);
+    tac1100_release(ctx);
+    // The bus is free: a good time to write out the captured frames
+    // and the debug messages
+    captureFlush();
+    if (log_ring != NULL) logRingDrain();
+}
+
+/*--------------------------------------------------------------------------
+    busRecover
+    After a failed poll cycle or batch command (--recover): flush, then
+    reconnect, then reopen the port as the failures go on in a row. Not
+    for the exceptions, the meter answered
+----------------------------------------------------------------------------*/
+void busRecover(tac1100_t *ctx, int rc)
+{
+    int err = tac1100_errno(ctx);
+    int tier;
+
+    if (rc == TAC1100_EBUS && err >= EMBXILFUN && err <= EMBXGTAR) return;
+    // Not sent at all, nothing to recover
+    if (rc == TAC1100_EOPEN) return;
+    tier = recover_fails < recover_max ? recover_fails : recover_max;
+    recover_fails++;
+    log_message(debug_flag | DEBUG_SYSLOG, "Bus fault (%s), %d in a row, recovery tier %d",
+                busStrerror(ctx, rc), recover_fails, tier);
+    if (tac1100_recover(ctx, tier) != TAC1100_OK) {
+        log_message(debug_flag | DEBUG_SYSLOG, "Recovery failed: (%d) %s", tac1100_errno(ctx), strerror(tac1100_errno(ctx)));
+    }
+}
+
+/*--------------------------------------------------------------------------
+    Redundant paths (--secondary)
+    The meters are reached through the primary device; when a cycle is
+    lost on it, or its error and timeout rate over the last
+    failover_window transactions reaches failover_percent, the polling
+    moves to the secondary and the cycle is read again there. From the
+    secondary the primary gets a one attempt probe every failover_probe
+    cycles and the polling goes back to it once it answers. Each path has
+    its own context, and with it its own port lock.
+----------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------
+    pathFault
+    A failed read that tells of the path: not an exception (the meter
+    answered) nor a request the circuit breaker didn't send
+----------------------------------------------------------------------------*/
+static int pathFault(tac1100_t *ctx, int rc)
+{
+    int err = tac1100_errno(ctx);
+
+    if (rc >= 0 || rc == TAC1100_EOPEN) return 0;
+    return !(rc == TAC1100_EBUS && err >= EMBXILFUN && err <= EMBXGTAR);
+}
+
+static void pathReset(buspath_t *p)
+{
+    memset(p->window, 0, sizeof(p->window));
+    p->wlen = p->wpos = p->wfails = 0;
+}
+
+/*--------------------------------------------------------------------------
+    pathSwitch
+    Make path k the active one, its context (opened and locked on first
+    use) holding the exclusive bus lock if the current one did
+----------------------------------------------------------------------------*/
+static int pathSwitch(tac1100_t **ctx, int k, int acquired, const char *reason)
+{
+    buspath_t *from = &paths[path_active], *to = &paths[k];
+    int rc;
+
+    if ((rc = tac1100_connect(to->ctx)) != TAC1100_OK ||
+        (acquired && (rc = tac1100_acquire(to->ctx)) != TAC1100_OK)) {
+        log_message(debug_flag | DEBUG_SYSLOG, "Can't switch from %s to %s (%s): %s", from->device, to->device,
+                    reason, busStrerror(to->ctx, rc));
+        tac1100_release(to->ctx);
+        return rc;
+    }
+    if (acquired) busRelease(from->ctx);
+    from->failovers++;
+    log_message(DEBUG_STDERR | DEBUG_SYSLOG, "%s from %s to %s: %s", k == PATH_PRIMARY ? "Failback" : "Failover",
+                from->device, to->device, reason);
+    path_active = k;
+    path_cycles = 0;
+    pathReset(to);
+    stats_bus = to->ctx;
+    *ctx = to->ctx;
+    return TAC1100_OK;
+}
+
+/*--------------------------------------------------------------------------
+    pathFailover
+    After the read of a cycle (rc) on the primary, with the bus lock held:
+    move to the secondary if the cycle was lost or the failure rate is
+    over the threshold. 1 if the lost cycle is to be read again
+----------------------------------------------------------------------------*/
+int pathFailover(tac1100_t **ctx, int rc)
+{
+    buspath_t *p = &paths[path_active];
+    int lost = pathFault(*ctx, rc);
+    char reason[80];
+
+    if (path_active != PATH_PRIMARY) return 0;
+    if (lost) {
+        snprintf(reason, sizeof(reason), "cycle lost (%s)", busStrerror(*ctx, rc));
+    } else if (p->wlen == failover_window && p->wfails * 100 >= failover_percent * failover_window) {
+        snprintf(reason, sizeof(reason), "%d of the last %d transactions failed", p->wfails, failover_window);
+    } else {
+        return 0;
+    }
+    if (pathSwitch(ctx, PATH_SECONDARY, 1, reason) != TAC1100_OK) return 0;
+    return lost;
+}
+
+/*--------------------------------------------------------------------------
+    pathProbe
+    Before a cycle on the secondary, every failover_probe cycles: one read
+    of the voltage over the primary, a single attempt (the probe of the
+    circuit breaker if it opened on the primary). Answered, an exception
+    too, the polling goes back to the primary; not, the port is opened
+    again for the next probe (the adapter may be plugged in again
+    meanwhile)
+----------------------------------------------------------------------------*/
+void pathProbe(tac1100_t **ctx, int device_address)
+{
+    buspath_t *p = &paths[PATH_PRIMARY];
+    int sel[NUM_REGS];
+    float value[NUM_REGS];
+    long long t[NUM_REGS];
+    int rc, err;
+
+    if (path_active != PATH_SECONDARY || ++path_cycles < failover_probe) return;
+    path_cycles = 0;
+    p->probes++;
+    memset(sel, 0, sizeof(sel));
+    sel[R_VOLTAGE] = 1;
+    if ((rc = tac1100_acquire(p->ctx)) == TAC1100_OK) {
+        tac1100_probe_next(p->ctx, device_address);
+        tac1100_set_retries(p->ctx, 1);
+        rc = tac1100_read(p->ctx, device_address, sel, value, t);
+        tac1100_set_retries(p->ctx, path_retries);
+    }
+    tac1100_release(p->ctx);
+    err = tac1100_errno(p->ctx);
+    if (rc >= 0 || (rc == TAC1100_EBUS && err >= EMBXILFUN && err <= EMBXGTAR)) {
+        pathSwitch(ctx, PATH_PRIMARY, 0, "probe answered");
+        return;
+    }
+    p->probe_failures++;
+    log_message(debug_flag | DEBUG_SYSLOG, "Probe of %s failed: %s", p->device, busStrerror(p->ctx, rc));
+    tac1100_recover(p->ctx, TAC1100_RECOVER_REOPEN);
+}
+
+void exit_error(tac1100_t *ctx)
+{
+      busClose(ctx);
       if (!metern_flag) {
         printf("NOK\n");
         log_message(debug_flag | DEBUG_SYSLOG, "NOK");
@@ -494,471 +1512,847 @@ void exit_error(modbus_t *ctx)
       exit(EXIT_FAILURE);
 }
 
-inline int bcd2int(int val)
-{
-    return((((val & 0xf0) >> 4) * 10) + (val & 0xf));
+// Read one register of the map in output units (energy in Wh), its raw
+// registers in tab_reg: TAC1100_OK, or the library error with --partial
+// (exits with error without it)
+int readMeasure(tac1100_t *ctx, int unit, const regdef_t *reg, uint16_t *tab_reg, float *value) {
+
+    int rc = tac1100_read_registers(ctx, unit, reg->fc, reg->address, reg->nb, tab_reg);
+
+    if (rc < 0) {
+        if (!partial_flag) exit_error(ctx);
+        return rc;
+    }
+    read_time_us = tac1100_read_time(ctx);
+
+    if (reg->type == REG_UINT) {
+        *value = tab_reg[0];
+    } else if (reg->type == REG_ENERGY) {
+        *value = tac1100_decode_float(tab_reg) * 1000;
+    } else {
+        *value = tac1100_decode_float(tab_reg);
+    }
+    return TAC1100_OK;
 }
 
-int int2bcd(int val)
+// Funzione per scrivere configurazioni in formato UINT (per TAC1100)
+void changeConfigUINT(tac1100_t *ctx, int unit, int address, int new_value, int restart)
 {
-    return(((val / 10) << 4) + (val % 10));
+    if (tac1100_write(ctx, unit, address, new_value) == TAC1100_OK) {
+        printf("New value %d for address 0x%X successfully written\n", new_value, address);
+        if (restart == RESTART_TRUE) {
+            printf("\n");
+            printf("*******************************************************\n");
+            printf("*** ATTENTION: METER RESTART REQUIRED               ***\n");
+            printf("*** Please restart the meter to apply the changes   ***\n");
+            printf("*******************************************************\n");
+            printf("\n");
+        }
+    } else {
+        if (tac1100_errno(ctx) == EMBXILFUN) { // Illegal function
+            fprintf(stderr, "\n");
+            fprintf(stderr, "ERROR: Write operation failed.\n");
+            fprintf(stderr, "This parameter may require KPPA (Key Parameter Programming Authorization).\n");
+            fprintf(stderr, "Please ensure the meter is in programming mode with correct password.\n");
+            fprintf(stderr, "\n");
+        }
+        exit_error(ctx);
+    }
 }
 
-int bcd2num(const uint16_t *src, int len)
+/*--------------------------------------------------------------------------
+    printValue
+----------------------------------------------------------------------------*/
+void printMeasure(const char *label, const char *unit, const char *iec_id, const char *iec_unit,
+                  const char *val, const char *stamp, int is_uint, int device_address, int compact_flag)
 {
-    int n = 0;
-    int m = 1;
-    int i = 0;
-    int shift = 0;
-    int digit = 0;
-    int j = 0;
-    for (i = 0; i < len; i++) {
-        for (j = 0; j < 4; j++) {
-            digit = ((src[len-1-i]>>shift) & 0x0F) * m;
-            n += digit;
-            m *= 10;
-            shift += 4;
+    if (metern_flag == 1 && iec_id != NULL) {
+        if (*stamp) {
+            printf("%d_%s(%s*%s)(%s)\n", device_address, iec_id, val, iec_unit, stamp);
+        } else {
+            printf("%d_%s(%s*%s)\n", device_address, iec_id, val, iec_unit);
+        }
+    } else if (compact_flag == 1) {
+        if (*stamp) {
+            printf("%s@%s ", val, stamp);
+        } else {
+            printf("%s ", val);
+        }
+    } else {
+        printf("%s: %s", label, val);
+        if (*unit) printf(" %s", unit);
+        if (*stamp) {
+            printf(" @%s\n", stamp);
+        } else {
+            printf(is_uint ? "\n" : " \n");
         }
     }
-    return n;
 }
 
-// Funzione per leggere valori in formato Float (usata per letture)
-float getMeasureFloat(modbus_t *ctx, int address, int retries, int nb) {
+void printValue(const regdef_t *reg, float value, long long t, int device_address, int compact_flag)
+{
+    char val[32];
+    char stamp[32];
 
-    uint16_t tab_reg[nb * sizeof(uint16_t)];
-    int rc = -1;
-    int i;
-    int j = 0;
-    int exit_loop = 0;
-    int errno_save=0;
-    struct timeval tvStart, tvStop;
+    if (reg->type == REG_FLOAT) {
+        snprintf(val, sizeof(val), "%3.2f", value);
+    } else {
+        snprintf(val, sizeof(val), "%d", (int) value);
+    }
+    formatStamp(stamp, sizeof(stamp), t);
+    printMeasure(reg->label, reg->unit, reg->iec_id, reg->iec_unit, val, stamp, reg->type == REG_UINT, device_address, compact_flag);
+}
 
-    while (j < retries && exit_loop == 0) {
-      j++;
+/*--------------------------------------------------------------------------
+    printInvalid
+    A value that could not be read (--partial): NaN, empty in IEC 62056,
+    with the reason in normal output
+----------------------------------------------------------------------------*/
+void printInvalid(const regdef_t *reg, const char *reason, int device_address, int compact_flag)
+{
+    if (metern_flag == 1 && reg->iec_id != NULL) {
+        printf("%d_%s()\n", device_address, reg->iec_id);
+    } else if (compact_flag == 1) {
+        printf("NaN ");
+    } else {
+        printf("%s: NaN", reg->label);
+        if (*reg->unit) printf(" %s", reg->unit);
+        printf(" (%s)\n", reason);
+    }
+    log_message(debug_flag | DEBUG_SYSLOG, "%s not read: %s", reg->label, reason);
+}
 
-      if (command_delay) {
-        log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-        usleep(command_delay);
-      }
+/*--------------------------------------------------------------------------
+    parseRates
+    Parse "group=seconds[,group=seconds...]" into the polling groups
+----------------------------------------------------------------------------*/
+int parseRates(const char *spec)
+{
+    char buf[256];
+    char *item, *save = NULL;
+    int i;
 
-      log_message(debug_flag, "%d/%d. Register Address %d [%04X]", j, retries, 30000+address+1, address);
-      gettimeofday(&tvStart, NULL); 
-      rc = modbus_read_input_registers(ctx, address, nb, tab_reg);
-      errno_save = errno;
-      gettimeofday(&tvStop, NULL); 
-
-      if (rc == -1) {
-        if (trace_flag) fprintf(stderr, "%s: ERROR (%d) %s, %d/%d\n", programName, errno_save, modbus_strerror(errno_save), j, retries);
-        log_message(debug_flag | ( j==retries ? DEBUG_SYSLOG : 0), "ERROR (%d) %s, %d/%d, Address %d [%04X]", errno_save, modbus_strerror(errno_save), j, retries, 30000+address+1, address);
-        log_message(debug_flag | ( j==retries ? DEBUG_SYSLOG : 0), "Response timeout gave up after %ldus", tv_diff(&tvStop, &tvStart));
-        if (command_delay) {
-          log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-          usleep(command_delay);
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        char *end = NULL;
+        double secs;
+        if (eq == NULL) return -1;
+        *eq = '\0';
+        secs = strtod(eq+1, &end);
+        if (end == eq+1 || *end != '\0' || secs < 0.1 || secs > 86400.0) return -1;
+        for (i = 0; i < NUM_GROUPS; i++) {
+            if (strcmp(item, groups[i].name) == 0) break;
         }
-      } else {
-        log_message(debug_flag, "Read time: %ldus", tv_diff(&tvStop, &tvStart));
-        exit_loop = 1;
-      }
+        if (i == NUM_GROUPS) return -1;
+        groups[i].period_us = (long long)(secs * 1000000.0 + 0.5);
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    Derived energy
+    The energy counters are IEEE floats in kWh: at large totals one float
+    step is several Wh, so reading them every cycle adds little. In poll
+    mode with --interpolate the fast power samples are integrated between
+    sparse counter reads; every real counter read re-anchors the estimate
+    within the counter resolution and the residual is accounted.
+----------------------------------------------------------------------------*/
+#define E_IMPORT   0        // Active import (positive active power)
+#define E_EXPORT   1        // Active export (negative active power)
+#define E_RIMPORT  2        // Reactive import (positive reactive power)
+#define E_REXPORT  3        // Reactive export (negative reactive power)
+#define NUM_ENERGY 4
+
+typedef struct {
+    const char *label;      // Normal output label
+    const char *iec_id;     // IEC 62056 ID
+    const char *unit;
+    int power_reg;          // R_* power register integrated
+    int counter_reg;        // R_* counter register used as anchor
+    int sign;               // +1 integrates positive power, -1 negative power
+    int anchored;           // Counter read at least once
+    double energy;          // Interpolated counter (Wh or VARh)
+    double output;          // Last value printed, output never goes backwards
+    double last_power;      // Last power sample (W or VAR)
+    long long last_t;       // Time of last power sample or anchor (us)
+    long anchors;           // Counter reads after the first one
+    double residual;        // Estimate - counter at last anchor
+    double sum_residual;    // Sum of |residual|
+    double max_residual;    // Max |residual|
+} energytrack_t;
+
+static energytrack_t energy[NUM_ENERGY] = {
+    { "Import Active Energy (interpolated)",   "IEI",  "Wh",   R_POWER,    R_IAENERGY,  1 },
+    { "Export Active Energy (interpolated)",   "EEI",  "Wh",   R_POWER,    R_EAENERGY, -1 },
+    { "Import Reactive Energy (interpolated)", "IREI", "VARh", R_REACTIVE, R_IRAENERGY, 1 },
+    { "Export Reactive Energy (interpolated)", "EREI", "VARh", R_REACTIVE, R_ERAENERGY, -1 },
+};
+
+/*--------------------------------------------------------------------------
+    floatStep
+    Size of one float step at value (kWh), i.e. the counter resolution
+----------------------------------------------------------------------------*/
+static double floatStep(float value)
+{
+    uint32_t bits;
+    float next;
+
+    if (value < 0) value = -value;
+    memcpy(&bits, &value, sizeof(bits));
+    bits++;
+    memcpy(&next, &bits, sizeof(next));
+    return (double)next - (double)value;
+}
+
+/*--------------------------------------------------------------------------
+    energyPower
+    Integrate a new power sample (trapezoidal rule on the clipped power)
+----------------------------------------------------------------------------*/
+void energyPower(energytrack_t *e, long long t, double power)
+{
+    double p = e->sign * power;
 
+    if (p < 0) p = 0;
+    if (e->anchored && t > e->last_t) {
+        e->energy += (e->last_power + p) / 2.0 * (t - e->last_t) / 3600000000.0;
     }
+    e->last_power = p;
+    e->last_t = t;
+}
 
-    if (rc == -1) {
-      exit_error(ctx);
+/*--------------------------------------------------------------------------
+    energyAnchor
+    Re-anchor the estimate on a real counter read (kWh float)
+----------------------------------------------------------------------------*/
+void energyAnchor(energytrack_t *e, long long t, float kwh)
+{
+    double counter = (double)kwh * 1000.0;
+    double half_step = floatStep(kwh) * 1000.0 / 2.0;
+
+    if (!e->anchored) {
+        e->energy = counter;
+        e->output = counter;
+        e->anchored = 1;
+        e->last_t = t;
+        log_message(debug_flag, "%s anchored at %.3f (resolution %.3f)", e->label, counter, half_step * 2.0);
+        return;
     }
 
-    if (debug_flag) {
-       for (i=0; i < rc; i++) {
-          log_message(debug_flag, "reg[%d/%d]=%d (0x%X)", i, (rc-1), tab_reg[i], tab_reg[i]);
-       }
+    // Extrapolate with the last power sample up to the counter read
+    if (t > e->last_t) {
+        e->energy += e->last_power * (t - e->last_t) / 3600000000.0;
+        e->last_t = t;
     }
 
-    // swap LSB and MSB
-    uint16_t tmp1 = tab_reg[0];
-    uint16_t tmp2 = tab_reg[1];
-    tab_reg[0] = tmp2;
-    tab_reg[1] = tmp1;
+    e->residual = e->energy - counter;
+    e->anchors++;
+    e->sum_residual += (e->residual < 0 ? -e->residual : e->residual);
+    if ((e->residual < 0 ? -e->residual : e->residual) > e->max_residual) {
+        e->max_residual = (e->residual < 0 ? -e->residual : e->residual);
+    }
+    log_message(debug_flag, "%s: estimate %.3f counter %.3f residual %.3f (resolution %.3f)",
+            e->label, e->energy, counter, e->residual, half_step * 2.0);
 
-    float value = modbus_get_float(&tab_reg[0]);
+    // The counter is exact only within its float resolution: keep the
+    // estimate when it lies inside, otherwise pull it to the nearest edge
+    if (e->energy < counter - half_step) e->energy = counter - half_step;
+    if (e->energy > counter + half_step) e->energy = counter + half_step;
+}
 
-    return value;
+/*--------------------------------------------------------------------------
+    printEnergy
+----------------------------------------------------------------------------*/
+void printEnergy(energytrack_t *e, int device_address, int compact_flag)
+{
+    char val[32];
+    char stamp[32];
 
-}
+    if (!e->anchored) return;
+    if (e->energy > e->output) e->output = e->energy;
 
-// Funzione per leggere configurazioni in formato UINT (Holding Registers)
-int getConfigUINT(modbus_t *ctx, int address, int retries, int nb) {
+    snprintf(val, sizeof(val), "%.3f", e->output);
+    formatStamp(stamp, sizeof(stamp), e->last_t);
+    printMeasure(e->label, e->unit, e->iec_id, e->unit, val, stamp, 0, device_address, compact_flag);
+}
 
-    uint16_t tab_reg[nb * sizeof(uint16_t)];
-    int rc = -1;
+/*--------------------------------------------------------------------------
+    reportEnergy
+----------------------------------------------------------------------------*/
+void reportEnergy(void)
+{
     int i;
-    int j = 0;
-    int exit_loop = 0;
-
-    while (j < retries && exit_loop == 0) {
-      j++;
 
-      if (command_delay) {
-        log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-        usleep(command_delay);
-      }
+    for (i = 0; i < NUM_ENERGY; i++) {
+        energytrack_t *e = &energy[i];
+        if (!e->anchored) continue;
+        fprintf(stderr, "%s: %s: %ld anchors, residual last %.3f, mean %.3f, max %.3f %s\n",
+                programName, e->label, e->anchors, e->residual,
+                e->anchors ? e->sum_residual / e->anchors : 0.0, e->max_residual, e->unit);
+        log_message(debug_flag | DEBUG_SYSLOG, "%s: %ld anchors, residual last %.3f, mean %.3f, max %.3f %s",
+                e->label, e->anchors, e->residual,
+                e->anchors ? e->sum_residual / e->anchors : 0.0, e->max_residual, e->unit);
+    }
+}
 
-      log_message(debug_flag, "%d/%d. Register Address %d [%04X]", j, retries, 40000+address+1, address);
-      rc = modbus_read_registers(ctx, address, nb, tab_reg);
+/*--------------------------------------------------------------------------
+    pollSignal
+----------------------------------------------------------------------------*/
+static void pollSignal(int sig)
+{
+    (void)sig;
+    poll_stop = 1;
+}
 
-      if (rc == -1) {
-        log_message(debug_flag | ( j==retries ? DEBUG_SYSLOG : 0), "ERROR (%d) %s, %d/%d, Address %d [%04X]", errno, modbus_strerror(errno), j, retries, 40000+address+1, address);
-        if (command_delay) {
-          log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-          usleep(command_delay);
+/*--------------------------------------------------------------------------
+    reportRates
+----------------------------------------------------------------------------*/
+void reportRates(long cycles, long transfers, long reg_reads)
+{
+    int g;
+
+    fprintf(stderr, "%s: %ld cycles, %ld transactions for %ld register reads\n", programName, cycles, transfers, reg_reads);
+    for (g = 0; g < NUM_GROUPS; g++) {
+        double requested = 1000000.0 / groups[g].period_us;
+        double achieved = 0.0;
+        long long late_mean = 0;
+        if (groups[g].samples == 0) continue;
+        if (groups[g].samples > 1 && groups[g].last > groups[g].first) {
+            achieved = (groups[g].samples - 1) * 1000000.0 / (groups[g].last - groups[g].first);
         }
-      } else {
-        exit_loop = 1;
-      }
+        if (groups[g].samples > 1) {
+            late_mean = groups[g].late_sum / (groups[g].samples - 1);
+        }
+        fprintf(stderr, "%s: group %-6s requested %8.4f Hz, achieved %8.4f Hz (%ld samples), lateness mean %lldus max %lldus, skipped %ld\n",
+                programName, groups[g].name, requested, achieved, groups[g].samples, late_mean, groups[g].late_max, groups[g].skipped);
+        log_message(debug_flag | DEBUG_SYSLOG, "group %s requested %.4f Hz, achieved %.4f Hz (%ld samples), lateness mean %lldus max %lldus, skipped %ld",
+                groups[g].name, requested, achieved, groups[g].samples, late_mean, groups[g].late_max, groups[g].skipped);
     }
+}
 
-    if (rc == -1) {
-      exit_error(ctx);
+/*--------------------------------------------------------------------------
+    pollLoop
+    Multi-rate polling: every group is read at its own period, all groups
+    due at the same time share the bus transactions of a single cycle.
+----------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------
+    pollRead
+    The registers due in a cycle, the failed ones in status with --partial
+----------------------------------------------------------------------------*/
+static int pollRead(tac1100_t *ctx, int device_address, const int *due, float *raw, long long *tread, int *status)
+{
+    if (partial_flag) return tac1100_read_partial(ctx, device_address, due, raw, tread, status);
+    return tac1100_read(ctx, device_address, due, raw, tread);
+}
+
+void pollLoop(tac1100_t *ctx, const int *selected, int device_address, int compact_flag, long max_cycles)
+{
+    float values[NUM_REGS];
+    float raw[NUM_REGS];
+    long long tread[NUM_REGS];
+    int wanted[NUM_REGS];
+    int active[NUM_GROUPS];
+    int gdue[NUM_GROUPS];
+    int due[NUM_REGS];
+    int status[NUM_REGS];
+    long cycles = 0, transfers = 0, reg_reads = 0;
+    long long now, next, start, wall_offset;
+    int g, r, nx, ndue, npartial, i;
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pollSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    memset(values, 0, sizeof(values));
+    memset(raw, 0, sizeof(raw));
+    memset(tread, 0, sizeof(tread));
+    memset(status, 0, sizeof(status));
+    memset(active, 0, sizeof(active));
+    for (r = 0; r < NUM_REGS; r++) {
+        wanted[r] = selected[r];
+    }
+    if (interpolate_flag) {
+        // Interpolation needs the power samples and the counters as anchors
+        for (i = 0; i < NUM_ENERGY; i++) {
+            wanted[energy[i].power_reg] = 1;
+            wanted[energy[i].counter_reg] = 1;
+        }
+    }
+    for (r = 0; r < NUM_REGS; r++) {
+        if (wanted[r]) active[regs[r].group] = 1;
     }
 
-    if (debug_flag) {
-       for (i=0; i < rc; i++) {
-          log_message(debug_flag, "reg[%d/%d]=%d (0x%X)", i, (rc-1), tab_reg[i], tab_reg[i]);
-       }
+    // Deadlines are absolute CLOCK_MONOTONIC times k*period apart, so the
+    // period never drifts with the cycle runtime. When aligned, the first
+    // deadline is the last wall clock multiple of the period (read at once)
+    // and the next ones fall on :00, :05... whatever the start time.
+    now = tac1100_now_us();
+    wall_offset = wall_offset_us();
+    for (g = 0; g < NUM_GROUPS; g++) {
+        if (align_flag) {
+            groups[g].next_due = ((now + wall_offset) / groups[g].period_us) * groups[g].period_us - wall_offset;
+        } else {
+            groups[g].next_due = now;
+        }
+        if (active[g]) log_message(debug_flag, "Poll group %s every %lldus", groups[g].name, groups[g].period_us);
     }
 
-    int value = tab_reg[0];
+    while (!poll_stop && (max_cycles == 0 || cycles < max_cycles)) {
+
+        now = tac1100_now_us();
+        start = now;
+        phase_mark = now;       // The sleep is not charged to any phase
+        stamp_offset = wall_offset_us();
+        for (g = 0; g < NUM_GROUPS; g++) {
+            gdue[g] = active[g] && groups[g].next_due <= now;
+        }
+        ndue = 0;
+        for (r = 0; r < NUM_REGS; r++) {
+            due[r] = wanted[r] && gdue[regs[r].group];
+            ndue += due[r];
+        }
+
+        if (ndue > 0) {
+            if (secondary_device != NULL) pathProbe(&ctx, device_address);
+            busAcquire(ctx);
+            phaseMark(PH_LOCK);
+            nx = pollRead(ctx, device_address, due, raw, tread, status);
+            if (secondary_device != NULL && pathFailover(&ctx, nx)) {
+                // Read again over the secondary: the cycle is late, not lost
+                nx = pollRead(ctx, device_address, due, raw, tread, status);
+            }
+            if (nx < 0) {
+                // The breaker has to see the failures to open
+                if (recover_max < 0 && secondary_device == NULL && breaker_fails == 0) exit_error(ctx);
+                if (recover_max >= 0) busRecover(ctx, nx);
+                busRelease(ctx);
+                phaseMark(PH_TRANSACTIONS);
+                cycles++;
+                // The cycle is lost: the groups due wait for their next deadline
+                now = tac1100_now_us();
+                for (g = 0; g < NUM_GROUPS; g++) {
+                    if (!gdue[g]) continue;
+                    while (groups[g].next_due <= now) groups[g].next_due += groups[g].period_us;
+                }
+                if (!metern_flag) printf("NOK\n");
+                fflush(stdout);
+                statsLive();
+                continue;
+            }
+            recover_fails = 0;
+            log_message(debug_flag, "Cycle %ld: %d registers due in %d transactions", cycles+1, ndue, nx);
+            npartial = 0;
+            for (r = 0; r < NUM_REGS; r++) {
+                if (!due[r]) continue;
+                if (status[r]) {
+                    npartial++;
+                    continue;
+                }
+                values[r] = regs[r].type == REG_ENERGY ? raw[r] * 1000 : raw[r];
+            }
+            // Give other bus clients a chance between cycles
+            busRelease(ctx);
+            phaseMark(PH_TRANSACTIONS);
+
+            transfers += nx;
+            reg_reads += ndue;
+            cycles++;
+
+            now = tac1100_now_us();
+            for (g = 0; g < NUM_GROUPS; g++) {
+                long steps = 0;
+                if (!gdue[g]) continue;
+                if (groups[g].samples == 0) {
+                    // Rate is measured from the (aligned) deadline of the first read
+                    groups[g].first = groups[g].next_due;
+                } else {
+                    long long late = start - groups[g].next_due;
+                    groups[g].late_sum += late;
+                    if (late > groups[g].late_max) groups[g].late_max = late;
+                }
+                groups[g].last = start;
+                groups[g].samples++;
+                // Skip deadlines missed while the bus was busy
+                while (groups[g].next_due <= now) {
+                    groups[g].next_due += groups[g].period_us;
+                    steps++;
+                }
+                if (steps > 1) {
+                    groups[g].skipped += steps - 1;
+                    log_message(debug_flag, "Poll group %s late, skipped %ld cycles", groups[g].name, steps - 1);
+                }
+            }
+
+            if (interpolate_flag) {
+                for (i = 0; i < NUM_ENERGY; i++) {
+                    int p = energy[i].power_reg, c = energy[i].counter_reg;
+                    if (due[p] && !status[p]) energyPower(&energy[i], tread[p], raw[p]);
+                    if (due[c] && !status[c]) energyAnchor(&energy[i], tread[c], raw[c]);
+                }
+            }
 
-    return value;
+            // Compact rows always carry every selected value (last known for groups not due)
+            for (r = 0; r < NUM_REGS; r++) {
+                if (!selected[r] || (!due[r] && compact_flag != 1)) continue;
+                if (due[r] && status[r]) {
+                    printInvalid(&regs[r], modbus_strerror(status[r]), device_address, compact_flag);
+                } else {
+                    printValue(&regs[r], values[r], tread[r], device_address, compact_flag);
+                }
+            }
+            if (interpolate_flag) {
+                for (i = 0; i < NUM_ENERGY; i++) {
+                    printEnergy(&energy[i], device_address, compact_flag);
+                }
+            }
+            if (!metern_flag) printf(npartial ? "PARTIAL\n" : "OK\n");
+            fflush(stdout);
+            phaseMark(PH_OUTPUT);
+            statsLive();
+        }
 
+        next = -1;
+        for (g = 0; g < NUM_GROUPS; g++) {
+            if (active[g] && (next == -1 || groups[g].next_due < next)) next = groups[g].next_due;
+        }
+        if (!poll_stop && (max_cycles == 0 || cycles < max_cycles) && next > tac1100_now_us()) {
+            struct timespec ts;
+            ts.tv_sec = next / 1000000LL;
+            ts.tv_nsec = (next % 1000000LL) * 1000L;
+            // Absolute deadline, interrupted by SIGINT/SIGTERM
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !poll_stop);
+        }
+    }
+
+    reportRates(cycles, transfers, reg_reads);
+    if (interpolate_flag) reportEnergy();
 }
 
-// Funzione per abilitare KPPA (Key Parameter Programming Authorization)
-// Requires current password to enable writing to protected parameters
-int enableKPPA(modbus_t *ctx, int current_password)
+/*--------------------------------------------------------------------------
+    Batch mode (--batch)
+    One command per line with the options of a single read or write (no
+    device), all run over the open context and lock session. Every command
+    gets one result line: "<line> OK [values]" or "<line> NOK <reason>".
+----------------------------------------------------------------------------*/
+#define BATCH_MAX_ARGS 64
+
+typedef struct {
+    int address;                // -a, session address by default
+    int retries;                // -z, session retries by default
+    int selected[NUM_REGS];
+    int count;                  // Selected registers
+    int write_reg;              // Register written, -1 for a read
+    int write_value;
+    int restart;                // Write needs a meter restart
+    int kppa;                   // Write needs KPPA (-Q)
+    int password;               // -Q, -1 if not given
+} batchcmd_t;
+
+// Read options and their registers, as on the command line
+static const struct { char opt; int reg; } batch_reads[] = {
+    { 'v', R_VOLTAGE  }, { 'c', R_CURRENT  }, { 'p', R_POWER     }, { 'l', R_APPARENT  },
+    { 'n', R_REACTIVE }, { 'g', R_PFACTOR  }, { 'o', R_PANGLE    }, { 'f', R_FREQUENCY },
+    { 'i', R_IAENERGY }, { 'e', R_EAENERGY }, { 't', R_TAENERGY  }, { 'A', R_IRAENERGY },
+    { 'B', R_ERAENERGY }, { 'C', R_TRENERGY }, { 'T', R_TIME_DISP },
+};
+
+/*--------------------------------------------------------------------------
+    batchParse
+    Parse one command line, 0 if valid, -1 with the reason in err
+----------------------------------------------------------------------------*/
+int batchParse(char *line, batchcmd_t *cmd, char *err, size_t len)
 {
-    uint16_t tab_reg[1];
-    tab_reg[0] = (uint16_t)current_password;
+    char *argv[BATCH_MAX_ARGS + 1];
+    char *save = NULL, *tok;
+    int argc = 0, writes = 0, c, k, value;
+
+    argv[argc++] = programName;
+    for (tok = strtok_r(line, " \t\r\n", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (argc == BATCH_MAX_ARGS) {
+            snprintf(err, len, "too many arguments");
+            return -1;
+        }
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+
+    cmd->write_reg = -1;
+    cmd->restart = RESTART_FALSE;
+    cmd->kppa = 0;
+    cmd->password = -1;
+    cmd->count = 0;
+    memset(cmd->selected, 0, sizeof(cmd->selected));
 
-    if (command_delay) {
-      log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-      usleep(command_delay);
+    optind = 0;                 // Full getopt reset for every command
+    while ((c = getopt(argc, argv, "+:a:z:vclpngofietABCTs:r:N:K:Q:L:U:R:G:H:")) != -1) {
+        for (k = 0; k < (int)(sizeof(batch_reads) / sizeof(batch_reads[0])); k++) {
+            if (batch_reads[k].opt == c) break;
+        }
+        if (k < (int)(sizeof(batch_reads) / sizeof(batch_reads[0]))) {
+            cmd->count += !cmd->selected[batch_reads[k].reg];
+            cmd->selected[batch_reads[k].reg] = 1;
+            continue;
+        }
+        if (c == '?') {
+            snprintf(err, len, "unknown option -%c", isprint(optopt) ? optopt : '?');
+            return -1;
+        }
+        if (c == ':') {
+            snprintf(err, len, "option -%c needs a value", optopt);
+            return -1;
+        }
+        value = atoi(optarg);
+        switch (c) {
+            case 'a':
+                if (!(0 < value && value <= 247)) {
+                    snprintf(err, len, "address must be between 1 and 247");
+                    return -1;
+                }
+                cmd->address = value;
+                continue;
+            case 'z':
+                if (value < 1) {
+                    snprintf(err, len, "retries must be >= 1");
+                    return -1;
+                }
+                cmd->retries = value;
+                continue;
+            case 'Q':
+                if (!(0 <= value && value <= 9999)) {
+                    snprintf(err, len, "current password (%d) out of range, 0-9999", value);
+                    return -1;
+                }
+                cmd->password = value;
+                continue;
+            case 's':
+                if (!(0 < value && value <= 247)) {
+                    snprintf(err, len, "new address (%d) out of range, 1-247", value);
+                    return -1;
+                }
+                cmd->write_reg = DEVICE_ID;
+                break;
+            case 'r':
+                switch (value) {
+                    case 1200:  value = BR1200;  break;
+                    case 2400:  value = BR2400;  break;
+                    case 4800:  value = BR4800;  break;
+                    case 9600:  value = BR9600;  break;
+                    case 19200: value = BR19200; break;
+                    default:
+                        snprintf(err, len, "baud rate must be one of 1200, 2400, 4800, 9600, 19200");
+                        return -1;
+                }
+                cmd->write_reg = BAUD_RATE;
+                break;
+            case 'N':
+                if (!(0 <= value && value <= 3)) {
+                    snprintf(err, len, "new parity/stop (%d) out of range, 0-3", value);
+                    return -1;
+                }
+                cmd->write_reg = NPARSTOP;
+                cmd->restart = RESTART_TRUE;
+                break;
+            case 'K':
+                if (!(0 <= value && value <= 9999)) {
+                    snprintf(err, len, "password (%d) out of range, 0-9999", value);
+                    return -1;
+                }
+                cmd->write_reg = PASSWORD;
+                cmd->kppa = 1;
+                break;
+            case 'L':
+                if (!(0 <= value && value <= 60)) {
+                    snprintf(err, len, "demand period (%d) out of range, 0-60 minutes", value);
+                    return -1;
+                }
+                cmd->write_reg = DEMAND_PERIOD;
+                break;
+            case 'U':
+                if (value < 1) {
+                    snprintf(err, len, "slide time (%d) must be >= 1", value);
+                    return -1;
+                }
+                cmd->write_reg = SLIDE_TIME;
+                break;
+            case 'R':
+                if (!(0 <= value && value <= 60)) {
+                    snprintf(err, len, "scroll time (%d) out of range, 0-60 seconds", value);
+                    return -1;
+                }
+                cmd->write_reg = TIME_DISP;
+                break;
+            case 'G':
+                if (!((0 <= value && value <= 120) || value == 255)) {
+                    snprintf(err, len, "backlit time (%d) out of range, 0-120 or 255", value);
+                    return -1;
+                }
+                cmd->write_reg = BACKLIT_TIME;
+                break;
+            case 'H':
+                if (!(value == 0 || value == 8 || value == 9)) {
+                    snprintf(err, len, "reset type (%d) must be 0, 8 or 9", value);
+                    return -1;
+                }
+                cmd->write_reg = RESET_HIST;
+                cmd->kppa = 1;
+                break;
+        }
+        cmd->write_value = value;
+        writes++;
+    }
+    if (optind < argc) {
+        snprintf(err, len, "unexpected argument %s", argv[optind]);
+        return -1;
+    }
+    if (writes > 1 || (writes > 0 && cmd->count > 0)) {
+        snprintf(err, len, "one write, or reads only, per command");
+        return -1;
+    }
+    if (cmd->kppa && cmd->password == -1) {
+        snprintf(err, len, "current password (-Q) required for KPPA authorization");
+        return -1;
     }
-
-    log_message(debug_flag, "Enabling KPPA with password %d (0x%04X)", current_password, current_password);
-    
-    // Write password to KPPA register to enable authorization
-    int n = modbus_write_registers(ctx, KPPA, 1, tab_reg);
-    if (n != -1) {
-        log_message(debug_flag, "KPPA enabled successfully");
-        return 0;  // Success
-    } else {
-        log_message(debug_flag | DEBUG_STDERR, "KPPA enable failed: (%d) %s", errno, modbus_strerror(errno));
-        return -1;  // Failure
+    if (writes == 0 && cmd->count == 0) {
+        // As on the command line: no option reads all the measures
+        for (k = 0; k < NUM_REGS; k++) {
+            cmd->selected[k] = (k != R_TIME_DISP);
+            cmd->count += cmd->selected[k];
+        }
     }
+    return 0;
 }
 
-// Funzione per scrivere configurazioni in formato UINT (per TAC1100)
-void changeConfigUINT(modbus_t *ctx, int address, int new_value, int restart)
+/*--------------------------------------------------------------------------
+    batchRun
+    Run one parsed command, 0 with the values in out, a TAC1100_E* code
+    with the reason, 1 with the values and NaN for those not read
+    (--partial)
+----------------------------------------------------------------------------*/
+int batchRun(tac1100_t *ctx, const batchcmd_t *cmd, char *out, size_t len)
 {
-    uint16_t tab_reg[1];
-    tab_reg[0] = (uint16_t)new_value;
+    float values[NUM_REGS];
+    long long tread[NUM_REGS];
+    int status[NUM_REGS];
+    int r, rc, n = 0, npartial = 0;
 
-    if (command_delay) {
-      log_message(debug_flag, "Sleeping command delay: %ldus", command_delay);
-      usleep(command_delay);
-    }
+    out[0] = '\0';
 
-    log_message(debug_flag, "Writing value %d (0x%04X) to register 0x%04X", new_value, new_value, address);
-    
-    // TAC1100 requires Function Code 0x10 (Write Multiple Registers) even for single register
-    int n = modbus_write_registers(ctx, address, 1, tab_reg);
-    if (n != -1) {
-        printf("New value %d for address 0x%X successfully written\n", new_value, address);
-        if (restart == RESTART_TRUE) {
-            printf("\n");
-            printf("*******************************************************\n");
-            printf("*** ATTENTION: METER RESTART REQUIRED               ***\n");
-            printf("*** Please restart the meter to apply the changes   ***\n");
-            printf("*******************************************************\n");
-            printf("\n");
+    if (cmd->write_reg != -1) {
+        if (cmd->kppa && (rc = tac1100_kppa(ctx, cmd->address, cmd->password)) != TAC1100_OK) {
+            snprintf(out, len, "KPPA: %s", busStrerror(ctx, rc));
+            return rc;
         }
-    } else {
-        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Write error: (%d) %s, n=%d", errno, modbus_strerror(errno), n);
-        if (errno == EMBXILFUN) { // Illegal function
-            log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Tip: Parameter may be read-only or password authorization (KPPA) required");
-            fprintf(stderr, "\n");
-            fprintf(stderr, "ERROR: Write operation failed.\n");
-            fprintf(stderr, "This parameter may require KPPA (Key Parameter Programming Authorization).\n");
-            fprintf(stderr, "Please ensure the meter is in programming mode with correct password.\n");
-            fprintf(stderr, "\n");
+        if ((rc = tac1100_write(ctx, cmd->address, cmd->write_reg, cmd->write_value)) != TAC1100_OK) {
+            snprintf(out, len, "%s", busStrerror(ctx, rc));
+            return rc;
         }
-        exit_error(ctx);
+        if (cmd->restart == RESTART_TRUE) snprintf(out, len, " restart required");
+        return 0;
     }
-}
-
-/*--------------------------------------------------------------------------
-    getIntLen
-----------------------------------------------------------------------------*/
-int getIntLen(long value){
-  long l=!value;
-  while(value) { l++; value/=10; }
-  return l;
-}
 
-/*--------------------------------------------------------------------------
-    getPIDcmd
-----------------------------------------------------------------------------*/
-void *getPIDcmd(long unsigned int PID)
-{
-    int fdcmd;
-    char *COMMAND = NULL;
-    size_t cmdLen = 0;
-    size_t length;
-    char buffer[1024];
-    char cmdFilename[getIntLen(PID)+14+1];
-
-    // Generate the name of the cmdline file for the process
-    *cmdFilename = '\0';
-    snprintf(cmdFilename,sizeof(cmdFilename),"/proc/%lu/cmdline",PID);
-    
-    // Read the contents of the file
-    if ((fdcmd  = open(cmdFilename, O_RDONLY)) < 0) return NULL;
-    if ((length = read(fdcmd, buffer, sizeof(buffer))) <= 0) {
-        close(fdcmd); return NULL;
-    }     
-    close(fdcmd);
-    
-    // read does not NUL-terminate the buffer, so do it here
-    buffer[length] = '\0';
-    // Get 1st string (command)
-    cmdLen=strlen(buffer)+1;
-    if((COMMAND = getMemPtr(cmdLen)) != NULL ) {
-        strncpy(COMMAND, buffer, cmdLen);
-        COMMAND[cmdLen-1] = '\0';
+    tac1100_set_retries(ctx, cmd->retries);
+    if (partial_flag) {
+        rc = tac1100_read_partial(ctx, cmd->address, cmd->selected, values, tread, status);
+    } else {
+        memset(status, 0, sizeof(status));
+        rc = tac1100_read(ctx, cmd->address, cmd->selected, values, tread);
+    }
+    if (rc < 0) {
+        snprintf(out, len, "%s", busStrerror(ctx, rc));
+        return rc;
+    }
+
+    // Values in register order, formatted as in compact mode
+    for (r = 0; r < NUM_REGS && n < (int)len; r++) {
+        char stamp[32];
+        if (!cmd->selected[r]) continue;
+        if (status[r]) {
+            n += snprintf(out + n, len - n, " NaN");
+            npartial++;
+            continue;
+        }
+        formatStamp(stamp, sizeof(stamp), tread[r]);
+        if (regs[r].type == REG_FLOAT) {
+            n += snprintf(out + n, len - n, " %3.2f", values[r]);
+        } else if (regs[r].type == REG_ENERGY) {
+            n += snprintf(out + n, len - n, " %d", (int) (values[r] * 1000));
+        } else {
+            n += snprintf(out + n, len - n, " %d", (int) values[r]);
+        }
+        if (*stamp && n < (int)len) n += snprintf(out + n, len - n, "@%s", stamp);
     }
-
-    return COMMAND;
+    return npartial ? 1 : 0;
 }
 
 /*--------------------------------------------------------------------------
-    lockSer
+    batchLoop
+    Run the commands read from fp, the number of failed commands, partial
+    ones in *partial
 ----------------------------------------------------------------------------*/
-void lockSer(const char *szttyDevice, const long unsigned int PID, int debug_flag)
-{
-    char *pos;
-    FILE *fdserlck = NULL;
-    char *COMMAND = NULL;
-    long unsigned int LckPID;
-    struct timeval tLockStart, tLockNow;
-    int bRead;
-    int errno_save = 0;
-    int fLen = 0;
-    int curChar = 0;
-    char *LckCOMMAND = NULL;
-    char *LckPIDcommand = NULL;
-
-    pos = strrchr(szttyDevice, '/');
-    if (pos > 0) {
-        pos++;
-        devLCKfile = getMemPtr(strlen(ttyLCKloc)+(strlen(szttyDevice)-(pos-szttyDevice))+1);
-        devLCKfile[0] = '\0';
-        strcpy(devLCKfile,ttyLCKloc);
-        strcat(devLCKfile, pos);
-        devLCKfile[strlen(devLCKfile)] = '\0';
-        devLCKfileNew = getMemPtr(strlen(devLCKfile)+getIntLen(PID)+2);	/* dot & terminator */
-        devLCKfileNew[0] = '\0';
-        strcpy(devLCKfileNew,devLCKfile);
-        sprintf(devLCKfileNew,"%s.%lu",devLCKfile,PID);
-        devLCKfileNew[strlen(devLCKfileNew)] = '\0';
-    } else {
-        devLCKfile = NULL;
-    }
-
-    log_message(debug_flag, "szttyDevice: %s",szttyDevice);
-    log_message(debug_flag, "devLCKfile: <%s>",devLCKfile);
-    log_message(debug_flag, "devLCKfileNew: <%s>",devLCKfileNew);
-    log_message(debug_flag, "PID: %lu", PID);    
-
-    COMMAND = getPIDcmd(PID);
-    AddSerLock(szttyDevice, devLCKfile, PID, COMMAND, debug_flag);
-
-    LckPID = 0;
-    long unsigned int oldLckPID = 0;
-    int staleLockRetries = 0;
-    int const staleLockRetriesMax = 2;
-    long unsigned int clrStaleTargetPID = 0;    
-    int missingPidRetries = 0;
-    int const missingPidRetriesMax = 2;
-    int totalLockAttempts = 0;
-    int const maxLockAttempts = 100; // Prevent infinite loop
-    
-    gettimeofday(&tLockStart, NULL);
-    tLockNow=tLockStart;
-
-    if (debug_flag) log_message(debug_flag, "Checking for lock");
-    while(LckPID != PID && tv_diff(&tLockNow, &tLockStart) <= yLockWait*1000000L) {
-        
-        totalLockAttempts++;
-        if (totalLockAttempts > maxLockAttempts) {
-            free(LckCOMMAND);
-            free(LckPIDcommand);
-            free(COMMAND);
-            ClrSerLock(PID);
-            log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Exceeded maximum lock attempts (%d). Lock file may be corrupted: %s", maxLockAttempts, devLCKfile);
-            log_message(DEBUG_STDERR, "Try removing the lock file manually: sudo rm -f %s", devLCKfile);
-            free(devLCKfile); free(devLCKfileNew); free(PARENTCOMMAND);
-            exit(2);
-        }
-
-        do {
-            fdserlck = fopen(devLCKfile, "r");
-            if (fdserlck == NULL) {
-                log_message(debug_flag | DEBUG_SYSLOG, "Problem locking serial device, can't open lock file: %s for read.",devLCKfile);
-                exit(2);
-            }
-            errno = 0;
-            if (flock(fileno(fdserlck), LOCK_SH | LOCK_NB) == 0) break;      // Lock Acquired 
-            errno_save=errno;
-            
-            if (errno_save == EWOULDBLOCK) {
-                log_message(debug_flag, "Would block %s, retry (%d) %s...", devLCKfile, errno_save, strerror(errno_save));
-                rnd_usleep(25000);
-                fclose(fdserlck);
-            } else {
-                log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Problem locking serial device, can't open lock file: %s for read. (%d) %s", devLCKfile, errno_save, strerror(errno_save));
-                exit(2);
+int batchLoop(tac1100_t *ctx, FILE *fp, int device_address, int num_retries, long *partial)
+{
+    char line[1024], result[512];
+    batchcmd_t cmd;
+    long lineno = 0, commands = 0, failed = 0;
+    struct sigaction sa;
+    char *p;
+    int rc;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pollSignal;         // Stop between commands
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // The bus is not needed while waiting for the first command
+    busRelease(ctx);
+
+    while (!poll_stop && fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL) *p = '\0';
+        if (line[strspn(line, " \t\r\n")] == '\0') continue;
+        phase_mark = tac1100_now_us();          // Waiting for input is not charged to any phase
+        commands++;
+        cmd.address = device_address;
+        cmd.retries = num_retries;
+        if (batchParse(line, &cmd, result, sizeof(result)) == 0) {
+            stamp_offset = wall_offset_us();
+            busAcquire(ctx);
+            phaseMark(PH_LOCK);
+            rc = batchRun(ctx, &cmd, result, sizeof(result));
+            if (rc >= TAC1100_OK) {
+                recover_fails = 0;
+            } else if (recover_max >= 0 && (rc == TAC1100_EBUS || rc == TAC1100_ECONNECT)) {
+                busRecover(ctx, rc);
             }
-        } while (errno_save == EWOULDBLOCK);
-
-        fLen = 0;
-        while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n' && curChar != ' ') fLen++;
-        fLen = 0;
-        if (curChar == ' ') while ((curChar = fgetc(fdserlck)) != EOF && curChar != '\n') fLen++;
-
-        rewind(fdserlck);
-        
-        LckCOMMAND = getMemPtr(fLen+1);
-        LckCOMMAND[0] = '\0';
-        LckPID=0;
-        
-        errno = 0;
-        bRead = fscanf(fdserlck, "%lu%*[ ]%[^\n]\n", &LckPID, LckCOMMAND);
-        errno_save = errno;
-        fclose(fdserlck);
-        if (LckPID != oldLckPID) {
-            log_message(debug_flag | (bRead==EOF || errno_save != 0 ? DEBUG_SYSLOG : 0), "errno=%i, bRead=%i PID=%lu LckPID=%lu", errno_save, bRead, PID, LckPID);
-            log_message(debug_flag, "Checking process %lu (%s) for lock", LckPID, LckCOMMAND);
+            // Give other bus clients a chance between commands
+            busRelease(ctx);
+            phaseMark(PH_TRANSACTIONS);
+        } else {
+            rc = -1;
         }
-        if (bRead == EOF || LckPID == 0 || errno_save != 0) {
-            log_message(debug_flag | DEBUG_SYSLOG, "Problem locking serial device, can't read PID from lock file: %s.",devLCKfile);
-            log_message(debug_flag | DEBUG_SYSLOG, "errno=%i, bRead=%i PID=%lu LckPID=%lu", errno_save, bRead, PID, LckPID);
-            if (errno_save != 0) {
-                log_message(debug_flag | DEBUG_SYSLOG, "(%u) %s", errno_save, strerror(errno_save));
-                free(LckCOMMAND); free(LckPIDcommand); free(COMMAND);
-                exit(2);
-            } else {
-                if (missingPidRetries < missingPidRetriesMax) {
-                    missingPidRetries++;
-                    log_message(debug_flag, "%s miss process self PID from lock file?",devLCKfile);
-                    rnd_usleep(250000); // Wait 250ms before retry
-                } else if (missingPidRetries >= missingPidRetriesMax) {
-                    log_message(debug_flag | DEBUG_SYSLOG, "%s miss process self PID from lock file, amending.",devLCKfile);
-                    AddSerLock(szttyDevice, devLCKfile, PID, COMMAND, debug_flag);
-                    missingPidRetries = 0;
-                }
-            }
-            oldLckPID = LckPID;
-        } else { //fread OK
-          
-          missingPidRetries = 0;
-          
-          LckPIDcommand = getPIDcmd(LckPID);
-          
-          if (LckPID != oldLckPID) {
-              log_message(debug_flag, "PID: %lu COMMAND: \"%s\" LckPID: %lu LckCOMMAND: \"%s\" LckPIDcommand \"%s\"%s", PID, COMMAND
-                                          , LckPID, LckCOMMAND, LckPIDcommand
-                                          , LckPID == PID ? " = me" : "");
-              oldLckPID = LckPID;              
-          }
-          
-          if ((PID != LckPID && LckPIDcommand == NULL) || (LckCOMMAND[0]!='\0' && strcmp(LckPIDcommand,LckCOMMAND) != 0) || strcmp(LckPIDcommand,"") == 0) {
-                // Stale lock: process doesn't exist or command mismatch
-                if (staleLockRetries < staleLockRetriesMax) {
-                    staleLockRetries++;
-                    clrStaleTargetPID = LckPID;
-                    log_message(debug_flag | (staleLockRetries > 1 ? DEBUG_SYSLOG : 0), "Stale pid lock(%d)? PID=%lu, LckPID=%lu, LckCOMMAND='%s', LckPIDCommand='%s'", staleLockRetries, PID, LckPID, LckCOMMAND, LckPIDcommand);
-                } else if (LckPID == clrStaleTargetPID && staleLockRetries >= staleLockRetriesMax) {
-                    log_message(debug_flag | DEBUG_SYSLOG, "Clearing stale serial port lock. (%lu)", LckPID);
-                    ClrSerLock(LckPID);
-                    staleLockRetries = 0;
-                    clrStaleTargetPID = 0;
-                }
-          } else {
-                // Valid lock: process exists and command matches
-                staleLockRetries = 0;
-                clrStaleTargetPID = 0;
-                
-                // Check if it's a compatible ModBus client (sdm120c, aurora, tac1100, etc.)
-                if (PID != LckPID && LckPIDcommand != NULL) {
-                    // Lock held by another process - check if it's ModBus compatible
-                    if (strstr(LckPIDcommand, "sdm120") != NULL || 
-                        strstr(LckPIDcommand, "tac1100") != NULL || 
-                        strstr(LckPIDcommand, "aurora") != NULL ||
-                        strstr(LckPIDcommand, "modbus") != NULL) {
-                        // Compatible ModBus client - we can share the bus
-                        log_message(debug_flag, "Compatible ModBus client detected: %s (PID %lu). Sharing bus.", LckPIDcommand, LckPID);
-                        // Accept this as valid - we have shared lock, exit loop
-                        LckPID = PID;  // Set to our PID to exit the loop
-                    }
-                }
-          } 
+        if (rc == 0) {
+            printf("%ld OK%s\n", lineno, result);
+        } else if (rc == 1) {
+            printf("%ld PARTIAL%s\n", lineno, result);
+            (*partial)++;
+        } else {
+            printf("%ld NOK %s\n", lineno, result);
+            log_message(debug_flag | DEBUG_SYSLOG, "Batch line %ld failed: %s", lineno, result);
+            failed++;
         }
-
-        if (yLockWait > 0 && LckPID != PID) {
-             rnd_usleep(25000);
+        fflush(stdout);
+        phaseMark(PH_OUTPUT);
+        statsLive();
+        if (rc < 0 && batch_on_error == BATCH_STOP) {
+            fprintf(stderr, "%s: batch stopped at line %ld\n", programName, lineno);
+            break;
         }
-
-        // Cleanup and loop        
-        free(LckCOMMAND);
-        free(LckPIDcommand);
-        LckCOMMAND = NULL;
-        LckPIDcommand = NULL;
-
-        gettimeofday(&tLockNow, NULL);
     }
 
-    free(LckCOMMAND);
-    free(LckPIDcommand);
-    free(COMMAND);
-
-    if (LckPID != PID) {
-        ClrSerLock(PID);
-        log_message(DEBUG_STDERR, "Problem locking serial device %s.",szttyDevice);
-        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Unable to get lock on serial %s for %lu in %ds: still locked by %lu.",szttyDevice,PID,(yLockWait)%30,LckPID);
-        log_message(DEBUG_STDERR, "Try a greater -w value (eg -w%u).", (yLockWait+2)%30);
-        free(devLCKfile); free(devLCKfileNew); free(PARENTCOMMAND);        
-        exit(2);
-    }
-    
-    // We have shared lock now. Before opening ModBus connection, upgrade to exclusive lock
-    // to prevent bus collisions when multiple processes communicate simultaneously.
-    log_message(debug_flag, "Upgrading to exclusive lock for ModBus communication...");
-    fdModbusExclusiveLock = fopen(devLCKfile, "r");
-    if (fdModbusExclusiveLock != NULL) {
-        if (flock(fileno(fdModbusExclusiveLock), LOCK_EX) != 0) {
-            log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Failed to acquire exclusive lock: (%d) %s", errno, strerror(errno));
-            fclose(fdModbusExclusiveLock);
-            fdModbusExclusiveLock = NULL;
-            ClrSerLock(PID);
-            free(devLCKfile); free(devLCKfileNew); free(PARENTCOMMAND);
-            exit(2);
-        }
-        log_message(debug_flag, "Exclusive lock acquired. Ready for ModBus communication.");
-        // Keep this file open during all ModBus operations
-        // It will be closed when program exits or in exit_error()
-    } else {
-        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Failed to open lock file for exclusive access");
-    }
+    log_message(debug_flag, "Batch: %ld commands, %ld failed, %ld partial", commands, failed, *partial);
+    return failed;
 }
 
 int main(int argc, char* argv[])
@@ -1006,6 +2400,15 @@ int main(int argc, char* argv[])
     int compact_flag   = 0;
     int count_param    = 0;
     int num_retries    = 1;
+
+    int poll_flag      = 0;
+    long poll_cycles   = 0;  // 0 = poll until SIGINT/SIGTERM
+    const char *poll_option = NULL;     // Last poll mode only option given
+    int max_gap_flag   = 0;
+    const char *batch_file = NULL;  // --batch input, NULL or "-" = stdin
+    FILE *batch_fp     = NULL;
+    int selected[NUM_REGS];
+    int r;
     
 #if LIBMODBUS_VERSION_MAJOR >= 3 && LIBMODBUS_VERSION_MINOR >= 1 && LIBMODBUS_VERSION_MICRO >= 2
     uint32_t resp_timeout = 2;
@@ -1031,6 +2434,7 @@ int main(int argc, char* argv[])
     char parity        = N_PARITY;  // Default: None
     
     programName        = argv[0];
+    phase_mark         = tac1100_now_us();
 
     if (argc == 1) {
         usage(programName);
@@ -1043,12 +2447,36 @@ int main(int argc, char* argv[])
     getCmdLine();
 
     PPID = getppid();
-    PARENTCOMMAND = getPIDcmd(PPID); 
+    PARENTCOMMAND = tac1100_pid_command(PPID);
 
     opterr = 0;
 
+    static struct option long_options[] = {
+        { "poll",    no_argument,       NULL, OPT_POLL    },
+        { "rate",    required_argument, NULL, OPT_RATE    },
+        { "cycles",  required_argument, NULL, OPT_CYCLES  },
+        { "max-gap", required_argument, NULL, OPT_MAX_GAP },
+        { "interpolate", no_argument,   NULL, OPT_INTERPOLATE },
+        { "no-align", no_argument,      NULL, OPT_NO_ALIGN },
+        { "timestamps", optional_argument, NULL, OPT_TIMESTAMPS },
+        { "stats",   optional_argument, NULL, OPT_STATS },
+        { "capture", required_argument, NULL, OPT_CAPTURE },
+        { "log-ring", optional_argument, NULL, OPT_LOG_RING },
+        { "fd-lock", no_argument, NULL, OPT_FD_LOCK },
+        { "batch",   optional_argument, NULL, OPT_BATCH },
+        { "on-error", required_argument, NULL, OPT_ON_ERROR },
+        { "native-rtu", no_argument, NULL, OPT_NATIVE_RTU },
+        { "arbiter", optional_argument, NULL, OPT_ARBITER },
+        { "recover", optional_argument, NULL, OPT_RECOVER },
+        { "partial", no_argument, NULL, OPT_PARTIAL },
+        { "breaker", required_argument, NULL, OPT_BREAKER },
+        { "secondary", required_argument, NULL, OPT_SECONDARY },
+        { "failover", required_argument, NULL, OPT_FAILOVER },
+        { NULL,      0,                 NULL, 0           }
+    };
+
     // Opzioni: a b c d D e f g i j K L m n N o p P q Q r R s S t T U v w W x y z A B C G H
-    while ((c = getopt (argc, argv, "a:Ab:BcCd:D:efgij:K:lL:mN:no OpP:qQ:r:R:s:S:tTU:vw:W:xy:z:G:H:")) != -1) {
+    while ((c = getopt_long (argc, argv, "a:Ab:BcCd:D:efgij:K:lL:mN:no OpP:qQ:r:R:s:S:tTU:vw:W:xy:z:G:H:", long_options, NULL)) != -1) {
         log_message(debug_flag | DEBUG_SYSLOG, "optind = %d, argc = %d, c = %c, optarg = %s", optind, argc, c, optarg);
 
         switch (c)
@@ -1384,6 +2812,172 @@ int main(int argc, char* argv[])
                 log_message(debug_flag | DEBUG_SYSLOG, "time_disp_flag = %d, count_param = %d", time_disp_flag, count_param);
                 break;
                 
+            case OPT_POLL:
+                poll_flag = 1;
+                log_message(debug_flag | DEBUG_SYSLOG, "poll_flag = %d", poll_flag);
+                break;
+
+            case OPT_RATE:
+                poll_option = "--rate";
+                if (parseRates(optarg) != 0) {
+                    fprintf(stderr, "%s: --rate must be group=seconds[,group=seconds...] with groups power, vi, energy, config (0.1-86400s).\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "rate = %s", optarg);
+                break;
+
+            case OPT_CYCLES:
+                poll_option = "--cycles";
+                poll_cycles = atol(optarg);
+                if (poll_cycles < 0) {
+                    fprintf(stderr, "%s: --cycles (%ld) must be >= 0.\n", programName, poll_cycles);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "poll_cycles = %ld", poll_cycles);
+                break;
+
+            case OPT_MAX_GAP:
+                max_gap_flag = 1;
+                max_gap = atoi(optarg);
+                if (max_gap < 0 || max_gap > MODBUS_MAX_READ_REGISTERS) {
+                    fprintf(stderr, "%s: --max-gap (%d) out of range, 0-%d.\n", programName, max_gap, MODBUS_MAX_READ_REGISTERS);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "max_gap = %d", max_gap);
+                break;
+
+            case OPT_INTERPOLATE:
+                poll_option = "--interpolate";
+                interpolate_flag = 1;
+                log_message(debug_flag | DEBUG_SYSLOG, "interpolate_flag = %d", interpolate_flag);
+                break;
+
+            case OPT_NO_ALIGN:
+                poll_option = "--no-align";
+                align_flag = 0;
+                log_message(debug_flag | DEBUG_SYSLOG, "align_flag = %d", align_flag);
+                break;
+
+            case OPT_TIMESTAMPS:
+                if (optarg == NULL || strcmp(optarg, "wall") == 0) {
+                    stamp_flag = STAMP_WALL;
+                } else if (strcmp(optarg, "mono") == 0) {
+                    stamp_flag = STAMP_MONO;
+                } else {
+                    fprintf(stderr, "%s: --timestamps must be wall or mono.\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "stamp_flag = %d", stamp_flag);
+                break;
+
+            case OPT_STATS:
+                stats_flag = 1;
+                stats_file = optarg;
+                log_message(debug_flag | DEBUG_SYSLOG, "stats_flag = %d, stats_file = %s", stats_flag, stats_file ? stats_file : "stderr");
+                break;
+
+            case OPT_CAPTURE:
+                capture_file = optarg;
+                log_message(debug_flag | DEBUG_SYSLOG, "capture_file = %s", capture_file);
+                break;
+
+            case OPT_LOG_RING: {
+                int entries = optarg ? atoi(optarg) : LOG_RING_DEFAULT;
+                if (entries < 16 || entries > 1000000) {
+                    fprintf(stderr, "%s: --log-ring entries must be between 16 and 1000000.\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                logRingOpen(entries);
+                log_message(debug_flag | DEBUG_SYSLOG, "log_ring = %d", entries);
+                break;
+            }
+
+            case OPT_FD_LOCK:
+                fd_lock_flag = 1;
+                log_message(debug_flag | DEBUG_SYSLOG, "fd_lock_flag = %d", fd_lock_flag);
+                break;
+
+            case OPT_NATIVE_RTU:
+                native_rtu_flag = 1;
+                log_message(debug_flag | DEBUG_SYSLOG, "native_rtu_flag = %d", native_rtu_flag);
+                break;
+
+            case OPT_ARBITER:
+                arbiter_flag = 1;
+                arbiter_socket = optarg;
+                log_message(debug_flag | DEBUG_SYSLOG, "arbiter = %s", optarg ? optarg : "default");
+                break;
+
+            case OPT_RECOVER:
+                if (optarg == NULL || strcmp(optarg, "reopen") == 0) {
+                    recover_max = TAC1100_RECOVER_REOPEN;
+                } else if (strcmp(optarg, "reconnect") == 0) {
+                    recover_max = TAC1100_RECOVER_RECONNECT;
+                } else if (strcmp(optarg, "flush") == 0) {
+                    recover_max = TAC1100_RECOVER_FLUSH;
+                } else {
+                    fprintf(stderr, "%s: --recover must be flush, reconnect or reopen.\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "recover_max = %d", recover_max);
+                break;
+
+            case OPT_PARTIAL:
+                partial_flag = 1;
+                log_message(debug_flag | DEBUG_SYSLOG, "partial_flag = %d", partial_flag);
+                break;
+
+            case OPT_BREAKER: {
+                char *end;
+                breaker_fails = strtol(optarg, &end, 10);
+                if (*end == ',') breaker_probe = strtol(end + 1, &end, 10);
+                if (*end == ',') probe_timeout_ms = strtol(end + 1, &end, 10);
+                if (*end != '\0' || breaker_fails < 1 || breaker_probe < 1 || probe_timeout_ms < 0 || probe_timeout_ms > 999) {
+                    fprintf(stderr, "%s: --breaker=fails[,probe[,ms]], fails and probe at least 1, ms 0-999.\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "breaker = %d,%d,%ld", breaker_fails, breaker_probe, probe_timeout_ms);
+                break;
+            }
+
+            case OPT_SECONDARY:
+                secondary_device = optarg;
+                log_message(debug_flag | DEBUG_SYSLOG, "secondary_device = %s", secondary_device);
+                break;
+
+            case OPT_FAILOVER: {
+                char *end;
+                failover_percent = strtol(optarg, &end, 10);
+                if (*end == ',') failover_window = strtol(end + 1, &end, 10);
+                if (*end == ',') failover_probe = strtol(end + 1, &end, 10);
+                if (*end != '\0' || failover_percent < 1 || failover_percent > 100 || failover_window < 1 ||
+                    failover_window > PATH_WINDOW_MAX || failover_probe < 1) {
+                    fprintf(stderr, "%s: --failover=percent[,window[,probe]], percent 1-100, window 1-%d, probe at least 1.\n",
+                            programName, PATH_WINDOW_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "failover = %d,%d,%d", failover_percent, failover_window, failover_probe);
+                break;
+            }
+
+            case OPT_BATCH:
+                batch_flag = 1;
+                batch_file = optarg;
+                log_message(debug_flag | DEBUG_SYSLOG, "batch_flag = %d, batch_file = %s", batch_flag, batch_file ? batch_file : "stdin");
+                break;
+
+            case OPT_ON_ERROR:
+                if (strcmp(optarg, "stop") == 0) {
+                    batch_on_error = BATCH_STOP;
+                } else if (strcmp(optarg, "continue") == 0) {
+                    batch_on_error = BATCH_CONTINUE;
+                } else {
+                    fprintf(stderr, "%s: --on-error must be stop or continue.\n", programName);
+                    exit(EXIT_FAILURE);
+                }
+                log_message(debug_flag | DEBUG_SYSLOG, "batch_on_error = %d", batch_on_error);
+                break;
+
             case '?':
                 if (isprint (optopt)) {
                     fprintf (stderr, "%s: Unknown option `-%c'.\n", programName, optopt);
@@ -1418,9 +3012,53 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
-    lockSer(szttyDevice, PID, debug_flag);
+    if (secondary_device != NULL && (!poll_flag || strcmp(secondary_device, szttyDevice) == 0)) {
+        fprintf(stderr, "%s: --secondary needs --poll and a device other than %s\n", programName, szttyDevice);
+        exit(EXIT_FAILURE);
+    }
+
+    if (poll_option != NULL && !poll_flag) {
+        fprintf(stderr, "%s: %s needs --poll\n", programName, poll_option);
+        exit(EXIT_FAILURE);
+    }
+    // Block reads are planned in poll and batch mode only
+    if (max_gap_flag && !poll_flag && !batch_flag) {
+        fprintf(stderr, "%s: --max-gap needs --poll or --batch\n", programName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (batch_flag) {
+        // Reads and writes come from the batch input, one command per line
+        if (count_param > 0 || poll_flag || new_address > 0 || new_baud_rate >= 0 || new_parity_stop >= 0 ||
+            password_flag || demand_period_flag || slide_time_flag || scroll_time_flag || backlit_time_flag || reset_hist_flag) {
+            fprintf(stderr, "%s: --batch takes the reads and writes from its input, one command per line\n", programName);
+            exit(EXIT_FAILURE);
+        }
+        if (batch_file == NULL || strcmp(batch_file, "-") == 0) {
+            batch_fp = stdin;
+        } else {
+            int errno_save;
+            userPrivileges();
+            batch_fp = fopen(batch_file, "r");
+            errno_save = errno;
+            restorePrivileges();
+            if (batch_fp == NULL) {
+                fprintf(stderr, "%s: Can't open batch file %s: (%d) %s\n", programName, batch_file, errno_save, strerror(errno_save));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (stats_flag) {
+        stats_port = szttyDevice;
+        stats_start = tac1100_now_us();
+        atexit(statsAtExit);
+    }
+    if (capture_file) captureOpen(capture_file);
 
-    modbus_t *ctx;
+    tac1100_t *ctx;
+    tac1100_config_t cfg;
+    int rc;
     
     // Baud rate
     if (baud_rate == 0) baud_rate = DEFAULT_RATE;
@@ -1451,102 +3089,98 @@ int main(int argc, char* argv[])
         log_message(debug_flag, "settle_time=%ldus", settle_time);
     }
 
-    if (stop_bits == 0) {
-        if (parity != N_PARITY)
-            stop_bits=1;     // Default if parity != N
-        else
-            stop_bits=2;     // Default if parity == N        
-    }
-
-    //--- Modbus Setup start ---
-    
-    ctx = modbus_new_rtu(szttyDevice, baud_rate, parity, 8, stop_bits);
+    tac1100_config_init(&cfg);
+    cfg.baud_rate = baud_rate;
+    cfg.parity = parity;
+    cfg.stop_bits = stop_bits;
+    cfg.resp_timeout_us = resp_timeout;
+    cfg.byte_timeout_us = byte_timeout == -1 ? -1 : (long)byte_timeout;
+    cfg.command_delay_us = command_delay;
+    cfg.settle_us = settle_time;
+    cfg.retries = num_retries;
+    cfg.max_gap = max_gap;
+    cfg.lock_mode = fd_lock_flag ? TAC1100_LOCK_FD : arbiter_flag ? TAC1100_LOCK_ARB : TAC1100_LOCK_UUCP;
+    cfg.lock_wait = yLockWait;
+    cfg.arb_socket = arbiter_socket;
+    cfg.trace = trace_flag;
+    cfg.native_rtu = native_rtu_flag;
+    cfg.breaker_fails = breaker_fails;
+    cfg.breaker_probe = breaker_probe;
+    cfg.probe_timeout_us = probe_timeout_ms * 1000;
+
+    ctx = tac1100_new(szttyDevice, &cfg);
     if (ctx == NULL) {
-        log_message(debug_flag | DEBUG_SYSLOG, "Unable to create the libmodbus context\n");
-        ClrSerLock(PID);
+        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Unable to create the tac1100 context");
         exit(EXIT_FAILURE);
-    } else {
-        log_message(debug_flag, "Libmodbus context open (%d%s%d)",
-                baud_rate,
-                (parity == E_PARITY) ? EVEN_parity :
-                (parity == N_PARITY) ? NONE_parity :
-                ODD_parity,
-                stop_bits);
-    }
-
-#if LIBMODBUS_VERSION_MAJOR >= 3 && LIBMODBUS_VERSION_MINOR >= 1 && LIBMODBUS_VERSION_MICRO >= 2
-
-    // Considering to get those values from command line
-    if (byte_timeout == -1) {
-        modbus_set_byte_timeout(ctx, -1, 0);
-        log_message(debug_flag, "Byte timeout disabled.");
-    } else {
-        modbus_set_byte_timeout(ctx, 0, byte_timeout);
-        log_message(debug_flag, "New byte timeout: %ds, %dus", 0, byte_timeout);
     }
-    modbus_set_response_timeout(ctx, 0, resp_timeout);
-    log_message(debug_flag, "New response timeout: %ds, %dus", 0, resp_timeout);
-
-#else
-
-    struct timeval timeout;
-
-    if (byte_timeout == -1) {
-        timeout.tv_sec = -1;
-        timeout.tv_usec = 0;
-        modbus_set_byte_timeout(ctx, &timeout);
-        log_message(debug_flag, "Byte timeout disabled.");
-    } else {
-        timeout.tv_sec = 0;
-        timeout.tv_usec = byte_timeout;
-        modbus_set_byte_timeout(ctx, &timeout);
-        log_message(debug_flag, "New byte timeout: %ds, %dus", timeout.tv_sec, timeout.tv_usec);
+    tac1100_set_log(ctx, busLog, NULL);
+    // Without a consumer the native codec decodes the responses in place
+    if (stats_flag || capture_file || trace_flag) tac1100_set_xfer_hook(ctx, busXfer, NULL);
+    stats_bus = ctx;
+
+    if (secondary_device != NULL) {
+        // The secondary is opened and locked when the polling first needs
+        // it; its arbiter, if any, is the default one of its port
+        paths[PATH_PRIMARY].device = szttyDevice;
+        paths[PATH_PRIMARY].ctx = ctx;
+        paths[PATH_SECONDARY].device = secondary_device;
+        cfg.arb_socket = NULL;
+        if ((paths[PATH_SECONDARY].ctx = tac1100_new(secondary_device, &cfg)) == NULL) {
+            log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Unable to create the tac1100 context");
+            busClose(ctx);
+            exit(EXIT_FAILURE);
+        }
+        tac1100_set_log(paths[PATH_SECONDARY].ctx, busLog, NULL);
+        tac1100_set_xfer_hook(ctx, busXfer, &paths[PATH_PRIMARY]);
+        tac1100_set_xfer_hook(paths[PATH_SECONDARY].ctx, busXfer, &paths[PATH_SECONDARY]);
+        path_retries = num_retries;
+    }
+
+    phaseMark(PH_STARTUP);
+    if (!fd_lock_flag) {
+        if ((rc = tac1100_lock_port(ctx)) != TAC1100_OK) {
+            if (rc == TAC1100_ELOCK) {
+                log_message(DEBUG_STDERR, "Problem locking serial device %s.", szttyDevice);
+                log_message(DEBUG_STDERR, "Try a greater -w value (eg -w%u).", (yLockWait+2)%30);
+            }
+            busClose(ctx);
+            free(PARENTCOMMAND);
+            exit(2);
+        }
+        phaseMark(PH_LOCK);
     }
-    
-    timeout.tv_sec = 0;
-    timeout.tv_usec = resp_timeout;
-    modbus_set_response_timeout(ctx, &timeout);
-    log_message(debug_flag, "New response timeout: %ds, %dus", timeout.tv_sec, timeout.tv_usec);
 
-#endif
+    //--- Modbus Setup start ---
 
-    modbus_set_error_recovery(ctx, MODBUS_ERROR_RECOVERY_NONE);
-    
-    if (settle_time) {
-      // Wait for line settle
-      log_message(debug_flag, "Sleeping %ldus for line settle...", settle_time);
-      usleep(settle_time);
+    if ((rc = tac1100_connect(ctx)) != TAC1100_OK) {
+        // No primary adapter: start on the secondary
+        if (rc != TAC1100_ECONNECT || secondary_device == NULL ||
+            pathSwitch(&ctx, PATH_SECONDARY, 0, "primary not available") != TAC1100_OK) {
+            busClose(ctx);
+            free(PARENTCOMMAND);
+            exit(rc == TAC1100_ECONNECT || rc == TAC1100_EINVAL ? EXIT_FAILURE : 2);
+        }
     }
-    
-    if (trace_flag == 1) {
-        modbus_set_debug(ctx, 1);
+    if (fd_lock_flag) {
+        // The port lock is part of tac1100_connect() here
+        long long lock_us = tac1100_lock_stats(ctx)->exclusive_us;
+        phaseMark(PH_CONNECT);
+        phase_us[PH_CONNECT] -= lock_us;
+        phase_us[PH_LOCK] += lock_us;
+    } else {
+        phaseMark(PH_CONNECT);
     }
 
-    modbus_set_slave(ctx, device_address);
-
-    if (modbus_connect(ctx) == -1) {
-        log_message(DEBUG_STDERR | DEBUG_SYSLOG, "Connection failed: (%d) %s\n", errno, modbus_strerror(errno));
-        modbus_free(ctx);
-        ClrSerLock(PID);
-        exit(EXIT_FAILURE);
+    if (batch_flag) {
+        long partial = 0;
+        int failed = batchLoop(ctx, batch_fp, device_address, num_retries, &partial);
+        if (batch_fp != stdin) fclose(batch_fp);
+        phase_mark = tac1100_now_us();
+        busClose(ctx);
+        free(PARENTCOMMAND);
+        return failed ? EXIT_FAILURE : partial ? EXIT_PARTIAL : 0;
     }
 
-    float voltage     = 0;
-    float current     = 0;
-    float power       = 0;
-    float apower      = 0;
-    float rapower     = 0;
-    float pf          = 0;
-    float pangle      = 0;
-    float freq        = 0;
-    float imp_energy  = 0;
-    float exp_energy  = 0;
-    float tot_energy  = 0;
-    float impr_energy = 0;
-    float expr_energy = 0;
-    float totr_energy = 0;
-    int   time_disp   = 0;
-
     // =============================================
     // GESTIONE SCRITTURA PARAMETRI TAC1100
     // =============================================
@@ -1566,16 +3200,12 @@ int main(int argc, char* argv[])
         // Change Meter Address
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting new meter address to %d", new_address);
-            changeConfigUINT(ctx, DEVICE_ID, new_address, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, DEVICE_ID, new_address, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1583,16 +3213,12 @@ int main(int argc, char* argv[])
         // Change Baud Rate
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting new baud rate to %d", new_baud_rate);
-            changeConfigUINT(ctx, BAUD_RATE, new_baud_rate, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, BAUD_RATE, new_baud_rate, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1600,16 +3226,12 @@ int main(int argc, char* argv[])
         // Change Parity/Stop bits
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting new parity/stop to %d", new_parity_stop);
-            changeConfigUINT(ctx, NPARSTOP, new_parity_stop, RESTART_TRUE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, NPARSTOP, new_parity_stop, RESTART_TRUE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1617,9 +3239,7 @@ int main(int argc, char* argv[])
         // Set Password
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting password to %d", password_value);
@@ -1629,36 +3249,30 @@ int main(int argc, char* argv[])
                 fprintf(stderr, "\nERROR: Current password required for KPPA authorization.\n");
                 fprintf(stderr, "Usage: %s -Q <current_password> -K <new_password> /dev/ttyUSB0\n", programName);
                 fprintf(stderr, "Example: %s -Q 0000 -K 1234 /dev/ttyUSB0\n\n", programName);
-                modbus_close(ctx);
-                modbus_free(ctx);
-                ClrSerLock(PID);
+                busClose(ctx);
                 exit(EXIT_FAILURE);
             }
             
             // Abilita KPPA con la password corrente
             printf("Enabling KPPA authorization with current password...\n");
-            if (enableKPPA(ctx, current_password) == -1) {
+            if (tac1100_kppa(ctx, device_address, current_password) != TAC1100_OK) {
                 fprintf(stderr, "\nERROR: Failed to enable KPPA.\n");
                 fprintf(stderr, "Please verify:\n");
                 fprintf(stderr, "  1. Current password (-Q) is correct (default: 0000)\n");
                 fprintf(stderr, "  2. Meter is accessible via Modbus\n");
                 fprintf(stderr, "  3. No communication errors\n\n");
-                modbus_close(ctx);
-                modbus_free(ctx);
-                ClrSerLock(PID);
+                busClose(ctx);
                 exit(EXIT_FAILURE);
             }
             
             printf("KPPA enabled. Changing password...\n");
             
             // Ora scrivi la nuova password
-            changeConfigUINT(ctx, PASSWORD, password_value, RESTART_FALSE);
+            changeConfigUINT(ctx, device_address, PASSWORD, password_value, RESTART_FALSE);
             
             printf("\nPassword changed successfully from %d to %d.\n", current_password, password_value);
             printf("IMPORTANT: Remember your new password!\n");
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             return 0;
         }
         
@@ -1666,16 +3280,12 @@ int main(int argc, char* argv[])
         // Set Demand Period
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting demand period to %d minutes", demand_period);
-            changeConfigUINT(ctx, DEMAND_PERIOD, demand_period, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, DEMAND_PERIOD, demand_period, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1683,16 +3293,12 @@ int main(int argc, char* argv[])
         // Set Slide Time
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting slide time to %d", slide_time);
-            changeConfigUINT(ctx, SLIDE_TIME, slide_time, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, SLIDE_TIME, slide_time, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1700,16 +3306,12 @@ int main(int argc, char* argv[])
         // Set Automatic Scroll Display Time
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting automatic scroll display time to %d seconds", scroll_time);
-            changeConfigUINT(ctx, TIME_DISP, scroll_time, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, TIME_DISP, scroll_time, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1717,16 +3319,12 @@ int main(int argc, char* argv[])
         // Set Backlit Time
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Setting backlit time to %d minutes", backlit_time);
-            changeConfigUINT(ctx, BACKLIT_TIME, backlit_time, RESTART_FALSE);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            changeConfigUINT(ctx, device_address, BACKLIT_TIME, backlit_time, RESTART_FALSE);
+            busClose(ctx);
             return 0;
         }
         
@@ -1734,9 +3332,7 @@ int main(int argc, char* argv[])
         // Reset Historical Data
         if (count_param > 0) {
             usage(programName);
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             exit(EXIT_FAILURE);
         } else {
             log_message(debug_flag, "Resetting historical data, type %d", reset_hist_type);
@@ -1750,30 +3346,26 @@ int main(int argc, char* argv[])
                 fprintf(stderr, "  0 = Reset maximum demand\n");
                 fprintf(stderr, "  8 = Reset monthly energy consumption\n");
                 fprintf(stderr, "  9 = Reset daily energy consumption\n\n");
-                modbus_close(ctx);
-                modbus_free(ctx);
-                ClrSerLock(PID);
+                busClose(ctx);
                 exit(EXIT_FAILURE);
             }
             
             // Abilita KPPA con la password corrente
             printf("Enabling KPPA authorization with password...\n");
-            if (enableKPPA(ctx, current_password) == -1) {
+            if (tac1100_kppa(ctx, device_address, current_password) != TAC1100_OK) {
                 fprintf(stderr, "\nERROR: Failed to enable KPPA.\n");
                 fprintf(stderr, "Please verify:\n");
                 fprintf(stderr, "  1. Password (-Q) is correct (default: 0000)\n");
                 fprintf(stderr, "  2. Meter is accessible via Modbus\n");
                 fprintf(stderr, "  3. No communication errors\n\n");
-                modbus_close(ctx);
-                modbus_free(ctx);
-                ClrSerLock(PID);
+                busClose(ctx);
                 exit(EXIT_FAILURE);
             }
             
             printf("KPPA enabled. Sending reset command...\n");
             
             // RESET_HIST richiede KPPA authorization
-            changeConfigUINT(ctx, RESET_HIST, reset_hist_type, RESTART_FALSE);
+            changeConfigUINT(ctx, device_address, RESET_HIST, reset_hist_type, RESTART_FALSE);
             
             printf("\nHistorical data reset command executed successfully.\n");
             printf("Reset type: ");
@@ -1782,9 +3374,7 @@ int main(int argc, char* argv[])
                 case 8: printf("Monthly energy consumption reset\n"); break;
                 case 9: printf("Daily energy consumption reset\n"); break;
             }
-            modbus_close(ctx);
-            modbus_free(ctx);
-            ClrSerLock(PID);
+            busClose(ctx);
             return 0;
         }
     }
@@ -1830,196 +3420,70 @@ int main(int argc, char* argv[])
                        rexport_flag + rimport_flag + rtotal_flag;
     }
 
+    selected[R_VOLTAGE]   = volt_flag;
+    selected[R_CURRENT]   = current_flag;
+    selected[R_POWER]     = power_flag;
+    selected[R_APPARENT]  = apower_flag;
+    selected[R_REACTIVE]  = rapower_flag;
+    selected[R_PFACTOR]   = pf_flag;
+    selected[R_PANGLE]    = pangle_flag;
+    selected[R_FREQUENCY] = freq_flag;
+    selected[R_IAENERGY]  = import_flag;
+    selected[R_EAENERGY]  = export_flag;
+    selected[R_TAENERGY]  = total_flag;
+    selected[R_IRAENERGY] = rimport_flag;
+    selected[R_ERAENERGY] = rexport_flag;
+    selected[R_TRENERGY]  = rtotal_flag;
+    selected[R_TIME_DISP] = time_disp_flag;
+
     // =============================================
-    // LETTURA PARAMETRI
+    // LETTURA PARAMETRI IN POLLING (MULTI-RATE)
     // =============================================
-    
-    if (volt_flag == 1) {
-        voltage = getMeasureFloat(ctx, VOLTAGE, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_V(%3.2f*V)\n", device_address, voltage);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", voltage);
-        } else {
-            printf("Voltage: %3.2f V \n",voltage);
-        }
-    }
-
-    if (current_flag == 1) {
-        current  = getMeasureFloat(ctx, CURRENT, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_C(%3.2f*A)\n", device_address, current);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", current);
-        } else {
-            printf("Current: %3.2f A \n",current);
-        }
-    }
-
-    if (power_flag == 1) {
-        power = getMeasureFloat(ctx, POWER, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_P(%3.2f*W)\n", device_address, power);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", power);
-        } else {
-            printf("Power: %3.2f W \n", power);
-        }
-    }
-
-    if (apower_flag == 1) {
-        apower = getMeasureFloat(ctx, RAPOWER, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_VA(%3.2f*VA)\n", device_address, apower);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", apower);
-        } else {
-            printf("Apparent Power: %3.2f VA \n", apower);
-        }
-    }
-
-    if (rapower_flag == 1) {
-        rapower = getMeasureFloat(ctx, APOWER, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_VAR(%3.2f*VAR)\n", device_address, rapower);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", rapower);
-        } else {
-            printf("Reactive Power: %3.2f VAR \n", rapower);
-        }
-    }
-
-    if (pf_flag == 1) {
-        pf = getMeasureFloat(ctx, PFACTOR, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_PF(%3.2f*F)\n", device_address, pf);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", pf);
-        } else {
-            printf("Power Factor: %3.2f \n", pf);
-        }
-    }
-
-    if (pangle_flag == 1) {
-        pangle = getMeasureFloat(ctx, PANGLE, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_PA(%3.2f*Dg)\n", device_address, pangle);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", pangle);
-        } else {
-            printf("Phase Angle: %3.2f Degree \n", pangle);
-        }
-    }
-
-    if (freq_flag == 1) {
-        freq = getMeasureFloat(ctx, FREQUENCY, num_retries, 2);
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_F(%3.2f*Hz)\n", device_address, freq);
-        } else if (compact_flag == 1) {
-            printf("%3.2f ", freq);
-        } else {
-            printf("Frequency: %3.2f Hz \n", freq);
-        }
-    }
-
-    if (import_flag == 1) {
-        imp_energy = getMeasureFloat(ctx, IAENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_IE(%d*Wh)\n", device_address, (int)imp_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)imp_energy);
-        } else {
-            printf("Import Active Energy: %d Wh \n", (int)imp_energy);
-        }
-    }
-
-    if (export_flag == 1) {
-        exp_energy = getMeasureFloat(ctx, EAENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_EE(%d*Wh)\n", device_address, (int)exp_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)exp_energy);
-        } else {
-            printf("Export Active Energy: %d Wh \n", (int)exp_energy);
-        }
-    }
-
-    if (total_flag == 1) {
-        tot_energy = getMeasureFloat(ctx, TAENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_TE(%d*Wh)\n", device_address, (int)tot_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)tot_energy);
-        } else {
-            printf("Total Active Energy: %d Wh \n", (int)tot_energy);
-        }
-    }
-
-    if (rimport_flag == 1) {
-        impr_energy = getMeasureFloat(ctx, IRAENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_IRE(%d*VARh)\n", device_address, (int)impr_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)impr_energy);
-        } else {
-            printf("Import Reactive Energy: %d VARh \n", (int)impr_energy);
-        }
-    }
-
-    if (rexport_flag == 1) {
-        expr_energy = getMeasureFloat(ctx, ERAENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_ERE(%d*VARh)\n", device_address, (int)expr_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)expr_energy);
-        } else {
-            printf("Export Reactive Energy: %d VARh \n", (int)expr_energy);
-        }
-    }
 
-    if (rtotal_flag == 1) {
-        totr_energy = getMeasureFloat(ctx, TRENERGY, num_retries, 2) * 1000;
-        read_count++;
-        if (metern_flag == 1) {
-            printf("%d_TRE(%d*VARh)\n", device_address, (int)totr_energy);
-        } else if (compact_flag == 1) {
-            printf("%d ", (int)totr_energy);
-        } else {
-            printf("Total Reactive Energy: %d VARh \n", (int)totr_energy);
-        }
+    if (poll_flag == 1) {
+        phaseMark(PH_TRANSACTIONS);
+        pollLoop(ctx, selected, device_address, compact_flag, poll_cycles);
+        phase_mark = tac1100_now_us();
+        busClose(ctx);
+        free(PARENTCOMMAND);
+        return 0;
     }
 
-    if (time_disp_flag == 1) {
-        time_disp = getConfigUINT(ctx, TIME_DISP, num_retries, 1);
-        read_count++;
-        if (compact_flag == 1) {
-            printf("%d ", (int) time_disp);
+    // =============================================
+    // LETTURA PARAMETRI
+    // =============================================
+    
+    stamp_offset = wall_offset_us();
+    for (r = 0; r < NUM_REGS; r++) {
+        uint16_t tab_reg[2];
+        float value;
+        int i;
+        if (!selected[r]) continue;
+        rc = readMeasure(ctx, device_address, &regs[r], tab_reg, &value);
+        phaseMark(PH_TRANSACTIONS);
+        if (rc == TAC1100_OK) {
+            // Out of the transaction timing
+            for (i = 0; i < regs[r].nb; i++) {
+                log_message(debug_flag, "reg[%d/%d]=%d (0x%X)", i, regs[r].nb - 1, tab_reg[i], tab_reg[i]);
+            }
+            read_count++;
+            printValue(&regs[r], value, read_time_us, device_address, compact_flag);
         } else {
-            printf("Automatic scroll display time: %d seconds\n", (int) time_disp);
+            printInvalid(&regs[r], busStrerror(ctx, rc), device_address, compact_flag);
         }
+        phaseMark(PH_OUTPUT);
     }
 
     if (read_count == count_param) {
-        modbus_close(ctx);
-        modbus_free(ctx);
-        ClrSerLock(PID);
-        free(devLCKfile);
-        free(devLCKfileNew);
+        busClose(ctx);
         free(PARENTCOMMAND);
         if (!metern_flag) printf("OK\n");
+    } else if (read_count > 0) {
+        busClose(ctx);
+        free(PARENTCOMMAND);
+        if (!metern_flag) printf("PARTIAL\n");
+        log_message(debug_flag | DEBUG_SYSLOG, "PARTIAL %d/%d", read_count, count_param);
+        return EXIT_PARTIAL;
     } else {
         exit_error(ctx);
     }
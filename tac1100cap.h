@@ -0,0 +1,135 @@
+/*
+ * tac1100cap.h: binary wire capture format (tac1100 --capture)
+ *
+ * A capture file is one or more segments (one per tac1100 run appending
+ * to the file), each a header followed by records. Integers are little
+ * endian.
+ *
+ * Header (CAP_HEADER_SIZE bytes):
+ *   0  char[8]  magic "TAC1100W"
+ *   8  uint32   format version (CAP_VERSION)
+ *  12  uint32   pid of the writer
+ *  16  int64    wall clock offset: wall time = record time + offset (us)
+ *  24  int64    monotonic time the segment was opened (us)
+ *
+ * Record (CAP_RECORD_SIZE bytes followed by len bytes of ADU):
+ *   0  int64    CLOCK_MONOTONIC time (us): request sent / response received
+ *   8  uint8    direction (CAP_TX, CAP_RX)
+ *   9  uint8    unit id
+ *  10  uint8    outcome (CAP_OK...), always CAP_OK for CAP_TX
+ *  11  uint8    exception code for CAP_EXCEPTION, otherwise 0
+ *  12  uint16   ADU length (address to CRC), 0 when nothing valid was received
+ */
+
+#ifndef TAC1100CAP_H
+#define TAC1100CAP_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define CAP_MAGIC        "TAC1100W"
+#define CAP_MAGIC_SIZE   8
+#define CAP_VERSION      1
+#define CAP_HEADER_SIZE  32
+#define CAP_RECORD_SIZE  14
+#define CAP_MAX_ADU      256
+
+#define CAP_TX           0
+#define CAP_RX           1
+
+#define CAP_OK           0
+#define CAP_TIMEOUT      1      // No response
+#define CAP_BADCRC       2      // Response failed the CRC check (bytes not kept)
+#define CAP_EXCEPTION    3      // ModBus exception response
+#define CAP_ERROR        4      // Any other failure
+
+typedef struct {
+    uint32_t version;
+    uint32_t pid;
+    int64_t wall_offset;
+    int64_t start;
+} capheader_t;
+
+typedef struct {
+    int64_t t;
+    uint8_t dir;
+    uint8_t unit;
+    uint8_t outcome;
+    uint8_t code;
+    uint16_t len;
+} caprecord_t;
+
+static inline void capPut16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void capPut32(uint8_t *p, uint32_t v)
+{
+    capPut16(p, v & 0xFFFF);
+    capPut16(p + 2, v >> 16);
+}
+
+static inline void capPut64(uint8_t *p, int64_t v)
+{
+    capPut32(p, (uint64_t)v & 0xFFFFFFFFu);
+    capPut32(p + 4, (uint64_t)v >> 32);
+}
+
+static inline uint16_t capGet16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t capGet32(const uint8_t *p)
+{
+    return capGet16(p) | ((uint32_t)capGet16(p + 2) << 16);
+}
+
+static inline int64_t capGet64(const uint8_t *p)
+{
+    return (int64_t)(capGet32(p) | ((uint64_t)capGet32(p + 4) << 32));
+}
+
+static inline void capEncodeHeader(uint8_t *p, const capheader_t *h)
+{
+    memcpy(p, CAP_MAGIC, CAP_MAGIC_SIZE);
+    capPut32(p + 8, h->version);
+    capPut32(p + 12, h->pid);
+    capPut64(p + 16, h->wall_offset);
+    capPut64(p + 24, h->start);
+}
+
+// 0 if p holds a header
+static inline int capDecodeHeader(const uint8_t *p, capheader_t *h)
+{
+    if (memcmp(p, CAP_MAGIC, CAP_MAGIC_SIZE) != 0) return -1;
+    h->version = capGet32(p + 8);
+    h->pid = capGet32(p + 12);
+    h->wall_offset = capGet64(p + 16);
+    h->start = capGet64(p + 24);
+    return 0;
+}
+
+static inline void capEncodeRecord(uint8_t *p, const caprecord_t *r)
+{
+    capPut64(p, r->t);
+    p[8] = r->dir;
+    p[9] = r->unit;
+    p[10] = r->outcome;
+    p[11] = r->code;
+    capPut16(p + 12, r->len);
+}
+
+static inline void capDecodeRecord(const uint8_t *p, caprecord_t *r)
+{
+    r->t = capGet64(p);
+    r->dir = p[8];
+    r->unit = p[9];
+    r->outcome = p[10];
+    r->code = p[11];
+    r->len = capGet16(p + 12);
+}
+
+#endif /* TAC1100CAP_H */
@@ -0,0 +1,94 @@
+/*
+ * tac1100regs.h: short names of the TAC1100 register map
+ *
+ * libtac1100.h exports the register map with the TAC1100_ prefix only.
+ * tac1100 and the library itself use the short names of the original
+ * program through this header, which is not installed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TAC1100REGS_H
+#define TAC1100REGS_H
+
+#include "libtac1100.h"
+
+// Read register addresses
+#define VOLTAGE        TAC1100_VOLTAGE
+#define CURRENT        TAC1100_CURRENT
+#define POWER          TAC1100_POWER
+#define APOWER         TAC1100_APOWER
+#define RAPOWER        TAC1100_RAPOWER
+#define PFACTOR        TAC1100_PFACTOR
+#define PANGLE         TAC1100_PANGLE
+#define FREQUENCY      TAC1100_FREQUENCY
+#define IAENERGY       TAC1100_IAENERGY
+#define EAENERGY       TAC1100_EAENERGY
+#define TAENERGY       TAC1100_TAENERGY
+#define IRAENERGY      TAC1100_IRAENERGY
+#define ERAENERGY      TAC1100_ERAENERGY
+#define TRENERGY       TAC1100_TRENERGY
+
+// Write register addresses
+#define KPPA           TAC1100_KPPA
+#define DEMAND_PERIOD  TAC1100_DEMAND_PERIOD
+#define SLIDE_TIME     TAC1100_SLIDE_TIME
+#define DEVICE_ID      TAC1100_DEVICE_ID
+#define BAUD_RATE      TAC1100_BAUD_RATE
+#define NPARSTOP       TAC1100_NPARSTOP
+#define PASSWORD       TAC1100_PASSWORD
+#define TIME_DISP      TAC1100_TIME_DISP
+#define BACKLIT_TIME   TAC1100_BACKLIT_TIME
+#define SYSTEM_TIME    TAC1100_SYSTEM_TIME
+#define TARIFF         TAC1100_TARIFF
+#define RESET_HIST     TAC1100_RESET_HIST
+#define METER_CODE     TAC1100_METER_CODE
+#define SERIAL_NUM     TAC1100_SERIAL_NUM
+#define SW_VERSION     TAC1100_SW_VERSION
+#define HW_VERSION     TAC1100_HW_VERSION
+#define DISP_VERSION   TAC1100_DISP_VERSION
+#define FAULT_CODE     TAC1100_FAULT_CODE
+
+#define BR1200         TAC1100_BR1200
+#define BR2400         TAC1100_BR2400
+#define BR4800         TAC1100_BR4800
+#define BR9600         TAC1100_BR9600
+#define BR19200        TAC1100_BR19200
+
+// Read register table
+#define FC_HOLDING     TAC1100_FC_HOLDING
+#define FC_INPUT       TAC1100_FC_INPUT
+
+#define REG_FLOAT      TAC1100_REG_FLOAT
+#define REG_ENERGY     TAC1100_REG_ENERGY
+#define REG_UINT       TAC1100_REG_UINT
+
+#define GRP_POWER      TAC1100_GRP_POWER
+#define GRP_VI         TAC1100_GRP_VI
+#define GRP_ENERGY     TAC1100_GRP_ENERGY
+#define GRP_CONFIG     TAC1100_GRP_CONFIG
+#define NUM_GROUPS     TAC1100_NUM_GROUPS
+
+typedef tac1100_regdef_t regdef_t;
+
+#define R_VOLTAGE      TAC1100_R_VOLTAGE
+#define R_CURRENT      TAC1100_R_CURRENT
+#define R_POWER        TAC1100_R_POWER
+#define R_APPARENT     TAC1100_R_APPARENT
+#define R_REACTIVE     TAC1100_R_REACTIVE
+#define R_PFACTOR      TAC1100_R_PFACTOR
+#define R_PANGLE       TAC1100_R_PANGLE
+#define R_FREQUENCY    TAC1100_R_FREQUENCY
+#define R_IAENERGY     TAC1100_R_IAENERGY
+#define R_EAENERGY     TAC1100_R_EAENERGY
+#define R_TAENERGY     TAC1100_R_TAENERGY
+#define R_IRAENERGY    TAC1100_R_IRAENERGY
+#define R_ERAENERGY    TAC1100_R_ERAENERGY
+#define R_TRENERGY     TAC1100_R_TRENERGY
+#define R_TIME_DISP    TAC1100_R_TIME_DISP
+#define NUM_REGS       TAC1100_NUM_REGS
+
+#endif /* TAC1100REGS_H */
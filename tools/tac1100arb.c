@@ -0,0 +1,457 @@
+/*
+ * tac1100arb: bus arbiter for the ModBus clients of one serial port
+ *
+ * Listens on a Unix socket (/var/lock/ARB..ttyUSB0 for /dev/ttyUSB0) and
+ * hands the bus to its clients one at a time, in the order they asked for
+ * it. Every client announces how long it expects to hold the bus; its
+ * turn is a lease of that length (at most -m), renewed by heartbeats,
+ * and bounded while other clients wait. A client that dies loses its
+ * turn with its socket, one that overstays its lease is revoked; in both
+ * cases the next client gets the bus after a guard time (-g) for the
+ * transaction that may still be on the line.
+ *
+ * The protocol (one ASCII line per message, see README "Bus Arbiter"):
+ *   client: HELLO <pid> <name>   arbiter: OK 1
+ *           REQ <hold_ms>                 GRANT <lease_ms> | QUEUED <position> <eta_ms>
+ *           HB                            LEASE <remaining_ms> (0: not holding) | QUEUED <position> <eta_ms>
+ *           REL                           OK
+ *           STATUS                        HOLDER ... / WAITER ... / END
+ *   later, unasked:                       GRANT <lease_ms>, REVOKE
+ *   errors:                               ERR <reason>
+ *
+ *   tools/tac1100arb /dev/ttyUSB0 &
+ *   ./tac1100 --arbiter -p /dev/ttyUSB0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static const char *version = "0.1";
+
+#define ARB_PREFIX  "/var/lock/ARB.."       // Socket of a port: prefix + ttyUSB0 (see libtac1100.h)
+#define ARB_PROTO   1                       // Protocol version
+#define MAX_CLIENTS 128
+#define LINE_LEN    256
+
+typedef struct {
+    int fd;                     // -1: free slot
+    unsigned long pid;
+    char name[32];
+    char in[LINE_LEN];
+    int in_len;
+    long hold_ms;               // Lease of its request
+    long long queued_us;        // Asked for the bus (waiting)
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+static int queue[MAX_CLIENTS];  // Waiting clients, first served first
+static int nqueue = 0;
+static int holder = -1;
+static long long turn_start, lease_end, guard_end;
+static long max_hold_ms = 5000;
+static long grace_ms = 250;
+static int verbose = 0;
+static const char *sock_path;
+
+// Statistics (SIGUSR1, exit)
+static unsigned long turns = 0, revoked = 0, lost = 0;
+static long long wait_sum_us = 0, wait_max_us = 0, held_sum_us = 0, held_max_us = 0;
+
+static volatile sig_atomic_t arb_stop = 0;
+static volatile sig_atomic_t arb_report = 0;
+
+static void arbSignal(int sig)
+{
+    if (sig == SIGUSR1) arb_report = 1;
+    else arb_stop = 1;
+}
+
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void logArb(const char *format, ...)
+{
+    va_list ap;
+
+    if (!verbose) return;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/*--------------------------------------------------------------------------
+    reply
+    One line to a client: a client that doesn't read its socket loses it
+----------------------------------------------------------------------------*/
+static void reply(int c, const char *format, ...)
+{
+    char line[LINE_LEN];
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(line, sizeof(line) - 1, format, ap);
+    va_end(ap);
+    if (n < 0 || n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+    line[n++] = '\n';
+    if (send(clients[c].fd, line, n, MSG_NOSIGNAL | MSG_DONTWAIT) != n) {
+        logArb("client %d (%lu %s): send: (%d) %s", c, clients[c].pid, clients[c].name, errno, strerror(errno));
+    }
+}
+
+static int queuePos(int c)
+{
+    int i;
+
+    for (i = 0; i < nqueue; i++) {
+        if (queue[i] == c) return i;
+    }
+    return -1;
+}
+
+static void queueRemove(int pos)
+{
+    memmove(&queue[pos], &queue[pos + 1], (nqueue - pos - 1) * sizeof(queue[0]));
+    nqueue--;
+}
+
+/*--------------------------------------------------------------------------
+    eta
+    Longest wait of the client at queue position pos (ms) when every turn
+    ends in time: what is left of the turn on the bus and the leases of the
+    clients ahead
+----------------------------------------------------------------------------*/
+static long eta(int pos)
+{
+    long long now = now_us(), t = 0;
+    int i;
+
+    if (holder >= 0) t = lease_end > now ? lease_end - now : 0;
+    else if (guard_end > now) t = guard_end - now;
+    for (i = 0; i < pos; i++) t += clients[queue[i]].hold_ms * 1000LL;
+    return (long)(t / 1000);
+}
+
+/*--------------------------------------------------------------------------
+    endTurn
+    A turn released cleanly ends with its last response; a revoked or lost
+    one may have left a request on the line: guard time before the next
+----------------------------------------------------------------------------*/
+static void endTurn(long long now, int guard)
+{
+    long long held = now - turn_start;
+
+    held_sum_us += held;
+    if (held > held_max_us) held_max_us = held;
+    holder = -1;
+    guard_end = guard ? now + grace_ms * 1000LL : now;
+}
+
+/*--------------------------------------------------------------------------
+    schedule
+    Revoke an expired lease, grant the bus to the first waiting client
+    once the guard time is over
+----------------------------------------------------------------------------*/
+static void schedule(void)
+{
+    long long now = now_us(), waited;
+    int c;
+
+    if (holder >= 0 && now >= lease_end) {
+        c = holder;
+        logArb("client %d (%lu %s): lease expired after %lldms, revoked", c, clients[c].pid, clients[c].name,
+               (now - turn_start) / 1000);
+        reply(c, "REVOKE");
+        revoked++;
+        endTurn(now, 1);
+    }
+    if (holder >= 0 || nqueue == 0 || now < guard_end) return;
+
+    c = queue[0];
+    queueRemove(0);
+    holder = c;
+    turn_start = now;
+    lease_end = now + clients[c].hold_ms * 1000LL;
+    waited = now - clients[c].queued_us;
+    wait_sum_us += waited;
+    if (waited > wait_max_us) wait_max_us = waited;
+    turns++;
+    logArb("client %d (%lu %s): granted %ldms after %lldms", c, clients[c].pid, clients[c].name, clients[c].hold_ms,
+           waited / 1000);
+    reply(c, "GRANT %ld", clients[c].hold_ms);
+}
+
+static void dropClient(int c)
+{
+    int pos;
+
+    logArb("client %d (%lu %s): gone", c, clients[c].pid, clients[c].name);
+    if (holder == c) {
+        lost++;
+        endTurn(now_us(), 1);
+    }
+    if ((pos = queuePos(c)) >= 0) queueRemove(pos);
+    close(clients[c].fd);
+    clients[c].fd = -1;
+}
+
+static void status(int c)
+{
+    long long now = now_us();
+    int i;
+
+    if (holder >= 0) {
+        reply(c, "HOLDER %lu %s %lld %lld", clients[holder].pid, clients[holder].name, (now - turn_start) / 1000,
+              lease_end > now ? (lease_end - now) / 1000 : 0);
+    }
+    for (i = 0; i < nqueue; i++) {
+        client_t *w = &clients[queue[i]];
+        reply(c, "WAITER %d %lu %s %ld %lld", i + 1, w->pid, w->name, w->hold_ms, (now - w->queued_us) / 1000);
+    }
+    reply(c, "END");
+}
+
+/*--------------------------------------------------------------------------
+    command
+    One line of a client
+----------------------------------------------------------------------------*/
+static void command(int c, char *line)
+{
+    client_t *cl = &clients[c];
+    long long now = now_us();
+    char name[32];
+    long hold;
+    int pos;
+
+    name[0] = '\0';
+    if (sscanf(line, "HELLO %lu %31s", &cl->pid, name) >= 1) {
+        snprintf(cl->name, sizeof(cl->name), "%s", name[0] ? name : "-");
+        reply(c, "OK %d", ARB_PROTO);
+    } else if (sscanf(line, "REQ %ld", &hold) == 1) {
+        if (holder == c || queuePos(c) >= 0) {
+            reply(c, "ERR already %s", holder == c ? "holding" : "queued");
+            return;
+        }
+        cl->hold_ms = hold < 1 ? 1 : hold > max_hold_ms ? max_hold_ms : hold;
+        cl->queued_us = now;
+        queue[nqueue++] = c;
+        schedule();
+        if ((pos = queuePos(c)) >= 0) reply(c, "QUEUED %d %ld", pos + 1, eta(pos));
+    } else if (strcmp(line, "HB") == 0) {
+        if (holder == c) {
+            // Renew the lease; while others wait the turn stays bounded by it
+            long long end = now + cl->hold_ms * 1000LL;
+            if (nqueue > 0 && end > turn_start + cl->hold_ms * 1000LL) end = turn_start + cl->hold_ms * 1000LL;
+            if (end > lease_end) lease_end = end;
+            reply(c, "LEASE %lld", (lease_end - now) / 1000);
+        } else if ((pos = queuePos(c)) >= 0) {
+            reply(c, "QUEUED %d %ld", pos + 1, eta(pos));
+        } else {
+            // Revoked meanwhile: nothing left
+            reply(c, "LEASE 0");
+        }
+    } else if (strcmp(line, "REL") == 0) {
+        if (holder == c) {
+            logArb("client %d (%lu %s): released after %lldms", c, cl->pid, cl->name, (now - turn_start) / 1000);
+            endTurn(now, 0);
+        } else if ((pos = queuePos(c)) >= 0) {
+            queueRemove(pos);
+        }
+        reply(c, "OK");
+    } else if (strcmp(line, "STATUS") == 0) {
+        status(c);
+    } else {
+        reply(c, "ERR unknown command");
+    }
+}
+
+static void readClient(int c)
+{
+    client_t *cl = &clients[c];
+    char *nl;
+    ssize_t n;
+
+    n = read(cl->fd, cl->in + cl->in_len, sizeof(cl->in) - 1 - cl->in_len);
+    if (n <= 0) {
+        if (n == -1 && (errno == EINTR || errno == EAGAIN)) return;
+        dropClient(c);
+        return;
+    }
+    cl->in_len += n;
+    cl->in[cl->in_len] = '\0';
+    while ((nl = strchr(cl->in, '\n')) != NULL) {
+        *nl = '\0';
+        if (nl > cl->in && nl[-1] == '\r') nl[-1] = '\0';
+        command(c, cl->in);
+        if (cl->fd == -1) return;
+        cl->in_len -= nl + 1 - cl->in;
+        memmove(cl->in, nl + 1, cl->in_len + 1);
+    }
+    if (cl->in_len == (int)sizeof(cl->in) - 1) {
+        reply(c, "ERR line too long");
+        dropClient(c);
+    }
+}
+
+static void report(void)
+{
+    fprintf(stderr, "tac1100arb %s: turns=%lu revoked=%lu lost=%lu wait_avg=%lldms wait_max=%lldms "
+            "held_avg=%lldms held_max=%lldms waiting=%d\n", sock_path, turns, revoked, lost,
+            turns ? wait_sum_us / turns / 1000 : 0, wait_max_us / 1000,
+            turns ? held_sum_us / turns / 1000 : 0, held_max_us / 1000, nqueue);
+}
+
+/*--------------------------------------------------------------------------
+    listenSocket
+    Bind the socket, replacing a stale one but not a running arbiter
+----------------------------------------------------------------------------*/
+static int listenSocket(const char *path)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+        fprintf(stderr, "An arbiter is already listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || listen(fd, 16) == -1) {
+        fprintf(stderr, "Can't listen on %s: (%d) %s\n", path, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // Whoever may use the port may ask for it: the port permissions still apply
+    chmod(path, 0666);
+    return fd;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100arb %s: bus arbiter for the ModBus clients of one serial port\n\n", version);
+    fprintf(stderr, "Usage: %s [-s socket] [-m max_hold_ms] [-g guard_ms] [-v] device\n", program);
+    fprintf(stderr, "\t-s path \tSocket. Default: %s + port name\n", ARB_PREFIX);
+    fprintf(stderr, "\t-m ms \t\tLongest lease of a turn. Default: 5000\n");
+    fprintf(stderr, "\t-g ms \t\tGuard time between two turns. Default: 250\n");
+    fprintf(stderr, "\t-v \t\tLog the turns on stderr\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static char path[108];
+    struct pollfd pfd[MAX_CLIENTS + 1];
+    int map[MAX_CLIENTS + 1];
+    struct sigaction sa;
+    long long now, next;
+    int lfd, fd, c, i, n, rc;
+    const char *port;
+
+    while ((c = getopt(argc, argv, "s:m:g:vh")) != -1) {
+        switch (c) {
+            case 's': sock_path = optarg; break;
+            case 'm': max_hold_ms = atol(optarg); break;
+            case 'g': grace_ms = atol(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || max_hold_ms < 1 || grace_ms < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (sock_path == NULL) {
+        port = strrchr(argv[optind], '/');
+        snprintf(path, sizeof(path), "%s%s", ARB_PREFIX, port ? port + 1 : argv[optind]);
+        sock_path = path;
+    }
+    if ((lfd = listenSocket(sock_path)) == -1) exit(EXIT_FAILURE);
+    for (c = 0; c < MAX_CLIENTS; c++) clients[c].fd = -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = arbSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    logArb("tac1100arb: listening on %s", sock_path);
+    while (!arb_stop) {
+        if (arb_report) {
+            arb_report = 0;
+            report();
+        }
+        schedule();
+
+        // Sleep until the next lease expiry or end of a guard time
+        now = now_us();
+        next = -1;
+        if (holder >= 0) next = lease_end;
+        else if (nqueue > 0) next = guard_end;
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        n = 1;
+        for (c = 0; c < MAX_CLIENTS; c++) {
+            if (clients[c].fd == -1) continue;
+            pfd[n].fd = clients[c].fd;
+            pfd[n].events = POLLIN;
+            map[n++] = c;
+        }
+        rc = poll(pfd, n, next < 0 ? -1 : next <= now ? 0 : (int)((next - now + 999) / 1000));
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: (%d) %s\n", errno, strerror(errno));
+            break;
+        }
+        for (i = 1; i < n; i++) {
+            if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) readClient(map[i]);
+        }
+        if (pfd[0].revents & POLLIN) {
+            if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1) continue;
+            for (c = 0; c < MAX_CLIENTS && clients[c].fd != -1; c++);
+            if (c == MAX_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            memset(&clients[c], 0, sizeof(clients[c]));
+            clients[c].fd = fd;
+            snprintf(clients[c].name, sizeof(clients[c].name), "-");
+        }
+    }
+
+    report();
+    for (c = 0; c < MAX_CLIENTS; c++) {
+        if (clients[c].fd != -1) close(clients[c].fd);
+    }
+    close(lfd);
+    unlink(sock_path);
+    return 0;
+}
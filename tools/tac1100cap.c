@@ -0,0 +1,235 @@
+/*
+ * tac1100cap: print or export a tac1100 --capture file
+ *
+ * Prints one line per frame: time, direction, unit, function, outcome,
+ * decoded fields and the ADU in hex, then a summary per unit. With -p
+ * writes the frames to a pcap file (LINKTYPE_USER0, one ADU per packet,
+ * wall clock timestamps) for Wireshark: set the DLT User table entry for
+ * User 0 (DLT=147) to the "mbrtu" payload protocol.
+ *
+ *   ./tac1100 --poll --capture=bus.cap /dev/ttyUSB0
+ *   tools/tac1100cap bus.cap
+ *   tools/tac1100cap -p bus.pcap bus.cap
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../tac1100cap.h"
+
+static const char *version = "0.1";
+
+#define LINKTYPE_USER0 147
+
+static const char *outcome_names[] = { "OK", "TIMEOUT", "BADCRC", "EXCEPTION", "ERROR" };
+
+typedef struct {
+    unsigned long requests;
+    unsigned long outcomes[5];
+    long long rtt_sum;          // Request to response time
+    long long rtt_max;
+} unitsum_t;
+
+static unitsum_t units[256];
+
+/*--------------------------------------------------------------------------
+    describe
+    Decoded fields of an ADU
+----------------------------------------------------------------------------*/
+static void describe(char *out, size_t len, const caprecord_t *r, const uint8_t *adu)
+{
+    int fc;
+
+    out[0] = '\0';
+    if (r->len < 4) return;
+    fc = adu[1];
+    if (fc & 0x80) {
+        snprintf(out, len, "exception %02X", adu[2]);
+    } else if (r->dir == CAP_TX && r->len >= 8) {
+        snprintf(out, len, "addr 0x%04X nb %u", (adu[2] << 8) | adu[3], (adu[4] << 8) | adu[5]);
+    } else if (r->dir == CAP_RX && (fc == 0x03 || fc == 0x04)) {
+        snprintf(out, len, "%u bytes", adu[2]);
+    } else if (r->dir == CAP_RX && fc == 0x10 && r->len >= 8) {
+        snprintf(out, len, "addr 0x%04X nb %u written", (adu[2] << 8) | adu[3], (adu[4] << 8) | adu[5]);
+    }
+}
+
+static void formatWall(char *out, size_t len, long long us)
+{
+    time_t sec = us / 1000000;
+    struct tm tm;
+
+    localtime_r(&sec, &tm);
+    snprintf(out, len, "%04d-%02d-%02d %02d:%02d:%02d.%06lld", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, us % 1000000);
+}
+
+static void pcapHeader(FILE *fp)
+{
+    uint8_t h[24];
+
+    capPut32(h, 0xa1b2c3d4);        // Microsecond timestamps
+    capPut16(h + 4, 2);
+    capPut16(h + 6, 4);
+    capPut32(h + 8, 0);
+    capPut32(h + 12, 0);
+    capPut32(h + 16, CAP_MAX_ADU);
+    capPut32(h + 20, LINKTYPE_USER0);
+    fwrite(h, 1, sizeof(h), fp);
+}
+
+static void pcapRecord(FILE *fp, long long wall, const uint8_t *adu, int len)
+{
+    uint8_t h[16];
+
+    capPut32(h, wall / 1000000);
+    capPut32(h + 4, wall % 1000000);
+    capPut32(h + 8, len);
+    capPut32(h + 12, len);
+    fwrite(h, 1, sizeof(h), fp);
+    fwrite(adu, 1, len, fp);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100cap %s: print or export a tac1100 --capture file\n\n", version);
+    fprintf(stderr, "Usage: %s [-u unit] [-w] [-q] [-p file.pcap] capture\n", program);
+    fprintf(stderr, "\t-u unit \tOnly frames of this unit id\n");
+    fprintf(stderr, "\t-w \t\tWall clock times (default: seconds from the first frame)\n");
+    fprintf(stderr, "\t-q \t\tSummary only\n");
+    fprintf(stderr, "\t-p file \tExport the frames to a pcap file (LINKTYPE_USER0)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pcap_file = NULL;
+    int only_unit = -1, wall_flag = 0, quiet = 0, segments = 0, c, i;
+    uint8_t head[CAP_HEADER_SIZE], adu[CAP_MAX_ADU];
+    capheader_t h;
+    caprecord_t r;
+    long long first = -1, last_tx[256];
+    unsigned long records = 0, exported = 0;
+    FILE *fp, *pcap = NULL;
+
+    while ((c = getopt(argc, argv, "u:wqp:h")) != -1) {
+        switch (c) {
+            case 'u': only_unit = atoi(optarg); break;
+            case 'w': wall_flag = 1; break;
+            case 'q': quiet = 1; break;
+            case 'p': pcap_file = optarg; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+        fprintf(stderr, "Can't open %s: (%d) %s\n", argv[optind], errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (pcap_file != NULL) {
+        if ((pcap = fopen(pcap_file, "wb")) == NULL) {
+            fprintf(stderr, "Can't write %s: (%d) %s\n", pcap_file, errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        pcapHeader(pcap);
+    }
+    memset(last_tx, 0, sizeof(last_tx));
+    memset(&h, 0, sizeof(h));
+
+    // Every segment starts with a header, records follow until the next one
+    while (fread(head, 1, CAP_RECORD_SIZE, fp) == CAP_RECORD_SIZE) {
+        if (memcmp(head, CAP_MAGIC, CAP_MAGIC_SIZE) == 0) {
+            char when[64];
+            if (fread(head + CAP_RECORD_SIZE, 1, CAP_HEADER_SIZE - CAP_RECORD_SIZE, fp) != CAP_HEADER_SIZE - CAP_RECORD_SIZE) break;
+            capDecodeHeader(head, &h);
+            if (h.version != CAP_VERSION) {
+                fprintf(stderr, "Unsupported capture version %u\n", h.version);
+                exit(EXIT_FAILURE);
+            }
+            segments++;
+            formatWall(when, sizeof(when), h.start + h.wall_offset);
+            if (!quiet) printf("# segment %d: pid %u, started %s\n", segments, h.pid, when);
+            continue;
+        }
+        if (segments == 0) {
+            fprintf(stderr, "%s: not a tac1100 capture\n", argv[optind]);
+            exit(EXIT_FAILURE);
+        }
+        capDecodeRecord(head, &r);
+        if (r.len > CAP_MAX_ADU || fread(adu, 1, r.len, fp) != r.len) {
+            fprintf(stderr, "Truncated record after %lu records\n", records);
+            break;
+        }
+        records++;
+        if (only_unit >= 0 && r.unit != only_unit) continue;
+        if (first == -1) first = r.t;
+
+        if (r.dir == CAP_TX) {
+            units[r.unit].requests++;
+            last_tx[r.unit] = r.t;
+        } else if (r.outcome < 5) {
+            long long rtt = r.t - last_tx[r.unit];
+            units[r.unit].outcomes[r.outcome]++;
+            units[r.unit].rtt_sum += rtt;
+            if (rtt > units[r.unit].rtt_max) units[r.unit].rtt_max = rtt;
+        }
+
+        if (pcap != NULL && r.len > 0) {
+            pcapRecord(pcap, r.t + h.wall_offset, adu, r.len);
+            exported++;
+        }
+
+        if (!quiet) {
+            char when[64], desc[64];
+            if (wall_flag) {
+                formatWall(when, sizeof(when), r.t + h.wall_offset);
+            } else {
+                snprintf(when, sizeof(when), "%12.6f", (r.t - first) / 1e6);
+            }
+            describe(desc, sizeof(desc), &r, adu);
+            printf("%s %s %3u ", when, r.dir == CAP_TX ? "TX" : "RX", r.unit);
+            if (r.len >= 2) printf("fc %02X ", adu[1] & 0x7F); else printf("fc -- ");
+            if (r.dir == CAP_RX) {
+                printf("%-9s +%-8lld ", r.outcome < 5 ? outcome_names[r.outcome] : "?", r.t - last_tx[r.unit]);
+            } else {
+                printf("%-9s %-9s ", "", "");
+            }
+            printf("%-26s", desc);
+            for (i = 0; i < r.len; i++) printf(" %02X", adu[i]);
+            printf("\n");
+        }
+    }
+    fclose(fp);
+
+    printf("# %d segments, %lu records\n", segments, records);
+    printf("# %4s %9s %9s %9s %9s %9s %9s %9s %9s\n", "unit", "requests", "ok", "timeout", "badcrc", "exception",
+           "error", "rtt_mean", "rtt_max");
+    for (i = 0; i < 256; i++) {
+        unitsum_t *u = &units[i];
+        unsigned long responses = 0;
+        int k;
+        if (u->requests == 0) continue;
+        for (k = 0; k < 5; k++) responses += u->outcomes[k];
+        printf("# %4d %9lu %9lu %9lu %9lu %9lu %9lu %9lld %9lld\n", i, u->requests, u->outcomes[CAP_OK],
+               u->outcomes[CAP_TIMEOUT], u->outcomes[CAP_BADCRC], u->outcomes[CAP_EXCEPTION], u->outcomes[CAP_ERROR],
+               responses ? u->rtt_sum / (long long)responses : 0, u->rtt_max);
+    }
+    if (pcap != NULL) {
+        fclose(pcap);
+        printf("# %lu frames exported to %s\n", exported, pcap_file);
+    }
+    return 0;
+}
@@ -0,0 +1,786 @@
+/*
+ * tac1100emu: TAC1100 meter emulator with fault and latency injection
+ *
+ * Creates a pty pair, prints the slave device name on stdout and answers
+ * ModBus RTU requests on the master side for any number of unit IDs, as
+ * meters sharing one RS485 bus would. The register map is the one read
+ * and written by tac1100:
+ *   input registers   0x0000-0x0031, 0x0500-0x050D (FC 04)
+ *   holding registers 0x5000-0x5607 (FC 03 read, FC 10 write)
+ * with the meter rules: writes only through FC 10, range checked values,
+ * read only registers, PASSWORD and RESET_HIST accepted only after the
+ * current password has been written to KPPA.
+ *
+ * Measures follow time varying synthetic waveforms (mains voltage and
+ * frequency drift, a base load with appliances switching on and off,
+ * optional generation), the energy counters integrate them.
+ *
+ * Per unit the response latency (plus jitter), the probability to drop a
+ * request, to corrupt the response CRC and to answer with an exception
+ * can be set. The time the frames need on a real line at the emulated
+ * baud rate is added before every reply.
+ *
+ * With -2 the same meters are also reachable through a second pty, as
+ * through a second RS485 adapter on its own cable, and SIGUSR2 cuts (and
+ * restores) the cable of the first one: its requests are then lost.
+ *
+ *   tools/tac1100emu -u 1 -u 2-4:drop=0.05:latency=20000 &
+ *   ./tac1100 -a 3 /dev/pts/N
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+// Register map (see tac1100.c)
+#define VOLTAGE        0x0000
+#define CURRENT        0x0006
+#define POWER          0x000C
+#define APOWER         0x0012
+#define RAPOWER        0x0018
+#define PFACTOR        0x001E
+#define PANGLE         0x0024
+#define FREQUENCY      0x0030
+#define IAENERGY       0x0500
+#define EAENERGY       0x0502
+#define TAENERGY       0x0504
+#define IRAENERGY      0x0508
+#define ERAENERGY      0x050A
+#define TRENERGY       0x050C
+
+#define INPUT_LO_START 0x0000
+#define INPUT_LO_NB    0x0032   // 0x0000-0x0031
+#define INPUT_HI_START 0x0500
+#define INPUT_HI_NB    0x000E   // 0x0500-0x050D
+#define HOLDING_START  0x5000
+#define HOLDING_NB     0x0608   // 0x5000-0x5607
+
+#define KPPA           0x5000
+#define DEMAND_PERIOD  0x5002
+#define SLIDE_TIME     0x5003
+#define DEVICE_ID      0x5005
+#define BAUD_RATE      0x5006
+#define NPARSTOP       0x5007
+#define PASSWORD       0x5008
+#define TIME_DISP      0x5018
+#define BACKLIT_TIME   0x5019
+#define SYSTEM_TIME    0x501A   // 4 registers, BCD
+#define TARIFF         0x501E   // 2 registers, BCD
+#define RESET_HIST     0x5600
+#define METER_CODE     0x5601
+#define SERIAL_NUM     0x5602
+#define SW_VERSION     0x5604
+#define HW_VERSION     0x5605
+#define DISP_VERSION   0x5606
+#define FAULT_CODE     0x5607
+
+// ModBus exception codes
+#define EXC_ILLEGAL_FUNCTION  0x01
+#define EXC_ILLEGAL_ADDRESS   0x02
+#define EXC_ILLEGAL_VALUE     0x03
+#define EXC_DEVICE_FAILURE    0x04
+#define EXC_DEVICE_BUSY       0x06
+
+#define MAX_ADU        256
+#define MAX_READ       125
+#define MAX_WRITE      123
+#define KPPA_WINDOW_US (60 * 1000000LL)  // Authorization lifetime after a good KPPA write
+#define MAX_PATHS      2
+
+typedef struct {
+    int hosted;
+    // Injection
+    long latency_us;            // Turnaround before the response
+    long jitter_us;             // Uniform extra 0..jitter
+    double drop;                // Probability to ignore a request
+    double crc;                 // Probability to corrupt the response CRC
+    double exc;                 // Probability to answer with exc_code
+    int exc_code;
+    // Waveforms
+    double load_w;              // Base load
+    double gen_w;               // Peak generation (0 = none)
+    double gen_period;          // Generation cycle (s)
+    double phase;               // Per unit phase offset of the waveforms
+    double appliance_w;         // Appliance currently on (0 = off)
+    double appliance_until;
+    double last_t;
+    double kwh_imp, kwh_exp, kvarh_imp, kvarh_exp;
+    double max_demand_w;
+    double month_base_kwh, day_base_kwh;
+    // Registers
+    uint16_t input_lo[INPUT_LO_NB];
+    uint16_t input_hi[INPUT_HI_NB];
+    uint16_t holding[HOLDING_NB];
+    long long kppa_until;       // Monotonic us, 0 = not authorized
+    // Counters
+    unsigned long requests, replies, dropped, corrupted, injected, exceptions, kppa_denied;
+    long long latency_sum;
+} unit_t;
+
+static unit_t units[248];
+static unit_t defaults;
+static long baud = 9600;
+static int char_bits = 10;      // Start + 8 data + parity + stop
+static int verbose = 0;
+static unsigned long bad_frames = 0, foreign = 0;
+static long long start_us;
+static volatile sig_atomic_t emu_stop = 0;
+static volatile sig_atomic_t emu_report = 0;
+static volatile sig_atomic_t emu_cut = 0;       // SIGUSR2: cable of the first pty cut
+
+// A pty the meters are reachable through (an adapter and its cable)
+typedef struct {
+    int master, slave;
+    char pts[64];
+    uint8_t buf[MAX_ADU];
+    int len;
+    long long last_rx;
+    unsigned long cut_requests;     // Lost while the cable was cut
+} path_t;
+
+static path_t paths[MAX_PATHS];
+static int npaths = 1;
+
+static void emuSignal(int sig)
+{
+    if (sig == SIGUSR1) {
+        emu_report = 1;
+    } else if (sig == SIGUSR2) {
+        emu_cut = !emu_cut;
+    } else {
+        emu_stop = 1;
+    }
+}
+
+static double uniform(void)
+{
+    return drand48();
+}
+
+/*--------------------------------------------------------------------------
+    setFloat
+    Store f in the meter word order (high word first)
+----------------------------------------------------------------------------*/
+static void setFloat(unit_t *u, int address, float f)
+{
+    uint32_t i;
+    uint16_t *reg;
+
+    memcpy(&i, &f, sizeof(i));
+    if (address >= INPUT_HI_START) {
+        reg = &u->input_hi[address - INPUT_HI_START];
+    } else {
+        reg = &u->input_lo[address - INPUT_LO_START];
+    }
+    reg[0] = (uint16_t)(i >> 16);
+    reg[1] = (uint16_t)i;
+}
+
+static uint16_t *holding(unit_t *u, int address)
+{
+    return &u->holding[address - HOLDING_START];
+}
+
+/*--------------------------------------------------------------------------
+    unitInit
+    Registers at their factory defaults, waveforms seeded by the unit id
+----------------------------------------------------------------------------*/
+static void unitInit(unit_t *u, int id)
+{
+    memset(u->input_lo, 0, sizeof(u->input_lo));
+    memset(u->input_hi, 0, sizeof(u->input_hi));
+    memset(u->holding, 0, sizeof(u->holding));
+    *holding(u, DEMAND_PERIOD) = 60;
+    *holding(u, SLIDE_TIME)    = 1;
+    *holding(u, DEVICE_ID)     = id;
+    *holding(u, BAUD_RATE)     = 3;
+    *holding(u, NPARSTOP)      = 0;
+    *holding(u, PASSWORD)      = 0;
+    *holding(u, TIME_DISP)     = 0;
+    *holding(u, BACKLIT_TIME)  = 60;
+    *holding(u, METER_CODE)    = 0x1100;
+    *holding(u, SERIAL_NUM)    = 0x0026;
+    *holding(u, SERIAL_NUM + 1) = 0x0000 + id;
+    *holding(u, SW_VERSION)    = 0x0102;
+    *holding(u, HW_VERSION)    = 0x0100;
+    *holding(u, DISP_VERSION)  = 0x0101;
+    *holding(u, FAULT_CODE)    = 0;
+
+    u->phase = id * 0.7;
+    if (u->load_w <= 0) u->load_w = 200.0 + 150.0 * (id % 7);
+    u->kwh_imp = 1000.0 + 37.0 * id;
+    u->kvarh_imp = 100.0 + 3.0 * id;
+    u->month_base_kwh = u->day_base_kwh = u->kwh_imp;
+}
+
+/*--------------------------------------------------------------------------
+    unitUpdate
+    Advance the waveforms to t (seconds since start) and integrate energy
+----------------------------------------------------------------------------*/
+static void unitUpdate(unit_t *u, double t)
+{
+    double dt = t - u->last_t;
+    double v, f, load, gen, p, q, s, pf_load;
+
+    // Appliances: a random telegraph of 500-2500W loads on for 10-120s
+    if (t >= u->appliance_until) {
+        if (u->appliance_w > 0 || uniform() < 0.5) {
+            u->appliance_w = 0;
+            u->appliance_until = t + 5.0 + 60.0 * uniform();
+        } else {
+            u->appliance_w = 500.0 + 2000.0 * uniform();
+            u->appliance_until = t + 10.0 + 110.0 * uniform();
+        }
+    }
+
+    v = 230.0 + 3.0 * sin(2 * M_PI * t / 300.0 + u->phase) + 0.3 * (uniform() - 0.5);
+    f = 50.0 + 0.03 * sin(2 * M_PI * t / 120.0 + u->phase) + 0.004 * (uniform() - 0.5);
+    load = u->load_w * (1.0 + 0.2 * sin(2 * M_PI * t / 60.0 + u->phase)) + u->appliance_w;
+    gen = u->gen_w > 0 ? u->gen_w * fmax(0.0, sin(2 * M_PI * t / u->gen_period)) : 0.0;
+    pf_load = 0.94 + 0.04 * sin(2 * M_PI * t / 90.0 + u->phase);
+    p = load - gen;
+    q = load * tan(acos(pf_load));
+    s = sqrt(p * p + q * q);
+
+    if (dt > 0) {
+        if (p >= 0) u->kwh_imp += p * dt / 3600000.0; else u->kwh_exp -= p * dt / 3600000.0;
+        if (q >= 0) u->kvarh_imp += q * dt / 3600000.0; else u->kvarh_exp -= q * dt / 3600000.0;
+    }
+    if (p > u->max_demand_w) u->max_demand_w = p;
+    u->last_t = t;
+
+    setFloat(u, VOLTAGE, v);
+    setFloat(u, CURRENT, s / v);
+    setFloat(u, POWER, p);
+    setFloat(u, APOWER, q);
+    setFloat(u, RAPOWER, s);
+    setFloat(u, PFACTOR, s > 0 ? p / s : 1.0);
+    setFloat(u, PANGLE, atan2(q, p) * 180.0 / M_PI);
+    setFloat(u, FREQUENCY, f);
+    setFloat(u, IAENERGY, u->kwh_imp);
+    setFloat(u, EAENERGY, u->kwh_exp);
+    setFloat(u, TAENERGY, u->kwh_imp + u->kwh_exp);
+    setFloat(u, IRAENERGY, u->kvarh_imp);
+    setFloat(u, ERAENERGY, u->kvarh_exp);
+    setFloat(u, TRENERGY, u->kvarh_imp + u->kvarh_exp);
+}
+
+/*--------------------------------------------------------------------------
+    readInput
+    FC 04: the request must lie inside one of the two input blocks
+----------------------------------------------------------------------------*/
+static int readInput(unit_t *u, int address, int nb, uint8_t *data)
+{
+    const uint16_t *src;
+    int i;
+
+    if (address >= INPUT_LO_START && address + nb <= INPUT_LO_START + INPUT_LO_NB) {
+        src = &u->input_lo[address - INPUT_LO_START];
+    } else if (address >= INPUT_HI_START && address + nb <= INPUT_HI_START + INPUT_HI_NB) {
+        src = &u->input_hi[address - INPUT_HI_START];
+    } else {
+        return EXC_ILLEGAL_ADDRESS;
+    }
+    for (i = 0; i < nb; i++) {
+        data[2 * i] = src[i] >> 8;
+        data[2 * i + 1] = src[i] & 0xFF;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    readHolding
+    FC 03: KPPA and RESET_HIST are write only and read as 0
+----------------------------------------------------------------------------*/
+static int readHolding(unit_t *u, int address, int nb, uint8_t *data)
+{
+    int i;
+
+    if (address < HOLDING_START || address + nb > HOLDING_START + HOLDING_NB) return EXC_ILLEGAL_ADDRESS;
+    for (i = 0; i < nb; i++) {
+        int a = address + i;
+        uint16_t v = (a == KPPA || a == KPPA + 1 || a == RESET_HIST) ? 0 : *holding(u, a);
+        data[2 * i] = v >> 8;
+        data[2 * i + 1] = v & 0xFF;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    checkWrite
+    Validate one register write, 0 or the exception code
+----------------------------------------------------------------------------*/
+static int checkWrite(unit_t *u, int address, uint16_t v, int kppa_ok)
+{
+    switch (address) {
+        case KPPA:
+            return 0;                   // Checked when applied
+        case DEMAND_PERIOD:
+            return v <= 60 ? 0 : EXC_ILLEGAL_VALUE;
+        case SLIDE_TIME:
+            return (v >= 1 && (*holding(u, DEMAND_PERIOD) <= 1 || v < *holding(u, DEMAND_PERIOD))) ? 0 : EXC_ILLEGAL_VALUE;
+        case DEVICE_ID:
+            return (v >= 1 && v <= 247 && (v == *holding(u, DEVICE_ID) || !units[v].hosted)) ? 0 : EXC_ILLEGAL_VALUE;
+        case BAUD_RATE:
+            return v <= 4 ? 0 : EXC_ILLEGAL_VALUE;
+        case NPARSTOP:
+            return v <= 3 ? 0 : EXC_ILLEGAL_VALUE;
+        case PASSWORD:
+            if (!kppa_ok) return EXC_DEVICE_FAILURE;
+            return v <= 9999 ? 0 : EXC_ILLEGAL_VALUE;
+        case TIME_DISP:
+            return v <= 60 ? 0 : EXC_ILLEGAL_VALUE;
+        case BACKLIT_TIME:
+            return (v <= 120 || v == 255) ? 0 : EXC_ILLEGAL_VALUE;
+        case SYSTEM_TIME: case SYSTEM_TIME + 1: case SYSTEM_TIME + 2: case SYSTEM_TIME + 3:
+        case TARIFF: case TARIFF + 1:
+            return 0;
+        case RESET_HIST:
+            if (!kppa_ok) return EXC_DEVICE_FAILURE;
+            return (v == 0 || v == 8 || v == 9) ? 0 : EXC_ILLEGAL_VALUE;
+        default:
+            return EXC_ILLEGAL_ADDRESS;     // Read only or not mapped
+    }
+}
+
+/*--------------------------------------------------------------------------
+    writeHolding
+    FC 10: all or nothing, *new_id set when DEVICE_ID changes
+----------------------------------------------------------------------------*/
+static int writeHolding(unit_t *u, int id, int address, int nb, const uint8_t *data, int *new_id)
+{
+    long long now = tac1100_now_us();
+    int kppa_ok = u->kppa_until > now;
+    int i, rc;
+
+    if (address < HOLDING_START || address + nb > HOLDING_START + HOLDING_NB) return EXC_ILLEGAL_ADDRESS;
+
+    // A KPPA write in the same request authorizes the registers after it
+    for (i = 0; i < nb; i++) {
+        int a = address + i;
+        uint16_t v = (data[2 * i] << 8) | data[2 * i + 1];
+        if (a == KPPA) {
+            if (v != *holding(u, PASSWORD)) {
+                u->kppa_denied++;
+                if (verbose) fprintf(stderr, "unit %d: KPPA denied (password %u)\n", id, v);
+                return EXC_ILLEGAL_VALUE;
+            }
+            kppa_ok = 1;
+        } else if ((rc = checkWrite(u, a, v, kppa_ok)) != 0) {
+            if (rc == EXC_DEVICE_FAILURE) u->kppa_denied++;
+            if (verbose) fprintf(stderr, "unit %d: write 0x%04X = %u refused (exception %d)\n", id, a, v, rc);
+            return rc;
+        }
+    }
+
+    for (i = 0; i < nb; i++) {
+        int a = address + i;
+        uint16_t v = (data[2 * i] << 8) | data[2 * i + 1];
+        switch (a) {
+            case KPPA:
+                u->kppa_until = now + KPPA_WINDOW_US;
+                if (verbose) fprintf(stderr, "unit %d: KPPA granted\n", id);
+                break;
+            case RESET_HIST:
+                if (v == 0) u->max_demand_w = 0;
+                if (v == 8) u->month_base_kwh = u->kwh_imp;
+                if (v == 9) u->day_base_kwh = u->kwh_imp;
+                if (verbose) fprintf(stderr, "unit %d: history reset %u\n", id, v);
+                break;
+            case DEVICE_ID:
+                if (v != id) *new_id = v;
+                *holding(u, a) = v;
+                break;
+            default:
+                *holding(u, a) = v;
+                if (verbose) fprintf(stderr, "unit %d: 0x%04X = %u\n", id, a, v);
+        }
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------
+    requestLength
+    Expected length of the request in buf, 0 if not known yet, -1 if the
+    function code does not tell (wait for the end of frame gap)
+----------------------------------------------------------------------------*/
+static int requestLength(const uint8_t *buf, int len)
+{
+    if (len < 2) return 0;
+    switch (buf[1]) {
+        case 0x03:
+        case 0x04:
+        case 0x06:
+            return 8;
+        case 0x10:
+            return len < 7 ? 0 : 9 + buf[6];
+        default:
+            return -1;
+    }
+}
+
+/*--------------------------------------------------------------------------
+    lineTime
+    Time n characters take on the emulated line (us)
+----------------------------------------------------------------------------*/
+static long long lineTime(int n)
+{
+    return baud > 0 ? (long long)n * char_bits * 1000000LL / baud : 0;
+}
+
+/*--------------------------------------------------------------------------
+    handleFrame
+    Answer one complete frame, applying the unit's fault injection
+----------------------------------------------------------------------------*/
+static void handleFrame(int fd, const uint8_t *req, int len)
+{
+    uint8_t rsp[MAX_ADU];
+    int id, fc, address, nb, n = 0, exc = 0, new_id = 0;
+    unit_t *u;
+    uint16_t crc;
+    long long delay;
+
+    if (len < 4 || tac1100_crc16(req, len - 2) != (req[len - 2] | (req[len - 1] << 8))) {
+        bad_frames++;           // A real meter stays silent
+        if (verbose) fprintf(stderr, "bad frame (%d bytes)\n", len);
+        return;
+    }
+    id = req[0];
+    fc = req[1];
+    if (id == 0 || id > 247 || !units[id].hosted) {
+        // Broadcast: apply writes, never answer
+        if (id == 0 && fc == 0x10 && len >= 9) {
+            int i;
+            nb = (req[4] << 8) | req[5];
+            if (nb < 1 || nb > MAX_WRITE || req[6] != 2 * nb || len != 9 + req[6]) {
+                bad_frames++;   // Malformed: nothing to apply
+                return;
+            }
+            for (i = 1; i <= 247; i++) {
+                if (units[i].hosted) writeHolding(&units[i], i, (req[2] << 8) | req[3], nb, &req[7], &new_id);
+            }
+        } else {
+            foreign++;
+        }
+        return;
+    }
+    u = &units[id];
+    u->requests++;
+
+    if (u->drop > 0 && uniform() < u->drop) {
+        u->dropped++;
+        if (verbose) fprintf(stderr, "unit %d: request dropped\n", id);
+        return;
+    }
+
+    unitUpdate(u, (tac1100_now_us() - start_us) / 1e6);
+    rsp[n++] = id;
+    if (u->exc > 0 && uniform() < u->exc) {
+        exc = u->exc_code;
+        u->injected++;
+    } else if (fc == 0x03 || fc == 0x04) {
+        address = (req[2] << 8) | req[3];
+        nb = (req[4] << 8) | req[5];
+        if (len != 8 || nb < 1 || nb > MAX_READ) {
+            exc = EXC_ILLEGAL_VALUE;
+        } else {
+            exc = fc == 0x04 ? readInput(u, address, nb, &rsp[3]) : readHolding(u, address, nb, &rsp[3]);
+        }
+        if (!exc) {
+            rsp[n++] = fc;
+            rsp[n++] = 2 * nb;
+            n += 2 * nb;
+        }
+    } else if (fc == 0x10) {
+        address = (req[2] << 8) | req[3];
+        nb = (req[4] << 8) | req[5];
+        if (len < 9 || nb < 1 || nb > MAX_WRITE || req[6] != 2 * nb || len != 9 + req[6]) {
+            exc = EXC_ILLEGAL_VALUE;
+        } else {
+            exc = writeHolding(u, id, address, nb, &req[7], &new_id);
+        }
+        if (!exc) {
+            memcpy(&rsp[n], &req[1], 5);
+            n += 5;
+        }
+    } else {
+        exc = EXC_ILLEGAL_FUNCTION;     // FC 06 included: the meter wants FC 10
+    }
+    if (exc) {
+        rsp[n++] = fc | 0x80;
+        rsp[n++] = exc;
+        u->exceptions++;
+    }
+    crc = tac1100_crc16(rsp, n);
+    rsp[n++] = crc & 0xFF;
+    rsp[n++] = crc >> 8;
+    if (u->crc > 0 && uniform() < u->crc) {
+        rsp[n - 1] ^= 0x5A;
+        u->corrupted++;
+    }
+
+    delay = lineTime(len) + u->latency_us + (u->jitter_us > 0 ? (long long)(u->jitter_us * uniform()) : 0) + lineTime(n);
+    if (delay > 0) usleep(delay);
+    u->latency_sum += delay;
+    if (write(fd, rsp, n) != n) {
+        fprintf(stderr, "write: (%d) %s\n", errno, strerror(errno));
+    }
+    u->replies++;
+
+    if (new_id) {
+        // The meter answers at the new address from the next request
+        units[new_id] = *u;
+        memset(u, 0, sizeof(*u));
+        if (verbose) fprintf(stderr, "unit %d: now at address %d\n", id, new_id);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    report
+    Per unit counters on stderr
+----------------------------------------------------------------------------*/
+static void report(void)
+{
+    int id;
+
+    fprintf(stderr, "%4s %9s %9s %9s %9s %9s %9s %9s %11s\n",
+            "unit", "requests", "replies", "dropped", "crc", "injected", "exception", "kppa_deny", "latency_us");
+    for (id = 1; id <= 247; id++) {
+        unit_t *u = &units[id];
+        if (!u->hosted) continue;
+        fprintf(stderr, "%4d %9lu %9lu %9lu %9lu %9lu %9lu %9lu %11lld\n", id, u->requests, u->replies, u->dropped,
+                u->corrupted, u->injected, u->exceptions, u->kppa_denied, u->replies ? u->latency_sum / (long long)u->replies : 0);
+    }
+    fprintf(stderr, "bad frames %lu, requests for other addresses %lu\n", bad_frames, foreign);
+    if (npaths > 1) {
+        fprintf(stderr, "path 1 %s, %lu requests lost on the cut cable\n", emu_cut ? "cut" : "connected",
+                paths[0].cut_requests);
+    }
+}
+
+/*--------------------------------------------------------------------------
+    parseUnits
+    ID[-ID][:key=value...] with keys latency, jitter, drop, crc, exc,
+    code, load, gen, period, password
+----------------------------------------------------------------------------*/
+static int parseUnits(char *spec)
+{
+    unit_t u = defaults;
+    char *opts, *tok, *save, *end;
+    long first, last, id;
+
+    if ((opts = strchr(spec, ':')) != NULL) *opts++ = '\0';
+    first = strtol(spec, &end, 10);
+    last = first;
+    if (*end == '-') last = strtol(end + 1, &end, 10);
+    if (*end != '\0' || first < 1 || last > 247 || last < first) return -1;
+
+    u.exc_code = defaults.exc_code;
+    for (tok = opts ? strtok_r(opts, ":", &save) : NULL; tok; tok = strtok_r(NULL, ":", &save)) {
+        char *val = strchr(tok, '=');
+        if (val == NULL) return -1;
+        *val++ = '\0';
+        if (!strcmp(tok, "latency")) u.latency_us = atol(val);
+        else if (!strcmp(tok, "jitter")) u.jitter_us = atol(val);
+        else if (!strcmp(tok, "drop")) u.drop = atof(val);
+        else if (!strcmp(tok, "crc")) u.crc = atof(val);
+        else if (!strcmp(tok, "exc")) u.exc = atof(val);
+        else if (!strcmp(tok, "code")) u.exc_code = atoi(val);
+        else if (!strcmp(tok, "load")) u.load_w = atof(val);
+        else if (!strcmp(tok, "gen")) u.gen_w = atof(val);
+        else if (!strcmp(tok, "period")) u.gen_period = atof(val);
+        else if (!strcmp(tok, "password")) u.holding[PASSWORD - HOLDING_START] = atoi(val);
+        else return -1;
+    }
+    for (id = first; id <= last; id++) {
+        uint16_t password = u.holding[PASSWORD - HOLDING_START];
+        units[id] = u;
+        units[id].hosted = 1;
+        unitInit(&units[id], id);
+        *holding(&units[id], PASSWORD) = password;
+    }
+    return 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100emu %s: TAC1100 meter emulator with fault and latency injection\n\n", version);
+    fprintf(stderr, "Usage: %s [-u units]... [-b baud_rate] [-P parity] [-S bit] [-l latency_us] [-j jitter_us]\n", program);
+    fprintf(stderr, "       [-D drop] [-C crc] [-E exception[:code]] [-s seed] [-v]\n");
+    fprintf(stderr, "\t-u units \tID[-ID][:key=value...] Meters to emulate, repeatable. Default: 1\n");
+    fprintf(stderr, "\t\t\tkeys: latency, jitter (us), drop, crc, exc (probability 0-1),\n");
+    fprintf(stderr, "\t\t\tcode (exception code), load, gen (W), period (s), password\n");
+    fprintf(stderr, "\t-b baud_rate \tEmulated line speed, 0 = no line time. Default: 9600\n");
+    fprintf(stderr, "\t-P parity \tE, N, O (character time only). Default: N\n");
+    fprintf(stderr, "\t-S bit \t\tStop bits 1, 2 (character time only). Default: 1\n");
+    fprintf(stderr, "\t-l latency_us \tDefault meter turnaround. Default: 5000\n");
+    fprintf(stderr, "\t-j jitter_us \tDefault extra random turnaround. Default: 0\n");
+    fprintf(stderr, "\t-D drop \tDefault probability to ignore a request\n");
+    fprintf(stderr, "\t-C crc \t\tDefault probability to corrupt the response CRC\n");
+    fprintf(stderr, "\t-E exc[:code] \tDefault probability to answer with an exception (code 4)\n");
+    fprintf(stderr, "\t-s seed \tRandom seed. Default: 1\n");
+    fprintf(stderr, "\t-2 \t\tThe meters also on a second pty, SIGUSR2 cuts (restores) the first\n");
+    fprintf(stderr, "\t-v \t\tLog writes and injected faults on stderr\n");
+    fprintf(stderr, "The slave device names are printed on stdout, SIGUSR1 prints the counters.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char *specs[64];
+    int nspecs = 0, parity = 0, stop = 1;
+    int c, i, k, expect;
+    long seed = 1;
+    char *pts, *p;
+    struct sigaction sa;
+    struct pollfd pfd[MAX_PATHS];
+
+    defaults.latency_us = 5000;
+    defaults.exc_code = EXC_DEVICE_FAILURE;
+    defaults.gen_period = 600;
+
+    while ((c = getopt(argc, argv, "u:b:P:S:l:j:D:C:E:s:2vh")) != -1) {
+        switch (c) {
+            case 'u':
+                if (nspecs < 64) specs[nspecs++] = optarg;
+                break;
+            case 'b': baud = atol(optarg); break;
+            case 'P': parity = (optarg[0] == 'E' || optarg[0] == 'O'); break;
+            case 'S': stop = atoi(optarg) == 2 ? 2 : 1; break;
+            case 'l': defaults.latency_us = atol(optarg); break;
+            case 'j': defaults.jitter_us = atol(optarg); break;
+            case 'D': defaults.drop = atof(optarg); break;
+            case 'C': defaults.crc = atof(optarg); break;
+            case 'E':
+                defaults.exc = atof(optarg);
+                if ((p = strchr(optarg, ':')) != NULL) defaults.exc_code = atoi(p + 1);
+                break;
+            case 's': seed = atol(optarg); break;
+            case '2': npaths = 2; break;
+            case 'v': verbose = 1; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    char_bits = 1 + 8 + parity + stop;
+    srand48(seed);
+
+    // Unit options apply on top of the command line defaults
+    if (nspecs == 0) specs[nspecs++] = "1";
+    for (i = 0; i < nspecs; i++) {
+        char spec[256];
+        snprintf(spec, sizeof(spec), "%s", specs[i]);
+        if (parseUnits(spec) == -1) {
+            fprintf(stderr, "Invalid unit specification: %s\n", specs[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (k = 0; k < npaths; k++) {
+        path_t *path = &paths[k];
+
+        if ((path->master = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(path->master) == -1 ||
+            unlockpt(path->master) == -1 || (pts = ptsname(path->master)) == NULL) {
+            fprintf(stderr, "Can't create pseudo-terminal: (%d) %s\n", errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        snprintf(path->pts, sizeof(path->pts), "%s", pts);
+        // Keep the slave side open: without it the master reads EIO every
+        // time a client closes the port
+        if ((path->slave = open(path->pts, O_RDWR | O_NOCTTY)) == -1) {
+            fprintf(stderr, "Can't open %s: (%d) %s\n", path->pts, errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = emuSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    for (k = 0; k < npaths; k++) printf("%s\n", paths[k].pts);
+    fflush(stdout);
+
+    start_us = tac1100_now_us();
+    for (k = 0; k < npaths; k++) {
+        pfd[k].fd = paths[k].master;
+        pfd[k].events = POLLIN;
+    }
+    while (!emu_stop) {
+        // End of frame: expected length reached or t3.5 of silence
+        int gap_ms = (int)(lineTime(4) / 1000) + 2;
+        int partial = 0, rc;
+        long long now;
+
+        for (k = 0; k < npaths; k++) partial |= paths[k].len > 0;
+        rc = poll(pfd, npaths, partial ? gap_ms : -1);
+        if (emu_report) {
+            emu_report = 0;
+            report();
+        }
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: (%d) %s\n", errno, strerror(errno));
+            break;
+        }
+        now = tac1100_now_us();
+        for (k = 0; k < npaths; k++) {
+            path_t *path = &paths[k];
+            // Requests on a cut cable never reach the meters
+            int cut = k == 0 && npaths > 1 && emu_cut;
+
+            if (!(pfd[k].revents & POLLIN)) {
+                if (path->len > 0 && now - path->last_rx >= gap_ms * 1000LL) {
+                    if (cut) path->cut_requests++;
+                    else handleFrame(path->master, path->buf, path->len);
+                    path->len = 0;
+                }
+                continue;
+            }
+            rc = read(path->master, path->buf + path->len, sizeof(path->buf) - path->len);
+            if (rc <= 0) {
+                if (rc == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+                fprintf(stderr, "read: (%d) %s\n", errno, strerror(errno));
+                emu_stop = 1;
+                break;
+            }
+            path->len += rc;
+            path->last_rx = now;
+            while (path->len > 0 && (expect = requestLength(path->buf, path->len)) > 0 && path->len >= expect) {
+                if (cut) path->cut_requests++;
+                else handleFrame(path->master, path->buf, expect);
+                memmove(path->buf, path->buf + expect, path->len - expect);
+                path->len -= expect;
+            }
+            if (path->len == sizeof(path->buf)) {
+                bad_frames++;
+                path->len = 0;
+            }
+        }
+    }
+
+    report();
+    for (k = 0; k < npaths; k++) {
+        close(paths[k].slave);
+        close(paths[k].master);
+    }
+    return 0;
+}
@@ -0,0 +1,432 @@
+/*
+ * tac1100replay: serve a tac1100 --capture file as a virtual meter
+ *
+ * Creates a pty pair, prints the slave device name on stdout and answers
+ * the ModBus RTU requests on the master side with the responses recorded
+ * in a capture, so that failures seen in the field (timeouts, exceptions,
+ * bad CRCs, odd values) can be reproduced without RS485 hardware.
+ *
+ * Every request recorded (TX) is paired with the response that followed
+ * it (RX) into an exchange. An incoming request is matched to the next
+ * exchange not served yet with the same bytes; failing that to the next
+ * one for the same unit, function, address and count (a write with other
+ * data, a request reordered by a changed tac1100). The response goes out
+ * after the recorded request to response time, divided by the -x speed
+ * factor, from the first byte of the request. Recorded outcomes are
+ * reproduced: nothing is sent for a timeout or an error, a response of
+ * the expected length with a wrong CRC for a bad CRC. Unmatched requests
+ * get no answer, as from a missing meter.
+ *
+ * The request times are those of the client: run it with the options of
+ * the captured run (--poll interval, -a, values) for a faithful replay.
+ *
+ *   tools/tac1100replay bus.cap &
+ *   ./tac1100 --poll /dev/pts/N
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include "../tac1100cap.h"
+#include "../libtac1100.h"
+
+static const char *version = "0.1";
+
+#define GAP_MS      5           // Silence that ends a frame of unknown length
+
+typedef struct {
+    uint8_t unit;
+    uint8_t outcome;            // Of the response (CAP_OK...)
+    uint16_t tx_len, rx_len;    // Up to CAP_MAX_ADU, as in the capture
+    long long rtt_us;           // Request sent to response received
+    uint8_t *tx, *rx;
+    int served;
+} exchange_t;
+
+static exchange_t *exchanges = NULL;
+static int nexchanges = 0;
+static int cursor = 0;          // First exchange not served yet
+static int served = 0;
+static double speed = 1.0;
+static int loop_flag = 0;
+static int verbose = 0;
+static unsigned long requests = 0, in_order = 0, reordered = 0, approximate = 0, unmatched = 0, bad_frames = 0;
+static unsigned long outcomes[5];
+static volatile sig_atomic_t replay_stop = 0;
+static volatile sig_atomic_t replay_report = 0;
+
+static void replaySignal(int sig)
+{
+    if (sig == SIGUSR1) {
+        replay_report = 1;
+    } else {
+        replay_stop = 1;
+    }
+}
+
+static uint8_t *copyAdu(const uint8_t *adu, int len)
+{
+    uint8_t *p = malloc(len > 0 ? len : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(p, adu, len);
+    return p;
+}
+
+/*--------------------------------------------------------------------------
+    loadCapture
+    Pair every request of the capture with its response. A request
+    without a response (capture cut short) is left out.
+----------------------------------------------------------------------------*/
+static void loadCapture(const char *file, int only_unit)
+{
+    uint8_t head[CAP_HEADER_SIZE], adu[CAP_MAX_ADU];
+    capheader_t h;
+    caprecord_t r, tx;
+    uint8_t tx_adu[CAP_MAX_ADU];
+    int segments = 0, pending = 0, size = 0;
+    FILE *fp;
+
+    if ((fp = fopen(file, "rb")) == NULL) {
+        fprintf(stderr, "Can't open %s: (%d) %s\n", file, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(&tx, 0, sizeof(tx));
+    while (fread(head, 1, CAP_RECORD_SIZE, fp) == CAP_RECORD_SIZE) {
+        if (memcmp(head, CAP_MAGIC, CAP_MAGIC_SIZE) == 0) {
+            if (fread(head + CAP_RECORD_SIZE, 1, CAP_HEADER_SIZE - CAP_RECORD_SIZE, fp) != CAP_HEADER_SIZE - CAP_RECORD_SIZE) break;
+            capDecodeHeader(head, &h);
+            if (h.version != CAP_VERSION) {
+                fprintf(stderr, "Unsupported capture version %u\n", h.version);
+                exit(EXIT_FAILURE);
+            }
+            segments++;
+            pending = 0;
+            continue;
+        }
+        if (segments == 0) {
+            fprintf(stderr, "%s: not a tac1100 capture\n", file);
+            exit(EXIT_FAILURE);
+        }
+        capDecodeRecord(head, &r);
+        if (r.len > CAP_MAX_ADU || fread(adu, 1, r.len, fp) != r.len) {
+            fprintf(stderr, "Truncated record after %d exchanges\n", nexchanges);
+            break;
+        }
+        if (only_unit >= 0 && r.unit != only_unit) continue;
+        if (r.dir == CAP_TX) {
+            tx = r;
+            memcpy(tx_adu, adu, r.len);
+            pending = r.len >= 4;
+            continue;
+        }
+        if (!pending || r.unit != tx.unit) continue;
+        pending = 0;
+        if (nexchanges == size) {
+            size = size ? 2 * size : 1024;
+            if ((exchanges = realloc(exchanges, size * sizeof(exchange_t))) == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        exchange_t *e = &exchanges[nexchanges++];
+        e->unit = tx.unit;
+        e->outcome = r.outcome < 5 ? r.outcome : CAP_ERROR;
+        e->tx_len = tx.len;
+        e->tx = copyAdu(tx_adu, tx.len);
+        e->rx_len = r.len;
+        e->rx = copyAdu(adu, r.len);
+        e->rtt_us = r.t - tx.t;
+        e->served = 0;
+    }
+    fclose(fp);
+    if (nexchanges == 0) {
+        fprintf(stderr, "%s: no exchanges to replay\n", file);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%d exchanges from %d segments\n", nexchanges, segments);
+}
+
+/*--------------------------------------------------------------------------
+    sameRequest
+    Same unit, function, address and count (the data of a write may differ)
+----------------------------------------------------------------------------*/
+static int sameRequest(const exchange_t *e, const uint8_t *req, int len)
+{
+    if (len < 6 || e->tx_len < 6) return 0;
+    return memcmp(e->tx, req, 6) == 0;
+}
+
+/*--------------------------------------------------------------------------
+    findExchange
+    The exchange answering req, NULL if none is left
+----------------------------------------------------------------------------*/
+static exchange_t *findExchange(const uint8_t *req, int len)
+{
+    int i, first = -1;
+
+    for (i = cursor; i < nexchanges; i++) {
+        exchange_t *e = &exchanges[i];
+        if (e->served) continue;
+        if (e->tx_len == len && memcmp(e->tx, req, len) == 0) {
+            if (i == cursor) in_order++; else reordered++;
+            first = i;
+            break;
+        }
+    }
+    if (first == -1) {
+        for (i = cursor; i < nexchanges; i++) {
+            if (!exchanges[i].served && sameRequest(&exchanges[i], req, len)) {
+                approximate++;
+                first = i;
+                break;
+            }
+        }
+    }
+    if (first == -1) {
+        // Looping: nothing left for this request in this pass, start over
+        if (!loop_flag || served == 0) return NULL;
+        for (i = 0; i < nexchanges; i++) exchanges[i].served = 0;
+        cursor = served = 0;
+        if (verbose) fprintf(stderr, "starting over\n");
+        return findExchange(req, len);
+    }
+
+    exchanges[first].served = 1;
+    served++;
+    while (cursor < nexchanges && exchanges[cursor].served) cursor++;
+    return &exchanges[first];
+}
+
+/*--------------------------------------------------------------------------
+    corruptResponse
+    A response of the length the request expects with a wrong CRC, for
+    an exchange recorded as CAP_BADCRC (its bytes were not kept)
+----------------------------------------------------------------------------*/
+static int corruptResponse(const exchange_t *e, uint8_t *rsp)
+{
+    int n = 0, nb;
+    uint16_t crc;
+
+    rsp[n++] = e->tx[0];
+    rsp[n++] = e->tx[1];
+    if (e->tx[1] == 0x03 || e->tx[1] == 0x04) {
+        nb = (e->tx[4] << 8) | e->tx[5];
+        if (nb > (CAP_MAX_ADU - 5) / 2) nb = (CAP_MAX_ADU - 5) / 2;
+        rsp[n++] = 2 * nb;
+        memset(&rsp[n], 0, 2 * nb);
+        n += 2 * nb;
+    } else {
+        memcpy(&rsp[n], &e->tx[2], 4);
+        n += 4;
+    }
+    crc = tac1100_crc16(rsp, n) ^ 0x5A5A;
+    rsp[n++] = crc & 0xFF;
+    rsp[n++] = crc >> 8;
+    return n;
+}
+
+/*--------------------------------------------------------------------------
+    handleFrame
+    Answer one complete frame received at t_first (first byte)
+----------------------------------------------------------------------------*/
+static void handleFrame(int fd, const uint8_t *req, int len, long long t_first)
+{
+    uint8_t rsp[CAP_MAX_ADU];
+    exchange_t *e;
+    long long delay;
+    int n = 0;
+
+    if (len < 4 || tac1100_crc16(req, len - 2) != (req[len - 2] | (req[len - 1] << 8))) {
+        bad_frames++;
+        if (verbose) fprintf(stderr, "bad frame (%d bytes)\n", len);
+        return;
+    }
+    requests++;
+    if ((e = findExchange(req, len)) == NULL) {
+        unmatched++;
+        if (verbose) fprintf(stderr, "unit %d fc %02X: no recorded exchange left\n", req[0], req[1]);
+        return;
+    }
+    outcomes[e->outcome]++;
+    switch (e->outcome) {
+        case CAP_OK:
+        case CAP_EXCEPTION:
+            memcpy(rsp, e->rx, e->rx_len);
+            n = e->rx_len;
+            break;
+        case CAP_BADCRC:
+            n = corruptResponse(e, rsp);
+            break;
+        default:
+            break;              // Timeout or error: stay silent
+    }
+    if (verbose) {
+        fprintf(stderr, "unit %d fc %02X: %s after %lld us\n", e->unit, req[1],
+                e->outcome == CAP_OK ? "ok" : e->outcome == CAP_EXCEPTION ? "exception" :
+                e->outcome == CAP_BADCRC ? "bad crc" : "no response", e->rtt_us);
+    }
+    if (n == 0) return;
+
+    if (speed > 0) {
+        delay = t_first + (long long)(e->rtt_us / speed) - tac1100_now_us();
+        if (delay > 0) usleep(delay);
+    }
+    if (write(fd, rsp, n) != n) {
+        fprintf(stderr, "write: (%d) %s\n", errno, strerror(errno));
+    }
+}
+
+/*--------------------------------------------------------------------------
+    requestLength
+    Expected length of the request in buf, 0 if not known yet, -1 if the
+    function code does not tell (wait for the end of frame gap)
+----------------------------------------------------------------------------*/
+static int requestLength(const uint8_t *buf, int len)
+{
+    if (len < 2) return 0;
+    switch (buf[1]) {
+        case 0x03:
+        case 0x04:
+        case 0x06:
+            return 8;
+        case 0x10:
+            return len < 7 ? 0 : 9 + buf[6];
+        default:
+            return -1;
+    }
+}
+
+/*--------------------------------------------------------------------------
+    report
+    Counters on stderr
+----------------------------------------------------------------------------*/
+static void report(void)
+{
+    fprintf(stderr, "exchanges %d, served %d, requests %lu: in order %lu, reordered %lu, approximate %lu, "
+            "unmatched %lu, bad frames %lu\n", nexchanges, served, requests, in_order, reordered, approximate,
+            unmatched, bad_frames);
+    fprintf(stderr, "replayed ok %lu, timeout %lu, badcrc %lu, exception %lu, error %lu\n", outcomes[CAP_OK],
+            outcomes[CAP_TIMEOUT], outcomes[CAP_BADCRC], outcomes[CAP_EXCEPTION], outcomes[CAP_ERROR]);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "tac1100replay %s: serve a tac1100 --capture file as a virtual meter\n\n", version);
+    fprintf(stderr, "Usage: %s [-x speed] [-u unit] [-L] [-e] [-v] capture\n", program);
+    fprintf(stderr, "\t-x speed \tTiming factor: 2 = responses twice as fast, 0 = no delay. Default: 1\n");
+    fprintf(stderr, "\t-u unit \tOnly the exchanges of this unit id\n");
+    fprintf(stderr, "\t-L \t\tStart over when no exchange is left for a request\n");
+    fprintf(stderr, "\t-e \t\tExit when every exchange has been served\n");
+    fprintf(stderr, "\t-v \t\tLog every request on stderr\n");
+    fprintf(stderr, "The slave device name is printed on stdout, SIGUSR1 prints the counters.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int only_unit = -1, exit_flag = 0;
+    int master, slave, c, len = 0, expect;
+    long long t_first = 0;
+    char *pts;
+    uint8_t buf[CAP_MAX_ADU];
+    struct sigaction sa;
+    struct pollfd pfd;
+
+    while ((c = getopt(argc, argv, "x:u:Levh")) != -1) {
+        switch (c) {
+            case 'x': speed = atof(optarg); break;
+            case 'u': only_unit = atoi(optarg); break;
+            case 'L': loop_flag = 1; break;
+            case 'e': exit_flag = 1; break;
+            case 'v': verbose = 1; break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || speed < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    loadCapture(argv[optind], only_unit);
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(master) == -1 ||
+        unlockpt(master) == -1 || (pts = ptsname(master)) == NULL) {
+        fprintf(stderr, "Can't create pseudo-terminal: (%d) %s\n", errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    // Keep the slave side open: without it the master reads EIO every
+    // time a client closes the port
+    if ((slave = open(pts, O_RDWR | O_NOCTTY)) == -1) {
+        fprintf(stderr, "Can't open %s: (%d) %s\n", pts, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = replaySignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    printf("%s\n", pts);
+    fflush(stdout);
+
+    pfd.fd = master;
+    pfd.events = POLLIN;
+    while (!replay_stop && !(exit_flag && !loop_flag && served == nexchanges)) {
+        int rc = poll(&pfd, 1, len > 0 ? GAP_MS : -1);
+
+        if (replay_report) {
+            replay_report = 0;
+            report();
+        }
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: (%d) %s\n", errno, strerror(errno));
+            break;
+        }
+        if (rc == 0) {
+            handleFrame(master, buf, len, t_first);
+            len = 0;
+            continue;
+        }
+        if (len == 0) t_first = tac1100_now_us();
+        rc = read(master, buf + len, sizeof(buf) - len);
+        if (rc <= 0) {
+            if (rc == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+            fprintf(stderr, "read: (%d) %s\n", errno, strerror(errno));
+            break;
+        }
+        len += rc;
+        while (len > 0 && (expect = requestLength(buf, len)) > 0 && len >= expect) {
+            handleFrame(master, buf, expect, t_first);
+            memmove(buf, buf + expect, len - expect);
+            len -= expect;
+            t_first = tac1100_now_us();
+        }
+        if (len == sizeof(buf)) {
+            bad_frames++;
+            len = 0;
+        }
+    }
+
+    report();
+    close(slave);
+    close(master);
+    return 0;
+}